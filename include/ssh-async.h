@@ -0,0 +1,447 @@
+#ifndef __SSH_ASYNC_H__
+#define __SSH_ASYNC_H__
+
+#include "ssh.h"
+
+#if !defined(__cpp_impl_coroutine) || !__has_include(<coroutine>)
+#error "ssh-async.h requires a compiler with C++20 coroutines"
+#endif
+
+#include <algorithm>
+#include <coroutine>
+#include <cstring>
+#include <exception>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace SSH
+{
+  /*
+    Awaitable layer over Client, so orchestration code can be written as C++20 coroutines
+    instead of stitching callbacks together. The library itself stays C++17, this header is only
+    needed by code which wants to co_await.
+
+    Nothing here has a thread of its own. A suspended coroutine is resumed from inside the
+    callback which completes it, so it carries on running on the client's event loop (its I/O
+    thread, or whoever is calling Process). Awaiters live in the coroutine frame and channels keep
+    their receive buffer between reads, so awaiting doesn't allocate once a channel is running.
+
+    Apart from the first co_await Connect, a client and its channels must only be awaited from
+    the client's event loop.
+  */
+
+  //Eagerly started coroutine which nobody waits on, the usual return type for code using AsyncClient
+  struct Task
+  {
+    struct promise_type
+    {
+      Task get_return_object() { return {}; }
+      std::suspend_never initial_suspend() noexcept { return {}; }
+      std::suspend_never final_suspend() noexcept { return {}; }
+      void return_void() {}
+
+      //The library doesn't use exceptions, so one escaping a task is a bug
+      void unhandled_exception() { std::terminate(); }
+    };
+  };
+
+  class AsyncClient;
+
+  class AsyncChannel
+  {
+  private:
+    friend class AsyncClient;
+
+    //Shared with the channel's event callback, which may well outlive the AsyncChannel
+    struct Shared
+    {
+      Client* mpClient = nullptr;
+      TChannelID mID = 0;
+      bool mbOpen = false;
+      bool mbClosed = false; //Closed by the remote, or the client disconnected
+
+      //Data which arrived while nobody was reading, read from mInboxPos onwards
+      std::vector<Byte> mInbox;
+      size_t mInboxPos = 0;
+
+      //The coroutine waiting for the channel to open or for data, and where its data should go
+      std::coroutine_handle<> mWaiter;
+      std::span<Byte> mReadBuf;
+      size_t mReadResult = 0;
+
+      //The coroutine waiting for window to send the rest of its data, and how far it has got
+      std::coroutine_handle<> mWriteWaiter;
+      std::span<const Byte> mWriteData;
+      size_t mWritten = 0;
+      bool mbWriteFailed = false;
+
+      size_t InboxSize() const { return mInbox.size() - mInboxPos; }
+
+      size_t TakeInbox(std::span<Byte> buf)
+      {
+        size_t numBytes = std::min(buf.size(), InboxSize());
+        if (numBytes > 0)
+        {
+          std::memcpy(buf.data(), mInbox.data() + mInboxPos, numBytes);
+        }
+
+        mInboxPos += numBytes;
+
+        //Only now has the data been read, so only now can the remote send more
+        if (numBytes > 0 && !mbClosed)
+        {
+          mpClient->Consume(mID, (UINT32)numBytes);
+        }
+
+        if (mInboxPos == mInbox.size())
+        {
+          //Keeps its capacity, so steady state reads don't allocate
+          mInbox.clear();
+          mInboxPos = 0;
+        }
+
+        return numBytes;
+      }
+
+      void Resume()
+      {
+        std::coroutine_handle<> waiter = std::exchange(mWaiter, nullptr);
+        if (waiter)
+        {
+          waiter.resume();
+        }
+      }
+
+      //Sends as much of the current write as the window allows, returns true once there is nothing left to wait for
+      bool ContinueWrite()
+      {
+        while (mWritten < mWriteData.size() && !mbClosed)
+        {
+          TResult taken = mpClient->Send(mID, mWriteData.data() + mWritten, (int)(mWriteData.size() - mWritten));
+          if (!taken.has_value())
+          {
+            mbWriteFailed = true;
+            return true;
+          }
+
+          if (taken.value() == 0)
+          {
+            return false;
+          }
+
+          mWritten += taken.value();
+        }
+
+        return true;
+      }
+
+      void ResumeWriter()
+      {
+        std::coroutine_handle<> waiter = std::exchange(mWriteWaiter, nullptr);
+        if (waiter)
+        {
+          waiter.resume();
+        }
+      }
+
+      void Close()
+      {
+        mbClosed = true;
+        Resume();
+        ResumeWriter();
+      }
+
+      //Returns the bytes of data consumed straight away, the rest waits in the inbox for a reader
+      TResult OnEvent(ChannelEvent event, const Byte* pBuf, const int bufLen)
+      {
+        switch (event)
+        {
+          case ChannelEvent::Opened:
+          {
+            mbOpen = true;
+            Resume();
+            break;
+          }
+          case ChannelEvent::Data:
+          {
+            size_t offset = 0;
+            if (mWaiter && !mReadBuf.empty())
+            {
+              //Somebody is already waiting, so hand the data straight to them
+              offset = std::min(mReadBuf.size(), (size_t)bufLen);
+              std::memcpy(mReadBuf.data(), pBuf, offset);
+              mReadResult = offset;
+              mReadBuf = {};
+            }
+
+            mInbox.insert(mInbox.end(), pBuf + offset, pBuf + bufLen);
+
+            if (mReadResult > 0)
+            {
+              Resume();
+            }
+            return (int)offset;
+          }
+          case ChannelEvent::Closed:
+          {
+            Close();
+            break;
+          }
+          case ChannelEvent::Writable:
+          {
+            if (mWriteWaiter && ContinueWrite())
+            {
+              ResumeWriter();
+            }
+            break;
+          }
+        }
+
+        return {};
+      }
+    };
+
+    std::shared_ptr<Shared> mShared;
+
+    explicit AsyncChannel(std::shared_ptr<Shared> pShared)
+      : mShared(std::move(pShared))
+    {}
+
+  public:
+    AsyncChannel() = default;
+    AsyncChannel(AsyncChannel&&) = default;
+    AsyncChannel& operator=(AsyncChannel&&) = default;
+
+    AsyncChannel(const AsyncChannel&) = delete;
+    AsyncChannel& operator=(const AsyncChannel&) = delete;
+
+    ~AsyncChannel()
+    {
+      if (mShared != nullptr && mShared->mbOpen && !mShared->mbClosed)
+      {
+        mShared->mpClient->CloseChannel(mShared->mID);
+      }
+    }
+
+    //False if the channel failed to open, or has since been closed
+    bool IsOpen() const { return (mShared != nullptr && mShared->mbOpen && !mShared->mbClosed); }
+    TChannelID ID() const { return (mShared != nullptr) ? mShared->mID : 0; }
+
+    struct ReadAwaiter
+    {
+      Shared& mShared;
+      std::span<Byte> mBuf;
+
+      bool await_ready() const
+      {
+        return (mShared.InboxSize() > 0 || mShared.mbClosed || mBuf.empty());
+      }
+
+      void await_suspend(std::coroutine_handle<> handle)
+      {
+        mShared.mReadBuf = mBuf;
+        mShared.mReadResult = 0;
+        mShared.mWaiter = handle;
+      }
+
+      size_t await_resume()
+      {
+        if (mShared.mReadResult > 0)
+        {
+          return std::exchange(mShared.mReadResult, 0);
+        }
+
+        mShared.mReadBuf = {};
+        return mShared.TakeInbox(mBuf);
+      }
+    };
+
+    //Waits for data, returning the number of bytes copied into buf, or 0 once the channel has closed
+    ReadAwaiter Read(std::span<Byte> buf) { return { *mShared, buf }; }
+
+    struct WriteAwaiter
+    {
+      Shared& mShared;
+      std::span<const Byte> mData;
+
+      //Whatever fits in the remote's window is queued straight away, the rest waits for it to open
+      bool await_ready()
+      {
+        if (mShared.mbClosed)
+        {
+          return true;
+        }
+
+        mShared.mWriteData = mData;
+        mShared.mWritten = 0;
+        mShared.mbWriteFailed = false;
+        return mShared.ContinueWrite();
+      }
+
+      void await_suspend(std::coroutine_handle<> handle) { mShared.mWriteWaiter = handle; }
+
+      TResult await_resume()
+      {
+        size_t written = std::exchange(mShared.mWritten, 0);
+        mShared.mWriteData = {};
+
+        if (written == 0 && (mShared.mbClosed || mShared.mbWriteFailed))
+        {
+          return {};
+        }
+
+        return (int)written;
+      }
+    };
+
+    /*
+      Sends all of data, waiting for the remote's window whenever it fills up. Returns the number of bytes
+      queued, which is less than asked for only if the channel closed part way through.
+    */
+    WriteAwaiter Write(std::span<const Byte> data) { return { *mShared, data }; }
+  };
+
+  class AsyncClient
+  {
+  private:
+    ClientOptions mOpts;
+    TCtx mCtx;
+    Client mClient;
+
+    std::coroutine_handle<> mConnectWaiter;
+    std::vector<std::weak_ptr<AsyncChannel::Shared>> mChannels;
+
+    //Chains our hooks in front of any the caller set
+    ClientOptions& Hook(ClientOptions& options)
+    {
+      TOnConnectFunc onConnect = options.mOnConnect;
+      options.mOnConnect = [this, onConnect](Client* pClient)
+      {
+        if (onConnect)
+        {
+          onConnect(pClient);
+        }
+
+        if (std::coroutine_handle<> waiter = std::exchange(mConnectWaiter, nullptr))
+        {
+          waiter.resume();
+        }
+      };
+
+      TOnDisconnectFunc onDisconnect = options.mOnDisconnect;
+      options.mOnDisconnect = [this, onDisconnect](Client* pClient)
+      {
+        if (onDisconnect)
+        {
+          onDisconnect(pClient);
+        }
+
+        //Nothing more will happen on this client, so wake everything still waiting on it
+        if (std::coroutine_handle<> waiter = std::exchange(mConnectWaiter, nullptr))
+        {
+          waiter.resume();
+        }
+
+        auto channels = std::move(mChannels);
+        for (auto& weakShared : channels)
+        {
+          if (auto pShared = weakShared.lock())
+          {
+            pShared->Close();
+          }
+        }
+      };
+
+      return options;
+    }
+
+  public:
+    AsyncClient(ClientOptions options, TCtx ctx)
+      : mOpts(std::move(options))
+      , mCtx(std::move(ctx))
+      , mClient(Hook(mOpts), mCtx)
+    {}
+
+    AsyncClient(const AsyncClient&) = delete;
+    AsyncClient& operator=(const AsyncClient&) = delete;
+
+    //For Process, Stop, ClientReactor::Add and the rest of the plain API
+    Client& GetClient() { return mClient; }
+    State GetState() const { return mClient.GetState(); }
+
+    struct ConnectAwaiter
+    {
+      AsyncClient& mClient;
+
+      bool await_ready() const { return (mClient.GetState() != State::Idle); }
+
+      void await_suspend(std::coroutine_handle<> handle)
+      {
+        //Connect may start the I/O thread, which could resume us before it returns, so it goes last
+        mClient.mConnectWaiter = handle;
+        mClient.mClient.Connect();
+      }
+
+      //True once logged in, false if the client disconnected first
+      bool await_resume() const { return (mClient.GetState() == State::Connected); }
+    };
+
+    ConnectAwaiter Connect() { return { *this }; }
+
+    struct OpenChannelAwaiter
+    {
+      AsyncClient& mClient;
+      ChannelTypes mType;
+      std::shared_ptr<AsyncChannel::Shared> mShared;
+
+      bool await_ready() const { return (mClient.GetState() != State::Connected); }
+
+      bool await_suspend(std::coroutine_handle<> handle)
+      {
+        mShared = std::make_shared<AsyncChannel::Shared>();
+        mShared->mpClient = &mClient.mClient;
+        mShared->mWaiter = handle;
+
+        auto iter = std::remove_if(mClient.mChannels.begin(), mClient.mChannels.end(), [](const auto& weakShared)
+        {
+          return weakShared.expired();
+        });
+        mClient.mChannels.erase(iter, mClient.mChannels.end());
+        mClient.mChannels.push_back(mShared);
+
+        auto pShared = mShared;
+        mShared->mID = mClient.mClient.OpenChannel(mType, [pShared](ChannelEvent event, const Byte* pBuf, const int bufLen) -> TResult
+        {
+          return pShared->OnEvent(event, pBuf, bufLen);
+        });
+
+        if (mShared->mID == 0)
+        {
+          mShared->mWaiter = nullptr;
+          mShared->mbClosed = true;
+          return false;
+        }
+
+        return true;
+      }
+
+      //Check IsOpen on the result, the remote may have refused or the client disconnected
+      AsyncChannel await_resume()
+      {
+        if (mShared == nullptr)
+        {
+          //Never got as far as asking, so hand back a channel which is already closed
+          mShared = std::make_shared<AsyncChannel::Shared>();
+          mShared->mbClosed = true;
+        }
+
+        return AsyncChannel(std::move(mShared));
+      }
+    };
+
+    OpenChannelAwaiter OpenChannel(ChannelTypes type) { return { *this, type, nullptr }; }
+  };
+}
+
+#endif //~__SSH_ASYNC_H__
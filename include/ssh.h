@@ -1,10 +1,13 @@
 #ifndef __SSH_H__
 #define __SSH_H__
 
+#include <chrono>
 #include <functional>
 #include <memory>
 #include <optional>
 #include <queue>
+#include <string>
+#include <vector>
 
 using UINT32 = uint32_t;
 
@@ -30,8 +33,13 @@ namespace SSH
   enum class ChannelEvent
   {
     Opened,
+    /*
+      The callback returns how many bytes it has consumed, or nothing for all of them. Anything it
+      holds on to keeps the channel's receive window closed until handed back with Client::Consume.
+    */
     Data,
     Closed,
+    Writable, //There is room to send again after a Send was cut short, by the remote's window or mChannelSendBufferSize
   };
 
   enum class ChannelTypes
@@ -40,6 +48,20 @@ namespace SSH
     Session,
   };
 
+  //Which of a connection's channels goes first when several have data waiting to send
+  enum class ChannelPriority
+  {
+    Interactive, //Always sent ahead of bulk channels, for keystrokes and other small latency sensitive traffic
+    Bulk,        //Shares whatever is left with the other bulk channels, in proportion to their weights
+  };
+
+  //How the client's connection is driven once Connect has been called
+  enum class RunMode
+  {
+    Thread, //The client owns an I/O thread which is started by Connect and joined by Stop
+    Manual, //Connect only starts the handshake, the caller drives the connection with Client::Process
+  };
+
   enum LogLevel
   {
     Error   = 0,
@@ -49,15 +71,26 @@ namespace SSH
   };
 
   class Client;
+  class ClientReactor;
 
   using TCtx = std::weak_ptr<void>;
   using TResult = std::optional<int>;
 
+  //A single buffer within a vectored send, laid out in the same way as an iovec
+  struct IOVec
+  {
+    const Byte* mpBuf;
+    int mBufLen;
+  };
+
   using TSendFunc = std::function<TResult (TCtx ctx, const Byte* pBuf, const int bufLen)>;
+  using TSendVecFunc = std::function<TResult (TCtx ctx, const IOVec* pVecs, const int numVecs)>;
   using TRecvFunc = std::function<TResult (TCtx ctx, Byte* pBuf, const int bufLen)>;
   using TLogFunc = std::function<void (const char* pszLogString)>;
 
   using TOnConnectFunc = std::function<void (Client* pClient)>;
+  using TOnDisconnectFunc = std::function<void (Client* pClient)>;
+  using TOnIdleFunc = std::function<bool (Client* pClient)>; //Return true to disconnect the idle client
 
   using TOnAuthFunc = std::function<TResult (TCtx ctx, UserAuthMethod, Byte* pBuf, const int bufLen)>;
   using TAuthMethods = std::queue<UserAuthMethod>;
@@ -65,18 +98,234 @@ namespace SSH
   using TChannelID = UINT32;
   using TOnEventFunc = std::function<TResult (ChannelEvent event, const Byte* pBuf, const int bufLen)>;
 
+  class IChannel;
+
+  /*
+    Data received on a channel, as views straight into the decrypted packets it arrived in. Everything
+    read for the channel in one go arrives as a single batch, in order. The views are only valid until
+    the callback returns, unless the batch is retained.
+  */
+  class ChannelData
+  {
+  public:
+    struct Span
+    {
+      const Byte* mpData;
+      UINT32 mLen;
+    };
+
+    //Keeps a batch's memory alive for as long as it is held
+    using TRetained = std::shared_ptr<const void>;
+
+  private:
+    friend class IChannel;
+
+    std::vector<Span> mSpans;
+    std::vector<std::shared_ptr<const void>> mOwners; //Whatever keeps each span's memory alive
+    UINT32 mNumBytes = 0;
+
+    void Add(const Byte* pData, UINT32 len, std::shared_ptr<const void> pOwner);
+    void Clear();
+
+  public:
+    const std::vector<Span>& Spans() const { return mSpans; }
+    UINT32 Size() const { return mNumBytes; }
+    bool Empty() const { return mSpans.empty(); }
+
+    /*
+      Keeps every span valid after the callback has returned, without copying anything, for as long
+      as the result is held. Until then the memory behind them (which may be a whole receive buffer)
+      can't be reused, so hand it back promptly, along with the window via Client::Consume.
+    */
+    TRetained Retain() const;
+  };
+
+  /*
+    Alternative to ChannelEvent::Data, see Client::OpenChannel. The callback returns how many bytes
+    it has consumed, or nothing for all of them, just as for ChannelEvent::Data.
+  */
+  using TOnDataFunc = std::function<TResult (TChannelID channelID, const ChannelData& data)>;
+
+  //Counters for the recycling packet pool, useful when sizing mPacketPoolLimit
+  struct PacketPoolStats
+  {
+    uint64_t mHits = 0;     //Packets served from a free list
+    uint64_t mMisses = 0;   //Packets which required a new allocation
+    uint64_t mReleases = 0; //Packets returned to a free list
+    uint64_t mDiscards = 0; //Packets freed because their free list was full or they were oversized
+  };
+
+  //Transport readiness passed to, and requested by, Client::Process. Combined as bit flags.
+  using TIOEvents = UINT32;
+  namespace IOEvent
+  {
+    constexpr TIOEvents None = 0;
+    constexpr TIOEvents Readable = 1 << 0;
+    constexpr TIOEvents Writable = 1 << 1;
+  }
+
+  /*
+    Transport objects are an alternative to the send/recv functions in ClientOptions.
+    The client calls straight into the object, so there is no context to lock per call.
+    Results follow the same rules as TSendFunc/TRecvFunc: bytes transferred, an empty
+    result when nothing could be transferred, or -1 to signal the connection has failed.
+  */
+  class ITransport
+  {
+  public:
+    virtual ~ITransport() = default;
+
+    virtual TResult Send(const Byte* pBuf, const int bufLen) = 0;
+    virtual TResult Recv(Byte* pBuf, const int bufLen) = 0;
+
+    /*
+      Gather write of multiple buffers, returning the total bytes written across all of them.
+      The default falls back to one Send per buffer, stopping at the first partial write.
+    */
+    virtual TResult SendVec(const IOVec* pVecs, const int numVecs);
+
+    /*
+      Called with the client's receive buffer once it exists, and with nullptr before it is freed.
+      Every Recv lands somewhere inside it, so a transport may register it with the kernel up front.
+      Nothing may be written into the old buffer once this returns, and anything a read already put there
+      which hasn't been handed over yet must come back from the next Recv instead.
+    */
+    virtual void AttachRecvBuffer(Byte* pBuf, const UINT32 bufLen) {}
+
+    /*
+      Descriptor the I/O thread can sleep on until the transport is ready, or -1 if there isn't one,
+      in which case it is polled every ClientOptions::mPollIntervalUs instead.
+    */
+    virtual int WaitFD() const { return -1; }
+
+    /*
+      Events to wait for on WaitFD, given the events the client is waiting on. A transport which signals
+      everything through one kind of readiness (E.G. a completion queue) maps them here.
+    */
+    virtual TIOEvents WaitEvents(TIOEvents events) const { return events; }
+  };
+
+  using TTransport = std::shared_ptr<ITransport>;
+
+  //What a client needs before Process can make any more progress
+  struct ProcessResult
+  {
+    TIOEvents mWantEvents = IOEvent::None; //Call Process again once the transport has any of these events
+    std::optional<std::chrono::steady_clock::time_point> mDeadline; //Call Process again by this time regardless
+  };
+
   struct ClientOptions
   {
     TSendFunc mSend;   //Function for how the SSH Client will SEND data into the socket
     TRecvFunc mRecv;   //Function for how the SSH Client will RECEIVE data from a socket
+    TSendVecFunc mSendVec; //Optional gather version of mSend, used to flush many packets in one call
+    TTransport mTransport; //Optional, when set it is used instead of mSend, mSendVec and mRecv
     TOnAuthFunc mOnAuth; //Function for when the SSH Client requests private data for authentication
     TAuthMethods mAuthMethods; //Authentication methods available to the SSH client
 
     TOnConnectFunc mOnConnect; //Function for when the SSH client has successully connected to the remote
+    TOnDisconnectFunc mOnDisconnect; //Optional, called once when the client becomes disconnected, from whichever thread disconnected it
     std::string mUserName;
 
     TLogFunc mLogFunc;
     LogLevel mLogLevel;
+
+    RunMode mRunMode = RunMode::Thread;
+
+    /*
+      The I/O thread sleeps until the transport is ready or there is other work to do, but a transport
+      without a descriptor to wait on (see ITransport::WaitFD) is checked this often instead.
+      0 checks it continuously, trading CPU for the lowest latency.
+    */
+    UINT32 mPollIntervalUs = 100;
+
+    UINT32 mPacketPoolLimit = 64; //Maximum number of free packets kept per pool size class
+    UINT32 mRecvBufferSize = 256 * 1024; //Size of the per-connection receive buffer mRecv reads into
+
+    /*
+      Largest incoming packet accepted, counting the packet_length field and MAC.
+      Anything larger is treated as malformed and the connection is dropped.
+    */
+    UINT32 mMaxPacketLen = 35000;
+
+    /*
+      Most bytes of received packets allowed to wait to be handled.
+      mRecv is not called again until the queue has drained below this.
+    */
+    UINT32 mMaxRecvQueueBytes = 256 * 1024;
+
+    /*
+      Number of packets other threads may have waiting for the I/O thread to send.
+      Rounded up to a power of two. Channel data beyond this waits on its channel.
+    */
+    UINT32 mSendQueueLength = 1024;
+
+    /*
+      Runs key exchange work (DH key generation and host key verification) on the shared crypto pool,
+      so a burst of handshakes doesn't hold up other clients sharing an I/O thread.
+    */
+    bool mOffloadKEX = true;
+
+    //Outgoing packets at least this long are MAC'd and encrypted on the crypto pool, 0 keeps them all on the I/O thread
+    UINT32 mOffloadPacketLen = 16 * 1024;
+
+    /*
+      Once logged in, decrypt and verify incoming packets on a thread of their own, which hands them on to
+      the thread running callbacks through a ring of mPipelineDepth packets, so the two can overlap.
+      mRecv is then called from the pipeline's thread (and polled while idle), and every packet is
+      copied out of the receive buffer on its way through.
+    */
+    bool mPipelineRecv = false;
+    UINT32 mPipelineDepth = 256;
+
+    /*
+      Channel sends smaller than mCoalesceBytes are merged into a single CHANNEL_DATA packet.
+      Merged data is flushed once it reaches mCoalesceBytes or has waited mCoalesceDelayMs.
+      Setting mCoalesceBytes to 0 sends every write as its own packet (unless the channel is corked).
+    */
+    UINT32 mCoalesceBytes = 0;
+    UINT32 mCoalesceDelayMs = 2;
+
+    /*
+      Receive window advertised on each channel, and the most data the remote may put in a single packet.
+      The packet size is capped so the remote's packets always fit within mMaxPacketLen.
+      Window is handed back to the remote as channel data is consumed, see ChannelEvent::Data.
+    */
+    UINT32 mChannelWindowSize = 2 * 1024 * 1024;
+    UINT32 mChannelMaxPacketSize = 32 * 1024;
+
+    /*
+      Each channel's receive window grows from mChannelWindowSize towards twice the connection's measured
+      bandwidth-delay product, but never beyond this, which bounds what a channel can have in flight.
+      Setting it no higher than mChannelWindowSize turns autotuning off.
+    */
+    UINT32 mChannelMaxWindowSize = 16 * 1024 * 1024;
+
+    /*
+      Most data each channel holds once Send has taken it, waiting for the remote's window and its turn
+      on the connection. Send takes no more than there is room for, so a large upload is copied in a
+      piece at a time as it goes out, and memory stays the same whatever its size.
+    */
+    UINT32 mChannelSendBufferSize = 512 * 1024;
+
+    //Longest each handshake or authentication stage may take before giving up and disconnecting, 0 waits forever
+    UINT32 mHandshakeTimeoutMs = 30 * 1000;
+
+    /*
+      Once logged in, a keepalive@openssh.com request is sent whenever nothing has been received for
+      mKeepaliveIntervalMs, and the client disconnects once mKeepaliveMaxMissed of them in a row have
+      gone unanswered (0 never gives up). Setting mKeepaliveIntervalMs to 0 turns keepalives off.
+    */
+    UINT32 mKeepaliveIntervalMs = 0;
+    UINT32 mKeepaliveMaxMissed = 3;
+
+    /*
+      mOnIdle is called, from the thread driving the connection, once no channel data has been sent or
+      received for mIdleTimeoutMs. Without a callback idle clients are simply disconnected.
+      Setting mIdleTimeoutMs to 0 turns idle detection off.
+    */
+    UINT32 mIdleTimeoutMs = 0;
+    TOnIdleFunc mOnIdle;
   };
 
   class Client
@@ -87,27 +336,205 @@ namespace SSH
       Interface API can stay solid while implemenation details change underneath.
     */
     class Impl;
-    std::unique_ptr<Impl> mImpl;
+    std::shared_ptr<Impl> mImpl; //Shared with the I/O thread, which may outlive us when destroyed from a callback
+
+    friend class ClientReactor;
 
   public:
     Client(ClientOptions& options, TCtx& ctx);
+
+    /*
+      Stops the I/O thread (see Stop) and frees the client. May be called from one of the client's own
+      callbacks (including within Process), in which case it is freed once the current pass is over.
+      Callbacks which are handed the Client aren't called again either way.
+    */
     ~Client();
 
+    //Begins the handshake. Returns straight away in either run mode.
     void Connect();
     void Disconnect();
 
+    /*
+      Asks the I/O thread to stop and waits for it to finish, without disconnecting.
+      Safe to call from the I/O thread itself (E.G. within a callback), in which case it does not wait.
+      Also called when the client is destroyed.
+    */
+    void Stop();
+
+    //Blocks until the I/O thread has finished, either by disconnecting or by Stop
+    void Join();
+
+    /*
+      Performs all the work which is possible without blocking, for clients using RunMode::Manual.
+      Pass in the events the transport is ready for. Reading continues until the transport has
+      no more data, so edge triggered readiness is fine.
+      The result says which events to wait for, and when to call again if none of them happen.
+      Once disconnected the result has no events and no deadline.
+    */
+    ProcessResult Process(TIOEvents events);
+
     /*
       OpenChannel does not mean that the remote successfully opened a new
       channel.
       The callback will receive an event once the channel has been opened.
     */
     TChannelID OpenChannel(ChannelTypes type, TOnEventFunc callback);
+
+    /*
+      As above, but the channel's data goes to dataCallback in batches (see ChannelData) instead
+      of as a ChannelEvent::Data per packet. Every other event still goes to callback.
+    */
+    TChannelID OpenChannel(ChannelTypes type, TOnEventFunc callback, TOnDataFunc dataCallback);
     bool CloseChannel(TChannelID channelID);
 
+    /*
+      Queues as much of the data as the remote's channel window and the channel's send buffer have room
+      for, returning how many bytes were taken (or nothing if the channel doesn't exist). It goes out in
+      packets no bigger than the remote allows. Anything not taken is left with the caller, who should
+      try again once the channel reports ChannelEvent::Writable.
+    */
     TResult Send(TChannelID channelID, const Byte* pBuf, const int bufLen);
 
+    /*
+      While a channel is corked, sends are held back and merged into as few packets as possible.
+      Uncorking flushes everything that has been held back.
+    */
+    bool Cork(TChannelID channelID);
+    bool Uncork(TChannelID channelID);
+
+    /*
+      Channels start out as ChannelPriority::Bulk with a weight of 1. Channels in the same class share
+      the connection in proportion to their weights. A change applies once the channel's queued data has gone.
+      Control traffic, such as key exchange and window adjusts, always goes ahead of channel data.
+    */
+    bool SetChannelPriority(TChannelID channelID, ChannelPriority priority, UINT32 weight = 1);
+
+    /*
+      Hands back receive window for data a ChannelEvent::Data callback held on to, once it has been used.
+      Returns false if the channel doesn't exist or was holding fewer bytes than that.
+    */
+    bool Consume(TChannelID channelID, UINT32 numBytes);
+
     State GetState() const;
+    PacketPoolStats GetPacketPoolStats() const;
+  };
+
+  struct ReactorOptions
+  {
+    UINT32 mNumThreads = 0; //Number of I/O threads, 0 uses one per hardware thread
+    bool mPinThreads = true; //Pin each I/O thread to its own core
+    UINT32 mPacketPoolLimit = 64; //Maximum number of free packets kept per size class, for each thread's shared pool
+
+    /*
+      Threads sleep until one of their clients' transports is ready or a client has work to do, but clients whose
+      transport has no descriptor to wait on (see ITransport::WaitFD) are checked this often instead.
+      0 checks them continuously, trading CPU for the lowest latency.
+    */
+    UINT32 mIdleSleepUs = 100;
+  };
+
+  /*
+    Services many clients from a fixed set of I/O threads, instead of a thread per client.
+    Clients must use RunMode::Manual and are handed to the thread with the fewest clients.
+    Each thread shares a single packet pool between all of its clients, sleeps on all of their transports
+    at once, and only steps the clients which are ready, have been handed work, or have a deadline due.
+  */
+  class ClientReactor
+  {
+  private:
+    class Impl;
+    std::unique_ptr<Impl> mImpl;
+
+  public:
+    explicit ClientReactor(const ReactorOptions& options);
+    ~ClientReactor(); //Stops every thread, clients are left connected
+
+    ClientReactor(const ClientReactor&) = delete;
+    ClientReactor& operator=(const ClientReactor&) = delete;
+
+    /*
+      Clients may be added before or after Connect.
+      Returns false if the client is not using RunMode::Manual or has already been added.
+    */
+    bool Add(Client* pClient);
+
+    /*
+      Once this returns the reactor will not touch the client again.
+      Clients must be removed before they are destroyed, disconnected clients are dropped automatically.
+    */
+    bool Remove(Client* pClient);
+
+    size_t NumClients() const;
+  };
+
+#ifdef __linux__
+  struct SocketOptions
+  {
+    bool mNoDelay = true; //TCP_NODELAY, so small packets such as keystrokes aren't held back by Nagle
+    int mSendBufferSize = 0; //SO_SNDBUF, 0 leaves the kernel's default (and its autotuning) alone
+    int mRecvBufferSize = 0; //SO_RCVBUF, 0 leaves the kernel's default (and its autotuning) alone
+  };
+
+  namespace Transport
+  {
+    //Opens a TCP connection, blocking until it is established. Returns the socket, or -1 on failure.
+    int ConnectTCP(const char* pszHost, const char* pszPort, const SocketOptions& options = {});
+
+    /*
+      Transport over a connected socket, which is switched to non-blocking and has options applied.
+      Gather writes go out as a single sendmsg. The socket is left open when the transport is destroyed.
+    */
+    TTransport CreateSocket(int socketFD, const SocketOptions& options = {});
+
+    /*
+      Transport which does its socket I/O through an io_uring of queueDepth entries.
+      Reads go straight into the client's receive buffer, registered as a fixed buffer, and are kept
+      in flight between calls so an idle connection costs no syscalls. Gather writes are submitted
+      as one chain of linked writes. The socket is left open when the transport is destroyed.
+      Anyone driving Client::Process must wait for readability on pOutWaitFD rather than the socket,
+      since the ring has usually read the data already. Returns nullptr if io_uring isn't available.
+    */
+    TTransport CreateIOUring(int socketFD, const UINT32 queueDepth = 64, int* pOutWaitFD = nullptr);
+  }
+
+  /*
+    Epoll readiness loop for a RunMode::Manual client over a single descriptor, either a socket or
+    the WaitFD of the client's transport:
+
+      TIOEvents events = IOEvent::Readable | IOEvent::Writable;
+      while (client.GetState() != State::Disconnected)
+      {
+        events = waiter.Wait(client.Process(events));
+      }
+  */
+  class EpollWaiter
+  {
+  private:
+    int mEpollFD;
+    int mFD;
+    TTransport mpTransport; //Maps the client's events onto mFD's, when waiting on a transport
+    TIOEvents mRegistered = IOEvent::None;
+
+  public:
+    explicit EpollWaiter(int fd);
+
+    /*
+      Waits on the transport's WaitFD for whatever its WaitEvents asks for. An io_uring transport only
+      ever signals through its ring becoming readable, so waiting on it for writable would never sleep.
+    */
+    explicit EpollWaiter(const TTransport& pTransport);
+    ~EpollWaiter();
+
+    EpollWaiter(const EpollWaiter&) = delete;
+    EpollWaiter& operator=(const EpollWaiter&) = delete;
+
+    /*
+      Blocks until the descriptor has any of the wanted events or the deadline passes, returning the
+      events which are ready (possibly none). Returns straight away if nothing is wanted.
+    */
+    TIOEvents Wait(const ProcessResult& result);
   };
+#endif
 
   const char* StateToString(State state);
 
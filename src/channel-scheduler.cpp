@@ -0,0 +1,103 @@
+#include "channel-scheduler.h"
+
+#include <algorithm>
+
+using namespace SSH;
+
+void ChannelScheduler::Wake(const TChannel& channel)
+{
+  //Already in the rotation (or on its way), in which case it will be seen anyway
+  if (!channel->TryMarkScheduled())
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mWokenMutex);
+  mWoken.push_back(channel);
+  mbAnyWoken = true;
+}
+
+void ChannelScheduler::DrainWoken()
+{
+  if (!mbAnyWoken)
+  {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(mWokenMutex);
+  for (TChannel& channel : mWoken)
+  {
+    size_t priority = std::min((size_t)channel->Priority(), sNumPriorities - 1);
+
+    Entry entry;
+    entry.mChannel = std::move(channel);
+    mActive[priority].push_back(std::move(entry));
+  }
+
+  mWoken.clear();
+  mbAnyWoken = false;
+}
+
+TPacket ChannelScheduler::Next()
+{
+  DrainWoken();
+
+  for (std::deque<Entry>& active : mActive)
+  {
+    while (!active.empty())
+    {
+      Entry& entry = active.front();
+      if (!entry.mbTurnStarted)
+      {
+        entry.mDeficit += (uint64_t)sQuantum * entry.mChannel->Weight();
+        entry.mbTurnStarted = true;
+      }
+
+      UINT32 packetLen = entry.mChannel->ReadyPacketLen();
+      if (packetLen == 0)
+      {
+        //Cleared before checking again, so a writer racing with us either sees it clear or is seen here
+        entry.mChannel->ClearScheduled();
+        if (entry.mChannel->ReadyPacketLen() > 0 && entry.mChannel->TryMarkScheduled())
+        {
+          continue;
+        }
+
+        //Credit isn't banked while idle, or a quiet channel could later burst past the others
+        active.pop_front();
+        continue;
+      }
+
+      if (packetLen <= entry.mDeficit)
+      {
+        entry.mDeficit -= packetLen;
+        return entry.mChannel->TakeReadyPacket();
+      }
+
+      //Out of credit for this turn, whatever is left carries over to the next
+      entry.mbTurnStarted = false;
+      active.push_back(std::move(entry));
+      active.pop_front();
+    }
+  }
+
+  return nullptr;
+}
+
+bool ChannelScheduler::Pending()
+{
+  if (mbAnyWoken)
+  {
+    return true;
+  }
+
+  for (const std::deque<Entry>& active : mActive)
+  {
+    if (!active.empty())
+    {
+      return true;
+    }
+  }
+
+  return false;
+}
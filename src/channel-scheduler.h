@@ -0,0 +1,58 @@
+#ifndef __CHANNEL_SCHEDULER_H__
+#define __CHANNEL_SCHEDULER_H__
+
+#include "ssh.h"
+#include "channels.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+namespace SSH
+{
+  /*
+    Decides which channel's data goes out next, so one channel pushing megabytes can't starve
+    the others on the same connection. Each priority class is served strictly before the next,
+    and the channels within a class take turns by deficit round robin: every turn a channel
+    earns sQuantum bytes per unit of weight, and sends whole packets for as long as its credit
+    lasts. Channels only take part while they have packets ready, so idle ones cost nothing.
+
+    Wake may be called from any thread, everything else belongs to the thread driving the connection.
+  */
+  class ChannelScheduler
+  {
+  private:
+    static constexpr UINT32 sQuantum = 16 * 1024;
+    static constexpr size_t sNumPriorities = 2;
+
+    struct Entry
+    {
+      TChannel mChannel;
+      uint64_t mDeficit = 0;
+      bool mbTurnStarted = false;
+    };
+
+    //Channels woken by other threads, waiting to join the rotation
+    std::mutex mWokenMutex;
+    std::vector<TChannel> mWoken;
+    std::atomic<bool> mbAnyWoken = false; //Lets Next skip the lock when nothing has been woken
+
+    std::array<std::deque<Entry>, sNumPriorities> mActive;
+
+    void DrainWoken();
+
+  public:
+    //Adds the channel to the rotation, if it isn't already in it, once it has packets ready
+    void Wake(const TChannel& channel);
+
+    //The next packet to send, or nullptr once no channel has anything ready
+    TPacket Next();
+
+    //True if any channel may have packets ready
+    bool Pending();
+  };
+}
+
+#endif //~__CHANNEL_SCHEDULER_H__
@@ -0,0 +1,177 @@
+#include "channel-table.h"
+
+#include <algorithm>
+
+using namespace SSH;
+
+ChannelTable::~ChannelTable()
+{
+  for (std::atomic<Page*>& page : mPages)
+  {
+    delete page.load();
+  }
+}
+
+ChannelTable::Slot* ChannelTable::SlotFor(TChannelID id) const
+{
+  UINT32 index = id & sIndexMask;
+  Page* pPage = mPages[index / sSlotsPerPage].load(std::memory_order_acquire);
+  if (pPage == nullptr)
+  {
+    return nullptr;
+  }
+
+  Slot& slot = pPage->mSlots[index % sSlotsPerPage];
+  return (id != 0 && slot.mID.load(std::memory_order_acquire) == id) ? &slot : nullptr;
+}
+
+TChannelID ChannelTable::Insert(const TCreateFunc& createFunc)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  UINT32 index = 0;
+  UINT32 generation = 0;
+  bool bNewSlot = mFreeSlots.empty();
+
+  if (!bNewSlot)
+  {
+    index = mFreeSlots.back();
+    Slot& slot = mPages[index / sSlotsPerPage].load()->mSlots[index % sSlotsPerPage];
+    generation = slot.mGeneration + 1;
+  }
+  else
+  {
+    index = mNumSlots;
+    if (index == sMaxSlots)
+    {
+      return 0;
+    }
+
+    //Slots on a page given back earlier carry on from the table's count, so old IDs don't come straight back
+    generation = mNextGeneration++;
+  }
+
+  //Generation 0 is skipped, so no ID is ever 0
+  generation &= sGenerationMask;
+  if (generation == 0)
+  {
+    generation = 1;
+  }
+
+  TChannelID id = (generation << sIndexBits) | index;
+  TChannel channel = createFunc(id);
+  if (channel == nullptr)
+  {
+    return 0;
+  }
+
+  std::atomic<Page*>& page = mPages[index / sSlotsPerPage];
+  if (page.load() == nullptr)
+  {
+    page.store(new Page(), std::memory_order_release);
+  }
+
+  Slot& slot = page.load()->mSlots[index % sSlotsPerPage];
+  slot.mGeneration = generation;
+  slot.mChannel = std::move(channel);
+  slot.mID.store(id, std::memory_order_release);
+  page.load()->mNumUsed++;
+
+  if (bNewSlot)
+  {
+    mNumSlots.store(index + 1, std::memory_order_release);
+  }
+  else
+  {
+    mFreeSlots.pop_back();
+  }
+
+  return id;
+}
+
+IChannel* ChannelTable::Find(TChannelID id) const
+{
+  Slot* pSlot = SlotFor(id);
+  return (pSlot != nullptr) ? pSlot->mChannel.get() : nullptr;
+}
+
+TChannel ChannelTable::Get(TChannelID id)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  Slot* pSlot = SlotFor(id);
+  return (pSlot != nullptr) ? pSlot->mChannel : nullptr;
+}
+
+bool ChannelTable::Remove(TChannelID id)
+{
+  //Released once the lock is dropped, in case anything it owns calls back into the table
+  TChannel oldChannel;
+
+  std::lock_guard<std::mutex> lock(mMutex);
+
+  Slot* pSlot = SlotFor(id);
+  if (pSlot == nullptr)
+  {
+    return false;
+  }
+
+  UINT32 index = id & sIndexMask;
+  pSlot->mID.store(0, std::memory_order_release);
+  oldChannel = std::move(pSlot->mChannel);
+
+  mPages[index / sSlotsPerPage].load()->mNumUsed--;
+  mFreeSlots.push_back(index);
+
+  ReclaimPages();
+  return true;
+}
+
+void ChannelTable::ReclaimPages()
+{
+  while (mNumSlots > 0)
+  {
+    UINT32 lastPage = (mNumSlots - 1) / sSlotsPerPage;
+    Page* pPage = mPages[lastPage].load();
+    if (pPage->mNumUsed > 0)
+    {
+      return;
+    }
+
+    //Every slot on the page is free, so they all leave the free list with it
+    UINT32 firstIndex = lastPage * sSlotsPerPage;
+    mFreeSlots.erase(std::remove_if(mFreeSlots.begin(), mFreeSlots.end(), [&](UINT32 index)
+    {
+      return (index >= firstIndex);
+    }), mFreeSlots.end());
+
+    mNumSlots.store(firstIndex, std::memory_order_release);
+    mPages[lastPage].store(nullptr, std::memory_order_release);
+    delete pPage;
+  }
+}
+
+void ChannelTable::ForEach(const std::function<void (const TChannel&)>& func) const
+{
+  UINT32 numSlots = mNumSlots.load(std::memory_order_acquire);
+  for (UINT32 index = 0; index < numSlots; ++index)
+  {
+    Page* pPage = mPages[index / sSlotsPerPage].load(std::memory_order_acquire);
+    if (pPage == nullptr)
+    {
+      continue;
+    }
+
+    const Slot& slot = pPage->mSlots[index % sSlotsPerPage];
+    if (slot.mID.load(std::memory_order_acquire) != 0)
+    {
+      func(slot.mChannel);
+    }
+  }
+}
+
+size_t ChannelTable::Capacity() const
+{
+  UINT32 numSlots = mNumSlots.load(std::memory_order_acquire);
+  return ((numSlots + sSlotsPerPage - 1) / sSlotsPerPage) * sSlotsPerPage;
+}
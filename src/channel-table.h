@@ -0,0 +1,91 @@
+#ifndef __CHANNEL_TABLE_H__
+#define __CHANNEL_TABLE_H__
+
+#include "ssh.h"
+#include "channels.h"
+#include <array>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace SSH
+{
+  /*
+    A connection's channels, indexed directly by local channel ID. The low bits of an ID are its
+    slot and the high bits the slot's generation, which moves on every time the slot is reused,
+    so a stale ID never finds the channel which took its place. Freed slots are reused before
+    new ones are made, and pages of slots are given back once every slot in them is free.
+
+    Slots live in pages which never move, so the thread driving the connection can look channels
+    up with Find and walk them with ForEach without locking or touching reference counts. Removing
+    channels belongs to that thread too. Any thread may Insert, or take a reference with Get.
+  */
+  class ChannelTable
+  {
+  private:
+    static constexpr UINT32 sIndexBits = 16;
+    static constexpr UINT32 sIndexMask = (1 << sIndexBits) - 1;
+    static constexpr UINT32 sMaxSlots = 1 << sIndexBits;
+    static constexpr UINT32 sGenerationMask = (1 << (32 - sIndexBits)) - 1;
+    static constexpr UINT32 sSlotsPerPage = 64;
+    static constexpr UINT32 sNumPages = sMaxSlots / sSlotsPerPage;
+
+    struct Slot
+    {
+      std::atomic<TChannelID> mID = 0; //0 while the slot is free
+      UINT32 mGeneration = 0;
+      TChannel mChannel;
+    };
+
+    struct Page
+    {
+      std::array<Slot, sSlotsPerPage> mSlots;
+      UINT32 mNumUsed = 0;
+    };
+
+    //Guards everything but the lock free reads of mPages, mNumSlots and each slot's mID
+    std::mutex mMutex;
+    std::array<std::atomic<Page*>, sNumPages> mPages = {};
+    std::atomic<UINT32> mNumSlots = 0; //Slots below this have been handed out at some point
+    std::vector<UINT32> mFreeSlots;
+    UINT32 mNextGeneration = 1; //Seeds the generation of brand new slots
+
+    Slot* SlotFor(TChannelID id) const;
+
+    //Frees trailing pages which no longer hold any channels. Expects mMutex to be held.
+    void ReclaimPages();
+
+  public:
+    using TCreateFunc = std::function<TChannel (TChannelID id)>;
+
+    ChannelTable() = default;
+    ~ChannelTable();
+
+    ChannelTable(const ChannelTable&) = delete;
+    ChannelTable& operator=(const ChannelTable&) = delete;
+
+    /*
+      Picks an ID and has createFunc make the channel for it. Returns the ID, or 0 if the table
+      is full or createFunc returned nullptr, in which case nothing is added.
+    */
+    TChannelID Insert(const TCreateFunc& createFunc);
+
+    //The channel with this ID, or nullptr. Only for the thread driving the connection.
+    IChannel* Find(TChannelID id) const;
+
+    //A reference to the channel with this ID, or nullptr. Safe from any thread.
+    TChannel Get(TChannelID id);
+
+    //Drops the channel, returning false if there was none. Only for the thread driving the connection.
+    bool Remove(TChannelID id);
+
+    //Calls func for every channel. Only for the thread driving the connection.
+    void ForEach(const std::function<void (const TChannel&)>& func) const;
+
+    //Slots currently allocated, used or not
+    size_t Capacity() const;
+  };
+}
+
+#endif //~__CHANNEL_TABLE_H__
@@ -1,61 +1,422 @@
 #include "channels.h"
+#include "messages.h"
+
+#include <algorithm>
+#include <limits>
 
 using namespace SSH;
 
-class Session_Channel : public SSH::IChannel
+void IChannel::SetCoalescing(UINT32 coalesceBytes, TClock::duration delay)
 {
-public:
-  Session_Channel(UINT32 id, TOnEventFunc callback)
-    : IChannel(id, ChannelTypes::Session, callback)
+  std::lock_guard<std::mutex> lock(mSendMutex);
+  mCoalesceBytes = coalesceBytes;
+  mCoalesceDelay = delay;
+}
+
+void IChannel::SetSendBuffer(UINT32 bufferSize)
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+  mSendBufferSize = std::max(bufferSize, 1u);
+}
+
+void IChannel::BuildPackets(const Byte* pBuf, UINT32 numBytes, PacketStore& store)
+{
+  //Data may never exceed what the remote will accept in a single packet
+  UINT32 maxChunk = (mRemote.mMaxPacketSize > 0) ? mRemote.mMaxPacketSize : numBytes;
+  UINT32 offset = 0;
+
+  while (offset < numBytes)
   {
-    mLocal.mWindowSize = 1024;
-    mLocal.mMaxPacketSize = 1024;
+    UINT32 chunkLen = std::min(maxChunk, numBytes - offset);
+    mReadyPackets.push_back({ PrepareSend(pBuf + offset, chunkLen, store), chunkLen });
+    offset += chunkLen;
   }
+}
 
-  virtual ~Session_Channel()
+void IChannel::FlushPending(UINT32 numBytes, PacketStore& store)
+{
+  BuildPackets(mPendingData.data(), numBytes, store);
+
+  mPendingData.erase(mPendingData.begin(), mPendingData.begin() + numBytes);
+  mPendingSince = TClock::now();
+}
+
+void IChannel::OpenSendWindow(UINT32 windowSize, UINT32 maxPacketSize)
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+  mRemote.mWindowSize = windowSize;
+  mRemote.mMaxPacketSize = maxPacketSize;
+}
+
+bool IChannel::GrowSendWindow(UINT32 numBytes)
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+
+  //The window can never go beyond 2^32 - 1, whatever the remote asks for
+  mRemote.mWindowSize += std::min(numBytes, std::numeric_limits<UINT32>::max() - mRemote.mWindowSize);
+
+  return WriterUnblocked();
+}
+
+bool IChannel::WriterUnblocked()
+{
+  //Waiting for half the buffer to drain means writers are woken for a decent amount each time
+  if (!mSendBlocked || mRemote.mWindowSize == 0 || mBufferedBytes > mSendBufferSize / 2)
   {
+    return false;
   }
 
-  virtual TPacket CreateOpenPacket(PacketStore& store) override
+  mSendBlocked = false;
+  return true;
+}
+
+void IChannel::SetRecvWindow(UINT32 windowSize, UINT32 maxWindowSize, UINT32 maxPacketSize)
+{
+  std::lock_guard<std::mutex> lock(mRecvMutex);
+  mLocal.mWindowSize = windowSize;
+  mLocal.mMaxPacketSize = maxPacketSize;
+  mRecvTuner = WindowTuner(windowSize, maxWindowSize);
+}
+
+bool IChannel::TakeRecvWindow(UINT32 numBytes)
+{
+  std::lock_guard<std::mutex> lock(mRecvMutex);
+
+  if (numBytes > mLocal.mWindowSize || numBytes > mLocal.mMaxPacketSize)
   {
-    std::string channelType = Channel::ChannelTypeToString(mChannelType);
-    UINT32 packetLen =  sizeof(Byte) +          //SSH_MSG
-                        sizeof(UINT32) +        //Channel type field length
-                        channelType.length() +  //Channel type
-                        sizeof(UINT32) +        //Sender Channel
-                        sizeof(UINT32) +        //Initial window size
-                        sizeof(UINT32);         //Maximum packet size
+    return false;
+  }
+
+  mLocal.mWindowSize -= numBytes;
+  mRecvHeld += numBytes;
+  mRecvGrowth += mRecvTuner.OnData(TClock::now(), numBytes);
+  return true;
+}
 
-    TPacket newPacket = store.Create(packetLen, PacketType::Write);
+void ChannelData::Add(const Byte* pData, UINT32 len, std::shared_ptr<const void> pOwner)
+{
+  mSpans.push_back({ pData, len });
+  mOwners.push_back(std::move(pOwner));
+  mNumBytes += len;
+}
+
+void ChannelData::Clear()
+{
+  //Capacity is kept, so batches after the first don't allocate
+  mSpans.clear();
+  mOwners.clear();
+  mNumBytes = 0;
+}
 
-    newPacket->Write(SSH_MSG::CHANNEL_OPEN);
-    newPacket->Write(channelType);
-    newPacket->Write(mChannelId);
-    newPacket->Write(mLocal.mWindowSize);
-    newPacket->Write(mLocal.mMaxPacketSize);
+ChannelData::TRetained ChannelData::Retain() const
+{
+  return std::make_shared<std::vector<std::shared_ptr<const void>>>(mOwners);
+}
 
-    return newPacket;
+void IChannel::DeliverData(const Byte* pBuf, UINT32 bufLen, const TPacket& pPacket)
+{
+  if (mOnData)
+  {
+    mBatch.Add(pBuf, bufLen, pPacket);
+    return;
   }
 
-  virtual TPacket CreateClosePacket(PacketStore& store) override
+  TResult result = mOnEvent(ChannelEvent::Data, pBuf, (int)bufLen);
+
+  //Callbacks which don't say are taken to have consumed everything
+  UINT32 numConsumed = bufLen;
+  if (result.has_value())
   {
-    return nullptr;
+    numConsumed = (UINT32)std::clamp(result.value(), 0, (int)bufLen);
   }
 
-  virtual TPacket PrepareSend(const Byte* pBuf, const int bufLen, PacketStore& store) override
+  Consume(numConsumed);
+}
+
+void IChannel::DeliverBatch()
+{
+  if (mBatch.Empty())
   {
-    UINT32 packetLen =  sizeof(Byte) +    //SSH_MSG
-                        sizeof(UINT32) +  //Recipient channel
-                        sizeof(UINT32) +  //Data length field
-                        bufLen;           //Data
+    return;
+  }
 
-    TPacket newPacket = store.Create(packetLen, PacketType::Write);
+  TResult result = mOnData(mChannelId, mBatch);
 
-    newPacket->Write(SSH_MSG::CHANNEL_DATA);
-    newPacket->Write(mRemoteId);
-    newPacket->Write(pBuf, bufLen);
+  UINT32 numConsumed = mBatch.Size();
+  if (result.has_value())
+  {
+    numConsumed = (UINT32)std::clamp(result.value(), 0, (int)mBatch.Size());
+  }
 
-    return newPacket;
+  //Anything retained keeps its own references to the packets
+  mBatch.Clear();
+  Consume(numConsumed);
+}
+
+bool IChannel::Consume(UINT32 numBytes)
+{
+  std::lock_guard<std::mutex> lock(mRecvMutex);
+
+  if (numBytes > mRecvHeld)
+  {
+    return false;
+  }
+
+  mRecvHeld -= numBytes;
+  mRecvConsumed += numBytes;
+  return true;
+}
+
+TPacket IChannel::TakeWindowAdjust(PacketStore& store)
+{
+  UINT32 numBytes = 0;
+  {
+    std::lock_guard<std::mutex> lock(mRecvMutex);
+
+    //No more window once either side has closed the channel
+    if (mState == ChannelState::Closing || mState == ChannelState::Closed)
+    {
+      return nullptr;
+    }
+
+    //Adjusting in halves keeps the remote sending without a round trip for every packet
+    numBytes = mRecvConsumed + mRecvGrowth;
+    if (numBytes == 0 || numBytes < mRecvTuner.Window() / 2)
+    {
+      return nullptr;
+    }
+
+    mRecvTuner.OnAdjustSent(TClock::now(), mLocal.mWindowSize);
+    mRecvConsumed = 0;
+    mRecvGrowth = 0;
+    mLocal.mWindowSize += numBytes;
+  }
+
+  return Messages::ChannelWindowAdjust::Create(store, mRemoteId, numBytes);
+}
+
+UINT32 IChannel::Write(const Byte* pBuf, const int bufLen, PacketStore& store)
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+
+  if (mbCloseSent)
+  {
+    return 0;
+  }
+
+  /*
+    Anything beyond the window or the send buffer stays with the caller, so nothing here grows without
+    limit, and a large write is copied in a piece at a time as the earlier pieces go out.
+  */
+  UINT32 wanted = (UINT32)std::max(bufLen, 0);
+  UINT32 bufferSpace = (mBufferedBytes < mSendBufferSize) ? (mSendBufferSize - mBufferedBytes) : 0;
+  UINT32 numBytes = std::min({ wanted, mRemote.mWindowSize, bufferSpace });
+  if (numBytes < wanted)
+  {
+    mSendBlocked = true;
+  }
+
+  if (numBytes == 0)
+  {
+    return 0;
+  }
+
+  mRemote.mWindowSize -= numBytes;
+  mBufferedBytes += numBytes;
+
+  if (!mCorked && mPendingData.empty() && numBytes >= mCoalesceBytes)
+  {
+    //Nothing to merge with, so skip the copy into the pending buffer
+    BuildPackets(pBuf, numBytes, store);
+    return numBytes;
+  }
+
+  if (mPendingData.empty())
+  {
+    mPendingSince = TClock::now();
+  }
+
+  mPendingData.insert(mPendingData.end(), pBuf, pBuf + numBytes);
+
+  if (!mCorked && mPendingData.size() >= mCoalesceBytes)
+  {
+    FlushPending(mPendingData.size(), store);
+  }
+  else if (mRemote.mMaxPacketSize > 0 && mPendingData.size() >= mRemote.mMaxPacketSize)
+  {
+    //Even when corked, full packets can go out straight away
+    UINT32 fullPackets = mPendingData.size() / mRemote.mMaxPacketSize;
+    FlushPending(fullPackets * mRemote.mMaxPacketSize, store);
+  }
+
+  return numBytes;
+}
+
+void IChannel::FlushExpired(TClock::time_point now, PacketStore& store)
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+
+  if (mCorked || mPendingData.empty())
+  {
+    return;
+  }
+
+  if (now - mPendingSince >= mCoalesceDelay)
+  {
+    FlushPending(mPendingData.size(), store);
+  }
+}
+
+std::optional<TClock::time_point> IChannel::FlushDeadline()
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+
+  if (mCorked || mPendingData.empty())
+  {
+    return {};
+  }
+
+  return mPendingSince + mCoalesceDelay;
+}
+
+void IChannel::Cork()
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+  mCorked = true;
+}
+
+void IChannel::Uncork(PacketStore& store)
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+  mCorked = false;
+
+  if (!mPendingData.empty())
+  {
+    FlushPending(mPendingData.size(), store);
+  }
+}
+
+bool IChannel::Close(PacketStore& store)
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+  mbCloseWanted = true;
+  return QueueClose(store);
+}
+
+bool IChannel::ResumeClose(PacketStore& store)
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+
+  //A close from the remote has to be answered with ours
+  if (!mbCloseWanted && mState != ChannelState::Closed)
+  {
+    return false;
+  }
+
+  mbCloseWanted = true;
+  return QueueClose(store);
+}
+
+bool IChannel::QueueClose(PacketStore& store)
+{
+  //The remote's channel ID isn't known until it confirms the channel
+  if (mbCloseSent || mState == ChannelState::Opening)
+  {
+    return false;
+  }
+
+  //Whatever was written goes out first, corked or not
+  if (!mPendingData.empty())
+  {
+    FlushPending(mPendingData.size(), store);
+  }
+
+  TPacket pPacket = CreateClosePacket(store);
+  if (pPacket == nullptr)
+  {
+    return false;
+  }
+
+  mReadyPackets.push_back({ pPacket, 0 });
+  mbCloseSent = true;
+
+  ChannelState expected = ChannelState::Open;
+  mState.compare_exchange_strong(expected, ChannelState::Closing);
+  return true;
+}
+
+UINT32 IChannel::ReadyPacketLen()
+{
+  std::lock_guard<std::mutex> lock(mSendMutex);
+  return mReadyPackets.empty() ? 0 : (UINT32)mReadyPackets.front().mPacket->PacketLen();
+}
+
+TPacket IChannel::TakeReadyPacket()
+{
+  TPacket pPacket;
+  bool bWritable = false;
+  {
+    std::lock_guard<std::mutex> lock(mSendMutex);
+
+    if (mReadyPackets.empty())
+    {
+      return nullptr;
+    }
+
+    ReadyPacket& ready = mReadyPackets.front();
+    pPacket = std::move(ready.mPacket);
+    mBufferedBytes -= ready.mDataLen;
+    mReadyPackets.pop_front();
+
+    bWritable = WriterUnblocked();
+  }
+
+  //Outside the lock, as the callback will most likely write some more
+  if (bWritable)
+  {
+    mOnEvent(ChannelEvent::Writable, nullptr, 0);
+  }
+
+  return pPacket;
+}
+
+void IChannel::SetPriority(ChannelPriority priority, UINT32 weight)
+{
+  mPriority = priority;
+  mWeight = std::max(weight, 1u);
+}
+
+class Session_Channel : public SSH::IChannel
+{
+public:
+  Session_Channel(UINT32 id, TOnEventFunc callback, TOnDataFunc dataCallback)
+    : IChannel(id, ChannelTypes::Session, callback, dataCallback)
+  {}
+
+  virtual ~Session_Channel()
+  {
+  }
+
+  virtual TPacket CreateOpenPacket(PacketStore& store) override
+  {
+    std::string channelType = Channel::ChannelTypeToString(mChannelType);
+
+    return Messages::ChannelOpen::Create(store,
+                                         channelType,
+                                         mChannelId,
+                                         mLocal.mWindowSize,
+                                         mLocal.mMaxPacketSize);
+  }
+
+  virtual TPacket CreateClosePacket(PacketStore& store) override
+  {
+    return Messages::ChannelClose::Create(store, mRemoteId);
+  }
+
+  virtual TPacket PrepareSend(const Byte* pBuf, const int bufLen, PacketStore& store) override
+  {
+    ByteView data = { pBuf, (UINT32)bufLen };
+    return Messages::ChannelData::Create(store, mRemoteId, data);
   }
 
   virtual bool HandleData(Byte msgId, TPacket pPacket) override
@@ -64,25 +425,48 @@ public:
     {
       case SSH_MSG::CHANNEL_OPEN_CONFIRMATION:
       {
+        UINT32 windowSize = 0;
+        UINT32 maxPacketSize = 0;
         pPacket->Read(mRemoteId);
-        pPacket->Read(mRemote.mWindowSize);
-        pPacket->Read(mRemote.mMaxPacketSize);
+        pPacket->Read(windowSize);
+        pPacket->Read(maxPacketSize);
+        OpenSendWindow(windowSize, maxPacketSize);
 
         mState = ChannelState::Open;
         mOnEvent(ChannelEvent::Opened, nullptr, 0);
 
         break;
       }
+      case SSH_MSG::CHANNEL_WINDOW_ADJUST:
+      {
+        UINT32 numBytes = 0;
+        if (pPacket->Read(numBytes) < 0)
+        {
+          return false;
+        }
+
+        if (GrowSendWindow(numBytes))
+        {
+          mOnEvent(ChannelEvent::Writable, nullptr, 0);
+        }
+        break;
+      }
       case SSH_MSG::CHANNEL_DATA:
       {
-        TByteString data;
-        pPacket->Read(data);
+        //Hand the data straight out of the packet
+        PacketReader reader = pPacket->Reader();
+        ByteView data;
+        if (!reader.Read(data) || !TakeRecvWindow(data.mLen))
+        {
+          return false;
+        }
 
-        mOnEvent(ChannelEvent::Data, data.data(), data.size());
+        DeliverData(data.mpData, data.mLen, pPacket);
         break;
       }
       case SSH_MSG::CHANNEL_CLOSE:
       {
+        mState = ChannelState::Closed;
         mOnEvent(ChannelEvent::Closed, nullptr, 0);
         break;
       }
@@ -92,11 +476,11 @@ public:
   }
 };
 
-TChannel Channel::Create(ChannelTypes type, TChannelID id, TOnEventFunc callback)
+TChannel Channel::Create(ChannelTypes type, TChannelID id, TOnEventFunc callback, TOnDataFunc dataCallback)
 {
   switch (type)
   {
-    case ChannelTypes::Session: return std::make_shared<Session_Channel>(id, callback);
+    case ChannelTypes::Session: return std::make_shared<Session_Channel>(id, callback, dataCallback);
     default: return nullptr;
   }
 }
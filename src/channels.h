@@ -3,9 +3,16 @@
 
 #include "ssh.h"
 #include "packets.h"
+#include "window-tuner.h"
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <limits>
 
 namespace SSH
 {
@@ -13,11 +20,63 @@ namespace SSH
   {
     Opening,
     Open,
-    Closing,
+    Closing, //Our CHANNEL_CLOSE has been queued, the remote's hasn't arrived yet
+    Closed,  //The remote has sent its CHANNEL_CLOSE, so nothing more will arrive for the channel
   };
 
-  class IChannel
+  using TClock = std::chrono::steady_clock;
+
+  class IChannel : public std::enable_shared_from_this<IChannel>
   {
+  private:
+    struct ReadyPacket
+    {
+      TPacket mPacket;
+      UINT32 mDataLen; //Channel data carried by the packet
+    };
+
+    using TPacketDeque = std::deque<ReadyPacket>;
+
+    //Sending is shared between the user's thread and the poll thread
+    std::mutex mSendMutex;
+
+    //Receiving happens on the poll thread, but data can be consumed from any
+    std::mutex mRecvMutex;
+    WindowTuner mRecvTuner = { 0, 0 }; //Decides the window the remote is topped back up to
+    UINT32 mRecvHeld = 0; //Delivered to the callback but not yet consumed
+    UINT32 mRecvConsumed = 0; //Consumed but not yet handed back to the remote
+    UINT32 mRecvGrowth = 0; //Window added by the tuner but not yet handed to the remote
+
+    //Data waiting for DeliverBatch, only used when there is a data callback. Poll thread only.
+    ChannelData mBatch;
+
+    TByteString mPendingData; //Data waiting to be merged into a CHANNEL_DATA packet
+    TClock::time_point mPendingSince;
+    TPacketDeque mReadyPackets; //Packets built by the channel, waiting to be queued on the connection
+
+    UINT32 mCoalesceBytes = 0;
+    TClock::duration mCoalesceDelay = {};
+    bool mCorked = false;
+    bool mSendBlocked = false; //A Write was cut short by the remote's window or the send buffer
+    UINT32 mSendBufferSize = std::numeric_limits<UINT32>::max();
+    UINT32 mBufferedBytes = 0; //Data taken by Write which hasn't been handed to the connection yet
+    bool mbCloseWanted = false; //Close was called, or the remote closed the channel
+    bool mbCloseSent = false; //Our CHANNEL_CLOSE has been queued, nothing more may be written
+
+    //Set while the channel is in (or on its way into) the connection's ChannelScheduler
+    std::atomic<bool> mScheduled = false;
+    std::atomic<ChannelPriority> mPriority = ChannelPriority::Bulk;
+    std::atomic<UINT32> mWeight = 1;
+
+    //Builds packets of no more than the remote's maximum size. Expects mSendMutex to be held.
+    void BuildPackets(const Byte* pBuf, UINT32 numBytes, PacketStore& store);
+
+    //Turns up to numBytes of pending data into packets. Expects mSendMutex to be held.
+    void FlushPending(UINT32 numBytes, PacketStore& store);
+
+    //Queues CHANNEL_CLOSE once the channel is open, if it hasn't been already. Expects mSendMutex to be held.
+    bool QueueClose(PacketStore& store);
+
   protected:
     struct ChannelInfo
     {
@@ -29,16 +88,44 @@ namespace SSH
     UINT32 mRemoteId;
     ChannelTypes mChannelType;
     TOnEventFunc mOnEvent;
-    ChannelState mState;
+    TOnDataFunc mOnData; //Takes the channel's data in batches instead of mOnEvent, if set
+    std::atomic<ChannelState> mState = ChannelState::Opening;
+
+    //What we have advertised to the remote, guarded by mRecvMutex once the channel is open
+    ChannelInfo mLocal = {};
+
+    /*
+      mRemote.mWindowSize counts down as Write takes data, so it is what the remote will still accept
+      once everything already taken has gone out. Both are guarded by mSendMutex.
+    */
+    ChannelInfo mRemote = {};
+
+    //Sets the remote's initial window and packet size once it has confirmed the channel
+    void OpenSendWindow(UINT32 windowSize, UINT32 maxPacketSize);
+
+    //Adds to the remote's window, returning true if a writer was waiting on it and can now continue
+    bool GrowSendWindow(UINT32 numBytes);
+
+    //True once a blocked writer has room to write again. Expects mSendMutex to be held.
+    bool WriterUnblocked();
 
-    ChannelInfo mLocal;
-    ChannelInfo mRemote;
+    //Takes incoming data out of our window, returning false if the remote has overrun it or our packet size
+    bool TakeRecvWindow(UINT32 numBytes);
+
+    /*
+      Passes received data to the callback. Its result is how much of the data it has consumed,
+      anything less is held (and keeps the window closed) until handed back with Consume.
+      With a data callback, the data is added to the batch for DeliverBatch instead, along with
+      the packet it points into so the batch can be retained.
+    */
+    void DeliverData(const Byte* pBuf, UINT32 bufLen, const TPacket& pPacket);
 
   public:
-    IChannel(UINT32 id, ChannelTypes type, TOnEventFunc callback)
+    IChannel(UINT32 id, ChannelTypes type, TOnEventFunc callback, TOnDataFunc dataCallback = nullptr)
         : mChannelId(id)
         , mChannelType(ChannelTypes::Session)
         , mOnEvent(callback)
+        , mOnData(dataCallback)
     {}
 
     virtual ~IChannel() = default;
@@ -58,6 +145,77 @@ namespace SSH
       return mState;
     }
 
+    void SetCoalescing(UINT32 coalesceBytes, TClock::duration delay);
+
+    //Most data Write holds on to before it stops taking more, see ClientOptions::mChannelSendBufferSize
+    void SetSendBuffer(UINT32 bufferSize);
+
+    /*
+      Sets the window and packet size advertised to the remote, before the channel is opened.
+      The window is autotuned from there up to maxWindowSize.
+    */
+    void SetRecvWindow(UINT32 windowSize, UINT32 maxWindowSize, UINT32 maxPacketSize);
+
+    //Hands back window for data which a callback held on to, returns false if more than was held
+    bool Consume(UINT32 numBytes);
+
+    //Packets of data waiting in the batch
+    size_t NumBatched() const { return mBatch.Spans().size(); }
+
+    //Hands any batched data to the data callback, in one call
+    void DeliverBatch();
+
+    /*
+      Once enough data has been consumed, returns a CHANNEL_WINDOW_ADJUST giving that much window back
+      to the remote. Returns nullptr while it isn't worth sending one yet.
+    */
+    TPacket TakeWindowAdjust(PacketStore& store);
+
+    /*
+      Queues data to be sent on this channel, merging small writes where possible.
+      Only takes as much as the remote's window and the send buffer have room for, returning the number
+      of bytes taken. Any packets which are ready to go out can be collected with TakeReadyPacket.
+    */
+    UINT32 Write(const Byte* pBuf, const int bufLen, PacketStore& store);
+
+    //Flushes merged data which has waited longer than the coalesce delay
+    void FlushExpired(TClock::time_point now, PacketStore& store);
+
+    //When merged data will next need flushing, if there is any waiting
+    std::optional<TClock::time_point> FlushDeadline();
+
+    void Cork();
+    void Uncork(PacketStore& store);
+
+    /*
+      Queues a CHANNEL_CLOSE behind any data already written, returning true if it did.
+      A channel which is still opening is closed once confirmed, see ResumeClose.
+    */
+    bool Close(PacketStore& store);
+
+    /*
+      Called once the channel is confirmed, or the remote has closed it. Queues the close which
+      Close couldn't send yet, or the answer to the remote's, returning true if it did.
+    */
+    bool ResumeClose(PacketStore& store);
+
+    //Length of the next packet ready to go out, or 0 if there isn't one
+    UINT32 ReadyPacketLen();
+
+    /*
+      Removes and returns the next packet ready to go out, or nullptr if there isn't one.
+      Fires ChannelEvent::Writable once that leaves room for a writer which was cut short.
+    */
+    TPacket TakeReadyPacket();
+
+    void SetPriority(ChannelPriority priority, UINT32 weight);
+    ChannelPriority Priority() const { return mPriority; }
+    UINT32 Weight() const { return mWeight; }
+
+    //Returns true if the channel wasn't already scheduled, and now is
+    bool TryMarkScheduled() { return !mScheduled.exchange(true); }
+    void ClearScheduled() { mScheduled = false; }
+
     virtual TPacket CreateOpenPacket(PacketStore& store) = 0;
     virtual TPacket CreateClosePacket(PacketStore& store) = 0;
     virtual TPacket PrepareSend(const Byte* pBuf, const int bufLen, PacketStore& store) = 0;
@@ -66,11 +224,10 @@ namespace SSH
   };
 
   using TChannel = std::shared_ptr<IChannel>;
-  using TChannelVec = std::vector<TChannel>;
 
   namespace Channel
   {
-    TChannel Create(ChannelTypes type, TChannelID id, TOnEventFunc callback);
+    TChannel Create(ChannelTypes type, TChannelID id, TOnEventFunc callback, TOnDataFunc dataCallback = nullptr);
     std::string ChannelTypeToString(ChannelTypes type);
   }
 }
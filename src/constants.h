@@ -36,4 +36,7 @@ enum SSH_MSG
 
 constexpr char cKexCookieLength = 16;
 
+//RFC4253#section-6.1, every implementation must accept packets of at least this total size (including MAC)
+constexpr unsigned int cMinMaxPacketLength = 35000;
+
 #endif //~__CONSTANTS_H__
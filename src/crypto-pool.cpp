@@ -0,0 +1,180 @@
+#include "crypto-pool.h"
+
+using namespace SSH;
+
+namespace
+{
+  //Index of the pool worker running on this thread, if any
+  thread_local const CryptoPool* tpWorkerPool = nullptr;
+  thread_local size_t tWorkerIndex = 0;
+}
+
+CryptoPool::CryptoPool(UINT32 numThreads)
+{
+  if (numThreads == 0)
+  {
+    //Leave a core for the I/O threads
+    UINT32 numCores = std::thread::hardware_concurrency();
+    numThreads = (numCores > 1) ? numCores - 1 : 1;
+  }
+
+  for (UINT32 i = 0; i < numThreads; ++i)
+  {
+    mWorkers.push_back(std::make_unique<Worker>());
+  }
+
+  //Only start once every worker exists, so stealing never sees a half built set
+  for (UINT32 i = 0; i < numThreads; ++i)
+  {
+    mWorkers[i]->mThread = std::thread(&CryptoPool::Run, this, i);
+  }
+}
+
+CryptoPool::~CryptoPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(mSleepMutex);
+    mStopRequested = true;
+  }
+  mWake.notify_all();
+
+  for (auto& pWorker : mWorkers)
+  {
+    if (pWorker->mThread.joinable())
+    {
+      pWorker->mThread.join();
+    }
+  }
+}
+
+void CryptoPool::Submit(TCryptoTask task)
+{
+  size_t index = 0;
+  if (tpWorkerPool == this)
+  {
+    //Work spawned by a task stays with the worker that spawned it, unless someone steals it
+    index = tWorkerIndex;
+  }
+  else
+  {
+    index = mNextWorker++ % mWorkers.size();
+  }
+
+  {
+    Worker& worker = *mWorkers[index];
+    std::lock_guard<std::mutex> lock(worker.mMutex);
+    worker.mTasks.push_back(std::move(task));
+  }
+
+  mNumQueued++;
+
+  //Taking the lock means a worker can't miss this between checking for work and sleeping
+  {
+    std::lock_guard<std::mutex> lock(mSleepMutex);
+  }
+  mWake.notify_one();
+}
+
+bool CryptoPool::TryPop(size_t index, TCryptoTask& outTask)
+{
+  Worker& worker = *mWorkers[index];
+  std::lock_guard<std::mutex> lock(worker.mMutex);
+  if (worker.mTasks.empty())
+  {
+    return false;
+  }
+
+  //Oldest first, so a burst of new handshakes can't hold back ones already waiting
+  outTask = std::move(worker.mTasks.front());
+  worker.mTasks.pop_front();
+  return true;
+}
+
+bool CryptoPool::TrySteal(size_t thief, TCryptoTask& outTask)
+{
+  for (size_t i = 1; i < mWorkers.size(); ++i)
+  {
+    Worker& victim = *mWorkers[(thief + i) % mWorkers.size()];
+    std::lock_guard<std::mutex> lock(victim.mMutex);
+    if (victim.mTasks.empty())
+    {
+      continue;
+    }
+
+    //Take from the other end to the owner, so the two rarely fight over the same task
+    outTask = std::move(victim.mTasks.back());
+    victim.mTasks.pop_back();
+    return true;
+  }
+
+  return false;
+}
+
+void CryptoPool::Run(size_t index)
+{
+  tpWorkerPool = this;
+  tWorkerIndex = index;
+
+  while (true)
+  {
+    TCryptoTask task;
+    if (TryPop(index, task) || TrySteal(index, task))
+    {
+      mNumQueued--;
+      task();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(mSleepMutex);
+    mWake.wait(lock, [this]()
+    {
+      return (mStopRequested || mNumQueued > 0);
+    });
+
+    if (mStopRequested)
+    {
+      break;
+    }
+  }
+}
+
+CryptoPool& CryptoPool::Shared()
+{
+  static CryptoPool sPool;
+  return sPool;
+}
+
+void CompletionQueue::Post(TCryptoTask func)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mFuncs.push_back(std::move(func));
+
+  //Under the lock, so once SetOnPost has replaced it the old one is never called again
+  if (mOnPost)
+  {
+    mOnPost();
+  }
+}
+
+void CompletionQueue::SetOnPost(TCryptoTask onPost)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mOnPost = std::move(onPost);
+}
+
+bool CompletionQueue::RunAll()
+{
+  std::vector<TCryptoTask> funcs;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    funcs.swap(mFuncs);
+  }
+
+  //Run outside the lock, completions are free to post (or submit more work) themselves
+  for (TCryptoTask& func : funcs)
+  {
+    func();
+  }
+
+  return !funcs.empty();
+}
@@ -0,0 +1,90 @@
+#ifndef __CRYPTO_POOL_H__
+#define __CRYPTO_POOL_H__
+
+#include "ssh.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace SSH
+{
+  using TCryptoTask = std::function<void()>;
+
+  /*
+    Work-stealing thread pool for CPU heavy crypto, such as DH key generation, host key
+    verification and encrypting large packets, so it doesn't stall the I/O threads.
+    Each worker has its own queue. Tasks submitted from outside the pool are spread across
+    the queues in turn, tasks submitted from a worker go on that worker's own queue, and an
+    idle worker steals from the back of the others' queues before going to sleep.
+  */
+  class CryptoPool
+  {
+  private:
+    struct Worker
+    {
+      std::thread mThread;
+      std::mutex mMutex;
+      std::deque<TCryptoTask> mTasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+    std::atomic<size_t> mNextWorker = 0;
+    std::atomic<size_t> mNumQueued = 0;
+    std::atomic<bool> mStopRequested = false;
+
+    std::mutex mSleepMutex;
+    std::condition_variable mWake;
+
+    bool TryPop(size_t index, TCryptoTask& outTask);
+    bool TrySteal(size_t thief, TCryptoTask& outTask);
+    void Run(size_t index);
+
+  public:
+    //0 threads uses one less than the number of cores (but always at least one)
+    explicit CryptoPool(UINT32 numThreads = 0);
+    ~CryptoPool();
+
+    CryptoPool(const CryptoPool&) = delete;
+    CryptoPool& operator=(const CryptoPool&) = delete;
+
+    //Tasks run in no particular order, and must not throw
+    void Submit(TCryptoTask task);
+
+    UINT32 NumThreads() const { return (UINT32)mWorkers.size(); }
+
+    //Pool shared by every client in the process, started on first use
+    static CryptoPool& Shared();
+  };
+
+  /*
+    Hands results from the crypto pool back to the thread that drives a connection.
+    Tasks post here when they finish, and the connection runs the posted functions on its
+    next pass. Tasks hold the queue by shared_ptr, so one finishing after its connection has
+    gone simply posts to nobody.
+  */
+  class CompletionQueue
+  {
+  private:
+    std::mutex mMutex;
+    std::vector<TCryptoTask> mFuncs;
+    TCryptoTask mOnPost;
+
+  public:
+    void Post(TCryptoTask func);
+
+    //Called from the posting thread after every post, E.G. to wake whoever drives the connection. Must not post.
+    void SetOnPost(TCryptoTask onPost);
+
+    //Runs everything posted so far, returns false if there was nothing to run
+    bool RunAll();
+  };
+
+  using TCompletionQueue = std::shared_ptr<CompletionQueue>;
+}
+
+#endif //~__CRYPTO_POOL_H__
@@ -43,6 +43,18 @@ class AES128_CTR_CryptoHandler : public ICryptoHandler
 private:
   Aes mKey;
 
+  //Adds numBlocks to the big endian counter block
+  void AdvanceCounter(UINT32 numBlocks)
+  {
+    Byte* pCounter = (Byte*)mKey.reg;
+    for (int i = AES_BLOCK_SIZE - 1; i >= 0 && numBlocks > 0; --i)
+    {
+      UINT32 sum = pCounter[i] + (numBlocks & 0xFF);
+      pCounter[i] = (Byte)sum;
+      numBlocks = (numBlocks >> 8) + (sum >> 8);
+    }
+  }
+
 public:
   AES128_CTR_CryptoHandler()
   {
@@ -100,6 +112,20 @@ public:
   }
   virtual CryptoHandlers Type() override { return CryptoHandlers::AES128_CTR; }
   virtual UINT32 BlockLen() override { return AES_BLOCK_SIZE; }
+
+  virtual TCryptoHandler Split(const UINT32 numBytes) override
+  {
+    //Part way through a block the keystream position can't be handed over cleanly
+    if (numBytes % BlockLen() != 0 || mKey.left != 0)
+    {
+      return nullptr;
+    }
+
+    auto pSplit = std::make_shared<AES128_CTR_CryptoHandler>();
+    memcpy(&pSplit->mKey, &mKey, sizeof(Aes));
+    AdvanceCounter(numBytes / BlockLen());
+    return pSplit;
+  }
 };
 
 TCryptoHandler Crypto::Create(CryptoHandlers handler)
@@ -13,6 +13,9 @@ namespace SSH
     AES128_CTR
   };
 
+  class ICryptoHandler;
+  using TCryptoHandler = std::shared_ptr<ICryptoHandler>;
+
   class ICryptoHandler
   {
   public:
@@ -22,9 +25,14 @@ namespace SSH
     virtual bool Decrypt(Byte* pBuf, const int bufLen) = 0;
     virtual CryptoHandlers Type() = 0;
     virtual UINT32 BlockLen() = 0;
-  };
 
-  using TCryptoHandler = std::shared_ptr<ICryptoHandler>;
+    /*
+      Hands the next numBytes of the stream to a new handler and skips this one past them,
+      so the two can encrypt independently (and on different threads).
+      Returns nullptr for ciphers which can't seek, the work then has to be done in order.
+    */
+    virtual TCryptoHandler Split(const UINT32 numBytes) { return nullptr; }
+  };
 
   namespace Crypto
   {
@@ -2,6 +2,7 @@
 #define __KEY_H__
 
 #include "ssh.h"
+#include "secure-zero.h"
 
 namespace SSH
 {
@@ -15,8 +16,7 @@ namespace SSH
     ~Key()
     {
       //Ensure the key is nuked from memory.
-      //TODO: Check this is not removed via optimisation
-      std::fill(mData.begin(), mData.end(), 0);
+      SecureZero(mData.data(), mData.size());
     }
 
     const Byte* Data() const { return mData.data(); }
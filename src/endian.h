@@ -1,9 +1,47 @@
 #ifndef __ENDIAN_H__
 #define __ENDIAN_H__
 
-// from http://stackoverflow.com/a/4956493/238609
 #include <climits>
+#include <cstdint>
+#include <cstring>
+
+#ifdef _MSC_VER
+#include <stdlib.h>
+#endif
+
+/*
+  Byte order helpers for the (big endian) wire format.
+  The sized swaps compile down to a single bswap instruction, and the Load/Store
+  functions go through memcpy so packet fields never need to be aligned.
+*/
+inline uint16_t swap_endian16(uint16_t u)
+{
+#ifdef _MSC_VER
+  return _byteswap_ushort(u);
+#else
+  return __builtin_bswap16(u);
+#endif
+}
+
+inline uint32_t swap_endian32(uint32_t u)
+{
+#ifdef _MSC_VER
+  return _byteswap_ulong(u);
+#else
+  return __builtin_bswap32(u);
+#endif
+}
+
+inline uint64_t swap_endian64(uint64_t u)
+{
+#ifdef _MSC_VER
+  return _byteswap_uint64(u);
+#else
+  return __builtin_bswap64(u);
+#endif
+}
 
+// from http://stackoverflow.com/a/4956493/238609
 template <typename T>
 T swap_endian(T u)
 {
@@ -23,4 +61,28 @@ T swap_endian(T u)
     return dest.u;
 }
 
+template <>
+inline uint16_t swap_endian<uint16_t>(uint16_t u) { return swap_endian16(u); }
+
+template <>
+inline uint32_t swap_endian<uint32_t>(uint32_t u) { return swap_endian32(u); }
+
+template <>
+inline uint64_t swap_endian<uint64_t>(uint64_t u) { return swap_endian64(u); }
+
+//Reads a big endian uint32 from a buffer of any alignment
+inline uint32_t LoadBE32(const unsigned char* pBuf)
+{
+  uint32_t value;
+  std::memcpy(&value, pBuf, sizeof(value));
+  return swap_endian32(value);
+}
+
+//Writes a big endian uint32 to a buffer of any alignment
+inline void StoreBE32(unsigned char* pBuf, uint32_t value)
+{
+  value = swap_endian32(value);
+  std::memcpy(pBuf, &value, sizeof(value));
+}
+
 #endif //~__ENDIAN_H__
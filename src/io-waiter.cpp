@@ -0,0 +1,251 @@
+#include "io-waiter.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdint>
+#endif
+
+using namespace SSH;
+
+namespace
+{
+  //Most descriptors picked up by a single epoll_wait, any beyond are left for the next
+  constexpr int sMaxEvents = 64;
+}
+
+IOWaiter::IOWaiter()
+{
+#ifdef __linux__
+  mEpollFD = epoll_create1(EPOLL_CLOEXEC);
+  mWakeFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  //The wake descriptor is the only one without a tag
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr;
+  if (mEpollFD < 0 || mWakeFD < 0 || epoll_ctl(mEpollFD, EPOLL_CTL_ADD, mWakeFD, &event) != 0)
+  {
+    //Fall back to waking through mWakeCond, with nothing watched
+    if (mEpollFD >= 0)
+    {
+      close(mEpollFD);
+    }
+
+    if (mWakeFD >= 0)
+    {
+      close(mWakeFD);
+    }
+
+    mEpollFD = -1;
+    mWakeFD = -1;
+  }
+#endif
+}
+
+IOWaiter::~IOWaiter()
+{
+#ifdef __linux__
+  if (mEpollFD >= 0)
+  {
+    close(mEpollFD);
+    close(mWakeFD);
+  }
+#endif
+}
+
+bool IOWaiter::Watch(int fd, void* pTag, TIOEvents events)
+{
+#ifdef __linux__
+  if (mEpollFD < 0 || fd < 0 || pTag == nullptr)
+  {
+    return false;
+  }
+
+  epoll_event event = {};
+  event.data.ptr = pTag;
+  event.events = ((events & IOEvent::Readable) ? (UINT32)EPOLLIN : 0) |
+                 ((events & IOEvent::Writable) ? (UINT32)EPOLLOUT : 0);
+
+  if (epoll_ctl(mEpollFD, EPOLL_CTL_MOD, fd, &event) == 0)
+  {
+    return true;
+  }
+
+  return (errno == ENOENT && epoll_ctl(mEpollFD, EPOLL_CTL_ADD, fd, &event) == 0);
+#else
+  (void)fd;
+  (void)pTag;
+  (void)events;
+  return false;
+#endif
+}
+
+void IOWaiter::Unwatch(int fd)
+{
+#ifdef __linux__
+  if (mEpollFD >= 0 && fd >= 0)
+  {
+    epoll_event event = {};
+    epoll_ctl(mEpollFD, EPOLL_CTL_DEL, fd, &event);
+  }
+#else
+  (void)fd;
+#endif
+}
+
+void IOWaiter::Wake(void* pTag)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  mWoken.push_back(pTag);
+
+  //The waiting thread checks mWoken before it blocks, so only a thread which may be blocked needs signalling
+  if (mbSignalled || mWaitThread.load() == std::this_thread::get_id())
+  {
+    return;
+  }
+
+  mbSignalled = true;
+
+#ifdef __linux__
+  if (mWakeFD >= 0)
+  {
+    uint64_t one = 1;
+    ssize_t written = write(mWakeFD, &one, sizeof(one));
+    (void)written; //Can only fail once the counter is huge, in which case it is readable anyway
+    return;
+  }
+#endif
+
+  mWakeCond.notify_one();
+}
+
+bool IOWaiter::TakeWoken(std::vector<Ready>& outReady)
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+
+#ifdef __linux__
+  //Reset along with mbSignalled, so a Wake after this always signals again
+  if (mbSignalled && mWakeFD >= 0)
+  {
+    uint64_t count = 0;
+    ssize_t numRead = read(mWakeFD, &count, sizeof(count));
+    (void)numRead;
+  }
+#endif
+
+  mbSignalled = false;
+  if (mWoken.empty())
+  {
+    return false;
+  }
+
+  for (void* pTag : mWoken)
+  {
+    outReady.push_back({ pTag, IOEvent::None });
+  }
+
+  mWoken.clear();
+  return true;
+}
+
+void IOWaiter::Wait(std::optional<TClock::time_point> deadline, std::vector<Ready>& outReady)
+{
+  mWaitThread = std::this_thread::get_id();
+
+#ifdef __linux__
+  if (mEpollFD >= 0)
+  {
+    bool bWoken = false;
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      bWoken = !mWoken.empty();
+    }
+
+    TClock::duration remaining = TClock::duration::zero();
+    if (!bWoken && deadline.has_value())
+    {
+      remaining = std::max(deadline.value() - TClock::now(), TClock::duration::zero());
+    }
+
+    epoll_event events[sMaxEvents];
+    int numEvents = 0;
+    if (!bWoken && deadline.has_value() && remaining > TClock::duration::zero() && remaining < std::chrono::milliseconds(1))
+    {
+      //epoll_wait only counts in milliseconds, so short waits go through ppoll on the epoll descriptor
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+      timespec timeout = { 0, (long)ns };
+      pollfd pollFD = { mEpollFD, POLLIN, 0 };
+      if (ppoll(&pollFD, 1, &timeout, nullptr) > 0)
+      {
+        numEvents = epoll_wait(mEpollFD, events, sMaxEvents, 0);
+      }
+    }
+    else
+    {
+      int timeoutMs = -1;
+      if (bWoken)
+      {
+        timeoutMs = 0;
+      }
+      else if (deadline.has_value())
+      {
+        //Round up, waking early would only mean coming straight back here
+        auto remainingMs = std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+        timeoutMs = (int)std::clamp<long long>(remainingMs, 0, 60 * 1000);
+      }
+
+      do
+      {
+        numEvents = epoll_wait(mEpollFD, events, sMaxEvents, timeoutMs);
+      } while (numEvents < 0 && errno == EINTR);
+    }
+
+    for (int i = 0; i < numEvents; ++i)
+    {
+      if (events[i].data.ptr == nullptr)
+      {
+        //The wake descriptor, picked up by TakeWoken
+        continue;
+      }
+
+      //Errors and hangups are reported as readable, so the next read finds out what happened
+      TIOEvents ready = IOEvent::None;
+      if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+      {
+        ready |= IOEvent::Readable;
+      }
+
+      if (events[i].events & EPOLLOUT)
+      {
+        ready |= IOEvent::Writable;
+      }
+
+      outReady.push_back({ events[i].data.ptr, ready });
+    }
+
+    TakeWoken(outReady);
+    return;
+  }
+#endif
+
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto IsWoken = [this]() { return !mWoken.empty(); };
+    if (deadline.has_value())
+    {
+      mWakeCond.wait_until(lock, deadline.value(), IsWoken);
+    }
+    else
+    {
+      mWakeCond.wait(lock, IsWoken);
+    }
+  }
+
+  TakeWoken(outReady);
+}
@@ -0,0 +1,79 @@
+#ifndef __IO_WAITER_H__
+#define __IO_WAITER_H__
+
+#include "ssh.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace SSH
+{
+  /*
+    Puts an I/O thread to sleep until one of the connections it drives has something to do: a transport's
+    descriptor is ready, another thread has handed a connection work and woken it, or a deadline passes.
+    Each descriptor and wake carries a tag (the connection) so the thread knows which ones to step.
+
+    On Linux this is epoll, with an eventfd for wakes. Elsewhere descriptors can't be watched, so Watch
+    always fails and only wakes and deadlines end a wait.
+  */
+  class IOWaiter
+  {
+  public:
+    using TClock = std::chrono::steady_clock;
+
+    struct Ready
+    {
+      void* mpTag;
+      TIOEvents mEvents; //None when the tag was only woken
+    };
+
+  private:
+    int mEpollFD = -1;
+    int mWakeFD = -1;
+
+    std::mutex mMutex;
+    std::condition_variable mWakeCond; //Only used when there is no mWakeFD
+    std::vector<void*> mWoken;
+    bool mbSignalled = false; //mWakeFD has been written to since the last Wait emptied mWoken
+    std::atomic<std::thread::id> mWaitThread;
+
+    //Moves the woken tags into outReady, returns false if there weren't any
+    bool TakeWoken(std::vector<Ready>& outReady);
+
+  public:
+    IOWaiter();
+    ~IOWaiter();
+
+    IOWaiter(const IOWaiter&) = delete;
+    IOWaiter& operator=(const IOWaiter&) = delete;
+
+    /*
+      Watches fd for events on behalf of pTag, replacing whatever it was watched for before (None keeps it
+      registered but quiet). Level triggered. Returns false if the descriptor can't be watched.
+      Safe to call from any thread, a change made while waiting applies to the wait in progress.
+    */
+    bool Watch(int fd, void* pTag, TIOEvents events);
+    void Unwatch(int fd);
+
+    /*
+      Safe to call from any thread. The current Wait returns (or the next one doesn't block) with pTag
+      reported as ready. Costs nothing more than a lock when called from the waiting thread itself.
+    */
+    void Wake(void* pTag);
+
+    /*
+      Blocks until a watched descriptor is ready, a tag is woken or the deadline passes (never, if there
+      isn't one), then adds whatever is ready to outReady. A tag may appear more than once.
+    */
+    void Wait(std::optional<TClock::time_point> deadline, std::vector<Ready>& outReady);
+  };
+
+  using TIOWaiter = std::shared_ptr<IOWaiter>;
+}
+
+#endif //~__IO_WAITER_H__
@@ -3,6 +3,8 @@
 #include "constants.h"
 #include "mpint.h"
 #include "endian.h"
+#include "messages.h"
+#include "random.h"
 
 //Temporarily include this win10 user settings, otherwise we encounter stack smashing
 #define WOLFCRYPT_ONLY
@@ -23,7 +25,6 @@ class DH_KEXHandler : public SSH::IKEXHandler
 {
   private:
     DhKey mPrivKey;
-    WC_RNG mRNG;
     wc_HashAlg mHash;
     wc_HashType mHashType;
 
@@ -126,8 +127,9 @@ class DH_KEXHandler : public SSH::IKEXHandler
         return false;
       }
 
-      ret = wc_InitRng(&mRNG);
-      if (ret != 0)
+      //Key generation draws from the thread's shared DRBG rather than seeding one per connection
+      WC_RNG* pRNG = Random::ThreadRNG();
+      if (pRNG == nullptr)
       {
         return false;
       }
@@ -143,7 +145,7 @@ class DH_KEXHandler : public SSH::IKEXHandler
       UINT32 xLen = 0;
       UINT32 eLen = 0;
 
-      ret = wc_DhGenerateKeyPair(&mPrivKey, &mRNG,
+      ret = wc_DhGenerateKeyPair(&mPrivKey, pRNG,
                                  mHandshake.x.Data(), &xLen,
                                  mHandshake.e.Data(), &eLen);
       if (ret != 0)
@@ -184,38 +186,22 @@ class DH_KEXHandler : public SSH::IKEXHandler
     {
       mHandshake.e.Pad();
 
-      //Calculate the length of the packet
-      int packetLen = sizeof(Byte) + //MSG_ID
-                      sizeof(UINT32) + //Length
-                      mHandshake.e.Len();
-
-      TPacket pPacket = store.Create(packetLen, PacketType::Write);
-
-      pPacket->Write((Byte)SSH_MSG::KEXDH_INIT);
-      pPacket->Write(mHandshake.e.Data(), mHandshake.e.Len());
-
-      return pPacket;
+      return Messages::KEXDHInit::Create(store, mHandshake.e);
     }
 
     bool VerifyReply(KEXData& server, KEXData& client, TPacket pDHReply) override
     {
-      Byte msgId;
+      //Everything is read as views into the reply packet, which outlives this call
+      ByteView keyCerts;
+      ByteView f;
+      ByteView signature;
 
       //Verify this is a KEX packet
-      pDHReply->Read(msgId);
-      if (msgId != SSH_MSG::KEXDH_REPLY)
+      if (!Messages::KEXDHReply::Parse(*pDHReply, keyCerts, f, signature) || f.mLen > sMAX_KEX_KEY_SIZE)
       {
         return false;
       }
 
-      TByteString keyCerts;
-      MPInt f;
-      TByteString signature;
-
-      pDHReply->Read(keyCerts);
-      pDHReply->Read(f);
-      pDHReply->Read(signature);
-
       //Hash identifiers
       HashBuffer((Byte*)client.mIdent.c_str(), client.mIdent.length());
       HashBuffer((Byte*)server.mIdent.c_str(), server.mIdent.length());
@@ -231,15 +217,15 @@ class DH_KEXHandler : public SSH::IKEXHandler
       DUMP_BUFFER("server_kexInit", server.mKEXInit->Payload(), server.mKEXInit->PayloadLen());
 
       //Hash server's HostKey data (The entire buffer)
-      HashBuffer(keyCerts.data(), keyCerts.size());
+      HashBuffer(keyCerts.mpData, keyCerts.mLen);
 
-      DUMP_BUFFER("keyCerts", keyCerts.data(), keyCerts.size());
+      DUMP_BUFFER("keyCerts", keyCerts.mpData, keyCerts.mLen);
 
       //Hash MPInts e (client's) and f (server's)
       HashBuffer(mHandshake.e.Data(), mHandshake.e.Len());
-      HashBuffer(f.Data(), f.Len());
+      HashBuffer(f.mpData, f.mLen);
 
-      DUMP_BUFFER("f", f.Data(), f.Len());
+      DUMP_BUFFER("f", f.mpData, f.mLen);
 
       //Decode server's host key
       RsaKey key;
@@ -250,34 +236,21 @@ class DH_KEXHandler : public SSH::IKEXHandler
           return false;
         }
 
-        auto iter = keyCerts.begin();
-
-        UINT32 hostKeyTypeLen = 0;
-        hostKeyTypeLen = swap_endian<uint32_t>(*(UINT32*)&(*iter));
-        iter += sizeof(UINT32);
-
-        std::string hostKeyType;
-        hostKeyType.assign((char*)&(*iter), hostKeyTypeLen);
-        iter += hostKeyTypeLen;
-
-        MPInt e;
-        MPInt n;
-
-        UINT32 eLen = 0;
-        eLen = swap_endian<uint32_t>(*(UINT32*)&(*iter));
-        iter += sizeof(UINT32);
+        PacketReader reader(keyCerts);
 
-        e.Init(&(*iter), eLen);
-        iter += eLen;
+        std::string_view hostKeyType;
+        ByteView e;
+        ByteView n;
 
-        UINT32 nLen = 0;
-        nLen = swap_endian<uint32_t>(*(UINT32*)&(*iter));
-        iter += sizeof(UINT32);
-
-        n.Init(&(*iter), nLen);
-        iter += nLen;
+        reader.Read(hostKeyType);
+        reader.Read(e);
+        reader.Read(n);
+        if (reader.Truncated())
+        {
+          return false;
+        }
 
-        ret = wc_RsaPublicKeyDecodeRaw(n.Data(), n.Len(), e.Data(), e.Len(), &key);
+        ret = wc_RsaPublicKeyDecodeRaw(n.mpData, n.mLen, e.mpData, e.mLen, &key);
         if (ret != 0)
         {
           return false;
@@ -287,7 +260,7 @@ class DH_KEXHandler : public SSH::IKEXHandler
       UINT32 kLen = 0;
       int ret = wc_DhAgree( &mPrivKey, mK.Data(), &kLen,
                             mHandshake.x.Data(), mHandshake.x.Len(),
-                            f.Data(), f.Len());
+                            f.mpData, f.mLen);
       if (ret != 0)
       {
         return false;
@@ -317,25 +290,20 @@ class DH_KEXHandler : public SSH::IKEXHandler
 
       //Now we can verify our exchange hash with the server's signature
       {
-        auto iter = signature.begin();
-
-        //Size of signature name
-        UINT32 sigNameLen = 0;
-        sigNameLen = swap_endian<uint32_t>(*(UINT32*)&(*iter));
-        iter += sizeof(UINT32);
-
-        std::string sigName;
-        sigName.assign((char*)&(*iter), sigNameLen);
-        iter += sigNameLen;
+        PacketReader reader(signature);
 
+        std::string_view sigName;
         UINT32 sigLen = 0;
-        sigLen = swap_endian<uint32_t>(*(UINT32*)&(*iter));
-        iter += sizeof(UINT32);
 
-        UINT32 bytesRemaining = signature.end() - iter;
+        reader.Read(sigName);
+        reader.Read(sigLen);
+        if (reader.Truncated())
+        {
+          return false;
+        }
 
         ret = wc_SignatureVerify( mHashType, WC_SIGNATURE_TYPE_RSA_W_ENC,
-                                  mH.Data(), mH.Len(), (Byte*)&(*iter), bytesRemaining,
+                                  mH.Data(), mH.Len(), reader.Current(), reader.Remaining(),
                                   &key, sizeof(key));
         if (ret != 0)
         {
@@ -0,0 +1,226 @@
+#include "ssh.h"
+
+#include <getopt.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+/*
+  Throughput harness: logs in, opens a session channel and pushes a fixed volume of channel data
+  through it as fast as the connection will take it, then reports the rate.
+
+    ssh_harness [-h host] [-p port] [-u user] [-w password] [-m MiB] [-c chunk bytes]
+                [-s SO_SNDBUF] [-r SO_RCVBUF] [-n] [-i] [-v]
+
+  -n turns TCP_NODELAY off, -i uses the io_uring transport and -v logs at debug level.
+*/
+
+struct HarnessOptions
+{
+  std::string mHost = "127.0.0.1";
+  std::string mPort = "22222";
+  std::string mUser = "jill";
+  std::string mPassword = "upthehill"; //Nice and secure
+  size_t mTotalBytes = 64 * 1024 * 1024;
+  int mChunkBytes = 16 * 1024;
+  bool mIOUring = false;
+  bool mVerbose = false;
+  SSH::SocketOptions mSocket;
+};
+
+static bool ParseArgs(int argc, char** argv, HarnessOptions& opts)
+{
+  int opt = 0;
+  while ((opt = getopt(argc, argv, "h:p:u:w:m:c:s:r:niv")) != -1)
+  {
+    switch (opt)
+    {
+      case 'h': opts.mHost = optarg; break;
+      case 'p': opts.mPort = optarg; break;
+      case 'u': opts.mUser = optarg; break;
+      case 'w': opts.mPassword = optarg; break;
+      case 'm': opts.mTotalBytes = (size_t)strtoull(optarg, nullptr, 10) * 1024 * 1024; break;
+      case 'c': opts.mChunkBytes = atoi(optarg); break;
+      case 's': opts.mSocket.mSendBufferSize = atoi(optarg); break;
+      case 'r': opts.mSocket.mRecvBufferSize = atoi(optarg); break;
+      case 'n': opts.mSocket.mNoDelay = false; break;
+      case 'i': opts.mIOUring = true; break;
+      case 'v': opts.mVerbose = true; break;
+      default: return false;
+    }
+  }
+
+  return (opts.mChunkBytes > 0 && opts.mTotalBytes > 0);
+}
+
+int main(int argc, char** argv)
+{
+  HarnessOptions harnessOpts;
+  if (!ParseArgs(argc, argv, harnessOpts))
+  {
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-u user] [-w password] [-m MiB] [-c chunk bytes] [-s sndbuf] [-r rcvbuf] [-n] [-i] [-v]\n", argv[0]);
+    return -1;
+  }
+
+  SSH::Init();
+
+  int sock = SSH::Transport::ConnectTCP(harnessOpts.mHost.c_str(), harnessOpts.mPort.c_str(), harnessOpts.mSocket);
+  if (sock < 0)
+  {
+    fprintf(stderr, "Failed to connect to %s:%s\n", harnessOpts.mHost.c_str(), harnessOpts.mPort.c_str());
+    return -1;
+  }
+
+  SSH::TTransport transport;
+  if (harnessOpts.mIOUring)
+  {
+    transport = SSH::Transport::CreateIOUring(sock);
+    if (transport == nullptr)
+    {
+      fprintf(stderr, "io_uring isn't available, falling back to plain sockets\n");
+    }
+  }
+
+  if (transport == nullptr)
+  {
+    transport = SSH::Transport::CreateSocket(sock, harnessOpts.mSocket);
+  }
+
+  if (transport == nullptr)
+  {
+    fprintf(stderr, "Failed to set up the socket transport\n");
+    close(sock);
+    return -1;
+  }
+
+  SSH::TChannelID channelID = 0;
+  bool bChannelOpen = false;
+  bool bWindowOpen = true; //Cleared when the remote's window cuts a send short
+  size_t recievedBytes = 0;
+
+  SSH::TOnEventFunc onEventFunc = [&](SSH::ChannelEvent event, const SSH::Byte* pBuf, const int bufLen) -> SSH::TResult {
+    switch (event)
+    {
+      case SSH::ChannelEvent::Opened:
+      {
+        bChannelOpen = true;
+        break;
+      }
+
+      case SSH::ChannelEvent::Closed:
+      {
+        printf("Channel closed by the remote\n");
+        bChannelOpen = false;
+        break;
+      }
+
+      case SSH::ChannelEvent::Data:
+      {
+        recievedBytes += bufLen;
+        break;
+      }
+
+      case SSH::ChannelEvent::Writable:
+      {
+        bWindowOpen = true;
+        break;
+      }
+    }
+
+    return {};
+  };
+
+  SSH::ClientOptions opts;
+  opts.mTransport = transport;
+  opts.mRunMode = SSH::RunMode::Manual;
+  opts.mUserName = harnessOpts.mUser;
+  opts.mAuthMethods.push(SSH::UserAuthMethod::Password);
+  opts.mLogLevel = harnessOpts.mVerbose ? SSH::LogLevel::Debug : SSH::LogLevel::Warning;
+  opts.mLogFunc = [](const char* pszLogString) {
+    printf("SSH Client: %s\n", pszLogString);
+  };
+  opts.mOnAuth = [&](SSH::TCtx ctx, SSH::UserAuthMethod method, SSH::Byte* pBuf, const int bufLen) -> SSH::TResult {
+    int len = std::min<int>(bufLen, (int)harnessOpts.mPassword.length());
+    memcpy(pBuf, harnessOpts.mPassword.data(), len);
+    return len;
+  };
+  opts.mOnConnect = [&](SSH::Client* pConnected) {
+    channelID = pConnected->OpenChannel(SSH::ChannelTypes::Session, onEventFunc);
+  };
+
+  SSH::TCtx ctx;
+  SSH::Client client(opts, ctx);
+  client.Connect();
+
+  std::vector<SSH::Byte> chunk(harnessOpts.mChunkBytes, 'x');
+  size_t sentBytes = 0;
+  std::chrono::steady_clock::time_point start;
+  std::chrono::steady_clock::time_point finish;
+  bool bFinished = false;
+
+  SSH::EpollWaiter waiter(transport);
+  SSH::TIOEvents events = SSH::IOEvent::Readable | SSH::IOEvent::Writable;
+  while (client.GetState() != SSH::State::Disconnected)
+  {
+    SSH::ProcessResult result = client.Process(events);
+    bool bBacklogged = (result.mWantEvents & SSH::IOEvent::Writable) != 0;
+
+    if (bChannelOpen && bWindowOpen && sentBytes < harnessOpts.mTotalBytes && !bBacklogged)
+    {
+      if (sentBytes == 0)
+      {
+        start = std::chrono::steady_clock::now();
+      }
+
+      //Only top up once everything queued has reached the socket, so the queue stays shallow
+      for (int i = 0; i < 16 && sentBytes < harnessOpts.mTotalBytes; ++i)
+      {
+        int len = (int)std::min<size_t>(chunk.size(), harnessOpts.mTotalBytes - sentBytes);
+        SSH::TResult taken = client.Send(channelID, chunk.data(), len);
+        sentBytes += taken.value_or(0);
+
+        if (taken.value_or(0) < len)
+        {
+          //Out of window, wait for the remote to adjust it
+          bWindowOpen = false;
+          break;
+        }
+      }
+
+      events = SSH::IOEvent::Readable | SSH::IOEvent::Writable;
+      continue;
+    }
+
+    if (!bFinished && sentBytes == harnessOpts.mTotalBytes && !bBacklogged)
+    {
+      finish = std::chrono::steady_clock::now();
+      bFinished = true;
+      client.Disconnect();
+      break;
+    }
+
+    events = waiter.Wait(result);
+  }
+
+  if (!bFinished)
+  {
+    fprintf(stderr, "Disconnected after sending %zu of %zu bytes\n", sentBytes, harnessOpts.mTotalBytes);
+    close(sock);
+    return -1;
+  }
+
+  double seconds = std::chrono::duration<double>(finish - start).count();
+  double megabytes = (double)sentBytes / (1024.0 * 1024.0);
+  printf("Sent %.1f MiB in %.3f s: %.1f MB/s (%s, %d byte chunks, %zu bytes received)\n",
+    megabytes, seconds, (seconds > 0.0) ? (double)sentBytes / seconds / 1e6 : 0.0,
+    harnessOpts.mIOUring ? "io_uring" : "sockets", harnessOpts.mChunkBytes, recievedBytes);
+
+  SSH::Cleanup();
+  close(sock);
+  return 0;
+}
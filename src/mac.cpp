@@ -107,10 +107,10 @@ public:
 
   virtual bool Verify(const Packet* const pPacket) override
   {
-    TByteString MAC(Len());
-    Create(pPacket, MAC.data());
+    Byte mac[WC_SHA256_DIGEST_SIZE];
+    Create(pPacket, mac);
 
-    return (memcmp(MAC.data(), pPacket->MAC(), Len()) == 0);
+    return (memcmp(mac, pPacket->MAC(), Len()) == 0);
   }
 
   virtual MACHandlers Type() override { return MACHandlers::HMAC_SHA2_256; }
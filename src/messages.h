@@ -0,0 +1,305 @@
+#ifndef __MESSAGES_H__
+#define __MESSAGES_H__
+
+#include "ssh.h"
+#include "constants.h"
+#include "endian.h"
+#include "name-list.h"
+#include "mpint.h"
+#include "packets.h"
+#include "packet-reader.h"
+
+#include <cstring>
+#include <string>
+#include <string_view>
+
+namespace SSH
+{
+  /*
+    Declarative SSH message layouts.
+    Each field type knows its fixed wire size, any extra size required for a given
+    value, and how to write/read itself without further bounds arithmetic.
+    A Message combines these so the fixed part of every message is computed at compile
+    time and the whole message is serialised in a single pass.
+    Parsed variable length fields are views into the packet, so they are only valid
+    for as long as the packet they were read from.
+  */
+  namespace Schema
+  {
+    inline Byte* StoreU32(Byte* pIter, UINT32 value)
+    {
+      StoreBE32(pIter, value);
+      return pIter + sizeof(UINT32);
+    }
+
+    //Writes a uint32 length followed by the data (which may be null when empty)
+    inline Byte* StoreString(Byte* pIter, const void* pData, UINT32 len)
+    {
+      pIter = StoreU32(pIter, len);
+      if (len > 0)
+      {
+        std::memcpy(pIter, pData, len);
+      }
+
+      return pIter + len;
+    }
+
+    struct U8
+    {
+      using TIn = Byte;
+      using TOut = Byte;
+      static constexpr UINT32 sFixedLen = sizeof(Byte);
+
+      static UINT32 DynamicLen(TIn) { return 0; }
+
+      static Byte* Write(Byte* pIter, TIn value)
+      {
+        *pIter = value;
+        return pIter + sizeof(Byte);
+      }
+
+      static bool Read(PacketReader& reader, TOut& outValue) { return reader.Read(outValue); }
+    };
+
+    struct Boolean
+    {
+      using TIn = bool;
+      using TOut = bool;
+      static constexpr UINT32 sFixedLen = sizeof(Byte);
+
+      static UINT32 DynamicLen(TIn) { return 0; }
+
+      static Byte* Write(Byte* pIter, TIn value)
+      {
+        *pIter = value ? 1 : 0;
+        return pIter + sizeof(Byte);
+      }
+
+      static bool Read(PacketReader& reader, TOut& outValue) { return reader.Read(outValue); }
+    };
+
+    struct U32
+    {
+      using TIn = UINT32;
+      using TOut = UINT32;
+      static constexpr UINT32 sFixedLen = sizeof(UINT32);
+
+      static UINT32 DynamicLen(TIn) { return 0; }
+
+      static Byte* Write(Byte* pIter, TIn value)
+      {
+        return StoreU32(pIter, value);
+      }
+
+      static bool Read(PacketReader& reader, TOut& outValue) { return reader.Read(outValue); }
+    };
+
+    //Fixed length run of bytes with no length prefix (E.G. the KEX cookie)
+    template<UINT32 len>
+    struct Fixed
+    {
+      using TIn = const Byte*;
+      using TOut = ByteView;
+      static constexpr UINT32 sFixedLen = len;
+
+      static UINT32 DynamicLen(TIn) { return 0; }
+
+      static Byte* Write(Byte* pIter, TIn pBuf)
+      {
+        std::memcpy(pIter, pBuf, len);
+        return pIter + len;
+      }
+
+      static bool Read(PacketReader& reader, TOut& outValue) { return reader.ReadFixed(len, outValue); }
+    };
+
+    struct Str
+    {
+      using TIn = std::string_view;
+      using TOut = std::string_view;
+      static constexpr UINT32 sFixedLen = sizeof(UINT32);
+
+      static UINT32 DynamicLen(TIn value) { return value.length(); }
+
+      static Byte* Write(Byte* pIter, TIn value)
+      {
+        return StoreString(pIter, value.data(), value.length());
+      }
+
+      static bool Read(PacketReader& reader, TOut& outValue) { return reader.Read(outValue); }
+    };
+
+    //Parsed name-lists refer to the packet rather than owning a copy of their names
+    struct Names
+    {
+      using TIn = NameList;
+      using TOut = NameList;
+      static constexpr UINT32 sFixedLen = sizeof(UINT32);
+
+      static UINT32 DynamicLen(const TIn& value) { return value.Len(); }
+
+      static Byte* Write(Byte* pIter, const TIn& value)
+      {
+        return Str::Write(pIter, value.Str());
+      }
+
+      static bool Read(PacketReader& reader, TOut& outValue)
+      {
+        std::string_view list;
+        if (!reader.Read(list))
+        {
+          return false;
+        }
+
+        outValue.InitView(list);
+        return true;
+      }
+    };
+
+    struct MPI
+    {
+      using TIn = MPInt;
+      using TOut = MPInt;
+      static constexpr UINT32 sFixedLen = sizeof(UINT32);
+
+      static UINT32 DynamicLen(const TIn& value) { return value.Len(); }
+
+      static Byte* Write(Byte* pIter, const TIn& value)
+      {
+        return StoreString(pIter, value.Data(), value.Len());
+      }
+
+      static bool Read(PacketReader& reader, TOut& outValue)
+      {
+        ByteView view;
+        if (!reader.Read(view) || view.mLen > sMAX_KEX_KEY_SIZE)
+        {
+          return false;
+        }
+
+        outValue.Init(view.mpData, view.mLen);
+        return true;
+      }
+    };
+
+    //Length prefixed run of arbitrary bytes
+    struct Blob
+    {
+      using TIn = ByteView;
+      using TOut = ByteView;
+      static constexpr UINT32 sFixedLen = sizeof(UINT32);
+
+      static UINT32 DynamicLen(const TIn& value) { return value.mLen; }
+
+      static Byte* Write(Byte* pIter, const TIn& value)
+      {
+        return StoreString(pIter, value.mpData, value.mLen);
+      }
+
+      static bool Read(PacketReader& reader, TOut& outValue) { return reader.Read(outValue); }
+    };
+
+    template<SSH_MSG msgId, typename... TFields>
+    struct Message
+    {
+      static constexpr SSH_MSG sID = msgId;
+
+      //Size of the message (including the SSH_MSG byte) before any variable length data
+      static constexpr UINT32 sFixedLen = sizeof(Byte) + (0 + ... + TFields::sFixedLen);
+
+      static UINT32 Len(const typename TFields::TIn&... fields)
+      {
+        return sFixedLen + (0 + ... + TFields::DynamicLen(fields));
+      }
+
+      //Creates a write packet sized exactly for this message, with every field written
+      static TPacket Create(PacketStore& store, const typename TFields::TIn&... fields)
+      {
+        UINT32 len = Len(fields...);
+
+        TPacket pPacket = store.Create(len, PacketType::Write);
+        Byte* pIter = pPacket->Claim(len);
+        if (pIter == nullptr)
+        {
+          return nullptr;
+        }
+
+        *pIter++ = (Byte)msgId;
+        ((pIter = TFields::Write(pIter, fields)), ...);
+
+        return pPacket;
+      }
+
+      //Reads every field following the SSH_MSG byte, stopping if the payload is truncated
+      static bool ParseBody(Packet& packet, typename TFields::TOut&... outFields)
+      {
+        PacketReader reader = packet.Reader();
+        if (!(TFields::Read(reader, outFields) && ...))
+        {
+          return false;
+        }
+
+        packet.Advance(reader.Consumed());
+        return true;
+      }
+
+      //Checks the SSH_MSG byte matches this message before reading the rest of the fields
+      static bool Parse(Packet& packet, typename TFields::TOut&... outFields)
+      {
+        Byte readId = SSH_MSG::NONE;
+        packet.Peek(readId);
+        if (readId != msgId)
+        {
+          return false;
+        }
+
+        packet.Advance(sizeof(Byte));
+        return ParseBody(packet, outFields...);
+      }
+    };
+  }
+
+  namespace Messages
+  {
+    using namespace Schema;
+
+    using KEXInit = Message<SSH_MSG::KEXINIT,
+                            Fixed<cKexCookieLength>, //cookie
+                            Names, Names,            //kex_algorithms, server_host_key_algorithms
+                            Names, Names,            //encryption_algorithms (client to server, server to client)
+                            Names, Names,            //mac_algorithms
+                            Names, Names,            //compression_algorithms
+                            Names, Names,            //languages
+                            Boolean,                 //first_kex_packet_follows
+                            U32>;                    //reserved
+    using NewKeys = Message<SSH_MSG::NEWKEYS>;
+    using KEXDHInit = Message<SSH_MSG::KEXDH_INIT, MPI>;
+    //host key and certificates, f (an mpint, left unparsed), signature of H
+    using KEXDHReply = Message<SSH_MSG::KEXDH_REPLY, Blob, Blob, Blob>;
+
+    using ServiceRequest = Message<SSH_MSG::SERVICE_REQUEST, Str>;
+    using ServiceAccept = Message<SSH_MSG::SERVICE_ACCEPT, Str>;
+
+    //user name, service name, method name (and then any method specific fields)
+    using UserAuthNone = Message<SSH_MSG::USERAUTH_REQUEST, Str, Str, Str>;
+    using UserAuthPassword = Message<SSH_MSG::USERAUTH_REQUEST, Str, Str, Str, Boolean, Blob>;
+    using UserAuthFailure = Message<SSH_MSG::USERAUTH_FAILURE, Names, Boolean>;
+    using UserAuthBanner = Message<SSH_MSG::USERAUTH_BANNER, Str, Str>;
+
+    //request name, want reply (and then any request specific fields)
+    using GlobalRequest = Message<SSH_MSG::GLOBAL_REQUEST, Str, Boolean>;
+
+    //channel type, sender channel, initial window size, maximum packet size
+    using ChannelOpen = Message<SSH_MSG::CHANNEL_OPEN, Str, U32, U32, U32>;
+    using ChannelData = Message<SSH_MSG::CHANNEL_DATA, U32, Blob>;
+    //recipient channel, bytes to add
+    using ChannelWindowAdjust = Message<SSH_MSG::CHANNEL_WINDOW_ADJUST, U32, U32>;
+    //recipient channel
+    using ChannelClose = Message<SSH_MSG::CHANNEL_CLOSE, U32>;
+
+    static_assert(KEXInit::sFixedLen == 1 + cKexCookieLength + (10 * 4) + 1 + 4, "Unexpected KEXINIT size");
+    static_assert(ChannelOpen::sFixedLen == 1 + (4 * 4), "Unexpected CHANNEL_OPEN size");
+  }
+}
+
+#endif //~__MESSAGES_H__
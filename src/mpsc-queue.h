@@ -0,0 +1,129 @@
+#ifndef __MPSC_QUEUE_H__
+#define __MPSC_QUEUE_H__
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace SSH
+{
+  /*
+    Bounded lock-free queue for many producer threads and a single consumer.
+    Each cell carries a sequence number saying whether it is free to write or ready
+    to read, so producers only contend on a single atomic increment and the consumer
+    never blocks them. The capacity is rounded up to a power of two.
+    Pushes from the same thread are always popped in the order they were made.
+  */
+  template<typename T>
+  class MPSCQueue
+  {
+  private:
+    static constexpr size_t sCacheLine = 64;
+
+    struct Cell
+    {
+      std::atomic<size_t> mSequence;
+      T mData;
+    };
+
+    std::unique_ptr<Cell[]> mpCells;
+    size_t mMask;
+
+    //Kept apart so producers and the consumer don't share a cache line
+    alignas(sCacheLine) std::atomic<size_t> mEnqueuePos;
+    alignas(sCacheLine) size_t mDequeuePos;
+
+    static size_t RoundUp(size_t capacity)
+    {
+      size_t rounded = 2;
+      while (rounded < capacity)
+      {
+        rounded <<= 1;
+      }
+
+      return rounded;
+    }
+
+  public:
+    explicit MPSCQueue(size_t capacity)
+      : mpCells(std::make_unique<Cell[]>(RoundUp(capacity)))
+      , mMask(RoundUp(capacity) - 1)
+      , mEnqueuePos(0)
+      , mDequeuePos(0)
+    {
+      for (size_t i = 0; i <= mMask; ++i)
+      {
+        mpCells[i].mSequence.store(i, std::memory_order_relaxed);
+      }
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    size_t Capacity() const { return mMask + 1; }
+
+    //May be called from any thread, returns false if the queue is full
+    bool TryPush(const T& data)
+    {
+      Cell* pCell = nullptr;
+      size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+
+      while (true)
+      {
+        pCell = &mpCells[pos & mMask];
+        size_t sequence = pCell->mSequence.load(std::memory_order_acquire);
+        intptr_t diff = (intptr_t)sequence - (intptr_t)pos;
+
+        if (diff == 0)
+        {
+          //Cell is free, try to claim it
+          if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+          {
+            break;
+          }
+        }
+        else if (diff < 0)
+        {
+          //The consumer has not freed this cell yet
+          return false;
+        }
+        else
+        {
+          //Another producer claimed it first
+          pos = mEnqueuePos.load(std::memory_order_relaxed);
+        }
+      }
+
+      pCell->mData = data;
+      pCell->mSequence.store(pos + 1, std::memory_order_release);
+      return true;
+    }
+
+    //Consumer only, returns false if there is nothing ready to pop
+    bool TryPop(T& outData)
+    {
+      Cell& cell = mpCells[mDequeuePos & mMask];
+      size_t sequence = cell.mSequence.load(std::memory_order_acquire);
+      if (sequence != mDequeuePos + 1)
+      {
+        return false;
+      }
+
+      outData = std::move(cell.mData);
+      cell.mData = T();
+      cell.mSequence.store(mDequeuePos + mMask + 1, std::memory_order_release);
+      mDequeuePos++;
+      return true;
+    }
+
+    //Consumer only
+    bool Empty() const
+    {
+      const Cell& cell = mpCells[mDequeuePos & mMask];
+      return (cell.mSequence.load(std::memory_order_acquire) != mDequeuePos + 1);
+    }
+  };
+}
+
+#endif //~__MPSC_QUEUE_H__
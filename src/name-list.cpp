@@ -4,13 +4,43 @@
 using namespace SSH;
 
 NameList::NameList()
-  : mList("")
-  , mNumNames(0)
+  : mNumNames(0)
 {}
 
+NameList::NameList(const NameList& other)
+  : mStorage(other.mStorage)
+  , mList(other.mbView ? other.mList : mStorage)
+  , mNumNames(other.mNumNames)
+  , mbView(other.mbView)
+{}
+
+NameList& NameList::operator=(const NameList& other)
+{
+  mStorage = other.mStorage;
+  mList = other.mbView ? other.mList : mStorage;
+  mNumNames = other.mNumNames;
+  mbView = other.mbView;
+  return *this;
+}
+
 void NameList::Init(const Byte* pBuf, const int numBytes)
 {
-  mList.assign((char*)pBuf, numBytes);
+  mStorage.assign((char*)pBuf, numBytes);
+  mList = mStorage;
+  mbView = false;
+  CountNames();
+}
+
+void NameList::InitView(std::string_view list)
+{
+  mStorage.clear();
+  mList = list;
+  mbView = true;
+  CountNames();
+}
+
+void NameList::CountNames()
+{
   if (!mList.empty())
   {
     mNumNames = std::count(mList.begin(), mList.end(), ',') + 1;
@@ -29,12 +59,19 @@ NameList& NameList::operator+= (std::string newName)
 
 void NameList::Add(std::string newName)
 {
+  if (mbView)
+  {
+    mStorage.assign(mList);
+    mbView = false;
+  }
+
   if (mNumNames > 0)
   {
-    mList += ',';
+    mStorage += ',';
   }
 
-  mList += newName;
+  mStorage += newName;
+  mList = mStorage;
   mNumNames++;
 }
 
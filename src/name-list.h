@@ -10,23 +10,37 @@ namespace SSH
   class NameList
   {
   private:
-    std::string mList;
+    std::string mStorage; //Only used when the list owns its names
+    std::string_view mList;
     int mNumNames;
+    bool mbView = false;
+
+    void CountNames();
 
   public:
     NameList();
 
+    NameList(const NameList& other);
+    NameList& operator=(const NameList& other);
+
+    //Copies the names out of pBuf
     void Init(const Byte *pBuf, const int numBytes);
 
+    /*
+      Refers to the names in place without copying them.
+      The list is only valid for as long as the underlying buffer is, adding to it
+      will take a copy first.
+    */
+    void InitView(std::string_view list);
+
     NameList& operator+= (std::string newName);
     void Add(std::string newName);
 
     std::string_view operator[] (const int n);
     std::string_view Get (const int n);
 
-    std::string Str() { return mList; }
-    const std::string Str() const { return mList; }
-    
+    std::string_view Str() const { return mList; }
+
     size_t Len() const { return mList.length(); }
   };
 
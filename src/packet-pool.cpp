@@ -0,0 +1,241 @@
+#include "packet-pool.h"
+#include "packets.h"
+
+#include <new>
+
+using namespace SSH;
+
+/*
+  The control block is destroyed before its memory is deallocated, so deallocate is the first
+  point at which nothing refers to the packet any more, and that is where it is recycled.
+*/
+template<typename T>
+class PacketPool::ControlBlockAllocator
+{
+public:
+  using value_type = T;
+
+  PacketPool* mpPool;
+  Packet* mpPacket;
+
+  ControlBlockAllocator(PacketPool* pPool, Packet* pPacket)
+    : mpPool(pPool)
+    , mpPacket(pPacket)
+  {}
+
+  template<typename U>
+  ControlBlockAllocator(const ControlBlockAllocator<U>& other)
+    : mpPool(other.mpPool)
+    , mpPacket(other.mpPacket)
+  {}
+
+  T* allocate(size_t n)
+  {
+    static_assert(sizeof(T) <= sControlBlockLen, "Control block does not fit in a packet");
+    static_assert(alignof(T) <= alignof(std::max_align_t), "Control block is over aligned");
+
+    if (n != 1)
+    {
+      throw std::bad_alloc();
+    }
+
+    return reinterpret_cast<T*>(mpPacket->mControlBlock);
+  }
+
+  void deallocate(T*, size_t)
+  {
+    mpPool->Release(mpPacket);
+  }
+
+  template<typename U>
+  bool operator==(const ControlBlockAllocator<U>& other) const { return (mpPacket == other.mpPacket); }
+
+  template<typename U>
+  bool operator!=(const ControlBlockAllocator<U>& other) const { return (mpPacket != other.mpPacket); }
+};
+
+int PacketPool::SizeClass(UINT32 bufLen)
+{
+  int sizeClass = 0;
+  while (ClassSize(sizeClass) < bufLen)
+  {
+    if (++sizeClass == sNumClasses)
+    {
+      return -1;
+    }
+  }
+
+  return sizeClass;
+}
+
+UINT32 PacketPool::ClassSize(int sizeClass)
+{
+  return 1u << (sMinClassShift + sizeClass);
+}
+
+Byte* PacketPool::AllocateBuffer(UINT32 bufLen)
+{
+  return static_cast<Byte*>(::operator new[](bufLen, std::align_val_t(sBufferAlignment)));
+}
+
+void PacketPool::FreeBuffer(Byte* pBuf)
+{
+  ::operator delete[](pBuf, std::align_val_t(sBufferAlignment));
+}
+
+PacketPool::PacketPool(UINT32 maxCachedPerClass)
+  : mMaxCachedPerClass(maxCachedPerClass)
+{
+  for (TFreeList& freeList : mFreeLists)
+  {
+    freeList.reserve(maxCachedPerClass);
+  }
+
+  mViewFreeList.reserve(maxCachedPerClass);
+}
+
+PacketPool::~PacketPool()
+{
+  for (TFreeList& freeList : mFreeLists)
+  {
+    for (Packet* pPacket : freeList)
+    {
+      delete pPacket;
+    }
+  }
+
+  for (Packet* pPacket : mViewFreeList)
+  {
+    delete pPacket;
+  }
+}
+
+TPacket PacketPool::Acquire(UINT32 bufLen)
+{
+  int sizeClass = SizeClass(bufLen);
+  Packet* pPacket = nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (sizeClass >= 0 && !mFreeLists[sizeClass].empty())
+    {
+      pPacket = mFreeLists[sizeClass].back();
+      mFreeLists[sizeClass].pop_back();
+      mStats.mHits++;
+    }
+    else
+    {
+      mStats.mMisses++;
+    }
+
+    Checkout();
+  }
+
+  if (pPacket == nullptr)
+  {
+    //Oversized packets get an exact buffer and are never cached
+    UINT32 capacity = (sizeClass >= 0) ? ClassSize(sizeClass) : bufLen;
+    pPacket = new Packet(Packet::Token{});
+    pPacket->mpBuf = AllocateBuffer(capacity);
+    pPacket->mBufCapacity = capacity;
+  }
+
+  return Wrap(pPacket);
+}
+
+TPacket PacketPool::AcquireView()
+{
+  Packet* pPacket = nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!mViewFreeList.empty())
+    {
+      pPacket = mViewFreeList.back();
+      mViewFreeList.pop_back();
+      mStats.mHits++;
+    }
+    else
+    {
+      mStats.mMisses++;
+    }
+
+    Checkout();
+  }
+
+  if (pPacket == nullptr)
+  {
+    pPacket = new Packet(Packet::Token{});
+  }
+
+  return Wrap(pPacket);
+}
+
+void PacketPool::Checkout()
+{
+  //Packets may outlive every store using the pool, so it keeps itself alive until they are all back
+  if (mNumOutstanding++ == 0)
+  {
+    mpSelf = shared_from_this();
+  }
+}
+
+TPacket PacketPool::Wrap(Packet* pPacket)
+{
+  //Recycling is left to the allocator, so the deleter has nothing to do
+  return TPacket(pPacket, [](Packet*) {}, ControlBlockAllocator<Packet>(this, pPacket));
+}
+
+void PacketPool::Release(Packet* pPacket)
+{
+  pPacket->Recycle();
+
+  //Dropped once the lock has been, as it may be the last reference to the pool
+  TPacketPool pSelf;
+  bool bCached = false;
+
+  int sizeClass = SizeClass(pPacket->mBufCapacity);
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (pPacket->mBufCapacity == 0)
+    {
+      bCached = (mViewFreeList.size() < mMaxCachedPerClass);
+      if (bCached)
+      {
+        mViewFreeList.push_back(pPacket);
+      }
+    }
+    else if (sizeClass >= 0 &&
+        ClassSize(sizeClass) == pPacket->mBufCapacity &&
+        mFreeLists[sizeClass].size() < mMaxCachedPerClass)
+    {
+      bCached = true;
+      mFreeLists[sizeClass].push_back(pPacket);
+    }
+
+    if (bCached)
+    {
+      mStats.mReleases++;
+    }
+    else
+    {
+      mStats.mDiscards++;
+    }
+
+    if (--mNumOutstanding == 0)
+    {
+      pSelf = std::move(mpSelf);
+    }
+  }
+
+  if (!bCached)
+  {
+    delete pPacket;
+  }
+}
+
+PacketPoolStats PacketPool::Stats() const
+{
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mStats;
+}
@@ -0,0 +1,85 @@
+#ifndef __PACKET_POOL_H__
+#define __PACKET_POOL_H__
+
+#include "ssh.h"
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+namespace SSH
+{
+  class Packet;
+  using TPacket = std::shared_ptr<Packet>;
+
+  /*
+    Recycles packets (and their buffers) for one or more PacketStores.
+    Buffers are grouped into power-of-two size classes and are always aligned to
+    a cache line. A packet is handed back to its free list automatically once the
+    last TPacket referencing it is dropped.
+
+    Each packet carries the space for its own shared_ptr control block, so handing
+    out a recycled packet allocates nothing. The pool keeps itself alive while any
+    of its packets are out, so they may outlive every PacketStore using it.
+  */
+  class PacketPool : public std::enable_shared_from_this<PacketPool>
+  {
+  public:
+    static constexpr size_t sBufferAlignment = 64;
+
+    //Space each packet sets aside for the control block of the TPacket wrapping it
+    static constexpr size_t sControlBlockLen = 64;
+
+  private:
+    static constexpr int sMinClassShift = 6;  //64 bytes
+    static constexpr int sMaxClassShift = 18; //256 KiB
+    static constexpr int sNumClasses = (sMaxClassShift - sMinClassShift) + 1;
+
+    using TFreeList = std::vector<Packet*>;
+
+    std::array<TFreeList, sNumClasses> mFreeLists;
+    TFreeList mViewFreeList; //Packets without a buffer of their own
+    UINT32 mMaxCachedPerClass;
+    PacketPoolStats mStats;
+    mutable std::mutex mMutex;
+
+    size_t mNumOutstanding = 0; //Packets handed out and not yet released
+    std::shared_ptr<PacketPool> mpSelf; //Set while mNumOutstanding is above 0
+
+    //Gives shared_ptr the control block space inside a packet, and recycles the packet once it is done with it
+    template<typename T>
+    class ControlBlockAllocator;
+
+    //Returns -1 when the requested size is too large to be pooled
+    static int SizeClass(UINT32 bufLen);
+    static UINT32 ClassSize(int sizeClass);
+
+    //Counts the packet as handed out, expects mMutex to be held
+    void Checkout();
+
+    TPacket Wrap(Packet* pPacket);
+    void Release(Packet* pPacket);
+
+  public:
+    explicit PacketPool(UINT32 maxCachedPerClass);
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    //Returns a packet whose buffer can hold at least bufLen bytes
+    TPacket Acquire(UINT32 bufLen);
+
+    //Returns a packet with no buffer, for wrapping memory owned by something else
+    TPacket AcquireView();
+
+    PacketPoolStats Stats() const;
+
+    static Byte* AllocateBuffer(UINT32 bufLen);
+    static void FreeBuffer(Byte* pBuf);
+  };
+
+  using TPacketPool = std::shared_ptr<PacketPool>;
+}
+
+#endif //~__PACKET_POOL_H__
@@ -0,0 +1,157 @@
+#ifndef __PACKET_READER_H__
+#define __PACKET_READER_H__
+
+#include "ssh.h"
+#include "endian.h"
+
+#include <string_view>
+
+namespace SSH
+{
+  //Non-owning pointer/length pair for raw byte fields
+  struct ByteView
+  {
+    const Byte* mpData = nullptr;
+    UINT32 mLen = 0;
+
+    std::string_view Str() const { return std::string_view((const char*)mpData, mLen); }
+  };
+
+  /*
+    Bounds checked reader over a range of bytes (normally a packet's payload).
+    Variable length fields are returned as views into the underlying buffer rather
+    than copies, so they are only valid for as long as that buffer is.
+    Once a read would run past the end of the range the reader is marked as truncated,
+    and every following read fails without touching its output.
+  */
+  class PacketReader
+  {
+  private:
+    const Byte* mpBegin;
+    const Byte* mpIter;
+    const Byte* mpEnd;
+    bool mTruncated = false;
+
+    bool Has(const UINT32 numBytes)
+    {
+      if (mTruncated || (UINT32)(mpEnd - mpIter) < numBytes)
+      {
+        mTruncated = true;
+        return false;
+      }
+
+      return true;
+    }
+
+  public:
+    PacketReader(const Byte* pBuf, const UINT32 bufLen)
+      : mpBegin(pBuf)
+      , mpIter(pBuf)
+      , mpEnd(pBuf + bufLen)
+    {}
+
+    explicit PacketReader(const ByteView& view)
+      : PacketReader(view.mpData, view.mLen)
+    {}
+
+    //True once any read has failed due to a lack of data
+    bool Truncated() const { return mTruncated; }
+
+    UINT32 Remaining() const { return (UINT32)(mpEnd - mpIter); }
+    UINT32 Consumed() const { return (UINT32)(mpIter - mpBegin); }
+    const Byte* Current() const { return mpIter; }
+
+    bool Read(Byte& outData)
+    {
+      if (!Has(sizeof(Byte)))
+      {
+        return false;
+      }
+
+      outData = *mpIter++;
+      return true;
+    }
+
+    bool Read(bool& outData)
+    {
+      if (!Has(sizeof(Byte)))
+      {
+        return false;
+      }
+
+      outData = (*mpIter++ != 0);
+      return true;
+    }
+
+    bool Read(UINT32& outData)
+    {
+      if (!Has(sizeof(UINT32)))
+      {
+        return false;
+      }
+
+      outData = LoadBE32(mpIter);
+      mpIter += sizeof(UINT32);
+      return true;
+    }
+
+    //Reads a length prefixed string (also used for name-lists, mpints and raw blobs)
+    bool Read(ByteView& outData)
+    {
+      if (!Has(sizeof(UINT32)))
+      {
+        return false;
+      }
+
+      UINT32 len = LoadBE32(mpIter);
+      if ((UINT32)(mpEnd - mpIter) - sizeof(UINT32) < len)
+      {
+        mTruncated = true;
+        return false;
+      }
+
+      mpIter += sizeof(UINT32);
+      outData = { mpIter, len };
+      mpIter += len;
+      return true;
+    }
+
+    bool Read(std::string_view& outData)
+    {
+      ByteView view;
+      if (!Read(view))
+      {
+        return false;
+      }
+
+      outData = view.Str();
+      return true;
+    }
+
+    //Reads a run of bytes that has no length prefix
+    bool ReadFixed(const UINT32 numBytes, ByteView& outData)
+    {
+      if (!Has(numBytes))
+      {
+        return false;
+      }
+
+      outData = { mpIter, numBytes };
+      mpIter += numBytes;
+      return true;
+    }
+
+    bool Skip(const UINT32 numBytes)
+    {
+      if (!Has(numBytes))
+      {
+        return false;
+      }
+
+      mpIter += numBytes;
+      return true;
+    }
+  };
+}
+
+#endif //~__PACKET_READER_H__
@@ -1,6 +1,7 @@
 #include "packets.h"
 #include "crypto/crypto.h"
 #include "endian.h"
+#include "random.h"
 
 #include <array>
 #include <map>
@@ -16,9 +17,44 @@ constexpr static int minPaddingSize = 4; //RFC states there should be a minimum
 
 Packet::Packet(Token t) {}
 
+Packet::~Packet()
+{
+  if (mBufCapacity > 0)
+  {
+    PacketPool::FreeBuffer(mpBuf);
+  }
+}
+
+void Packet::Recycle()
+{
+  if (mBufCapacity == 0)
+  {
+    //Views never own the memory they point at
+    mpBuf = nullptr;
+    mpOwner.reset();
+  }
+
+  mIter = mpBuf;
+  mPacketLen = 0;
+  mTotalPacketLen = 0;
+  mPayloadLen = 0;
+  mPaddingLen = 0;
+  mSequenceNumber = 0;
+
+  //Drop our handler references so they don't outlive the connection that set them
+  mpCrypto = nullptr;
+  mpMAC = nullptr;
+  mCryptoRef.reset();
+  mMACRef.reset();
+
+  mEncrypted = false;
+  mComplete = false;
+  mInFlight = false;
+}
+
 const Byte* const Packet::Payload() const
 {
-  return &mPacket[payloadOffset + sizeof(Byte)];
+  return mpBuf + payloadOffset + sizeof(Byte);
 }
 
 int Packet::PayloadLen() const
@@ -28,7 +64,7 @@ int Packet::PayloadLen() const
 
 const Byte* const Packet::Begin() const
 {
-  return mPacket.data();
+  return mpBuf;
 }
 
 int Packet::PacketLen() const
@@ -38,7 +74,7 @@ int Packet::PacketLen() const
 
 const Byte* const Packet::MAC() const
 {
-  return &mPacket[mPacketLen + sizeof(UINT32)];
+  return mpBuf + mPacketLen + sizeof(UINT32);
 }
 
 Byte* Packet::MAC_Unsafe()
@@ -52,29 +88,13 @@ Byte* Packet::MAC_Unsafe()
 
 UINT32 Packet::Remaining() const
 {
-  return mTotalPacketLen - (mIter - mPacket.begin());
+  return mTotalPacketLen - (mIter - mpBuf);
 }
 
 void Packet::Reset()
 {
-  mIter = mPacket.begin();
-  std::fill(mIter, mPacket.end(), 0x00);
-}
-
-int Packet::Consume(const Byte* pBuf, const int numBytes)
-{
-  //Get the number of bytes needed by this packet
-  int bytesLeft = Remaining();
-  if (bytesLeft == 0)
-  {
-    return 0;
-  }
-
-  int bytesToConsume = std::min(bytesLeft, numBytes);
-  std::memcpy(&(*mIter), pBuf, bytesToConsume);
-  mIter += bytesToConsume;
-
-  return bytesToConsume;
+  mIter = mpBuf;
+  std::fill(mpBuf, mpBuf + mTotalPacketLen, 0x00);
 }
 
 int Packet::Write(const Byte data)
@@ -101,8 +121,7 @@ int Packet::Write(const int data)
 
 int Packet::Write(const UINT32 data)
 {
-  UINT32* pIter = (UINT32*)&(*mIter);
-  *pIter = swap_endian<uint32_t>(data);
+  StoreBE32(mIter, data);
   mIter += sizeof(UINT32);
   return sizeof(UINT32);
 }
@@ -111,14 +130,15 @@ int Packet::Write(const std::string data)
 {
   UINT32 len = data.length();
   Write(len);
-  std::memcpy(&(*mIter), data.data(), len);
+  std::memcpy(mIter, data.data(), len);
   mIter += len;
   return len + sizeof(UINT32);
 }
 
-int Packet::Write(const NameList data)
+int Packet::Write(const NameList& data)
 {
-  return Write(data.Str());
+  std::string_view list = data.Str();
+  return Write((const Byte*)list.data(), (int)list.length());
 }
 
 int Packet::Write(const MPInt data)
@@ -126,7 +146,7 @@ int Packet::Write(const MPInt data)
   UINT32 len = data.Len();
   Write(len);
 
-  std::memcpy(&(*mIter), data.Data(), len);
+  std::memcpy(mIter, data.Data(), len);
   mIter += len;
   return len + sizeof(UINT32);
 }
@@ -138,29 +158,49 @@ int Packet::Write(const Byte* pBuf, const int numBytes, const WriteMethod method
     Write(numBytes);
   }
 
-  std::memcpy(&(*mIter), pBuf, numBytes);
+  std::memcpy(mIter, pBuf, numBytes);
   mIter += numBytes;
   return numBytes + sizeof(UINT32);
 }
 
+PacketReader Packet::Reader() const
+{
+  const Byte* pPayloadEnd = mpBuf + payloadOffset + sizeof(Byte) + mPayloadLen;
+  UINT32 len = (mIter < pPayloadEnd) ? (UINT32)(pPayloadEnd - mIter) : 0;
+  return PacketReader(mIter, len);
+}
+
 int Packet::Read(Byte& outData)
 {
-  outData = *mIter;
+  PacketReader reader = Reader();
+  if (!reader.Read(outData))
+  {
+    return -1;
+  }
+
   mIter += sizeof(Byte);
   return sizeof(Byte);
 }
 
 int Packet::Read(bool& outData)
 {
-  outData = *mIter;
+  PacketReader reader = Reader();
+  if (!reader.Read(outData))
+  {
+    return -1;
+  }
+
   mIter += sizeof(Byte);
   return sizeof(Byte);
 }
 
 int Packet::Read(UINT32& outData)
 {
-  UINT32* pIter = (UINT32*)&(*mIter);
-  outData = swap_endian<uint32_t>(*pIter);
+  PacketReader reader = Reader();
+  if (!reader.Read(outData))
+  {
+    return -1;
+  }
 
   mIter += sizeof(UINT32);
   return sizeof(UINT32);
@@ -168,67 +208,92 @@ int Packet::Read(UINT32& outData)
 
 int Packet::Read(std::string& outData)
 {
-  UINT32 stringLen = 0;
-  Read(stringLen);
+  PacketReader reader = Reader();
+  std::string_view view;
+  if (!reader.Read(view))
+  {
+    return -1;
+  }
 
-  outData.assign((char*)&(*mIter), stringLen);
-  mIter += stringLen;
-  return stringLen + sizeof(UINT32);
+  outData.assign(view);
+  mIter += reader.Consumed();
+  return reader.Consumed();
 }
 
 int Packet::Read(NameList& outData)
 {
-  UINT32 namelistLen = 0;
-  Read(namelistLen);
+  PacketReader reader = Reader();
+  ByteView view;
+  if (!reader.Read(view))
+  {
+    return -1;
+  }
 
-  outData.Init(&(*mIter), namelistLen);
-  mIter += namelistLen;
-  return namelistLen + sizeof(UINT32);
+  outData.Init(view.mpData, view.mLen);
+  mIter += reader.Consumed();
+  return reader.Consumed();
 }
 
 int Packet::Read(MPInt& outData)
 {
-  UINT32 intLen = 0;
-  Read(intLen);
-
-  outData.Init(&(*mIter), intLen);
+  PacketReader reader = Reader();
+  ByteView view;
+  if (!reader.Read(view) || view.mLen > sMAX_KEX_KEY_SIZE)
+  {
+    return -1;
+  }
 
-  mIter += intLen;
-  return intLen + sizeof(UINT32);
+  outData.Init(view.mpData, view.mLen);
+  mIter += reader.Consumed();
+  return reader.Consumed();
 }
 
 int Packet::Read(Byte* pOutBuf, int bytesToRead)
 {
-  if (Remaining() < bytesToRead)
+  PacketReader reader = Reader();
+  ByteView view;
+  if (bytesToRead < 0 || !reader.ReadFixed(bytesToRead, view))
   {
     return -1;
   }
 
-  memcpy(pOutBuf, &(*mIter), bytesToRead);
+  memcpy(pOutBuf, view.mpData, bytesToRead);
   mIter += bytesToRead;
   return bytesToRead;
 }
 
 int Packet::Read(TByteString& outData)
 {
-  UINT32 len = 0;
-  Read(len);
-  outData.resize(len);
-  return Read(outData.data(), len) + sizeof(UINT32);
+  PacketReader reader = Reader();
+  ByteView view;
+  if (!reader.Read(view))
+  {
+    return -1;
+  }
+
+  outData.assign(view.mpData, view.mpData + view.mLen);
+  mIter += reader.Consumed();
+  return reader.Consumed();
 }
 
 void Packet::Peek(Byte& outData)
 {
-  outData = *mIter;
+  PacketReader reader = Reader();
+  reader.Read(outData);
 }
 
 UINT32 Packet::GetLength(const Byte* pBuf)
 {
-  uint32_t nLen = *((uint32_t*)pBuf);
-  return swap_endian<uint32_t>(nLen);
+  return LoadBE32(pBuf);
 }
 
 void Packet::PrepareWrite(const UINT32 seqNumber)
+{
+  StartWrite(seqNumber);
+  FinishWrite();
+}
+
+void Packet::StartWrite(const UINT32 seqNumber)
 {
   if (mType != PacketType::Write)
   {
@@ -242,19 +307,36 @@ void Packet::PrepareWrite(const UINT32 seqNumber)
     return;
   }
 
-  //TODO: Write random bytes into the padding string
-  std::fill(mIter, mIter+mPaddingLen, 0xAD);
+  if (!Random::Fill(mIter, mPaddingLen))
+  {
+    //This should probably raise an error
+    std::fill(mIter, mIter+mPaddingLen, 0);
+  }
+
   mSequenceNumber = seqNumber;
-  mIter = mPacket.begin();
+  mIter = mpBuf;
+}
+
+void Packet::FinishWrite(ICryptoHandler* pCrypto)
+{
+  if (mType != PacketType::Write || mComplete)
+  {
+    return;
+  }
+
+  if (pCrypto == nullptr)
+  {
+    pCrypto = mpCrypto;
+  }
 
   //Write the MAC
-  if (mMAC->Type() != MACHandlers::None)
+  if (mpMAC->Type() != MACHandlers::None)
   {
-    mMAC->Create(this, MAC_Unsafe());
+    mpMAC->Create(this, MAC_Unsafe());
   }
 
   //Encrypt everything in the packet going out, apart from the MAC
-  if (!mEncrypted && mCrypto->Encrypt(mPacket.data(), mPacketLen + sizeof(UINT32)))
+  if (!mEncrypted && pCrypto->Encrypt(mpBuf, mPacketLen + sizeof(UINT32)))
   {
     mEncrypted = true;
   }
@@ -262,6 +344,16 @@ void Packet::PrepareWrite(const UINT32 seqNumber)
   mComplete = true;
 }
 
+TCryptoHandler Packet::SplitCipher()
+{
+  if (mType != PacketType::Write || mComplete || mEncrypted)
+  {
+    return nullptr;
+  }
+
+  return mpCrypto->Split(mPacketLen + sizeof(UINT32));
+}
+
 bool Packet::PrepareRead()
 {
   if (mType != PacketType::Read)
@@ -274,16 +366,16 @@ bool Packet::PrepareRead()
     return false;
   }
 
-  mIter = mPacket.begin() + payloadOffset + sizeof(Byte);
+  mIter = mpBuf + payloadOffset + sizeof(Byte);
 
   if (mEncrypted)
   {
     /*
       We already decrypted the first block of data so we shouldn't need to re-decrypt it.
     */
-    UINT32 blockLen = mCrypto->BlockLen();
+    UINT32 blockLen = mpCrypto->BlockLen();
     UINT32 bytesToDecrypt = (mPacketLen + sizeof(UINT32)) - blockLen;
-    if (mCrypto->Decrypt(mPacket.data() + blockLen, bytesToDecrypt))
+    if (mpCrypto->Decrypt(mpBuf + blockLen, bytesToDecrypt))
     {
       mEncrypted = false;
     }
@@ -294,7 +386,7 @@ bool Packet::PrepareRead()
     }
   }
 
-  if (!mMAC->Verify(this))
+  if (!mpMAC->Verify(this))
   {
     //This should probably raise an error
     return false;
@@ -304,14 +396,30 @@ bool Packet::PrepareRead()
   return true;
 }
 
-int Packet::Send(TSendFunc sendFunc)
+Byte* Packet::Claim(const UINT32 numBytes)
 {
-  auto bytesSent = sendFunc(&(*mIter), Remaining());
-  mIter += bytesSent;
-  return bytesSent;
+  Byte* pPayloadEnd = mpBuf + payloadOffset + sizeof(Byte) + mPayloadLen;
+  if (mIter + numBytes > pPayloadEnd)
+  {
+    return nullptr;
+  }
+
+  Byte* pClaimed = mIter;
+  mIter += numBytes;
+  return pClaimed;
+}
+
+void Packet::Advance(const UINT32 numBytes)
+{
+  mIter += std::min(numBytes, Remaining());
 }
 
 PacketStore::PacketStore()
+  : PacketStore(std::make_shared<PacketPool>(64))
+{}
+
+PacketStore::PacketStore(TPacketPool pPool)
+  : mPool(pPool)
 {
   //Ensure we have blank encryption/decryption ready
   mEncryptor = Crypto::Create(CryptoHandlers::None);
@@ -321,63 +429,75 @@ PacketStore::PacketStore()
   mIncomingMAC = MAC::Create(MACHandlers::None);
 }
 
-std::shared_ptr<Packet> PacketStore::Create(int payloadLen, PacketType type)
+TPacket PacketStore::Acquire(UINT32 bufLen, PacketType type)
 {
-  auto pPacket = std::make_shared<Packet>(typename Packet::Token{});
+  TPacket pPacket = std::atomic_load(&mPool)->Acquire(bufLen);
 
   pPacket->mType = type;
   if (type == PacketType::Write)
   {
-    pPacket->mMAC = mOutgoingMAC;
-    pPacket->mCrypto = mEncryptor;
+    pPacket->mMACRef = mOutgoingMAC;
+    pPacket->mCryptoRef = mEncryptor;
+    pPacket->mpMAC = mOutgoingMAC.get();
+    pPacket->mpCrypto = mEncryptor.get();
   }
   else
   {
-    pPacket->mMAC = mIncomingMAC;
-    pPacket->mCrypto = mDecryptor;
+    pPacket->mpMAC = mIncomingMAC.get();
+    pPacket->mpCrypto = mDecryptor.get();
 
     //We're assuming that if a cryptographic handler has been set, incoming packets are encrypted.
-    if (pPacket->mCrypto->Type() != CryptoHandlers::None)
+    if (pPacket->mpCrypto->Type() != CryptoHandlers::None)
     {
       pPacket->mEncrypted = true;
     }
   }
 
+  return pPacket;
+}
+
+std::shared_ptr<Packet> PacketStore::Create(int payloadLen, PacketType type)
+{
+  const TMACHandler& mac = (type == PacketType::Write) ? mOutgoingMAC : mIncomingMAC;
+  const TCryptoHandler& crypto = (type == PacketType::Write) ? mEncryptor : mDecryptor;
+
   /*
     Figure out how much padding we need.
   */
-  UINT32 macLen = pPacket->mMAC->Len();
-  pPacket->mTotalPacketLen =  sizeof(UINT32) +  //packet_length
-                              sizeof(Byte) +    //padding_length
-                              payloadLen +      //payload
-                              macLen;           //MAC
+  UINT32 macLen = mac->Len();
+  int totalPacketLen =  sizeof(UINT32) +  //packet_length
+                        sizeof(Byte) +    //padding_length
+                        payloadLen +      //payload
+                        macLen;           //MAC
 
   /*
     Now figure out how much padding we need.
   */
-  UINT32 blockLen = std::max(8u, pPacket->mCrypto->BlockLen());
-  UINT32 padding = (blockLen - (pPacket->mTotalPacketLen % blockLen));
+  UINT32 blockLen = std::max(8u, crypto->BlockLen());
+  UINT32 padding = (blockLen - (totalPacketLen % blockLen));
   if (padding < minPaddingSize)
   {
     //Simple way to ensure we have our minimum
     padding += blockLen;
   }
 
-  pPacket->mTotalPacketLen += padding;
+  totalPacketLen += padding;
+
+  auto pPacket = Acquire(totalPacketLen, type);
+
+  pPacket->mTotalPacketLen = totalPacketLen;
   pPacket->mPaddingLen = padding;
   pPacket->mPayloadLen = payloadLen;
 
   //PacketLen is payload + padding + 1 byte for the padding_length field
   pPacket->mPacketLen = payloadLen + pPacket->mPaddingLen + sizeof(Byte);
-  pPacket->mPacket.reserve(pPacket->mTotalPacketLen);
-  pPacket->mPacket.resize(pPacket->mTotalPacketLen);
 
 #ifdef _DEBUG
   //Helps to identify exactly which bytes have been allocated for the packet
-  std::fill(pPacket->mPacket.begin(), pPacket->mPacket.end(), 0xDE);
+  std::fill(pPacket->mpBuf, pPacket->mpBuf + pPacket->mTotalPacketLen, 0xDE);
 #endif
 
-  pPacket->mIter = pPacket->mPacket.begin();
+  pPacket->mIter = pPacket->mpBuf;
 
   //We can immediately write the packet and padding length here
   pPacket->Write(pPacket->mPacketLen);
@@ -386,118 +506,94 @@ std::shared_ptr<Packet> PacketStore::Create(int payloadLen, PacketType type)
   return pPacket;
 }
 
-std::pair<TPacket, int> PacketStore::Create(const Byte* pBuf, const int numBytes, const UINT32 seqNumber, PacketType type)
+int PacketStore::DecryptHeader(Byte* pBuf, const int numBytes)
 {
-  if (numBytes < payloadOffset)
+  //We need the packet_length and padding_length fields, or the first cipher block if it's larger
+  UINT32 blockLen = mDecryptor->BlockLen();
+  UINT32 headerLen = std::max<UINT32>(blockLen, payloadOffset + sizeof(Byte));
+  if (numBytes < 0 || (UINT32)numBytes < headerLen)
   {
-    //We need a minimum of 4 bytes for the packet and padding length
-    return {nullptr, 0};
+    return 0;
   }
 
-  auto pPacket = std::make_shared<Packet>(typename Packet::Token{});
-
-  pPacket->mType = type;
-  if (type == PacketType::Write)
-  {
-    pPacket->mMAC = mOutgoingMAC;
-    pPacket->mCrypto = mEncryptor;
-  }
-  else
+  if (mDecryptor->Type() != CryptoHandlers::None)
   {
-    pPacket->mMAC = mIncomingMAC;
-    pPacket->mCrypto = mDecryptor;
-
-    //We're assuming that if a cryptographic handler has been set, incoming packets are encrypted.
-    if (pPacket->mCrypto->Type() != CryptoHandlers::None)
+    if (!mDecryptor->Decrypt(pBuf, blockLen))
     {
-      pPacket->mEncrypted = true;
+      return -1;
     }
   }
 
-  const Byte* pIter = pBuf;
-  UINT32 packetLen = 0;
-  UINT32 paddingLen = 0;
-
-  UINT32 blockLen = pPacket->mCrypto->BlockLen();
-  TByteString scratchPad(blockLen); //Used to decrypt the first block if available
-
-  if (pPacket->mEncrypted)
+  UINT32 packetLen = Packet::GetLength(pBuf);
+  UINT32 paddingLen = pBuf[payloadOffset];
+  if (packetLen < paddingLen + sizeof(Byte))
   {
-    if (numBytes < blockLen)
-    {
-      //We need more bytes before we start to decrypt this packet
-      return {nullptr, 0};
-    }
-
-    /*
-      We need to peek at the initial few bytes of this buffer to determine the length of the packet.
-    */
-    memcpy(scratchPad.data(), pIter, blockLen);
-    pPacket->mCrypto->Decrypt(scratchPad.data(), blockLen);
-
-    //Scratch pad should now contain enough information to determine the full size of the packet we'll consume.
-    packetLen = Packet::GetLength(scratchPad.data());
-    paddingLen = scratchPad[payloadOffset];
-    pIter += blockLen;
+    return -1;
   }
-  else
+
+  //Reject oversized packets now, before we buffer (or wait on) any more of them
+  if (packetLen > mMaxPacketLen)
   {
-    //Packet is not encrypted, can just use the buffer directly
-    packetLen = Packet::GetLength(pIter);
-    pIter += sizeof(UINT32);
-    paddingLen = *(pIter);
+    return -1;
   }
 
-  /*
-    packetLen does NOT include the MAC or the packetLen field itself.
-    When copying the buffer data into our packet, we will want to take this into account
-    via the fullPacketLen field.
-  */
-  pPacket->mTotalPacketLen =  packetLen +
-                              sizeof(UINT32) +
-                              pPacket->mMAC->Len();
-
-  pPacket->mPacketLen = packetLen;
-  pPacket->mPacket.reserve(pPacket->mTotalPacketLen);
-  pPacket->mPacket.resize(pPacket->mTotalPacketLen);
+  //packetLen does NOT include the MAC or the packetLen field itself.
+  UINT32 totalPacketLen = packetLen + sizeof(UINT32) + mIncomingMAC->Len();
+  if (totalPacketLen > mMaxPacketLen)
+  {
+    return -1;
+  }
 
-  pPacket->mPaddingLen = paddingLen;
-  pPacket->mPayloadLen = (packetLen - paddingLen - sizeof(Byte));
+  return totalPacketLen;
+}
 
-  UINT32 bytesToConsume = std::min(pPacket->mTotalPacketLen, numBytes);
+TPacket PacketStore::CreateView(Byte* pBuf, const UINT32 totalPacketLen, const UINT32 seqNumber, std::shared_ptr<const void> pOwner)
+{
+  TPacket pPacket = std::atomic_load(&mPool)->AcquireView();
 
-  if (pPacket->mEncrypted)
-  {
-    /*
-      Since we decrypted the first N bytes of the buffer, we have to place them into the
-      packet first
-    */
-    std::memcpy(pPacket->mPacket.data(), scratchPad.data(), blockLen);
-    std::memcpy(pPacket->mPacket.data() + blockLen, pIter, bytesToConsume - blockLen);
-  }
-  else
-  {
-    //Just straight copy the unencrypted buffer
-    std::memcpy(pPacket->mPacket.data(), pBuf, bytesToConsume);
-  }
+  pPacket->mType = PacketType::Read;
+  pPacket->mpMAC = mIncomingMAC.get();
+  pPacket->mpCrypto = mDecryptor.get();
 
-  pPacket->mIter = (pPacket->mPacket.begin() + bytesToConsume);
+  //The first block was already decrypted by DecryptHeader, PrepareRead handles the remainder
+  pPacket->mEncrypted = (mDecryptor->Type() != CryptoHandlers::None);
 
+  pPacket->mpBuf = pBuf;
+  pPacket->mpOwner = std::move(pOwner);
+  pPacket->mTotalPacketLen = totalPacketLen;
+  pPacket->mPacketLen = Packet::GetLength(pBuf);
+  pPacket->mPaddingLen = pBuf[payloadOffset];
+  pPacket->mPayloadLen = (pPacket->mPacketLen - pPacket->mPaddingLen - sizeof(Byte));
+  pPacket->mIter = pBuf + totalPacketLen;
   pPacket->mSequenceNumber = seqNumber;
 
-  return {pPacket, bytesToConsume};
+  return pPacket;
 }
 
-TPacket PacketStore::Copy(TPacket pPacket)
+TPacket PacketStore::Copy(const TPacket& pPacket)
 {
-  TPacket pNewPacket = Create(pPacket->mPayloadLen, pPacket->mType);
-  std::copy(pPacket->mPacket.begin(), pPacket->mPacket.end(), pNewPacket->mPacket.begin());
-  pNewPacket->mIter = pNewPacket->mPacket.begin() + (pPacket->mIter - pPacket->mPacket.begin());
+  TPacket pNewPacket = std::atomic_load(&mPool)->Acquire(pPacket->mTotalPacketLen);
+  std::memcpy(pNewPacket->mpBuf, pPacket->mpBuf, pPacket->mTotalPacketLen);
+  pNewPacket->mIter = pNewPacket->mpBuf + (pPacket->mIter - pPacket->mpBuf);
+
+  pNewPacket->mPacketLen = pPacket->mPacketLen;
+  pNewPacket->mTotalPacketLen = pPacket->mTotalPacketLen;
+  pNewPacket->mPayloadLen = pPacket->mPayloadLen;
+  pNewPacket->mPaddingLen = pPacket->mPaddingLen;
   pNewPacket->mSequenceNumber = pPacket->mSequenceNumber;
 
-  pNewPacket->mCrypto = pPacket->mCrypto;
-  pNewPacket->mMAC = pPacket->mMAC;
+  //Only a packet still to be prepared needs its handlers
+  if (!pPacket->mComplete)
+  {
+    pNewPacket->mCryptoRef = pPacket->mCryptoRef;
+    pNewPacket->mMACRef = pPacket->mMACRef;
+    pNewPacket->mpCrypto = pPacket->mpCrypto;
+    pNewPacket->mpMAC = pPacket->mpMAC;
+  }
+
   pNewPacket->mType = pPacket->mType;
+  pNewPacket->mEncrypted = pPacket->mEncrypted;
+  pNewPacket->mComplete = pPacket->mComplete;
 
   return pNewPacket;
 }
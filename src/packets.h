@@ -7,6 +7,10 @@
 #include "constants.h"
 #include "crypto/crypto.h"
 #include "mac.h"
+#include "packet-pool.h"
+#include "packet-reader.h"
+#include <atomic>
+#include <memory>
 #include <vector>
 
 namespace SSH
@@ -17,9 +21,6 @@ namespace SSH
     Packets are sized so that the payload is always a multiple of 16 bytes, with
     enough extra space for header and MAC information.
   */
-  class Packet;
-  using TPacket = std::shared_ptr<Packet>;
-
   using TByteString = std::vector<Byte>;
 
   enum class PacketType
@@ -35,11 +36,18 @@ namespace SSH
 
   private:
     friend class PacketStore;
+    friend class PacketPool;
+
+    //Where the PacketPool puts the control block of the TPacket wrapping this packet
+    alignas(std::max_align_t) Byte mControlBlock[PacketPool::sControlBlockLen];
+
+    //Buffers are owned by the packet but allocated and recycled by the PacketPool
+    Byte* mpBuf = nullptr;
+    UINT32 mBufCapacity = 0;
+    Byte* mIter = nullptr;
 
-    using TPacketBytes = std::vector<Byte>;
-    using TPacketIter = TPacketBytes::iterator;
-    TPacketBytes mPacket;
-    TPacketIter mIter = mPacket.begin();
+    //Keeps a view's memory alive, if whoever created the view asked for that
+    std::shared_ptr<const void> mpOwner;
 
     int mPacketLen = 0; //Value of the packet_length field
     int mTotalPacketLen = 0; //Size of the whole packet include packet_length and MAC
@@ -50,9 +58,16 @@ namespace SSH
 
     static UINT32 GetLength(const Byte* pBuf);
 
-    //Set by the packet store on creation
-    TCryptoHandler mCrypto;
-    TMACHandler mMAC;
+    /*
+      Set by the packet store on creation. Outgoing packets hold on to the handlers they were created
+      under, as they have to be finished with those keys (a NEWKEYS goes out under the old ones) and
+      may be finished on the crypto pool after their connection has gone. Incoming packets only borrow
+      the store's, see PacketStore::CreateView.
+    */
+    ICryptoHandler* mpCrypto = nullptr;
+    IMACHandler* mpMAC = nullptr;
+    TCryptoHandler mCryptoRef;
+    TMACHandler mMACRef;
 
     PacketType mType;
     bool mEncrypted = false;
@@ -63,9 +78,15 @@ namespace SSH
     */
     bool mComplete = false;
 
+    //Set while FinishWrite is running on another thread
+    std::atomic<bool> mInFlight = false;
+
     //Internal access for convinience
     Byte* MAC_Unsafe();
 
+    //Called by the PacketPool before the packet is placed back on a free list
+    void Recycle();
+
   public:
     enum class WriteMethod
     {
@@ -73,9 +94,11 @@ namespace SSH
       WithoutLength
     };
 
-    using TSendFunc = std::function<int (const Byte*, const int)>;
-
     explicit Packet(Token);
+    ~Packet();
+
+    Packet(const Packet&) = delete;
+    Packet& operator=(const Packet&) = delete;
 
     //Pointer to the beginning of the payload
     const Byte* const Payload() const;
@@ -91,6 +114,18 @@ namespace SSH
     //Number of bytes remaining to send/receive
     UINT32 Remaining() const;
 
+    //Pointer to the next byte to send
+    const Byte* const Current() const { return mIter; }
+
+    //Marks numBytes as sent, moving the iterator forward
+    void Advance(const UINT32 numBytes);
+
+    /*
+      Reserves numBytes of the payload at the iterator for writing directly, moving the iterator past them.
+      Returns nullptr if the payload does not have that much space left.
+    */
+    Byte* Claim(const UINT32 numBytes);
+
     //Convinience function for checking if the packet is ready
     bool Ready() const { return mComplete; }
 
@@ -99,20 +134,26 @@ namespace SSH
 
     UINT32 GetSequenceNumber() const { return mSequenceNumber; }
 
-    //Will copy the data from the pBuf into the underlying packet buffer
-    int Consume(const Byte* pBuf, const int numBytes);
-
     int Write(const Byte data);
     int Write(const bool data);
     int Write(const SSH_MSG data);
     int Write(const int data); //Will be treated as a UINT32 when writing
     int Write(const UINT32 data);
     int Write(const std::string data);
-    int Write(const NameList outData);
+    int Write(const NameList& data);
     int Write(const MPInt data);
     int Write(const Byte* pBuf, const int numBytes, const WriteMethod method = WriteMethod::WithLength);
 
-    //Reads data from the packet and increments the iterator
+    /*
+      Returns a bounds checked reader over the rest of the payload, starting at the iterator.
+      Use Advance(reader.Consumed()) afterwards if the packet's iterator should follow it.
+    */
+    PacketReader Reader() const;
+
+    /*
+      Reads data from the packet and increments the iterator.
+      Returns -1 without moving the iterator if the payload is too short for the field.
+    */
     int Read(Byte& outData);
     int Read(bool& outData);
     int Read(UINT32& data);
@@ -132,13 +173,27 @@ namespace SSH
     */
     void PrepareWrite(const UINT32 seqNumber);
 
+    /*
+      PrepareWrite in two halves, so the MAC and encryption can run on another thread.
+      StartWrite assigns the sequence number and padding, and must be called in sending order.
+      FinishWrite does the rest with the packet's own cipher, or with one taken from SplitCipher
+      (after StartWrite) in which case packets can be finished in any order.
+    */
+    void StartWrite(const UINT32 seqNumber);
+    void FinishWrite(ICryptoHandler* pCrypto = nullptr);
+
+    //Takes this packet's share of the keystream from its cipher, nullptr if it can't be split off
+    TCryptoHandler SplitCipher();
+
+    //A packet in flight is still being finished elsewhere and must not be sent yet
+    void SetInFlight(bool bInFlight) { mInFlight.store(bInFlight, std::memory_order_release); }
+    bool InFlight() const { return mInFlight.load(std::memory_order_acquire); }
+
     /*
       Prepares the packet for reading, setting the iterator to the beginning
       of the payload.
     */
     bool PrepareRead();
-
-    int Send(TSendFunc sendFunc);
   };
 
   /*
@@ -149,6 +204,12 @@ namespace SSH
   class PacketStore
   {
   private:
+    TPacketPool mPool; //Only accessed atomically, as sends allocate from any thread while a reactor moves the store over
+    UINT32 mMaxPacketLen = cMinMaxPacketLength;
+
+    //Binds the current handlers to a freshly acquired packet
+    TPacket Acquire(UINT32 bufLen, PacketType type);
+
     TCryptoHandler mEncryptor;
     TCryptoHandler mDecryptor;
 
@@ -157,10 +218,30 @@ namespace SSH
 
   public:
     PacketStore();
+    explicit PacketStore(TPacketPool pPool);
 
     TPacket Create(int payloadLen, PacketType type);
-    std::pair<TPacket,int> Create(const Byte* pBuf, const int numBytes, const UINT32 seqNumber, PacketType type);
-    TPacket Copy(TPacket pPacket);
+
+    //Copies of finished packets don't hold on to any handlers
+    TPacket Copy(const TPacket& pPacket);
+
+    /*
+      Decrypts the first block of an incoming packet in place so its length can be read.
+      Must only be called once per packet.
+      Returns the full size of the packet including the packet_length field and MAC,
+      0 if more bytes are required, or -1 if the header is malformed or the packet is larger
+      than the maximum packet length.
+    */
+    int DecryptHeader(Byte* pBuf, const int numBytes);
+
+    /*
+      Wraps a complete incoming packet (as sized by DecryptHeader) without copying it.
+      The caller must keep pBuf alive and unmodified for as long as the packet is in use,
+      or pass pOwner for the packet to hold on to until it is released.
+      PrepareRead will decrypt and verify the rest of the packet in place. It borrows the
+      store's decryption and MAC handlers, so must be called before they are next set.
+    */
+    TPacket CreateView(Byte* pBuf, const UINT32 totalPacketLen, const UINT32 seqNumber, std::shared_ptr<const void> pOwner = nullptr);
 
     //Crypto handlers are expected to be fully setup by the time they are passed here
     void SetEncryptionHandler(TCryptoHandler handler);
@@ -169,6 +250,13 @@ namespace SSH
     //MAC handlers are expected to be fully setup by the time they are passed here
     void SetOutgoingMACHandler(TMACHandler handler);
     void SetIncomingMACHandler(TMACHandler handler);
+
+    //Largest incoming packet DecryptHeader will accept (including packet_length and MAC)
+    void SetMaxPacketLen(UINT32 maxPacketLen) { mMaxPacketLen = maxPacketLen; }
+    UINT32 MaxPacketLen() const { return mMaxPacketLen; }
+
+    PacketPoolStats PoolStats() const { return std::atomic_load(&mPool)->Stats(); }
+    void SetPool(TPacketPool pPool) { std::atomic_store(&mPool, pPool); }
   };
 }
 
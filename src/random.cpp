@@ -0,0 +1,102 @@
+#include "random.h"
+#include "secure-zero.h"
+
+#define WOLFCRYPT_ONLY
+#include <IDE/WIN10/user_settings.h>
+#include <wolfssl/wolfcrypt/random.h>
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+using namespace SSH;
+
+namespace
+{
+  class ThreadRandom
+  {
+  private:
+    static constexpr UINT32 sBatchLen = 4096;
+
+    WC_RNG mRNG;
+    bool mSeeded = false;
+
+    std::array<Byte, sBatchLen> mBatch;
+    UINT32 mBatchPos = sBatchLen; //Empty until first use
+
+    bool Refill()
+    {
+      if (!mSeeded || wc_RNG_GenerateBlock(&mRNG, mBatch.data(), sBatchLen) != 0)
+      {
+        return false;
+      }
+
+      mBatchPos = 0;
+      return true;
+    }
+
+  public:
+    ThreadRandom()
+    {
+      mSeeded = (wc_InitRng(&mRNG) == 0);
+    }
+
+    ~ThreadRandom()
+    {
+      SecureZero(mBatch.data(), sBatchLen);
+
+      if (mSeeded)
+      {
+        wc_FreeRng(&mRNG);
+      }
+    }
+
+    ThreadRandom(const ThreadRandom&) = delete;
+    ThreadRandom& operator=(const ThreadRandom&) = delete;
+
+    WC_RNG* RNG()
+    {
+      return mSeeded ? &mRNG : nullptr;
+    }
+
+    bool Fill(Byte* pBuf, UINT32 numBytes)
+    {
+      while (numBytes > 0)
+      {
+        if (mBatchPos == sBatchLen && !Refill())
+        {
+          return false;
+        }
+
+        UINT32 numCopied = std::min(numBytes, sBatchLen - mBatchPos);
+        Byte* pSrc = mBatch.data() + mBatchPos;
+        std::memcpy(pBuf, pSrc, numCopied);
+
+        //Bytes are never handed out twice, nor left behind once used
+        SecureZero(pSrc, numCopied);
+
+        mBatchPos += numCopied;
+        pBuf += numCopied;
+        numBytes -= numCopied;
+      }
+
+      return true;
+    }
+  };
+
+  ThreadRandom& GetThreadRandom()
+  {
+    thread_local ThreadRandom sRandom;
+    return sRandom;
+  }
+}
+
+bool Random::Fill(Byte* pBuf, const UINT32 numBytes)
+{
+  return GetThreadRandom().Fill(pBuf, numBytes);
+}
+
+WC_RNG* Random::ThreadRNG()
+{
+  return GetThreadRandom().RNG();
+}
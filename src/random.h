@@ -0,0 +1,29 @@
+#ifndef __RANDOM_H__
+#define __RANDOM_H__
+
+#include "ssh.h"
+
+struct WC_RNG;
+
+namespace SSH
+{
+  /*
+    Library wide source of cryptographically secure random bytes.
+    Every thread owns a single DRBG, seeded the first time that thread needs it, which
+    refills a buffer of pre-generated bytes in large batches. Small requests such as packet
+    padding or the KEX cookie are then served from the buffer without calling into the DRBG.
+  */
+  namespace Random
+  {
+    //Fills pBuf with random bytes, returns false if the DRBG could not be seeded or failed
+    bool Fill(Byte* pBuf, const UINT32 numBytes);
+
+    /*
+      The calling thread's DRBG, for wolfCrypt calls which take an RNG directly (E.G. key generation).
+      Returns nullptr if it failed to seed. Must not be shared with other threads.
+    */
+    WC_RNG* ThreadRNG();
+  }
+}
+
+#endif //~__RANDOM_H__
@@ -0,0 +1,445 @@
+#include "ssh.h"
+#include "ssh_impl.h"
+#include "packet-pool.h"
+#include "io-waiter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace SSH;
+
+namespace
+{
+  void PinCurrentThread(UINT32 core)
+  {
+#ifdef _WIN32
+    SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << (core % (sizeof(DWORD_PTR) * 8)));
+#elif defined(__linux__)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core % CPU_SETSIZE, &cpuSet);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+#else
+    (void)core;
+#endif
+  }
+}
+
+class ClientReactor::Impl
+{
+private:
+  using TClock = IOWaiter::TClock;
+  using TDeadline = std::pair<TClock::time_point, Client::Impl*>;
+
+  //What a worker knows about one of its clients between steps
+  struct Entry
+  {
+    int mWaitFD = -1; //-1 when the transport has nothing to wait on, so the client is polled instead
+    TIOEvents mWatched = IOEvent::None;
+    TIOEvents mEvents = IOEvent::None; //Readiness seen since the client was last stepped
+    std::optional<TClock::time_point> mDeadline;
+    bool mbDue = false; //Listed in mDue
+    bool mbAdopted = false; //On the worker's wheel, which happens on its thread before the first step
+  };
+
+  //One I/O thread along with everything its clients share
+  struct Worker
+  {
+    std::thread mThread;
+    TPacketPool mPool;
+    TTimerWheel mTimers; //Only advanced while mMutex is held
+    TIOWaiter mWaiter;
+
+    //Held for a whole pass over the clients, so Remove can't return while a client is in use
+    std::mutex mMutex;
+    std::unordered_map<Client::Impl*, Entry> mClients;
+    std::atomic<size_t> mNumClients = 0;
+
+    //Clients to step on the next pass, may name clients which have since been removed
+    std::vector<Client::Impl*> mDue;
+
+    //Earliest first. Entries which no longer match their client's deadline are skipped when they come up.
+    std::priority_queue<TDeadline, std::vector<TDeadline>, std::greater<TDeadline>> mDeadlines;
+
+    std::vector<Client::Impl*> mPolled; //Clients without a descriptor
+    TClock::time_point mNextPoll;
+  };
+
+  ReactorOptions mOpts;
+  std::vector<std::unique_ptr<Worker>> mWorkers;
+
+  //Held by Add and Remove, so a client can't be added twice by racing calls. Taken before any worker's mMutex.
+  std::mutex mMembersMutex;
+  std::atomic<bool> mStopRequested = false;
+
+  static void MarkDue(Worker& worker, Client::Impl* pClient, Entry& entry)
+  {
+    if (!entry.mbDue)
+    {
+      entry.mbDue = true;
+      worker.mDue.push_back(pClient);
+    }
+  }
+
+  //Hands the client back to whoever drives it next, with mMutex held
+  static void Drop(Worker& worker, Client::Impl* pClient)
+  {
+    auto iter = worker.mClients.find(pClient);
+    if (iter == worker.mClients.end())
+    {
+      return;
+    }
+
+    if (iter->second.mWaitFD >= 0)
+    {
+      worker.mWaiter->Unwatch(iter->second.mWaitFD);
+    }
+    else
+    {
+      worker.mPolled.erase(std::find(worker.mPolled.begin(), worker.mPolled.end(), pClient));
+    }
+
+    //The worker's wheel and waiter can only be touched from its own thread, or under the lock
+    pClient->SetWaiter(nullptr);
+    if (iter->second.mbAdopted)
+    {
+      pClient->SetTimerWheel(nullptr);
+    }
+
+    worker.mClients.erase(iter);
+    worker.mNumClients = worker.mClients.size();
+  }
+
+  //When the worker next has to do something even if no descriptor becomes ready, with mMutex held
+  std::optional<TClock::time_point> NextDeadline(Worker& worker)
+  {
+    if (!worker.mDue.empty())
+    {
+      return TClock::now();
+    }
+
+    while (!worker.mDeadlines.empty())
+    {
+      const TDeadline& top = worker.mDeadlines.top();
+      auto iter = worker.mClients.find(top.second);
+      if (iter != worker.mClients.end() && iter->second.mDeadline == top.first)
+      {
+        break;
+      }
+
+      worker.mDeadlines.pop();
+    }
+
+    std::optional<TClock::time_point> deadline;
+    if (!worker.mDeadlines.empty())
+    {
+      deadline = worker.mDeadlines.top().first;
+    }
+
+    auto timerDeadline = worker.mTimers->NextDeadline();
+    if (timerDeadline.has_value() && (!deadline.has_value() || timerDeadline.value() < deadline.value()))
+    {
+      deadline = timerDeadline;
+    }
+
+    if (!worker.mPolled.empty() && (!deadline.has_value() || worker.mNextPoll < deadline.value()))
+    {
+      deadline = worker.mNextPoll;
+    }
+
+    return deadline;
+  }
+
+  //Steps every client which is due, then works out what each one waits on next. With mMutex held.
+  void StepDue(Worker& worker, std::vector<Client::Impl*>& stepping)
+  {
+    stepping.clear();
+    stepping.swap(worker.mDue);
+
+    for (Client::Impl* pClient : stepping)
+    {
+      auto iter = worker.mClients.find(pClient);
+      if (iter == worker.mClients.end())
+      {
+        continue;
+      }
+
+      Entry& entry = iter->second;
+      entry.mbDue = false;
+
+      //Whoever added the client may still be using its wheel, so it only moves over once the worker drives it
+      if (!entry.mbAdopted)
+      {
+        pClient->SetTimerWheel(worker.mTimers);
+        entry.mbAdopted = true;
+      }
+
+      //Without a descriptor there is no telling what is ready, so try everything
+      TIOEvents events = (entry.mWaitFD < 0) ? (IOEvent::Readable | IOEvent::Writable) : entry.mEvents;
+      entry.mEvents = IOEvent::None;
+
+      pClient->Step(events);
+
+      //Disconnected clients have nothing more to do
+      if (pClient->GetState() == State::Disconnected)
+      {
+        Drop(worker, pClient);
+        continue;
+      }
+
+      ProcessResult next = pClient->NextWait();
+      if (entry.mWaitFD >= 0)
+      {
+        TIOEvents watch = pClient->GetWaitEvents(next.mWantEvents);
+        if (watch != entry.mWatched)
+        {
+          worker.mWaiter->Watch(entry.mWaitFD, pClient, watch);
+          entry.mWatched = watch;
+        }
+      }
+
+      //An unchanged deadline is still in the heap
+      if (next.mDeadline.has_value() && next.mDeadline != entry.mDeadline)
+      {
+        worker.mDeadlines.push({ next.mDeadline.value(), pClient });
+      }
+
+      entry.mDeadline = next.mDeadline;
+    }
+  }
+
+  void Run(Worker& worker, UINT32 index)
+  {
+    if (mOpts.mPinThreads)
+    {
+      PinCurrentThread(index);
+    }
+
+    std::vector<IOWaiter::Ready> ready;
+    std::vector<Client::Impl*> stepping;
+    while (!mStopRequested)
+    {
+      std::optional<TClock::time_point> deadline;
+      {
+        std::lock_guard<std::mutex> lock(worker.mMutex);
+        deadline = NextDeadline(worker);
+      }
+
+      //Only clients which are ready, woken, or due are stepped, the rest are left alone
+      ready.clear();
+      worker.mWaiter->Wait(deadline, ready);
+
+      std::lock_guard<std::mutex> lock(worker.mMutex);
+      for (const IOWaiter::Ready& entry : ready)
+      {
+        //Tags may belong to clients removed since they were reported
+        auto iter = worker.mClients.find((Client::Impl*)entry.mpTag);
+        if (iter != worker.mClients.end())
+        {
+          iter->second.mEvents |= entry.mEvents;
+          MarkDue(worker, iter->first, iter->second);
+        }
+      }
+
+      auto now = TClock::now();
+
+      //Timers that fire wake their own client, which is picked up by the next pass
+      worker.mTimers->Advance(now);
+
+      while (!worker.mDeadlines.empty() && worker.mDeadlines.top().first <= now)
+      {
+        TDeadline top = worker.mDeadlines.top();
+        worker.mDeadlines.pop();
+
+        auto iter = worker.mClients.find(top.second);
+        if (iter != worker.mClients.end() && iter->second.mDeadline == top.first)
+        {
+          iter->second.mDeadline.reset();
+          MarkDue(worker, iter->first, iter->second);
+        }
+      }
+
+      if (!worker.mPolled.empty() && now >= worker.mNextPoll)
+      {
+        worker.mNextPoll = now + std::chrono::microseconds(mOpts.mIdleSleepUs);
+        for (Client::Impl* pClient : worker.mPolled)
+        {
+          MarkDue(worker, pClient, worker.mClients[pClient]);
+        }
+      }
+
+      StepDue(worker, stepping);
+    }
+  }
+
+public:
+  explicit Impl(const ReactorOptions& options)
+    : mOpts(options)
+  {
+    UINT32 numThreads = mOpts.mNumThreads;
+    if (numThreads == 0)
+    {
+      numThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    for (UINT32 i = 0; i < numThreads; ++i)
+    {
+      auto pWorker = std::make_unique<Worker>();
+      pWorker->mPool = std::make_shared<PacketPool>(mOpts.mPacketPoolLimit);
+      pWorker->mTimers = std::make_shared<TimerWheel>();
+      pWorker->mWaiter = std::make_shared<IOWaiter>();
+      mWorkers.push_back(std::move(pWorker));
+    }
+
+    //Only start once every worker exists, so Add never sees a half built set
+    for (UINT32 i = 0; i < numThreads; ++i)
+    {
+      Worker& worker = *mWorkers[i];
+      worker.mThread = std::thread(&Impl::Run, this, std::ref(worker), i);
+    }
+  }
+
+  ~Impl()
+  {
+    mStopRequested = true;
+    for (auto& pWorker : mWorkers)
+    {
+      pWorker->mWaiter->Wake(nullptr);
+    }
+
+    for (auto& pWorker : mWorkers)
+    {
+      if (pWorker->mThread.joinable())
+      {
+        pWorker->mThread.join();
+      }
+
+      //Clients left behind may be driven from different threads, so they can't keep sharing a wheel
+      std::lock_guard<std::mutex> lock(pWorker->mMutex);
+      while (!pWorker->mClients.empty())
+      {
+        Drop(*pWorker, pWorker->mClients.begin()->first);
+      }
+    }
+  }
+
+  bool Add(Client::Impl* pClient)
+  {
+    if (pClient->GetRunMode() != RunMode::Manual)
+    {
+      return false;
+    }
+
+    std::lock_guard<std::mutex> members(mMembersMutex);
+    for (auto& pWorker : mWorkers)
+    {
+      std::lock_guard<std::mutex> lock(pWorker->mMutex);
+      if (pWorker->mClients.count(pClient) != 0)
+      {
+        return false;
+      }
+    }
+
+    auto iter = std::min_element(mWorkers.begin(), mWorkers.end(), [](const auto& pLhs, const auto& pRhs)
+    {
+      return (pLhs->mNumClients < pRhs->mNumClients);
+    });
+
+    Worker& worker = **iter;
+    pClient->SetPacketPool(worker.mPool);
+
+    std::lock_guard<std::mutex> lock(worker.mMutex);
+    Entry& entry = worker.mClients[pClient];
+    entry.mWaitFD = pClient->GetWaitFD();
+    if (!worker.mWaiter->Watch(entry.mWaitFD, pClient, IOEvent::None))
+    {
+      entry.mWaitFD = -1;
+      worker.mPolled.push_back(pClient);
+    }
+
+    //Other threads handing the client work wake the worker from now on
+    pClient->SetWaiter(worker.mWaiter);
+
+    //Stepped straight away, trying everything as nothing is known about the transport yet
+    entry.mEvents = IOEvent::Readable | IOEvent::Writable;
+    MarkDue(worker, pClient, entry);
+    worker.mWaiter->Wake(pClient);
+
+    worker.mNumClients = worker.mClients.size();
+    return true;
+  }
+
+  bool Remove(Client::Impl* pClient)
+  {
+    std::lock_guard<std::mutex> members(mMembersMutex);
+    for (auto& pWorker : mWorkers)
+    {
+      std::lock_guard<std::mutex> lock(pWorker->mMutex);
+      if (pWorker->mClients.count(pClient) != 0)
+      {
+        Drop(*pWorker, pClient);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  size_t NumClients() const
+  {
+    size_t numClients = 0;
+    for (const auto& pWorker : mWorkers)
+    {
+      numClients += pWorker->mNumClients;
+    }
+
+    return numClients;
+  }
+};
+
+ClientReactor::ClientReactor(const ReactorOptions& options)
+  : mImpl(std::make_unique<ClientReactor::Impl>(options))
+{}
+
+ClientReactor::~ClientReactor()
+{
+  mImpl.reset();
+}
+
+bool ClientReactor::Add(Client* pClient)
+{
+  if (pClient == nullptr)
+  {
+    return false;
+  }
+
+  return mImpl->Add(pClient->mImpl.get());
+}
+
+bool ClientReactor::Remove(Client* pClient)
+{
+  if (pClient == nullptr)
+  {
+    return false;
+  }
+
+  return mImpl->Remove(pClient->mImpl.get());
+}
+
+size_t ClientReactor::NumClients() const
+{
+  return mImpl->NumClients();
+}
@@ -0,0 +1,67 @@
+#include "recv-buffer.h"
+#include "packet-pool.h"
+#include "secure-zero.h"
+
+#include <cstring>
+#include <algorithm>
+
+using namespace SSH;
+
+namespace
+{
+  std::shared_ptr<Byte> AllocateBlock(UINT32 capacity)
+  {
+    return std::shared_ptr<Byte>(PacketPool::AllocateBuffer(capacity), [capacity](Byte* pBuf)
+    {
+      SecureZero(pBuf, capacity);
+      PacketPool::FreeBuffer(pBuf);
+    });
+  }
+}
+
+RecvBuffer::RecvBuffer(UINT32 capacity)
+  : mpBlock(AllocateBlock(capacity))
+  , mpBuf(mpBlock.get())
+  , mCapacity(capacity)
+{}
+
+void RecvBuffer::Commit(UINT32 numBytes)
+{
+  mWritePos += std::min(numBytes, WriteSpace());
+}
+
+void RecvBuffer::Consume(UINT32 numBytes)
+{
+  mReadPos += std::min(numBytes, Readable());
+}
+
+std::shared_ptr<const void> RecvBuffer::Prepare(UINT32 minContiguous)
+{
+  UINT32 readable = Readable();
+  bool bStartAgain = (readable == 0);
+  bool bCompact = !bStartAgain && (mReadPos > 0) && ((WriteSpace() == 0) || (mReadPos + minContiguous > mCapacity));
+
+  if (!bStartAgain && !bCompact)
+  {
+    return nullptr;
+  }
+
+  //Something still refers to what has been read, so leave it be and carry on in a new block
+  std::shared_ptr<Byte> pOldBlock;
+  if (mpBlock.use_count() > 1)
+  {
+    pOldBlock = std::move(mpBlock);
+    mpBlock = AllocateBlock(mCapacity);
+    mpBuf = mpBlock.get();
+    memcpy(mpBuf, pOldBlock.get() + mReadPos, readable);
+  }
+  else if (bCompact)
+  {
+    memmove(mpBuf, mpBuf + mReadPos, readable);
+  }
+
+  mReadPos = 0;
+  mWritePos = readable;
+
+  return pOldBlock;
+}
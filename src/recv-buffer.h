@@ -0,0 +1,62 @@
+#ifndef __RECV_BUFFER_H__
+#define __RECV_BUFFER_H__
+
+#include "ssh.h"
+#include <memory>
+
+namespace SSH
+{
+  /*
+    Per-connection receive buffer which the transport reads straight into.
+    Packets are decrypted and verified in place, so every packet must sit in one
+    contiguous region. Instead of wrapping around, the unread tail is moved back
+    to the front of the buffer whenever a packet would not fit.
+
+    Packets read in place can hold on to the memory with Owner. If anything still does
+    when the buffer would next overwrite what has been read, the buffer moves to a fresh
+    block instead and leaves the old one to whoever is holding it.
+  */
+  class RecvBuffer
+  {
+  private:
+    std::shared_ptr<Byte> mpBlock;
+    Byte* mpBuf = nullptr;
+    UINT32 mCapacity = 0;
+    UINT32 mReadPos = 0;
+    UINT32 mWritePos = 0;
+
+  public:
+    explicit RecvBuffer(UINT32 capacity);
+
+    RecvBuffer(const RecvBuffer&) = delete;
+    RecvBuffer& operator=(const RecvBuffer&) = delete;
+
+    Byte* Data() { return mpBuf; }
+    UINT32 Capacity() const { return mCapacity; }
+
+    //Keeps the memory currently behind the buffer alive for as long as the result is held
+    std::shared_ptr<const void> Owner() const { return mpBlock; }
+
+    //Region the transport may write new data into
+    Byte* WritePtr() { return mpBuf + mWritePos; }
+    UINT32 WriteSpace() const { return mCapacity - mWritePos; }
+    void Commit(UINT32 numBytes);
+
+    //Region of data which has been received but not yet consumed
+    Byte* ReadPtr() { return mpBuf + mReadPos; }
+    UINT32 Readable() const { return mWritePos - mReadPos; }
+    void Consume(UINT32 numBytes);
+
+    /*
+      Makes sure that minContiguous bytes starting at the read position can be
+      held without running off the end of the buffer, compacting if required.
+      Any pointers previously handed out from ReadPtr are invalidated, unless kept
+      alive with Owner.
+      Returns the old block if the buffer had to move to a new one. It is only guaranteed
+      to stay alive while the result is held, so the transport must be moved over first.
+    */
+    std::shared_ptr<const void> Prepare(UINT32 minContiguous);
+  };
+}
+
+#endif //~__RECV_BUFFER_H__
@@ -0,0 +1,27 @@
+#ifndef __SECURE_ZERO_H__
+#define __SECURE_ZERO_H__
+
+#include <cstddef>
+
+namespace SSH
+{
+  /*
+    Zeroes memory which held secrets, in a way the compiler can't drop as a dead store
+    (which it may with a plain memset just before the memory is freed).
+  */
+  inline void SecureZero(void* pBuf, std::size_t numBytes)
+  {
+    volatile unsigned char* pBytes = static_cast<volatile unsigned char*>(pBuf);
+    while (numBytes--)
+    {
+      *pBytes++ = 0;
+    }
+
+#if defined(__GNUC__) || defined(__clang__)
+    //Also stops the stores being reordered past the memory being released
+    __asm__ __volatile__("" : : "r"(pBuf) : "memory");
+#endif
+  }
+}
+
+#endif //~__SECURE_ZERO_H__
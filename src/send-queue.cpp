@@ -0,0 +1,78 @@
+#include "send-queue.h"
+
+#include <array>
+#include <algorithm>
+
+using namespace SSH;
+
+size_t SendQueue::NumBytes() const
+{
+  size_t numBytes = 0;
+  for (const TPacket& pPacket : mPackets)
+  {
+    numBytes += pPacket->Remaining();
+  }
+
+  return numBytes;
+}
+
+SendQueue::WriteResult SendQueue::Write(ITransport& transport, WriteStats& outStats)
+{
+  outStats = WriteStats();
+  if (mPackets.empty())
+  {
+    return WriteResult::Empty;
+  }
+
+  std::array<IOVec, sMaxVecs> vecs;
+  for (auto iter = mPackets.begin(); iter != mPackets.end() && outStats.mNumPackets < sMaxVecs; ++iter)
+  {
+    const TPacket& pPacket = *iter;
+    if (pPacket->InFlight())
+    {
+      break;
+    }
+
+    vecs[outStats.mNumPackets].mpBuf = pPacket->Current();
+    vecs[outStats.mNumPackets].mBufLen = pPacket->Remaining();
+    outStats.mNumOffered += vecs[outStats.mNumPackets].mBufLen;
+    outStats.mNumPackets++;
+  }
+
+  if (outStats.mNumPackets == 0)
+  {
+    return WriteResult::Waiting;
+  }
+
+  auto sentBytes = transport.SendVec(vecs.data(), outStats.mNumPackets);
+  if (!sentBytes.has_value())
+  {
+    //Normal for a non-blocking transport, everything is offered again once it is writable
+    return WriteResult::Partial;
+  }
+
+  if (sentBytes.value() < 0)
+  {
+    return WriteResult::Failed;
+  }
+
+  outStats.mNumBytes = sentBytes.value();
+
+  UINT32 bytesLeft = outStats.mNumBytes;
+  while (bytesLeft > 0 && !mPackets.empty())
+  {
+    TPacket& pPacket = mPackets.front();
+    UINT32 packetBytes = std::min(bytesLeft, pPacket->Remaining());
+    pPacket->Advance(packetBytes);
+    bytesLeft -= packetBytes;
+
+    if (pPacket->Remaining() != 0)
+    {
+      break;
+    }
+
+    mPackets.pop_front();
+  }
+
+  return (outStats.mNumBytes < outStats.mNumOffered) ? WriteResult::Partial : WriteResult::Complete;
+}
@@ -0,0 +1,63 @@
+#ifndef __SEND_QUEUE_H__
+#define __SEND_QUEUE_H__
+
+#include "ssh.h"
+#include "packets.h"
+#include <deque>
+
+namespace SSH
+{
+  /*
+    Packets waiting to go out, in the order they were numbered, written to the transport in as few
+    gather writes as possible. A write may end anywhere, including part way through a packet, in which
+    case the rest of that packet is the first thing offered by the next write.
+    Only ever touched by the thread driving the connection.
+  */
+  class SendQueue
+  {
+  public:
+    //Upper bound on the number of packets gathered into a single write
+    static const int sMaxVecs = 64;
+
+    enum class WriteResult
+    {
+      Empty,    //Nothing is queued
+      Waiting,  //The packet at the front is still being encrypted
+      Partial,  //The transport took less than it was offered, possibly nothing
+      Complete, //Everything offered was written, although more may still be queued
+      Failed,   //The transport signalled a failure
+    };
+
+    struct WriteStats
+    {
+      int mNumBytes = 0;   //Bytes the transport took
+      int mNumOffered = 0; //Bytes it was offered
+      int mNumPackets = 0; //Packets they were gathered from
+    };
+
+  private:
+    std::deque<TPacket> mPackets;
+
+  public:
+    //The packet must already be numbered, it may still be being encrypted elsewhere (see Packet::InFlight)
+    void Push(const TPacket& pPacket) { mPackets.push_back(pPacket); }
+
+    bool Empty() const { return mPackets.empty(); }
+    size_t Size() const { return mPackets.size(); }
+    const TPacket& Front() const { return mPackets.front(); }
+
+    //True when Write has something to offer, rather than nothing or a packet still being encrypted
+    bool Sendable() const { return !mPackets.empty() && !mPackets.front()->InFlight(); }
+
+    //Bytes still to be written, across every queued packet
+    size_t NumBytes() const;
+
+    /*
+      Offers the transport everything from the front of the queue up to the first packet still being
+      encrypted, in a single gather write, and drops whichever packets it took the whole of.
+    */
+    WriteResult Write(ITransport& transport, WriteStats& outStats);
+  };
+}
+
+#endif //~__SEND_QUEUE_H__
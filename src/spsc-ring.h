@@ -0,0 +1,89 @@
+#ifndef __SPSC_RING_H__
+#define __SPSC_RING_H__
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+namespace SSH
+{
+  /*
+    Bounded lock-free ring between exactly one producer thread and one consumer thread.
+    Each side only ever writes its own index, so neither needs anything stronger than
+    acquire/release ordering. The capacity is rounded up to a power of two.
+  */
+  template<typename T>
+  class SPSCRing
+  {
+  private:
+    static constexpr size_t sCacheLine = 64;
+
+    std::unique_ptr<T[]> mpSlots;
+    size_t mMask;
+
+    //Kept apart so the two threads don't share a cache line
+    alignas(sCacheLine) std::atomic<size_t> mHead; //Next slot to pop, written by the consumer
+    alignas(sCacheLine) std::atomic<size_t> mTail; //Next slot to push, written by the producer
+
+    static size_t RoundUp(size_t capacity)
+    {
+      size_t rounded = 2;
+      while (rounded < capacity)
+      {
+        rounded <<= 1;
+      }
+
+      return rounded;
+    }
+
+  public:
+    explicit SPSCRing(size_t capacity)
+      : mpSlots(std::make_unique<T[]>(RoundUp(capacity)))
+      , mMask(RoundUp(capacity) - 1)
+      , mHead(0)
+      , mTail(0)
+    {}
+
+    SPSCRing(const SPSCRing&) = delete;
+    SPSCRing& operator=(const SPSCRing&) = delete;
+
+    size_t Capacity() const { return mMask + 1; }
+
+    //Producer only, returns false if the ring is full
+    bool TryPush(const T& data)
+    {
+      size_t tail = mTail.load(std::memory_order_relaxed);
+      if (tail - mHead.load(std::memory_order_acquire) > mMask)
+      {
+        return false;
+      }
+
+      mpSlots[tail & mMask] = data;
+      mTail.store(tail + 1, std::memory_order_release);
+      return true;
+    }
+
+    //Consumer only, returns false if the ring is empty
+    bool TryPop(T& outData)
+    {
+      size_t head = mHead.load(std::memory_order_relaxed);
+      if (head == mTail.load(std::memory_order_acquire))
+      {
+        return false;
+      }
+
+      outData = std::move(mpSlots[head & mMask]);
+      mpSlots[head & mMask] = T();
+      mHead.store(head + 1, std::memory_order_release);
+      return true;
+    }
+
+    //Consumer only
+    bool Empty() const
+    {
+      return (mHead.load(std::memory_order_relaxed) == mTail.load(std::memory_order_acquire));
+    }
+  };
+}
+
+#endif //~__SPSC_RING_H__
@@ -7,6 +7,29 @@
 
 using namespace SSH;
 
+TResult ITransport::SendVec(const IOVec* pVecs, const int numVecs)
+{
+  TResult totalSent;
+
+  for (int i = 0; i < numVecs; ++i)
+  {
+    auto sentBytes = Send(pVecs[i].mpBuf, pVecs[i].mBufLen);
+    if (!sentBytes.has_value() || sentBytes.value() == -1)
+    {
+      //Only report the failure if nothing has made it out yet
+      return totalSent.has_value() ? totalSent : sentBytes;
+    }
+
+    totalSent = totalSent.value_or(0) + sentBytes.value();
+    if (sentBytes.value() < pVecs[i].mBufLen)
+    {
+      break;
+    }
+  }
+
+  return totalSent;
+}
+
 const char* SSH::StateToString(State state)
 {
   switch (state)
@@ -49,11 +72,12 @@ void SSH::Cleanup()
 Client::Client(ClientOptions& options, TCtx& ctx)
 {
   //TODO: Handle NullPtr
-  mImpl = std::make_unique<Client::Impl>(options, ctx, this);
+  mImpl = std::make_shared<Client::Impl>(options, ctx, this);
 }
 
 Client::~Client()
 {
+  mImpl->ReleaseOwner();
   mImpl.reset();
 }
 
@@ -67,11 +91,33 @@ void Client::Disconnect()
   mImpl->Disconnect();
 }
 
+void Client::Stop()
+{
+  mImpl->Stop();
+}
+
+void Client::Join()
+{
+  mImpl->Join();
+}
+
+ProcessResult Client::Process(TIOEvents events)
+{
+  //Held for the whole call, as a callback may destroy the client part way through
+  std::shared_ptr<Impl> pImpl = mImpl;
+  return pImpl->Process(events);
+}
+
 TChannelID Client::OpenChannel(ChannelTypes type, TOnEventFunc callback)
 {
   return mImpl->OpenChannel(type, callback);
 }
 
+TChannelID Client::OpenChannel(ChannelTypes type, TOnEventFunc callback, TOnDataFunc dataCallback)
+{
+  return mImpl->OpenChannel(type, callback, dataCallback);
+}
+
 bool Client::CloseChannel(TChannelID channelID)
 {
   return mImpl->CloseChannel(channelID);
@@ -82,7 +128,32 @@ TResult Client::Send(TChannelID channelID, const Byte* pBuf, const int bufLen)
   return mImpl->Send(channelID, pBuf, bufLen);
 }
 
+bool Client::Cork(TChannelID channelID)
+{
+  return mImpl->Cork(channelID);
+}
+
+bool Client::SetChannelPriority(TChannelID channelID, ChannelPriority priority, UINT32 weight)
+{
+  return mImpl->SetChannelPriority(channelID, priority, weight);
+}
+
+bool Client::Consume(TChannelID channelID, UINT32 numBytes)
+{
+  return mImpl->Consume(channelID, numBytes);
+}
+
+bool Client::Uncork(TChannelID channelID)
+{
+  return mImpl->Uncork(channelID);
+}
+
 State Client::GetState() const
 {
   return mImpl->GetState();
 }
+
+PacketPoolStats Client::GetPacketPoolStats() const
+{
+  return mImpl->GetPacketPoolStats();
+}
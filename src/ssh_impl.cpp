@@ -1,10 +1,12 @@
 #include "ssh_impl.h"
+#include "secure-zero.h"
 #include "endian.h"
 #include "constants.h"
 #include "crypto/crypto.h"
+#include "messages.h"
+#include "random.h"
 
 #include <stdarg.h>
-#include <future>
 #include <array>
 #include <cstring>
 #include <algorithm>
@@ -30,14 +32,72 @@ public:
 
   ~SecureBuffer()
   {
-    //TODO: This NEEDS to be secure
-    memset(mArr.data(), 0, size);
+    SecureZero(mArr.data(), sizeof(T) * size);
   }
 
   T* Buffer() { return mArr.data(); }
   size_t Length() { return size; }
 };
 
+//Sets a flag for as long as it is in scope
+class ScopedFlag
+{
+private:
+  bool& mFlag;
+public:
+  explicit ScopedFlag(bool& flag)
+    : mFlag(flag)
+  {
+    mFlag = true;
+  }
+
+  ~ScopedFlag()
+  {
+    mFlag = false;
+  }
+};
+
+/*
+  Adapts the send/recv functions from ClientOptions to the transport interface,
+  so the rest of the client only has to deal with one way of moving bytes.
+*/
+class FunctionTransport : public ITransport
+{
+private:
+  TSendFunc mSend;
+  TSendVecFunc mSendVec;
+  TRecvFunc mRecv;
+  TCtx mCtx;
+
+public:
+  FunctionTransport(const ClientOptions& options, const TCtx& ctx)
+    : mSend(options.mSend)
+    , mSendVec(options.mSendVec)
+    , mRecv(options.mRecv)
+    , mCtx(ctx)
+  {}
+
+  virtual TResult Send(const Byte* pBuf, const int bufLen) override
+  {
+    return mSend(mCtx, pBuf, bufLen);
+  }
+
+  virtual TResult Recv(Byte* pBuf, const int bufLen) override
+  {
+    return mRecv(mCtx, pBuf, bufLen);
+  }
+
+  virtual TResult SendVec(const IOVec* pVecs, const int numVecs) override
+  {
+    if (!mSendVec)
+    {
+      return ITransport::SendVec(pVecs, numVecs);
+    }
+
+    return mSendVec(mCtx, pVecs, numVecs);
+  }
+};
+
 std::string SSH::StageToString(ConStage stage)
 {
   switch (stage)
@@ -74,12 +134,34 @@ Client::Impl::Impl(ClientOptions& options, TCtx& ctx, Client* pOwner)
   : mOpts(options)
   , mActiveAuthMethod(UserAuthMethod::None)
   , mCtx(ctx)
+  , mTransport(options.mTransport)
   , mState(State::Idle)
   , mStage(ConStage::Null)
   , mpOwner(pOwner)
+  , mRecvBuffer(std::max(options.mRecvBufferSize, options.mMaxPacketLen))
+  , mOutbound(options.mSendQueueLength)
+  , mDecrypted(options.mPipelineDepth)
+  , mCompletions(std::make_shared<CompletionQueue>())
+  , mTimers(std::make_shared<TimerWheel>())
   , mIncomingSequenceNumber(0)
   , mOutgoingSequenceNumber(0)
+  , mPacketStore(std::make_shared<PacketPool>(options.mPacketPoolLimit))
 {
+  if (mTransport == nullptr)
+  {
+    mTransport = std::make_shared<FunctionTransport>(mOpts, mCtx);
+  }
+
+  mTransport->AttachRecvBuffer(mRecvBuffer.Data(), mRecvBuffer.Capacity());
+
+  mPacketStore.SetMaxPacketLen(mOpts.mMaxPacketLen);
+
+  //Whatever the crypto pool finishes is picked up by the next Step, so make sure there is one
+  mCompletions->SetOnPost([this]()
+  {
+    Wake();
+  });
+
   mClientKex.mIdent = "SSH-2.0-cppsshSSH_3.6.3q3";
 
   mClientKex.mAlgorithms.mKex.Add("diffie-hellman-group14-sha1");
@@ -103,6 +185,22 @@ Client::Impl::Impl(ClientOptions& options, TCtx& ctx, Client* pOwner)
 
 Client::Impl::~Impl()
 {
+  Stop();
+
+  //Tasks still on the crypto pool may post after we are gone
+  mCompletions->SetOnPost(nullptr);
+
+  //The transport may outlive us, and must be done with the receive buffer before it goes
+  mTransport->AttachRecvBuffer(nullptr, 0);
+
+  /*
+    Only the I/O thread's own reference, dropped as it returns, can get us here without Stop having
+    joined it. It can't join itself, and has nothing left to do once we are gone.
+  */
+  if (mIOThread.joinable())
+  {
+    mIOThread.detach();
+  }
 }
 
 void Client::Impl::Log(LogLevel level, const std::string frmt, ...)
@@ -175,12 +273,17 @@ void Client::Impl::SetStage(ConStage newStage)
 void Client::Impl::SetState(State newState)
 {
   Log(LogLevel::Info, "State: (%s) -> (%s)", StateToString(mState), StateToString(newState));
-  mState = newState;
+  State oldState = mState.exchange(newState);
+
+  if (newState == State::Disconnected && oldState != State::Disconnected && mOpts.mOnDisconnect && mpOwner != nullptr)
+  {
+    mOpts.mOnDisconnect(mpOwner);
+  }
 }
 
 TResult Client::Impl::Raw_Send(const Byte* pBuf, const int bufLen)
 {
-  auto sentBytes = mOpts.mSend(mCtx, pBuf, bufLen);
+  auto sentBytes = mTransport->Send(pBuf, bufLen);
   if (!sentBytes.has_value())
   {
     Log(LogLevel::Warning, "Failed to send %d bytes", bufLen);
@@ -191,26 +294,36 @@ TResult Client::Impl::Raw_Send(const Byte* pBuf, const int bufLen)
   return sentBytes;
 }
 
-TResult Client::Impl::Send(std::shared_ptr<Packet> pPacket)
+void Client::Impl::FlushSendQueue()
 {
-  return pPacket->Send([&](const Byte* pBuf, const int numBytes) -> int
+  ScheduleChannels();
+
+  while (true)
   {
-    auto sentBytes = Raw_Send(pBuf, numBytes);
-    if (!sentBytes.has_value())
+    SendQueue::WriteStats stats;
+    switch (mSendQueue.Write(*mTransport, stats))
     {
-      return 0;
-    }
+      case SendQueue::WriteResult::Empty:
+      case SendQueue::WriteResult::Waiting:
+        //Either everything has gone, or the crypto pool hasn't finished the packet at the front yet
+        return;
 
-    if (sentBytes.value() == -1)
-    {
-      //User's send function has signalled a failure to send, simply disconnect to stop all further traffic.
-      Disconnect();
-      return 0;
-    }
+      case SendQueue::WriteResult::Failed:
+        //User's send function has signalled a failure to send, simply disconnect to stop all further traffic.
+        Disconnect();
+        return;
 
-    Log(LogLevel::Debug, "Packet (%d) sent %d bytes", pPacket->GetSequenceNumber(), sentBytes.value());
-    return sentBytes.value();
-  });
+      case SendQueue::WriteResult::Partial:
+        //The transport is full, the rest goes once it is writable again
+        Log(LogLevel::Debug, "Sent %d/%d raw bytes across %d packets, %d bytes left waiting", stats.mNumBytes, stats.mNumOffered, stats.mNumPackets, (int)mSendQueue.NumBytes());
+        return;
+
+      case SendQueue::WriteResult::Complete:
+        Log(LogLevel::Debug, "Successfully sent %d/%d raw bytes across %d packets", stats.mNumBytes, stats.mNumOffered, stats.mNumPackets);
+        ScheduleChannels();
+        break;
+    }
+  }
 }
 
 TResult Client::Impl::Send(TChannelID channelID, const Byte* pBuf, const int bufLen)
@@ -221,79 +334,812 @@ TResult Client::Impl::Send(TChannelID channelID, const Byte* pBuf, const int buf
     return {};
   }
 
-  TPacket dataPacket = channel->PrepareSend(pBuf, bufLen, mPacketStore);
-  if (dataPacket == nullptr)
+  UINT32 numBytes = channel->Write(pBuf, bufLen, mPacketStore);
+  if (numBytes > 0)
+  {
+    mScheduler.Wake(channel);
+    mNumSends.fetch_add(1, std::memory_order_relaxed);
+    Wake();
+  }
+
+  return (int)numBytes;
+}
+
+bool Client::Impl::Consume(TChannelID channelID, UINT32 numBytes)
+{
+  TChannel channel = GetChannel(channelID);
+  if (channel == nullptr || !channel->Consume(numBytes))
   {
     return false;
   }
 
-  Queue(dataPacket);
-  return dataPacket->PayloadLen();
+  QueueWindowAdjust(*channel);
+  return true;
 }
 
-void Client::Impl::Queue(std::shared_ptr<Packet> pPacket)
+bool Client::Impl::Cork(TChannelID channelID)
+{
+  TChannel channel = GetChannel(channelID);
+  if (channel == nullptr)
+  {
+    return false;
+  }
+
+  channel->Cork();
+  return true;
+}
+
+bool Client::Impl::Uncork(TChannelID channelID)
+{
+  TChannel channel = GetChannel(channelID);
+  if (channel == nullptr)
+  {
+    return false;
+  }
+
+  channel->Uncork(mPacketStore);
+  mScheduler.Wake(channel);
+  Wake();
+  return true;
+}
+
+bool Client::Impl::SetChannelPriority(TChannelID channelID, ChannelPriority priority, UINT32 weight)
+{
+  TChannel channel = GetChannel(channelID);
+  if (channel == nullptr)
+  {
+    return false;
+  }
+
+  channel->SetPriority(priority, weight);
+  return true;
+}
+
+void Client::Impl::ScheduleChannels()
+{
+  //Control traffic queued by other threads goes ahead of any channel data
+  DrainOutbound();
+
+  size_t queuedBytes = mSendQueue.NumBytes();
+
+  //The queue is kept shallow, so the scheduler rather than arrival order decides what goes next
+  while (queuedBytes < sMaxScheduledBytes && mSendQueue.Size() < SendQueue::sMaxVecs)
+  {
+    TPacket pPacket = mScheduler.Next();
+    if (pPacket == nullptr)
+    {
+      break;
+    }
+
+    PushSendQueue(pPacket);
+    queuedBytes += pPacket->Remaining();
+  }
+}
+
+void Client::Impl::QueueWindowAdjust(IChannel& channel)
 {
-  pPacket->PrepareWrite(mOutgoingSequenceNumber++);
-  mSendQueue.push(pPacket);
+  TPacket pPacket = channel.TakeWindowAdjust(mPacketStore);
+  if (pPacket != nullptr)
+  {
+    Queue(pPacket);
+  }
+}
+
+void Client::Impl::FlushChannels()
+{
+  auto now = TClock::now();
+  mChannels.ForEach([&](const TChannel& channel)
+  {
+    channel->FlushExpired(now, mPacketStore);
+    mScheduler.Wake(channel);
+  });
+}
+
+void Client::Impl::PushSendQueue(const TPacket& pPacket)
+{
+  pPacket->StartWrite(mOutgoingSequenceNumber++);
+
+  //Large packets are finished on the crypto pool, they still go out in order as the send queue waits for them
+  TCryptoHandler pCipher;
+  if (mOpts.mOffloadPacketLen > 0 && (UINT32)pPacket->PacketLen() >= mOpts.mOffloadPacketLen)
+  {
+    pCipher = pPacket->SplitCipher();
+  }
+
+  if (pCipher != nullptr)
+  {
+    pPacket->SetInFlight(true);
+
+    TCompletionQueue pCompletions = mCompletions;
+    CryptoPool::Shared().Submit([pPacket, pCipher, pCompletions]()
+    {
+      pPacket->FinishWrite(pCipher.get());
+      pPacket->SetInFlight(false);
+
+      //Nothing to run, but it wakes whoever is waiting to send the packet
+      pCompletions->Post([]() {});
+    });
+  }
+  else
+  {
+    pPacket->FinishWrite();
+  }
+
+  mSendQueue.Push(pPacket);
   Log(LogLevel::Debug, "Packet (%d) has been queued for sending", pPacket->GetSequenceNumber());
 }
 
+void Client::Impl::RunKEXTask(std::function<bool()> task, std::function<void(bool)> onDone)
+{
+  if (!mOpts.mOffloadKEX)
+  {
+    onDone(task());
+    return;
+  }
+
+  mKEXPending = true;
+
+  TCompletionQueue pCompletions = mCompletions;
+  CryptoPool::Shared().Submit([task, onDone, pCompletions]()
+  {
+    bool bSuccess = task();
+    pCompletions->Post([onDone, bSuccess]()
+    {
+      onDone(bSuccess);
+    });
+  });
+}
+
+void Client::Impl::DrainOutbound()
+{
+  bool bDrained = false;
+
+  TPacket pPacket;
+  while (mOutbound.TryPop(pPacket))
+  {
+    PushSendQueue(pPacket);
+    bDrained = true;
+  }
+
+  if (bDrained)
+  {
+    NotifyOutboundRoom();
+  }
+}
+
+void Client::Impl::NotifyOutboundRoom()
+{
+  //Taking the lock means a sender can't miss this between finding the queue full and going to sleep
+  {
+    std::lock_guard<std::mutex> lock(mOutboundMutex);
+  }
+
+  mOutboundRoom.notify_all();
+}
+
+bool Client::Impl::TryQueue(const TPacket& pPacket)
+{
+  if (OnConsumerThread())
+  {
+    //Anything queued from other threads was queued first, so must be numbered first
+    DrainOutbound();
+    PushSendQueue(pPacket);
+
+    //Outside of Step (E.G. from a timer its reactor fired) nothing else would come back to send it
+    Wake();
+    return true;
+  }
+
+  if (!mOutbound.TryPush(pPacket))
+  {
+    return false;
+  }
+
+  Wake();
+  return true;
+}
+
+void Client::Impl::Queue(std::shared_ptr<Packet> pPacket)
+{
+  if (TryQueue(pPacket))
+  {
+    return;
+  }
+
+  //Wait for whoever drives the connection to make some room
+  std::unique_lock<std::mutex> lock(mOutboundMutex);
+  while (!TryQueue(pPacket))
+  {
+    if (mState == State::Disconnected)
+    {
+      Log(LogLevel::Warning, "Dropping packet, the send queue is full and the client is disconnected");
+      return;
+    }
+
+    mOutboundRoom.wait(lock);
+  }
+}
+
+void Client::Impl::Wake()
+{
+  //Step picks up whatever the connection's own callbacks hand it before returning
+  if (OnConsumerThread() && mbStepping)
+  {
+    return;
+  }
+
+  TIOWaiter pWaiter = std::atomic_load(&mpWaiter);
+  if (pWaiter != nullptr)
+  {
+    pWaiter->Wake(this);
+  }
+}
+
+void Client::Impl::WakeCryptoStage()
+{
+  TIOWaiter pWaiter = std::atomic_load(&mpStageWaiter);
+  if (pWaiter != nullptr)
+  {
+    pWaiter->Wake(this);
+  }
+}
+
 void Client::Impl::Poll()
 {
-  while (mState != State::Disconnected)
+  TIOWaiter pWaiter = std::make_shared<IOWaiter>();
+  SetWaiter(pWaiter);
+
+  int waitFD = mTransport->WaitFD();
+  TIOEvents watched = IOEvent::None;
+  if (!pWaiter->Watch(waitFD, this, watched))
+  {
+    //Nothing to wait on, so the transport is checked every mPollIntervalUs instead
+    waitFD = -1;
+  }
+
+  std::vector<IOWaiter::Ready> ready;
+  TIOEvents events = IOEvent::Readable | IOEvent::Writable;
+  while (!mStopRequested && mState != State::Disconnected)
+  {
+    Step(events);
+
+    ProcessResult next = NextWait();
+    if (waitFD < 0)
+    {
+      auto pollAt = IOWaiter::TClock::now() + std::chrono::microseconds(mOpts.mPollIntervalUs);
+      if (!next.mDeadline.has_value() || pollAt < next.mDeadline.value())
+      {
+        next.mDeadline = pollAt;
+      }
+    }
+    else if (mTransport->WaitEvents(next.mWantEvents) != watched)
+    {
+      watched = mTransport->WaitEvents(next.mWantEvents);
+      pWaiter->Watch(waitFD, this, watched);
+    }
+
+    if (mStopRequested || mState == State::Disconnected)
+    {
+      break;
+    }
+
+    ready.clear();
+    pWaiter->Wait(next.mDeadline, ready);
+
+    //Sending is always attempted, so only whether to read depends on what was ready
+    events = (waitFD < 0) ? (IOEvent::Readable | IOEvent::Writable) : IOEvent::None;
+    for (const IOWaiter::Ready& entry : ready)
+    {
+      events |= entry.mEvents;
+    }
+  }
+
+  SetWaiter(nullptr);
+  StopPipeline();
+  Log(LogLevel::Debug, "I/O thread finished");
+}
+
+void Client::Impl::CryptoStage()
+{
+  auto Stopping = [this]()
   {
-    SecureBuffer<unsigned char, 1024> buf;
+    return (mPipelineStop || mStopRequested || mState == State::Disconnected);
+  };
+
+  //Published before anything is checked, so a stop can't slip in between checking and waiting
+  TIOWaiter pWaiter = std::make_shared<IOWaiter>();
+  std::atomic_store(&mpStageWaiter, pWaiter);
+
+  int waitFD = mTransport->WaitFD();
+  if (!pWaiter->Watch(waitFD, this, mTransport->WaitEvents(IOEvent::Readable)))
+  {
+    waitFD = -1;
+  }
 
-    //If we have any packets ready to send, attempt to send them now
-    while (!mSendQueue.empty())
+  std::vector<IOWaiter::Ready> ready;
+  while (!Stopping())
+  {
+    TPacket pView;
+    int result = TakePacket(pView);
+    if (result < 0)
     {
-      auto pPacket = mSendQueue.front();
-      Send(pPacket);
+      mPipelineFailed = true;
+      break;
+    }
 
-      UINT32 bytesRemaining = pPacket->Remaining();
-      if (bytesRemaining == 0)
+    if (result == 0)
+    {
+      PrepareRecvBuffer();
+
+      auto recievedBytes = mTransport->Recv(mRecvBuffer.WritePtr(), mRecvBuffer.WriteSpace());
+      if (!recievedBytes.has_value() || recievedBytes.value() == 0)
       {
-        Log(LogLevel::Debug, "Finished sending bytes for packet (%d)", pPacket->GetSequenceNumber());
-        mSendQueue.pop();
+        //Sleep until the transport has more, or without anything to wait on, check back after a poll interval
+        std::optional<IOWaiter::TClock::time_point> deadline;
+        if (waitFD < 0)
+        {
+          deadline = IOWaiter::TClock::now() + std::chrono::microseconds(mOpts.mPollIntervalUs);
+        }
+
+        ready.clear();
+        pWaiter->Wait(deadline, ready);
+        continue;
       }
-      else
+
+      if (recievedBytes.value() == -1)
       {
-        Log(LogLevel::Debug, "Packet (%d) has [%d] bytes left to send", pPacket->GetSequenceNumber(), bytesRemaining);
+        mPipelineFailed = true;
         break;
       }
+
+      mRecvBuffer.Commit(recievedBytes.value());
+      continue;
+    }
+
+    //Prepared in place, as the view borrows the store's handlers
+    if (!pView->PrepareRead())
+    {
+      mPipelineFailed = true;
+      break;
+    }
+
+    //The receive buffer will have moved on long before dispatch gets to the packet, so it needs its own copy
+    TPacket pPacket = mPacketStore.Copy(pView);
+    pView.reset();
+
+    bool bKeyExchange = (pPacket->PayloadLen() > 0 && pPacket->Payload()[0] == SSH_MSG::KEXINIT);
+
+    if (!mDecrypted.TryPush(pPacket))
+    {
+      //Dispatch has fallen behind, so sleep until it takes something rather than on the transport
+      if (waitFD >= 0)
+      {
+        pWaiter->Watch(waitFD, this, IOEvent::None);
+      }
+
+      while (!mDecrypted.TryPush(pPacket) && !Stopping())
+      {
+        ready.clear();
+        pWaiter->Wait(std::nullopt, ready);
+      }
+
+      if (waitFD >= 0)
+      {
+        pWaiter->Watch(waitFD, this, mTransport->WaitEvents(IOEvent::Readable));
+      }
     }
 
-    auto recievedBytes = mOpts.mRecv(mCtx, buf.Buffer(), buf.Length());
+    Wake();
+
+    if (bKeyExchange)
+    {
+      break;
+    }
+  }
+
+  std::atomic_store(&mpStageWaiter, TIOWaiter());
+  mPipelineFinished = true;
+  Wake();
+}
+
+bool Client::Impl::DispatchPipeline()
+{
+  bool bReadAny = false;
+
+  TPacket pPacket;
+  while (mState != State::Disconnected && mDecrypted.TryPop(pPacket))
+  {
+    Log(LogLevel::Info, "Packet (%d) [Payload: %u] now ready", pPacket->GetSequenceNumber(), pPacket->PayloadLen());
+
+    mRecvQueue.push(pPacket);
+    mRecvQueueBytes += pPacket->PacketLen();
+    pPacket.reset();
+
+    DispatchPackets();
+    bReadAny = true;
+    mLastRecv = mTimers->Now();
+  }
+
+  //The crypto stage may be asleep waiting for room
+  if (bReadAny)
+  {
+    WakeCryptoStage();
+  }
+
+  DeliverBatches();
+
+  if (mPipelineFinished && mDecrypted.Empty())
+  {
+    //The crypto stage has stopped, for good or to hand a key exchange back to ReadTransport
+    mCryptoStage.join();
+    mbResumeRead = true;
+
+    bool bFailed = mPipelineFailed;
+
+    //Once the key exchange is done with, and its keys are in place, Step starts the pipeline again
+    mPipelineStarted = false;
+    mPipelineFinished = false;
+    mPipelineFailed = false;
+
+    if (bFailed && mState != State::Disconnected)
+    {
+      Log(LogLevel::Error, "Failed to read incoming packet (%d)", mIncomingSequenceNumber);
+      Disconnect();
+    }
+    else if (mState != State::Disconnected && mRecvBuffer.Readable() > 0)
+    {
+      //The crypto stage may have read past the KEXINIT, and no readiness event will announce what it left behind
+      HandleData();
+      bReadAny = true;
+    }
+  }
+
+  return bReadAny;
+}
+
+void Client::Impl::StopPipeline()
+{
+  mPipelineStop = true;
+  WakeCryptoStage();
+
+  if (mCryptoStage.joinable() && mCryptoStage.get_id() != std::this_thread::get_id())
+  {
+    mCryptoStage.join();
+  }
+}
+
+ProcessResult Client::Impl::Process(TIOEvents events)
+{
+  if (mState == State::Idle ||
+      mState == State::Disconnected)
+  {
+    return {};
+  }
+
+  Step(events);
+  return NextWait();
+}
+
+bool Client::Impl::Step(TIOEvents events)
+{
+  //Whichever thread drives the connection owns the send queue
+  mConsumerThread = std::this_thread::get_id();
+  ScopedFlag stepping(mbStepping);
+
+  UpdateTimers();
+  if (mState == State::Disconnected)
+  {
+    return false;
+  }
+
+  //Pick up anything the crypto pool has finished for us, then handle whatever arrived in the meantime
+  if (mCompletions->RunAll() && mState != State::Disconnected && !mCryptoStage.joinable())
+  {
+    HandleData();
+  }
+
+  /*
+    Everything already parsed has been handled, so the crypto stage can take over the receive buffer.
+    The stage is only back at UserLoggedIn, with nothing pending on the pool, once any key exchange's keys are in place.
+  */
+  if (mOpts.mPipelineRecv && !mPipelineStarted && !mPipelineStop && !mKEXPending &&
+      mStage == ConStage::UserLoggedIn && mRecvQueue.empty())
+  {
+    Log(LogLevel::Debug, "Starting receive pipeline");
+    mPipelineStarted = true;
+    mCryptoStage = std::thread(&Impl::CryptoStage, this);
+  }
+
+  /*
+    Sending is always attempted, the transport will simply take nothing if it is full.
+    Writable only matters to the caller so they know when to come back.
+  */
+  FlushChannels();
+  FlushSendQueue();
+
+  bool bReadAny = false;
+  if (mCryptoStage.joinable())
+  {
+    bReadAny = DispatchPipeline();
+  }
+
+  //Reading which was held back picks up again straight away, as whatever the transport has may already have been announced
+  if (!mCryptoStage.joinable() && ((events & IOEvent::Readable) || mbResumeRead))
+  {
+    bReadAny |= ReadTransport();
+  }
+
+  if (!bReadAny)
+  {
+    return false;
+  }
+
+  //Handling incoming packets may well have queued replies
+  FlushChannels();
+  FlushSendQueue();
+  return true;
+}
+
+void Client::Impl::PrepareRecvBuffer()
+{
+  /*
+    A retained packet can be all that keeps the old block alive, while a read may still be aimed at it.
+    Hold on to it until the transport has cancelled that read and kept whatever it got.
+  */
+  std::shared_ptr<const void> pOldBlock = mRecvBuffer.Prepare(mPendingPacketLen);
+  if (pOldBlock != nullptr)
+  {
+    mTransport->AttachRecvBuffer(mRecvBuffer.Data(), mRecvBuffer.Capacity());
+  }
+}
+
+bool Client::Impl::ReadTransport()
+{
+  bool bReadAny = false;
+  mbResumeRead = false;
+
+  while (mState != State::Disconnected)
+  {
+    if (RecvPaused())
+    {
+      if (mKEXPending)
+      {
+        //Nothing more can be handled until the crypto pool is done
+        mbResumeRead = true;
+        break;
+      }
+
+      //Work through what we already have, leaving the rest of the data with the transport for now
+      HandleData();
+      continue;
+    }
+
+    //Make sure the packet we're waiting on will be contiguous once the rest of it arrives
+    PrepareRecvBuffer();
+
+    auto recievedBytes = mTransport->Recv(mRecvBuffer.WritePtr(), mRecvBuffer.WriteSpace());
+
+    if (!recievedBytes.has_value() || recievedBytes.value() == 0)
+    {
+      //Nothing more to read for now
+      break;
+    }
+
+    if (recievedBytes.value() == -1)
+    {
+      //User's recv function has signalled a failure to recv, simply disconnect to stop all further traffic.
+      Disconnect();
+      break;
+    }
+
+    /*
+      We received a number of bytes from the transport, simply hand them over
+      to the implementation to handle.
+    */
+    Log(LogLevel::Info, "Recieved %d bytes from remote!", recievedBytes.value());
+
+    mRecvBuffer.Commit(recievedBytes.value());
+    mLastRecv = mTimers->Now();
+    HandleData();
+    bReadAny = true;
+  }
+
+  return bReadAny;
+}
+
+ProcessResult Client::Impl::NextWait()
+{
+  ProcessResult result;
+  if (mState == State::Disconnected)
+  {
+    return result;
+  }
+
+  //The crypto stage does its own reading, and nothing more is read while key exchange work holds up what has been
+  if (!mCryptoStage.joinable() && !(mKEXPending && RecvPaused()))
+  {
+    result.mWantEvents |= IOEvent::Readable;
+  }
+
+  //A packet still being encrypted holds up everything behind it, whatever the transport says
+  if (mSendQueue.Sendable() || (mSendQueue.Empty() && (!mOutbound.Empty() || mScheduler.Pending())))
+  {
+    result.mWantEvents |= IOEvent::Writable;
+  }
+
+  //The crypto pool and receive pipeline wake a waiter when they have work for us, without one check back shortly
+  bool bBackgroundWork = (mKEXPending || mCryptoStage.joinable() || (!mSendQueue.Empty() && !mSendQueue.Sendable()));
+  if (bBackgroundWork && std::atomic_load(&mpWaiter) == nullptr)
+  {
+    result.mDeadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(1);
+  }
+
+  //Merged channel data has to be flushed even if nothing else happens
+  mChannels.ForEach([&](const TChannel& channel)
+  {
+    auto deadline = channel->FlushDeadline();
+    if (deadline.has_value() && (!result.mDeadline.has_value() || deadline.value() < result.mDeadline.value()))
+    {
+      result.mDeadline = deadline;
+    }
+  });
+
+  //A shared wheel is advanced by whoever shares it, and a timer of ours firing wakes us
+  auto timerDeadline = mbSharedTimers ? std::nullopt : mTimers->NextDeadline();
+  if (timerDeadline.has_value() && (!result.mDeadline.has_value() || timerDeadline.value() < result.mDeadline.value()))
+  {
+    result.mDeadline = timerDeadline;
+  }
+
+  return result;
+}
+
+void Client::Impl::SetTimerWheel(TTimerWheel pWheel)
+{
+  //Timers can't move between wheels, so they start again on the new one
+  mHandshakeTimer.Cancel();
+  mKeepaliveTimer.Cancel();
+  mIdleTimer.Cancel();
+
+  mTimers = (pWheel != nullptr) ? pWheel : std::make_shared<TimerWheel>();
+  mbSharedTimers = (pWheel != nullptr);
+  mTimedStage = ConStage::Null;
+}
+
+void Client::Impl::UpdateTimers()
+{
+  if (mState == State::Disconnected)
+  {
+    //Nothing left to time, and the client may be about to move off a shared wheel
+    mHandshakeTimer.Cancel();
+    mKeepaliveTimer.Cancel();
+    mIdleTimer.Cancel();
+    return;
+  }
+
+  auto now = TimerWheel::TClock::now();
+
+  //Sends can come from any thread, so they are only noticed here
+  UINT32 numSends = mNumSends.load(std::memory_order_relaxed);
+  if (numSends != mNumSendsSeen)
+  {
+    mNumSendsSeen = numSends;
+    mLastActivity = now;
+  }
+
+  mTimers->Advance(now);
+
+  if (mState == State::Disconnected || mStage == mTimedStage)
+  {
+    return;
+  }
+
+  mTimedStage = mStage;
+
+  if (mStage == ConStage::UserLoggedIn)
+  {
+    mHandshakeTimer.Cancel();
+    mLastRecv = now;
+    mLastActivity = now;
+    mKeepalivesMissed = 0;
+
+    if (mOpts.mKeepaliveIntervalMs > 0)
+    {
+      mTimers->Arm(mKeepaliveTimer, std::chrono::milliseconds(mOpts.mKeepaliveIntervalMs), [this]() { OnKeepaliveTimer(); });
+    }
+
+    if (mOpts.mIdleTimeoutMs > 0)
+    {
+      mTimers->Arm(mIdleTimer, std::chrono::milliseconds(mOpts.mIdleTimeoutMs), [this]() { OnIdleTimer(); });
+    }
+
+    return;
+  }
+
+  //Every handshake stage gets the full timeout, so a slow but steady handshake still completes
+  if (mStage != ConStage::Null && mOpts.mHandshakeTimeoutMs > 0)
+  {
+    ConStage stage = mStage;
+    mTimers->Arm(mHandshakeTimer, std::chrono::milliseconds(mOpts.mHandshakeTimeoutMs), [this, stage]()
+    {
+      Log(LogLevel::Error, "Timed out after %u ms waiting in stage %s", mOpts.mHandshakeTimeoutMs, StageToString(stage).c_str());
+      Disconnect();
+    });
+  }
+}
+
+void Client::Impl::OnKeepaliveTimer()
+{
+  auto interval = std::chrono::milliseconds(mOpts.mKeepaliveIntervalMs);
+  auto quiet = mTimers->Now() - mLastRecv;
+
+  if (quiet < interval)
+  {
+    //Heard from the remote since, so wait out the rest of the interval from then
+    mKeepalivesMissed = 0;
+    mTimers->Arm(mKeepaliveTimer, interval - quiet, [this]() { OnKeepaliveTimer(); });
+    return;
+  }
+
+  if (mOpts.mKeepaliveMaxMissed > 0 && mKeepalivesMissed >= mOpts.mKeepaliveMaxMissed)
+  {
+    Log(LogLevel::Error, "No response to %u keepalives, disconnecting", mKeepalivesMissed);
+    Disconnect();
+    return;
+  }
+
+  //Any reply at all will do, even a REQUEST_FAILURE from a server which doesn't know the request
+  TPacket pPacket = Messages::GlobalRequest::Create(mPacketStore, "keepalive@openssh.com", true);
+  if (pPacket != nullptr)
+  {
+    Queue(pPacket);
+  }
+
+  mKeepalivesMissed++;
+  mTimers->Arm(mKeepaliveTimer, interval, [this]() { OnKeepaliveTimer(); });
+}
+
+void Client::Impl::OnIdleTimer()
+{
+  auto timeout = std::chrono::milliseconds(mOpts.mIdleTimeoutMs);
+  auto idle = mTimers->Now() - mLastActivity;
 
-    if (!recievedBytes.has_value() || recievedBytes.value() == 0)
-    {
-      //No data received, nothing to do.
-      continue;
-    }
+  if (idle < timeout)
+  {
+    mTimers->Arm(mIdleTimer, timeout - idle, [this]() { OnIdleTimer(); });
+    return;
+  }
 
-    if (recievedBytes.value() == -1)
-    {
-      //User's recv function has signalled a failure to recv, simply disconnect to stop all further traffic.
-      Disconnect();
-      return;
-    }
+  bool bDisconnect = (mOpts.mOnIdle && mpOwner != nullptr) ? mOpts.mOnIdle(mpOwner) : true;
+  if (bDisconnect)
+  {
+    Log(LogLevel::Info, "Idle for %u ms, disconnecting", mOpts.mIdleTimeoutMs);
+    Disconnect();
+    return;
+  }
 
-    /*
-      We received a number of bytes from the transport, simply hand them over
-      to the implementation to handle.
-    */
-    Log(LogLevel::Info, "Recieved %d bytes from remote!", recievedBytes.value());
+  //Kept on, so it gets another full period
+  mLastActivity = mTimers->Now();
+  mTimers->Arm(mIdleTimer, timeout, [this]() { OnIdleTimer(); });
+}
 
-    HandleData(buf.Buffer(), recievedBytes.value());
+bool Client::Impl::RecvPaused() const
+{
+  if (mRecvQueueBytes >= mOpts.mMaxRecvQueueBytes || KEXHoldsRecv())
+  {
+    return true;
   }
+
+  //A full buffer can't be compacted, but it is at least mMaxPacketLen so always holds a whole packet to handle
+  return (mRecvBuffer.Readable() == mRecvBuffer.Capacity());
 }
 
-void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
+void Client::Impl::HandleData()
 {
   if (mState == State::Idle ||
       mState == State::Disconnected)
   {
-    Log(LogLevel::Error, "Recieved %d bytes of data from remote without being connected.", bufLen);
+    Log(LogLevel::Error, "Recieved %d bytes of data from remote without being connected.", mRecvBuffer.Readable());
     return;
   }
 
@@ -313,30 +1159,77 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
   if (mStage == ConStage::SentClientID)
   {
       //Now expecting that we're going to recieve the server's ID
-      if (!ReceiveServerIdent(pBuf, bufLen))
+      int identLen = ReceiveServerIdent(mRecvBuffer.ReadPtr(), mRecvBuffer.Readable());
+      if (identLen < 0)
       {
         Disconnect();
         return;
       }
 
+      if (identLen == 0)
+      {
+        //Wait for the rest of the ident line to arrive
+        return;
+      }
+
+      mRecvBuffer.Consume(identLen);
+
       SetStage(ConStage::SendClientKEXInit);
       SendClientKEXInit();
 
-      //Returning to allow for new data to populate our recv buffer
-      return;
+      //Any remaining bytes are the beginning of the binary packet protocol
   }
 
-  int bytesRemaining = bufLen;
-  int bytesConsumed = ConsumeBuffer(pBuf, bufLen);
-  if (bytesConsumed < 0)
+  //Whatever is already queued goes first, as it may change the keys the rest of the buffer needs
+  if (!DispatchPackets())
   {
-    Disconnect();
     return;
   }
 
-  bytesRemaining -= bytesConsumed;
+  /*
+    Parsing stops once mMaxRecvQueueBytes worth of packets are queued, so keep going
+    until everything complete in the buffer has been handled.
+  */
+  int bytesConsumed = 0;
+  do
+  {
+    bytesConsumed = ConsumeBuffer();
+    if (bytesConsumed < 0)
+    {
+      Disconnect();
+      break;
+    }
+
+    if (!DispatchPackets())
+    {
+      break;
+    }
+  } while (bytesConsumed > 0 && mRecvQueue.empty() && mState != State::Disconnected);
+
+  DeliverBatches();
+}
+
+void Client::Impl::DeliverBatches()
+{
+  for (const TChannel& channel : mBatchedChannels)
+  {
+    channel->DeliverBatch();
+    QueueWindowAdjust(*channel);
+  }
+
+  mBatchedChannels.clear();
+}
+
+bool Client::Impl::DispatchPackets()
+{
   while (!mRecvQueue.empty())
   {
+    if (mKEXPending || mState == State::Disconnected)
+    {
+      //Key exchange work is picked up again by Step once the crypto pool is done
+      break;
+    }
+
     TPacket pPacket = mRecvQueue.front();
     if (!pPacket->Ready())
     {
@@ -344,6 +1237,7 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
     }
 
     mRecvQueue.pop();
+    mRecvQueueBytes -= pPacket->PacketLen();
 
     switch (mStage)
     {
@@ -353,7 +1247,7 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
         if (!ReceiveServerKEXInit(pPacket))
         {
           Disconnect();
-          return;
+          return false;
         }
 
         SetStage(ConStage::ReceivedServerKEXInit);
@@ -368,14 +1262,13 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
       }
       case ConStage::SentClientDHInit:
       {
-        //Now expecting to receive the server's DH Kex Reply
+        //Now expecting to receive the server's DH Kex Reply, the stage moves on once it is verified
         if (!ReceiveServerDHReply(pPacket))
         {
           Disconnect();
-          return;
+          return false;
         }
 
-        SetStage(ConStage::ReceivedServerDHReply);
         break; //Allow for more packets to be handled
       }
       case ConStage::ReceivedServerDHReply:
@@ -384,7 +1277,7 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
         if (!ReceiveNewKeys(pPacket))
         {
           Disconnect();
-          return;
+          return false;
         }
 
         SetStage(ConStage::ReceivedNewKeys);
@@ -410,7 +1303,7 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
         if (!ReceiveServiceAccept(pPacket))
         {
           Disconnect();
-          return;
+          return false;
         }
 
         SetStage(ConStage::ReceivedServiceAccept);
@@ -436,7 +1329,10 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
             SetStage(ConStage::UserLoggedIn);
             SetState(State::Connected);
 
-            mOpts.mOnConnect(mpOwner);
+            if (mOpts.mOnConnect && mpOwner != nullptr)
+            {
+              mOpts.mOnConnect(mpOwner);
+            }
 
             break;
           }
@@ -460,14 +1356,14 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
             {
               Log(LogLevel::Info, "No more available authentication methods");
               Disconnect();
-              return;
+              return false;
             }
           }
           case UserAuthResponse::Failure:
           default:
           {
             Disconnect();
-            return;
+            return false;
           }
         }
 
@@ -478,7 +1374,7 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
         if (!ReceiveMessage(pPacket))
         {
           Disconnect();
-          return;
+          return false;
         }
         break;
       }
@@ -486,29 +1382,20 @@ void Client::Impl::HandleData(const Byte* pBuf, const int bufLen)
       {
         Log(LogLevel::Warning, "Unhandled data for (%s) state", StateToString(mState));
         Disconnect();
-        return;
+        return false;
       }
     }
   }
-}
 
-int Client::Impl::ParseNameList(NameList& list, const Byte* pBuf)
-{
-  UINT32 nameLen = swap_endian<uint32_t>(*(uint32_t*)pBuf);
-  list.Init(pBuf + sizeof(UINT32), nameLen);
-  return nameLen + sizeof(UINT32);
+  return true;
 }
 
-bool Client::Impl::ReceiveServerIdent(const Byte* pBuf, const int bufLen)
+int Client::Impl::ReceiveServerIdent(const Byte* pBuf, const int bufLen)
 {
   std::string serverIdent;
+  int identLen = 0;
   constexpr int minBufLen = 5;   //SSH-\LF
   constexpr int maxBufLen = 255; //RFC4253#section-4.2
-  if (bufLen < minBufLen)
-  {
-    Log(LogLevel::Error, "Malformed ServerIdent of %d bytes. MUST be > 6", bufLen);
-    return false;
-  };
 
   /*
     Although the SSH RFC REQUIRES servers to send <CR><LF>, some only send <LF>.
@@ -519,6 +1406,12 @@ bool Client::Impl::ReceiveServerIdent(const Byte* pBuf, const int bufLen)
   {
     if (pBuf[i] == LFbyte)
     {
+      if (i + 1 < minBufLen)
+      {
+        Log(LogLevel::Error, "Malformed ServerIdent of %d bytes. MUST be > 6", i + 1);
+        return -1;
+      }
+
       std::string ident;
       if (pBuf[i - 1] != CRbyte)
       {
@@ -533,20 +1426,27 @@ bool Client::Impl::ReceiveServerIdent(const Byte* pBuf, const int bufLen)
       if (i > maxBufLen)
       {
         Log(LogLevel::Error, "Malformed ServerIdent of %d bytes. MUST be < 255", i);
-        return false;
+        return -1;
       };
 
       //Found the ending byte
       serverIdent = ident;
+      identLen = i + 1;
       break;
     }
   }
 
   if (serverIdent.empty())
   {
+    if (bufLen <= maxBufLen)
+    {
+      //The rest of the line hasn't arrived yet
+      return 0;
+    }
+
     Log(LogLevel::Info, "Unable to parse ServerIdent");
     LogBuffer(LogLevel::Debug, "ServerIdent", pBuf, bufLen);
-    return false;
+    return -1;
   }
 
   Log(LogLevel::Info, "ServerIdent [%d]: %s", serverIdent.length(), serverIdent.c_str());
@@ -554,147 +1454,152 @@ bool Client::Impl::ReceiveServerIdent(const Byte* pBuf, const int bufLen)
 
   SetStage(ConStage::ReceivedServerID);
 
-  return true;
+  return identLen;
 }
 
-int Client::Impl::ConsumeBuffer(const Byte* pBuf, const int bufLen)
+int Client::Impl::TakePacket(TPacket& outPacket)
 {
-  int bytesRemaining = bufLen;
-  const Byte* pIter = pBuf;
+  Byte* pIter = mRecvBuffer.ReadPtr();
+  UINT32 bytesAvailable = mRecvBuffer.Readable();
 
-  //Packets in the rear of the recvQueue get first dibs on any new data
-  if (!mRecvQueue.empty())
+  if (mPendingPacketLen == 0)
   {
-    TPacket pPacket = mRecvQueue.back();
-
-    int bytesConsumed = pPacket->Consume(pIter, bufLen);
-    bytesRemaining -= bytesConsumed;
-    pIter += bytesConsumed;
-    Log(LogLevel::Info, "Packet (%d) consumed an additional [%d] bytes", pPacket->GetSequenceNumber(), bytesConsumed);
-
-    UINT32 bytesNeeded = pPacket->Remaining();
-    if (bytesNeeded == 0)
+    //Decrypting the header happens exactly once per packet, even if we have to wait for the rest of it
+    int packetLen = mPacketStore.DecryptHeader(pIter, bytesAvailable);
+    if (packetLen < 0 || packetLen > (int)mRecvBuffer.Capacity())
     {
-      Log(LogLevel::Info, "Queued packet (%d) [Payload: %u] is now ready!", pPacket->GetSequenceNumber(), pPacket->PayloadLen());
-
-      if (!pPacket->PrepareRead())
-      {
-        Log(LogLevel::Error, "Failed to prepare to read");
-        return -1;
-      }
+      return -1;
     }
-    else
+
+    if (packetLen == 0)
     {
-      Log(LogLevel::Info, "Queued packet (%d) is waiting for [%d] more bytes", pPacket->GetSequenceNumber(), bytesNeeded);
+      return 0;
     }
+
+    mPendingPacketLen = packetLen;
   }
 
-  while (bytesRemaining >= 4)
+  if (bytesAvailable < mPendingPacketLen)
   {
-    auto [pNewPacket, bytesConsumed] = mPacketStore.Create(pIter, bytesRemaining, mIncomingSequenceNumber, PacketType::Read);
-    if (!pNewPacket)
-    {
-      Log(LogLevel::Error, "Failed to allocate incoming packet (%d)!", mIncomingSequenceNumber);
-      return bytesRemaining;
-    }
+    //We have to wait for more data
+    return 0;
+  }
 
-    mIncomingSequenceNumber++;
-    bytesRemaining -= bytesConsumed;
-    pIter += bytesConsumed;
+  outPacket = mPacketStore.CreateView(pIter, mPendingPacketLen, mIncomingSequenceNumber++, mRecvBuffer.Owner());
+  mRecvBuffer.Consume(mPendingPacketLen);
+  mPendingPacketLen = 0;
+  return 1;
+}
 
-    mRecvQueue.push(pNewPacket);
+int Client::Impl::ConsumeBuffer()
+{
+  int bytesConsumed = 0;
+
+  while (mRecvQueueBytes < mOpts.mMaxRecvQueueBytes && !KEXHoldsRecv())
+  {
+    TPacket pNewPacket;
+    UINT32 bytesBefore = mRecvBuffer.Readable();
+    int result = TakePacket(pNewPacket);
+    if (result < 0)
+    {
+      Log(LogLevel::Error, "Malformed or oversized header for incoming packet (%d)", mIncomingSequenceNumber);
+      return -1;
+    }
 
-    UINT32 bytesNeeded = pNewPacket->Remaining();
-    if (bytesNeeded)
+    if (result == 0)
     {
-      //We have to wait for more data, pop this packet into the queue
-      Log(LogLevel::Debug, "Packet (%d) is waiting on [%d] bytes.", pNewPacket->GetSequenceNumber(), bytesNeeded);
+      if (mPendingPacketLen > 0)
+      {
+        Log(LogLevel::Debug, "Packet (%d) is waiting on [%d] bytes.", mIncomingSequenceNumber, mPendingPacketLen - mRecvBuffer.Readable());
+      }
       break;
     }
 
+    bytesConsumed += bytesBefore - mRecvBuffer.Readable();
+
     if (!pNewPacket->PrepareRead())
     {
       Log(LogLevel::Error, "Failed to prepare to read");
       return -1;
     }
 
+    mRecvQueue.push(pNewPacket);
+    mRecvQueueBytes += pNewPacket->PacketLen();
+
     Log(LogLevel::Info, "Packet (%d) [Payload: %u] now ready", pNewPacket->GetSequenceNumber(), pNewPacket->PayloadLen());
+
+    if (pNewPacket->PayloadLen() > 0 && pNewPacket->Payload()[0] == SSH_MSG::NEWKEYS)
+    {
+      //Everything after it needs the new keys, which are only set up once it is dispatched
+      break;
+    }
   }
 
-  return bufLen - bytesRemaining;
+  return bytesConsumed;
 }
 
 bool Client::Impl::ReceiveServerKEXInit(TPacket pPacket)
 {
-  Byte msgId;
-  Byte kexCookie[cKexCookieLength];
+  ByteView kexCookie;
+  bool bFirstKexFollows = false;
+  UINT32 reserved = 0;
 
-  //Verify this is a KEX packet
-  pPacket->Read(msgId);
-  if (msgId != SSH_MSG::KEXINIT)
+  /*
+    The payload is kept for the exchange hash anyway, so take that copy first and let the
+    server's algorithm lists refer straight into it rather than copying each of them.
+  */
+  mServerKex.mKEXInit = mPacketStore.Copy(pPacket);
+
+  //Verify this is a KEX packet and read all of the server's algorithms
+  bool bParsed = Messages::KEXInit::Parse(*mServerKex.mKEXInit,
+                                          kexCookie,
+                                          mServerKex.mAlgorithms.mKex,
+                                          mServerKex.mAlgorithms.mServerHost,
+                                          mServerKex.mAlgorithms.mEncryption.mClientToServer,
+                                          mServerKex.mAlgorithms.mEncryption.mServerToClient,
+                                          mServerKex.mAlgorithms.mMAC.mClientToServer,
+                                          mServerKex.mAlgorithms.mMAC.mServerToClient,
+                                          mServerKex.mAlgorithms.mCompression.mClientToServer,
+                                          mServerKex.mAlgorithms.mCompression.mServerToClient,
+                                          mServerKex.mAlgorithms.mLanguages.mClientToServer,
+                                          mServerKex.mAlgorithms.mLanguages.mServerToClient,
+                                          bFirstKexFollows,
+                                          reserved);
+  if (!bParsed)
   {
+    mServerKex.mKEXInit = nullptr;
     return false;
   }
 
-  pPacket->Read(kexCookie, cKexCookieLength);
-  pPacket->Read(mServerKex.mAlgorithms.mKex);
-  pPacket->Read(mServerKex.mAlgorithms.mServerHost);
-  pPacket->Read(mServerKex.mAlgorithms.mEncryption.mClientToServer);
-  pPacket->Read(mServerKex.mAlgorithms.mEncryption.mServerToClient);
-  pPacket->Read(mServerKex.mAlgorithms.mMAC.mClientToServer);
-  pPacket->Read(mServerKex.mAlgorithms.mMAC.mServerToClient);
-  pPacket->Read(mServerKex.mAlgorithms.mCompression.mClientToServer);
-  pPacket->Read(mServerKex.mAlgorithms.mCompression.mServerToClient);
-  pPacket->Read(mServerKex.mAlgorithms.mLanguages.mClientToServer);
-  pPacket->Read(mServerKex.mAlgorithms.mLanguages.mServerToClient);
-
   //TODO: Do some processing here to pick the right algorithms to initialise or whether to disconnect
 
-
-  mServerKex.mKEXInit = mPacketStore.Copy(pPacket);
-
   return true;
 }
 
 void Client::Impl::SendClientKEXInit()
 {
-  //Figure out the correct size of the packet
-  int requiredSize = sizeof(Byte) +
-                     cKexCookieLength +
-                     mClientKex.mAlgorithms.mKex.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mServerHost.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mEncryption.mClientToServer.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mEncryption.mServerToClient.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mMAC.mClientToServer.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mMAC.mServerToClient.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mCompression.mClientToServer.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mCompression.mServerToClient.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mLanguages.mClientToServer.Len() + sizeof(UINT32) +
-                     mClientKex.mAlgorithms.mLanguages.mServerToClient.Len() + sizeof(UINT32) +
-                     sizeof(Byte) +
-                     sizeof(UINT32);
-
-  auto pClientDataPacket = mPacketStore.Create(requiredSize, PacketType::Write);
-
-  pClientDataPacket->Write(SSH_MSG::KEXINIT);
-
-  Byte cookie[cKexCookieLength]; //TODO: Randomize this
-  memset(cookie, 0xBE, cKexCookieLength);
-  pClientDataPacket->Write(cookie, sizeof(cookie), Packet::WriteMethod::WithoutLength);
-
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mKex.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mServerHost.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mEncryption.mClientToServer.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mEncryption.mServerToClient.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mMAC.mClientToServer.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mMAC.mServerToClient.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mCompression.mClientToServer.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mCompression.mServerToClient.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mLanguages.mClientToServer.Str());
-  pClientDataPacket->Write(mClientKex.mAlgorithms.mLanguages.mServerToClient.Str());
-
-  pClientDataPacket->Write((Byte) false); //first_kex_packet_follows
-  pClientDataPacket->Write(0);            //Reserved UINT32
+  Byte cookie[cKexCookieLength];
+  if (!Random::Fill(cookie, cKexCookieLength))
+  {
+    Log(LogLevel::Error, "Failed to generate KEX cookie");
+    Disconnect();
+    return;
+  }
+
+  auto pClientDataPacket = Messages::KEXInit::Create(mPacketStore,
+                                                     cookie,
+                                                     mClientKex.mAlgorithms.mKex,
+                                                     mClientKex.mAlgorithms.mServerHost,
+                                                     mClientKex.mAlgorithms.mEncryption.mClientToServer,
+                                                     mClientKex.mAlgorithms.mEncryption.mServerToClient,
+                                                     mClientKex.mAlgorithms.mMAC.mClientToServer,
+                                                     mClientKex.mAlgorithms.mMAC.mServerToClient,
+                                                     mClientKex.mAlgorithms.mCompression.mClientToServer,
+                                                     mClientKex.mAlgorithms.mCompression.mServerToClient,
+                                                     mClientKex.mAlgorithms.mLanguages.mClientToServer,
+                                                     mClientKex.mAlgorithms.mLanguages.mServerToClient,
+                                                     false, //first_kex_packet_follows
+                                                     0);    //Reserved UINT32
 
   Queue(pClientDataPacket);
 
@@ -706,42 +1611,96 @@ void Client::Impl::SendClientKEXInit()
 void Client::Impl::SendClientDHInit()
 {
   mKEXHandler = KEX::CreateDH(DHGroups::G_14);
-  auto pKEXInitPacket = mKEXHandler->CreateInitPacket(mPacketStore);
-  if (!pKEXInitPacket)
+
+  //Generating our half of the shared secret is a large modexp, so it is done on the crypto pool
+  TKEXHandler pHandler = mKEXHandler;
+  PacketStore store = mPacketStore;
+  auto pInitPacket = std::make_shared<TPacket>();
+
+  RunKEXTask([pHandler, store, pInitPacket]() mutable
   {
-    Log(LogLevel::Error, "Failed to create DH init packet");
-    Disconnect();
-    return;
-  }
+    *pInitPacket = pHandler->CreateInitPacket(store);
+    return (*pInitPacket != nullptr);
+  },
+  [this, pInitPacket](bool bSuccess)
+  {
+    mKEXPending = false;
+    if (mState == State::Disconnected)
+    {
+      return;
+    }
+
+    if (!bSuccess)
+    {
+      Log(LogLevel::Error, "Failed to create DH init packet");
+      Disconnect();
+      return;
+    }
 
-  Queue(pKEXInitPacket);
+    Queue(*pInitPacket);
 
-  SetStage(ConStage::SentClientDHInit);
+    SetStage(ConStage::SentClientDHInit);
 
-  //Set keys now that we have a DH Init in progress
-  UINT32 blockLen = mKEXHandler->GetBlockSize();
-  UINT32 keyLen = mKEXHandler->GetKeySize();
-  UINT32 macLen = MAC::Len(MACHandlers::HMAC_SHA2_256);
-  mRemoteKeys.mIV.SetLen(blockLen);
-  mRemoteKeys.mEnc.SetLen(keyLen);
-  mRemoteKeys.mMac.SetLen(macLen);
+    //Set keys now that we have a DH Init in progress
+    UINT32 blockLen = mKEXHandler->GetBlockSize();
+    UINT32 keyLen = mKEXHandler->GetKeySize();
+    UINT32 macLen = MAC::Len(MACHandlers::HMAC_SHA2_256);
+    mRemoteKeys.mIV.SetLen(blockLen);
+    mRemoteKeys.mEnc.SetLen(keyLen);
+    mRemoteKeys.mMac.SetLen(macLen);
 
-  mLocalKeys.mIV.SetLen(blockLen);
-  mLocalKeys.mEnc.SetLen(keyLen);
-  mLocalKeys.mMac.SetLen(macLen);
+    mLocalKeys.mIV.SetLen(blockLen);
+    mLocalKeys.mEnc.SetLen(keyLen);
+    mLocalKeys.mMac.SetLen(macLen);
+  });
 }
 
 bool Client::Impl::ReceiveServerDHReply(TPacket pPacket)
 {
-  if (!mKEXHandler->VerifyReply(mServerKex, mClientKex, pPacket))
+  /*
+    Verifying the host key signature and computing the shared secret happen on the crypto pool.
+    The packet is a view into the receive buffer, which will have moved on by then, so work on a copy.
+  */
+  TKEXHandler pHandler = mKEXHandler;
+  TPacket pReply = mPacketStore.Copy(pPacket);
+  KEXData server = mServerKex;
+  KEXData client = mClientKex;
+
+  RunKEXTask([pHandler, pReply, server, client]() mutable
   {
-    Log(LogLevel::Error, "Failed to verify ServerDHReply");
-    Disconnect();
-    return false;
-  }
+    return pHandler->VerifyReply(server, client, pReply);
+  },
+  [this](bool bSuccess)
+  {
+    mKEXPending = false;
+    if (mState == State::Disconnected)
+    {
+      return;
+    }
+
+    if (!bSuccess)
+    {
+      Log(LogLevel::Error, "Failed to verify ServerDHReply");
+      Disconnect();
+      return;
+    }
+
+    Log(LogLevel::Info, "Verified ServerDHReply");
+
+    if (!GenerateKeys())
+    {
+      Disconnect();
+      return;
+    }
+
+    SetStage(ConStage::ReceivedServerDHReply);
+  });
 
-  Log(LogLevel::Info, "Verified ServerDHReply");
+  return (mState != State::Disconnected);
+}
 
+bool Client::Impl::GenerateKeys()
+{
   //If we don't already have a session ID, grab it from the KEX handler
   if (mSessionID.Len() == 0)
   {
@@ -835,8 +1794,7 @@ bool Client::Impl::ReceiveNewKeys(TPacket pPacket)
 
 void Client::Impl::SendNewKeys()
 {
-  TPacket pPacket = mPacketStore.Create(1, PacketType::Write);
-  pPacket->Write(SSH_MSG::NEWKEYS);
+  TPacket pPacket = Messages::NewKeys::Create(mPacketStore);
 
   //We can now activate MAC integrity for outgoing packets
   TMACHandler macHandler = MAC::Create(MACHandlers::HMAC_SHA2_256);
@@ -863,15 +1821,7 @@ void Client::Impl::SendNewKeys()
 
 void Client::Impl::SendServiceRequest()
 {
-  std::string userAuth = "ssh-userauth";
-  UINT32 packetLen = sizeof(Byte) +     //SSH_MSG
-                     sizeof(UINT32) +   //Length of string
-                     userAuth.length(); //String
-
-  TPacket pPacket = mPacketStore.Create(packetLen, PacketType::Write);
-
-  pPacket->Write(SSH_MSG::SERVICE_REQUEST);
-  pPacket->Write(userAuth);
+  TPacket pPacket = Messages::ServiceRequest::Create(mPacketStore, "ssh-userauth");
 
   Queue(pPacket);
 }
@@ -899,15 +1849,6 @@ void Client::Impl::SendUserAuthRequest(UserAuthMethod method)
   std::string methodName = AuthMethodToString(method);
   TPacket pPacket = nullptr;
 
-  //This packet length changes depending on what methods are used
-  UINT32 packetLen =  sizeof(Byte) +          //SSH_MSG
-                      sizeof(UINT32) +        //User name length field
-                      mOpts.mUserName.length() +    //User name
-                      sizeof(UINT32) +        //Service name length field
-                      serviceName.length() +  //Service name
-                      sizeof(UINT32) +        //Method name length field
-                      methodName.length();    //Method name
-
   Log(LogLevel::Info, "Attempting to login via %s method", methodName.c_str());
 
   switch (method)
@@ -924,30 +1865,20 @@ void Client::Impl::SendUserAuthRequest(UserAuthMethod method)
         return;
       }
 
-      packetLen +=  sizeof(Byte) +        //Password change request ("Usually false")
-                    sizeof(UINT32) +      //Password field length
-                    passwordLen.value();  //Password
-
-      pPacket = mPacketStore.Create(packetLen, PacketType::Write);
-
-      pPacket->Write(SSH_MSG::USERAUTH_REQUEST);
-      pPacket->Write(mOpts.mUserName);
-      pPacket->Write(serviceName);
-      pPacket->Write(methodName);
-      pPacket->Write(false);  //This is not a password change request
-      pPacket->Write(passwordBuffer.Buffer(), passwordLen.value());
+      ByteView password = { passwordBuffer.Buffer(), (UINT32)passwordLen.value() };
+      pPacket = Messages::UserAuthPassword::Create(mPacketStore,
+                                                   mOpts.mUserName,
+                                                   serviceName,
+                                                   methodName,
+                                                   false, //This is not a password change request
+                                                   password);
 
       break;
     }
     case UserAuthMethod::None:
     {
       //None is special and requires no other data
-      pPacket = mPacketStore.Create(packetLen, PacketType::Write);
-
-      pPacket->Write(SSH_MSG::USERAUTH_REQUEST);
-      pPacket->Write(mOpts.mUserName);
-      pPacket->Write(serviceName);
-      pPacket->Write(methodName);
+      pPacket = Messages::UserAuthNone::Create(mPacketStore, mOpts.mUserName, serviceName, methodName);
 
       break;
     }
@@ -975,19 +1906,24 @@ Client::Impl::UserAuthResponse Client::Impl::ReceiveUserAuth(TPacket pPacket)
     case SSH_MSG::USERAUTH_BANNER:
     {
       //We don't do anything with the banner messages at the moment but we can log them out regardless.
-      std::string bannerMessage;
-      pPacket->Read(bannerMessage);
-      Log(LogLevel::Info, "Banner Message: %s", bannerMessage.c_str());
+      std::string_view bannerMessage;
+      std::string_view languageTag;
+      Messages::UserAuthBanner::ParseBody(*pPacket, bannerMessage, languageTag);
+      Log(LogLevel::Info, "Banner Message: %.*s", (int)bannerMessage.length(), bannerMessage.data());
       return UserAuthResponse::Banner;
     }
     case SSH_MSG::USERAUTH_FAILURE:
     {
       NameList availableMethods;
-      Byte bPartialSuccess = 0;
-      pPacket->Read(availableMethods);
-      pPacket->Read(bPartialSuccess);
+      bool bPartialSuccess = false;
+      if (!Messages::UserAuthFailure::ParseBody(*pPacket, availableMethods, bPartialSuccess))
+      {
+        Log(LogLevel::Error, "Malformed userauth failure message");
+        return UserAuthResponse::Failure;
+      }
 
-      Log(LogLevel::Info, "Userauth Failure. Remaining methods [%s]", availableMethods.Str().c_str());
+      std::string_view methods = availableMethods.Str();
+      Log(LogLevel::Info, "Userauth Failure. Remaining methods [%.*s]", (int)methods.length(), methods.data());
       //TODO: Actually care about the methods the server sends us
 
       if (availableMethods.Len() == 0)
@@ -1014,32 +1950,39 @@ Client::Impl::UserAuthResponse Client::Impl::ReceiveUserAuth(TPacket pPacket)
 
 TChannel Client::Impl::GetChannel(TChannelID id)
 {
-  auto iter = std::find_if(mChannels.begin(), mChannels.end(), [&](TChannel channel)
-  {
-    return (channel->ID() == id);
-  });
-
-  return (iter == mChannels.end()) ? nullptr : *iter;
+  return mChannels.Get(id);
 }
 
-TChannelID Client::Impl::OpenChannel(ChannelTypes type, TOnEventFunc callback)
+TChannelID Client::Impl::OpenChannel(ChannelTypes type, TOnEventFunc callback, TOnDataFunc dataCallback)
 {
-  TChannel newChannel = Channel::Create(type, mNextChannelID++, callback);
-  if (newChannel == nullptr)
+  TPacket openPacket;
+  TChannelID channelID = mChannels.Insert([&](TChannelID id) -> TChannel
   {
-    return 0;
-  }
+    TChannel newChannel = Channel::Create(type, id, callback, dataCallback);
+    if (newChannel == nullptr)
+    {
+      return nullptr;
+    }
+
+    newChannel->SetCoalescing(mOpts.mCoalesceBytes, std::chrono::milliseconds(mOpts.mCoalesceDelayMs));
+    newChannel->SetSendBuffer(mOpts.mChannelSendBufferSize);
+
+    //Whatever the remote sends has to fit in an incoming packet, headers and all
+    UINT32 maxPacketSize = std::min(mOpts.mChannelMaxPacketSize, mOpts.mMaxPacketLen - std::min(mOpts.mMaxPacketLen, sChannelPacketOverhead));
+    newChannel->SetRecvWindow(mOpts.mChannelWindowSize, mOpts.mChannelMaxWindowSize, maxPacketSize);
 
-  TPacket openPacket = newChannel->CreateOpenPacket(mPacketStore);
-  if (openPacket == nullptr)
+    openPacket = newChannel->CreateOpenPacket(mPacketStore);
+    return (openPacket != nullptr) ? newChannel : nullptr;
+  });
+
+  if (channelID == 0)
   {
+    Log(LogLevel::Error, "Failed to open a new channel");
     return 0;
   }
 
   Queue(openPacket);
-  mChannels.push_back(newChannel);
-
-  return newChannel->ID();
+  return channelID;
 }
 
 bool Client::Impl::CloseChannel(TChannelID channelID)
@@ -1050,20 +1993,36 @@ bool Client::Impl::CloseChannel(TChannelID channelID)
     return false;
   }
 
-  if (oldChannel->State() == ChannelState::Open)
+  //The close goes out behind the channel's data, so it has to take its turn with the scheduler
+  if (oldChannel->Close(mPacketStore))
   {
-    TPacket closePacket = oldChannel->CreateClosePacket(mPacketStore);
-    if (closePacket == nullptr)
-    {
-      return false;
-    }
-
-    Queue(closePacket);
+    mScheduler.Wake(oldChannel);
+    Wake();
   }
 
   return true;
 }
 
+void Client::Impl::FinishClose(TChannelID channelID)
+{
+  TChannel channel = GetChannel(channelID);
+  if (channel == nullptr)
+  {
+    return;
+  }
+
+  if (channel->ResumeClose(mPacketStore))
+  {
+    mScheduler.Wake(channel);
+  }
+
+  //Both sides have closed, so the ID can go. The scheduler keeps the channel alive until its close is sent.
+  if (channel->State() == ChannelState::Closed)
+  {
+    mChannels.Remove(channelID);
+  }
+}
+
 bool Client::Impl::ReceiveMessage(TPacket pPacket)
 {
   Byte msgId;
@@ -1075,19 +2034,55 @@ bool Client::Impl::ReceiveMessage(TPacket pPacket)
   switch (msgId)
   {
     case SSH_MSG::CHANNEL_OPEN_CONFIRMATION:
+    case SSH_MSG::CHANNEL_WINDOW_ADJUST:
     case SSH_MSG::CHANNEL_DATA:
+    case SSH_MSG::CHANNEL_CLOSE:
     {
       TChannelID recipientChannelID = 0;
       pPacket->Read(msgId);
       pPacket->Read(recipientChannelID);
 
-      TChannel channel = GetChannel(recipientChannelID);
-      if (channel == nullptr)
+      //Only this thread removes channels, so the table can be read without taking a reference
+      IChannel* pChannel = mChannels.Find(recipientChannelID);
+      if (pChannel == nullptr)
+      {
+        Log(LogLevel::Error, "Message %u for unknown channel %u", msgId, recipientChannelID);
+        return false;
+      }
+
+      if (msgId == SSH_MSG::CHANNEL_DATA)
       {
+        mLastActivity = mTimers->Now();
+      }
+      else
+      {
+        //Data received before anything else on the channel is delivered before it
+        pChannel->DeliverBatch();
+      }
+
+      if (!pChannel->HandleData(msgId, pPacket))
+      {
+        Log(LogLevel::Error, "Channel %u rejected message %u, the remote may have overrun its window", recipientChannelID, msgId);
         return false;
       }
 
-      channel->HandleData(msgId, pPacket);
+      if (msgId == SSH_MSG::CHANNEL_OPEN_CONFIRMATION || msgId == SSH_MSG::CHANNEL_CLOSE)
+      {
+        FinishClose(recipientChannelID);
+        break;
+      }
+
+      if (pChannel->NumBatched() > 0)
+      {
+        //The window is handed back once the batch has been delivered
+        if (pChannel->NumBatched() == 1)
+        {
+          mBatchedChannels.push_back(pChannel->shared_from_this());
+        }
+        break;
+      }
+
+      QueueWindowAdjust(*pChannel);
 
       break;
     }
@@ -1111,8 +2106,61 @@ void Client::Impl::Connect()
 
   SetState(State::Connecting);
 
-  Log(LogLevel::Debug, "Starting poll async call");
-  auto fut = std::async(std::launch::async, &Impl::Poll, this);
+  if (mOpts.mRunMode == RunMode::Thread)
+  {
+    Start();
+  }
+
+  //Otherwise the caller drives the connection from here with Process
+}
+
+void Client::Impl::Start()
+{
+  if (mIOThread.joinable())
+  {
+    Log(LogLevel::Warning, "I/O thread is already running");
+    return;
+  }
+
+  Log(LogLevel::Debug, "Starting I/O thread");
+  mStopRequested = false;
+  std::lock_guard<std::mutex> lock(mIOThreadMutex);
+  mIOThread = std::thread([pSelf = shared_from_this()]()
+  {
+    {
+      std::lock_guard<std::mutex> started(pSelf->mIOThreadMutex);
+    }
+
+    pSelf->Poll();
+  });
+}
+
+void Client::Impl::Stop()
+{
+  mStopRequested = true;
+  Wake();
+
+  if (mIOThread.joinable() && mIOThread.get_id() != std::this_thread::get_id())
+  {
+    mIOThread.join();
+  }
+
+  StopPipeline();
+}
+
+void Client::Impl::ReleaseOwner()
+{
+  //Once Stop returns nothing else is running, unless we are on the I/O thread itself
+  Stop();
+  mpOwner = nullptr;
+}
+
+void Client::Impl::Join()
+{
+  if (mIOThread.joinable() && mIOThread.get_id() != std::this_thread::get_id())
+  {
+    mIOThread.join();
+  }
 }
 
 void Client::Impl::Disconnect()
@@ -1120,5 +2168,12 @@ void Client::Impl::Disconnect()
   Log(LogLevel::Info, "Disconnecting client");
   SetState(State::Disconnected);
   SetStage(ConStage::Null);
+
+  //Whoever drives the connection may be asleep, and has to notice that it is finished
+  Wake();
+  WakeCryptoStage();
+
+  //As do senders waiting for room that will now never come
+  NotifyOutboundRoom();
 }
 
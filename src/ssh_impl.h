@@ -5,9 +5,24 @@
 #include "name-list.h"
 #include "packets.h"
 #include "channels.h"
+#include "recv-buffer.h"
+#include "send-queue.h"
+#include "io-waiter.h"
+#include "mpsc-queue.h"
+#include "spsc-ring.h"
+#include "crypto-pool.h"
+#include "channel-scheduler.h"
+#include "channel-table.h"
+#include "timer-wheel.h"
 #include "kex/kex.h"
 #include "crypto/crypto.h"
 #include <queue>
+#include <deque>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
 
 namespace SSH
 {
@@ -43,12 +58,18 @@ namespace SSH
   class IPacket;
   class Client;
 
-  class Client::Impl
+  class Client::Impl : public std::enable_shared_from_this<Client::Impl>
   {
   private:
     static const int sMaxLogLength = 256;
     using TPacketQueue = std::queue<TPacket>;
 
+    //Room left in mMaxPacketLen around a channel's data for its headers, padding and MAC
+    static constexpr UINT32 sChannelPacketOverhead = 1024;
+
+    //Channel data is only moved onto the send queue while it holds less than this
+    static constexpr size_t sMaxScheduledBytes = 64 * 1024;
+
     enum class UserAuthResponse
     {
       Success, // A userauth method responded was successful, the user is now logged in
@@ -63,24 +84,96 @@ namespace SSH
     UserAuthMethod mActiveAuthMethod;
 
     TCtx mCtx;
-    State mState;
+    TTransport mTransport;
+    std::atomic<State> mState;
     ConStage mStage;
-    Client* mpOwner;
+    Client* mpOwner; //Cleared once the Client is destroyed, callbacks which would be handed it are skipped
+
+    RecvBuffer mRecvBuffer;
+    UINT32 mPendingPacketLen = 0; //Full size of the packet at the front of mRecvBuffer, once its header is decrypted
+
+    /*
+      The I/O thread, when running in RunMode::Thread. It holds a reference to us until it finishes,
+      so the Client may be destroyed from one of its own callbacks.
+    */
+    std::thread mIOThread;
+    std::mutex mIOThreadMutex; //Held by Start until mIOThread is set, which the thread itself looks at
+    std::atomic<bool> mStopRequested = false;
+
+    /*
+      Whoever sleeps while the connection has nothing to do, the I/O thread or a reactor's worker.
+      Other threads wake it whenever they hand the connection work. Only touched through std::atomic_load/store.
+    */
+    TIOWaiter mpWaiter;
+    bool mbStepping = false; //Set while the thread driving the connection is inside Step
 
     TPacketQueue mRecvQueue;
-    TPacketQueue mSendQueue;
+    UINT32 mRecvQueueBytes = 0; //Sum of the packet lengths waiting in mRecvQueue
+
+    /*
+      Packets queued from threads other than the one driving the connection wait in mOutbound.
+      The driving thread moves them to mSendQueue, assigning sequence numbers and encrypting as it goes,
+      so mSendQueue and mOutgoingSequenceNumber are only ever touched by that one thread.
+    */
+    MPSCQueue<TPacket> mOutbound;
+    SendQueue mSendQueue;
+
+    //Threads waiting on a full mOutbound sleep on this, notified once DrainOutbound makes room or the client disconnects
+    std::mutex mOutboundMutex;
+    std::condition_variable mOutboundRoom;
+    std::atomic<std::thread::id> mConsumerThread;
 
     KEXData mServerKex;
     KEXData mClientKex;
     TKEXHandler mKEXHandler;
 
+    //Optional receive pipeline, see ClientOptions::mPipelineRecv
+    std::thread mCryptoStage;
+    SPSCRing<TPacket> mDecrypted; //Verified packets on their way from the crypto stage to dispatch
+    bool mPipelineStarted = false;
+    std::atomic<bool> mPipelineStop = false;
+    std::atomic<bool> mPipelineFinished = false;
+    std::atomic<bool> mPipelineFailed = false;
+    TIOWaiter mpStageWaiter; //What the crypto stage sleeps on while it waits for the transport or for room in mDecrypted, only touched through std::atomic_load/store
+
+    //Work finished on the crypto pool, waiting to be picked up by the thread driving the connection
+    TCompletionQueue mCompletions;
+    bool mKEXPending = false; //Incoming packets wait while key exchange work is running on the pool
+
+    /*
+      Reading stopped early, for key exchange work or the crypto stage, so the transport may hold data
+      which no readiness event will announce again. The next Step reads regardless.
+    */
+    bool mbResumeRead = false;
+
+    /*
+      Handshake, keepalive and idle timeouts. The wheel is the client's own unless a reactor shares one
+      between the clients on a thread; either way it is only advanced by the thread driving the connection.
+    */
+    TTimerWheel mTimers;
+    bool mbSharedTimers = false; //Whoever shares the wheel advances it, so its deadline isn't ours to wait on
+    Timer mHandshakeTimer;
+    Timer mKeepaliveTimer;
+    Timer mIdleTimer;
+    ConStage mTimedStage = ConStage::Null; //Stage the timers were last set up for
+    TimerWheel::TClock::time_point mLastRecv; //Anything at all from the remote
+    TimerWheel::TClock::time_point mLastActivity; //Channel data in either direction
+    UINT32 mKeepalivesMissed = 0;
+    std::atomic<UINT32> mNumSends = 0; //Bumped by Send from any thread, so sends count as activity
+    UINT32 mNumSendsSeen = 0;
+
     UINT32 mIncomingSequenceNumber;
     UINT32 mOutgoingSequenceNumber;
 
     PacketStore mPacketStore;
 
-    TChannelVec mChannels;
-    TChannelID mNextChannelID = 1;
+    ChannelTable mChannels;
+
+    //Channels with data batched up from the current read, delivered once it has all been handled
+    std::vector<TChannel> mBatchedChannels;
+
+    //Channels with packets ready, in the order they should go out
+    ChannelScheduler mScheduler;
 
     //These are the Server to Client keys
     struct
@@ -105,23 +198,45 @@ namespace SSH
     void SetStage(ConStage newStage);
     void SetState(State newState);
 
-    void HandleData(const Byte* pBuf, const int bufLen);
+    void HandleData();
+    /*
+      Consumes as many complete packets as possible from mRecvBuffer.
+      Packets are views into the receive buffer and are only valid until the next read.
+      Returns number of bytes consumed, or -1 on a malformed packet.
+    */
+    int ConsumeBuffer();
+
+    /*
+      Takes the next complete packet from the front of mRecvBuffer, as a view which is still to be prepared.
+      Returns 1 with outPacket set, 0 if more data is needed, or -1 if the header is malformed.
+      Doesn't log, so the pipeline's crypto stage can use it.
+    */
+    int TakePacket(TPacket& outPacket);
+
     /*
-      Consumes as many bytes as possible from the buffer to form packets.
-      Returns number of bytes consumed.
+      Handles every ready packet in mRecvQueue for the current stage.
+      Returns false if the connection was dropped as a result.
     */
-    int ConsumeBuffer(const Byte* pBuf, const int bufLen);
+    bool DispatchPackets();
 
-    //Returns number of bytes consumed
-    int ParseNameList(NameList& list, const Byte* pBuf);
+    //True when we should handle what has already been received before reading any more
+    bool RecvPaused() const;
 
-    bool ReceiveServerIdent(const Byte* pBuf, const int bufLen);
+    /*
+      Key exchange work is holding up a queued packet, and whatever follows it may need the keys that work
+      produces (E.G. everything after NEWKEYS), so nothing more is read or parsed until it is done.
+    */
+    bool KEXHoldsRecv() const { return (mKEXPending && !mRecvQueue.empty()); }
+
+    //Returns number of bytes consumed, 0 if more data is needed, or -1 on failure
+    int ReceiveServerIdent(const Byte* pBuf, const int bufLen);
 
     //Transport Stages
     void SendClientKEXInit();
     bool ReceiveServerKEXInit(TPacket pPacket);
     void SendClientDHInit();
     bool ReceiveServerDHReply(TPacket pPacket);
+    bool GenerateKeys();
     bool ReceiveNewKeys(TPacket pPacket);
     void SendNewKeys();
 
@@ -137,28 +252,139 @@ namespace SSH
     */
     bool ReceiveMessage(TPacket pPacket);
 
-    TResult Send(std::shared_ptr<Packet> pPacket);
     TResult Raw_Send(const Byte* pBuf, const int bufLen);
 
+    //Writes as many queued packets as the transport will take, in as few calls as possible
+    void FlushSendQueue();
+
     TChannel GetChannel(TChannelID id);
 
+    //Tops up the send queue with channel packets, in the order the scheduler picks. Consumer only.
+    void ScheduleChannels();
+
+    //Gives window back to the remote once enough of the channel's data has been consumed
+    void QueueWindowAdjust(IChannel& channel);
+
+    //Sends any close still owed once a channel is confirmed or closed by the remote, and drops it once both sides have closed
+    void FinishClose(TChannelID channelID);
+
+    /*
+      Hands each channel's batched data to its data callback. Called once everything from a read
+      has been handled, and before the receive buffer can be reused.
+    */
+    void DeliverBatches();
+
+    //True when called from the thread currently driving the connection
+    bool OnConsumerThread() const { return (mConsumerThread.load() == std::this_thread::get_id()); }
+
+    //Numbers, encrypts and moves a packet onto mSendQueue. Consumer only.
+    void PushSendQueue(const TPacket& pPacket);
+
+    /*
+      Runs task on the crypto pool (or straight away when mOffloadKEX is off), then onDone with
+      its result on the thread driving the connection. Incoming packets are held until then.
+      task must not touch the connection itself, only what it has captured.
+    */
+    void RunKEXTask(std::function<bool()> task, std::function<void(bool)> onDone);
+
+    //Moves everything other threads have queued onto mSendQueue. Consumer only.
+    void DrainOutbound();
+
+    //Wakes senders waiting in Queue for mOutbound to have room
+    void NotifyOutboundRoom();
+
+    //Queues without waiting, returns false if the outbound queue is full
+    bool TryQueue(const TPacket& pPacket);
+
+    //Flushes channel data which has waited longer than the coalesce delay
+    void FlushChannels();
+
+    //Reads and handles everything the transport has available, returns false if nothing was read
+    bool ReadTransport();
+
+    //Makes room for the packet being waited on, moving the transport over if the receive buffer moves
+    void PrepareRecvBuffer();
+
+    //Body of the I/O thread, runs until disconnected or asked to stop
+    void Poll();
+
+    //Wakes whoever is waiting on the connection's behalf, unless that is the caller and it is already busy with it
+    void Wake();
+
+    //Wakes the crypto stage if it is waiting on the transport, so it notices it has been stopped
+    void WakeCryptoStage();
+
+    /*
+      The receive pipeline's first stage: reads, decrypts and verifies packets in order on its own thread.
+      Finishes when stopped, on failure, or after passing on a KEXINIT (the keys after it have to be
+      set up by the dispatch stage, so reading goes back to ReadTransport).
+    */
+    void CryptoStage();
+
+    //The receive pipeline's second stage: dispatches whatever the crypto stage has handed over
+    bool DispatchPipeline();
+
+    void StopPipeline();
+
+    //Fires whatever timers are due, then arms the ones the current stage needs
+    void UpdateTimers();
+    void OnKeepaliveTimer();
+    void OnIdleTimer();
+
   public:
     Impl(ClientOptions& options, TCtx& ctx, Client* pOwner);
     ~Impl();
 
+    //Safe to call from any thread, sleeps until there is space if the outbound queue is full
     void Queue(std::shared_ptr<Packet> pPacket);
 
-    void Poll();
-
     void Connect();
     void Disconnect();
 
+    void Start();
+    void Stop();
+    void Join();
+
+    //Called as the Client goes away, after which the I/O thread only runs on to finish
+    void ReleaseOwner();
+
+    ProcessResult Process(TIOEvents events);
+
+    //A single pass of sending and receiving, returns false if nothing was received
+    bool Step(TIOEvents events);
+
+    //Works out which events and deadline the next Step is waiting on
+    ProcessResult NextWait();
+
+    //Sets (or with null, clears) who is woken when other threads hand the connection work
+    void SetWaiter(TIOWaiter pWaiter) { std::atomic_store(&mpWaiter, pWaiter); }
+
+    //Moves packet allocation over to another (possibly shared) pool, packets already in flight keep their own. Safe while sending.
+    void SetPacketPool(TPacketPool pPool) { mPacketStore.SetPool(pPool); }
+
+    /*
+      Moves the client's timers over to another (possibly shared) wheel, or back to a wheel of its own when null.
+      Must be called from the thread driving the connection, or while nothing is.
+    */
+    void SetTimerWheel(TTimerWheel pWheel);
+
+    RunMode GetRunMode() const { return mOpts.mRunMode; }
+
+    //Descriptor to sleep on until the transport is ready, and what to wait on it for (see ITransport::WaitFD)
+    int GetWaitFD() const { return mTransport->WaitFD(); }
+    TIOEvents GetWaitEvents(TIOEvents events) const { return mTransport->WaitEvents(events); }
+
     TResult Send(TChannelID channelID, const Byte* pBuf, const int bufLen);
+    bool Cork(TChannelID channelID);
+    bool Uncork(TChannelID channelID);
+    bool SetChannelPriority(TChannelID channelID, ChannelPriority priority, UINT32 weight);
+    bool Consume(TChannelID channelID, UINT32 numBytes);
 
-    TChannelID OpenChannel(ChannelTypes type, TOnEventFunc callback);
+    TChannelID OpenChannel(ChannelTypes type, TOnEventFunc callback, TOnDataFunc dataCallback = nullptr);
     bool CloseChannel(TChannelID channelID);
 
     State GetState() const { return mState; }
+    PacketPoolStats GetPacketPoolStats() const { return mPacketStore.PoolStats(); }
   };
 }
 
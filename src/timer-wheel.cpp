@@ -0,0 +1,200 @@
+#include "timer-wheel.h"
+
+using namespace SSH;
+
+void Timer::Cancel()
+{
+  if (mpWheel != nullptr)
+  {
+    mpWheel->Cancel(*this);
+  }
+}
+
+TimerWheel::TimerWheel(TClock::duration tick, TClock::time_point now)
+  : mTick(tick)
+  , mStart(now)
+  , mNow(now)
+{}
+
+TimerWheel::~TimerWheel()
+{
+  //Anything still armed outlives us, so make sure it doesn't point back here
+  for (UINT32 level = 0; level < sNumLevels; ++level)
+  {
+    for (UINT32 slot = 0; slot < sNumSlots; ++slot)
+    {
+      while (mSlots[level][slot] != nullptr)
+      {
+        Unlink(*mSlots[level][slot]);
+      }
+    }
+  }
+}
+
+uint64_t TimerWheel::ToTick(TClock::time_point time) const
+{
+  if (time <= mStart)
+  {
+    return 0;
+  }
+
+  return (uint64_t)((time - mStart) / mTick);
+}
+
+void TimerWheel::Insert(Timer& timer)
+{
+  //Anything already due goes in the slot which is processed next
+  uint64_t expiry = std::max(timer.mExpiry, mCurrentTick);
+  uint64_t delta = std::min(expiry - mCurrentTick, sMaxTicks);
+  expiry = mCurrentTick + delta;
+  timer.mExpiry = expiry;
+
+  UINT32 level = 0;
+  while (level + 1 < sNumLevels && delta >= ((uint64_t)1 << (sSlotBits * (level + 1))))
+  {
+    level++;
+  }
+
+  Timer*& pHead = mSlots[level][(expiry >> (sSlotBits * level)) & sSlotMask];
+  timer.mpPrev = nullptr;
+  timer.mpNext = pHead;
+  if (pHead != nullptr)
+  {
+    pHead->mpPrev = &timer;
+  }
+  pHead = &timer;
+
+  timer.mpWheel = this;
+  mNumTimers++;
+}
+
+void TimerWheel::Unlink(Timer& timer)
+{
+  if (timer.mpPrev != nullptr)
+  {
+    timer.mpPrev->mpNext = timer.mpNext;
+  }
+  else
+  {
+    //Head of its slot, which has to be found again from its expiry
+    for (UINT32 level = 0; level < sNumLevels; ++level)
+    {
+      Timer*& pHead = mSlots[level][(timer.mExpiry >> (sSlotBits * level)) & sSlotMask];
+      if (pHead == &timer)
+      {
+        pHead = timer.mpNext;
+        break;
+      }
+    }
+  }
+
+  if (timer.mpNext != nullptr)
+  {
+    timer.mpNext->mpPrev = timer.mpPrev;
+  }
+
+  timer.mpPrev = nullptr;
+  timer.mpNext = nullptr;
+  timer.mpWheel = nullptr;
+  mNumTimers--;
+}
+
+void TimerWheel::Arm(Timer& timer, TClock::duration delay, TTimerFunc func)
+{
+  timer.Cancel();
+
+  //Round up so a timer never fires early, and always at least a tick away so re-arming from its own callback can't spin
+  uint64_t ticks = (uint64_t)((delay + mTick - TClock::duration(1)) / mTick);
+  timer.mExpiry = mCurrentTick + std::max<uint64_t>(ticks, 1);
+  timer.mFunc = std::move(func);
+  Insert(timer);
+}
+
+void TimerWheel::Cancel(Timer& timer)
+{
+  if (timer.mpWheel == this)
+  {
+    Unlink(timer);
+  }
+}
+
+void TimerWheel::Cascade(UINT32 level)
+{
+  Timer*& pHead = mSlots[level][(mCurrentTick >> (sSlotBits * level)) & sSlotMask];
+  Timer* pTimer = pHead;
+  pHead = nullptr;
+
+  while (pTimer != nullptr)
+  {
+    Timer* pNext = pTimer->mpNext;
+    mNumTimers--;
+    Insert(*pTimer);
+    pTimer = pNext;
+  }
+}
+
+void TimerWheel::Advance(TClock::time_point now)
+{
+  mNow = now;
+  uint64_t targetTick = ToTick(now);
+
+  while (mCurrentTick <= targetTick)
+  {
+    if (mNumTimers == 0)
+    {
+      //Nothing to fire on the way, so skip straight there
+      mCurrentTick = targetTick + 1;
+      break;
+    }
+
+    //Each time a level wraps around, the next slot up comes down to fill it
+    for (UINT32 level = 1; level < sNumLevels; ++level)
+    {
+      if (((mCurrentTick >> (sSlotBits * (level - 1))) & sSlotMask) != 0)
+      {
+        break;
+      }
+
+      Cascade(level);
+    }
+
+    Timer*& pHead = mSlots[0][mCurrentTick & sSlotMask];
+    while (pHead != nullptr)
+    {
+      Timer& timer = *pHead;
+      Unlink(timer);
+
+      //Moved out first, the callback is free to re-arm the timer with a new one
+      TTimerFunc func = std::move(timer.mFunc);
+      func();
+    }
+
+    mCurrentTick++;
+  }
+}
+
+std::optional<TimerWheel::TClock::time_point> TimerWheel::NextDeadline() const
+{
+  if (mNumTimers == 0)
+  {
+    return {};
+  }
+
+  //Exact if something is due before level 0 wraps, otherwise the wrap itself (which may bring timers down)
+  uint64_t ticks = 0;
+  for (; ticks < sNumSlots; ++ticks)
+  {
+    uint64_t tick = mCurrentTick + ticks;
+    if (mSlots[0][tick & sSlotMask] != nullptr)
+    {
+      break;
+    }
+
+    if (ticks > 0 && (tick & sSlotMask) == 0)
+    {
+      break;
+    }
+  }
+
+  return mStart + mTick * (mCurrentTick + ticks);
+}
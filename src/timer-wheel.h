@@ -0,0 +1,110 @@
+#ifndef __TIMER_WHEEL_H__
+#define __TIMER_WHEEL_H__
+
+#include "ssh.h"
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+
+namespace SSH
+{
+  class TimerWheel;
+
+  using TTimerFunc = std::function<void()>;
+
+  /*
+    A single timeout, owned by whatever it is timing. Arming and cancelling are O(1), and it
+    cancels itself when destroyed. Only ever touched from the thread driving its wheel.
+  */
+  class Timer
+  {
+  private:
+    friend class TimerWheel;
+
+    TimerWheel* mpWheel = nullptr; //Set while armed
+    Timer* mpPrev = nullptr;
+    Timer* mpNext = nullptr;
+    uint64_t mExpiry = 0; //Tick the timer fires on
+    TTimerFunc mFunc;
+
+  public:
+    Timer() = default;
+    ~Timer() { Cancel(); }
+
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    bool Armed() const { return (mpWheel != nullptr); }
+    void Cancel();
+  };
+
+  /*
+    Hierarchical timer wheel, so any number of connections can share one without a sorted
+    container or a thread per timer. Four levels of 64 slots each cover 64^4 ticks; timers
+    further out than that are clamped. A timer starts in the level whose slots are just wide
+    enough to hold it, and moves down a level each time the level below wraps around, so
+    every timer is touched at most once per level.
+
+    Time only moves when Advance is called, which is also when timers fire. Not thread safe,
+    every wheel belongs to a single event loop.
+  */
+  class TimerWheel
+  {
+  public:
+    using TClock = std::chrono::steady_clock;
+
+  private:
+    static constexpr UINT32 sSlotBits = 6;
+    static constexpr UINT32 sNumSlots = 1 << sSlotBits;
+    static constexpr UINT32 sSlotMask = sNumSlots - 1;
+    static constexpr UINT32 sNumLevels = 4;
+    static constexpr uint64_t sMaxTicks = (1ull << (sSlotBits * sNumLevels)) - 1;
+
+    TClock::duration mTick;
+    TClock::time_point mStart;
+    TClock::time_point mNow; //As of the last Advance
+    uint64_t mCurrentTick = 0; //Next tick to process, everything before it has fired
+    size_t mNumTimers = 0;
+
+    Timer* mSlots[sNumLevels][sNumSlots] = {};
+
+    void Insert(Timer& timer);
+    void Unlink(Timer& timer);
+
+    //Moves every timer in the level's current slot down to where it now belongs
+    void Cascade(UINT32 level);
+
+    uint64_t ToTick(TClock::time_point time) const;
+
+  public:
+    explicit TimerWheel(TClock::duration tick = std::chrono::milliseconds(10), TClock::time_point now = TClock::now());
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    //(Re)arms timer to call func once delay has passed, rounded up to a whole tick
+    void Arm(Timer& timer, TClock::duration delay, TTimerFunc func);
+    void Cancel(Timer& timer);
+
+    //Fires every timer which is due by now. Timers may arm or cancel others (or themselves) as they fire.
+    void Advance(TClock::time_point now);
+
+    //Time of the last Advance, cheaper than reading the clock again
+    TClock::time_point Now() const { return mNow; }
+
+    /*
+      When Advance next needs calling, or nothing if no timers are armed.
+      May be early, but never late.
+    */
+    std::optional<TClock::time_point> NextDeadline() const;
+
+    size_t NumTimers() const { return mNumTimers; }
+  };
+
+  using TTimerWheel = std::shared_ptr<TimerWheel>;
+}
+
+#endif //~__TIMER_WHEEL_H__
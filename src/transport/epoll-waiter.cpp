@@ -0,0 +1,100 @@
+#ifdef __linux__
+
+#include "ssh.h"
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+
+using namespace SSH;
+
+EpollWaiter::EpollWaiter(int fd)
+  : mEpollFD(epoll_create1(EPOLL_CLOEXEC))
+  , mFD(fd)
+{
+  epoll_event event = {};
+  event.data.fd = mFD;
+  if (epoll_ctl(mEpollFD, EPOLL_CTL_ADD, mFD, &event) != 0)
+  {
+    close(mEpollFD);
+    mEpollFD = -1;
+  }
+}
+
+EpollWaiter::EpollWaiter(const TTransport& pTransport)
+  : EpollWaiter(pTransport->WaitFD())
+{
+  mpTransport = pTransport;
+}
+
+EpollWaiter::~EpollWaiter()
+{
+  if (mEpollFD >= 0)
+  {
+    close(mEpollFD);
+  }
+}
+
+TIOEvents EpollWaiter::Wait(const ProcessResult& result)
+{
+  if (mEpollFD < 0 || (result.mWantEvents == IOEvent::None && !result.mDeadline.has_value()))
+  {
+    return IOEvent::None;
+  }
+
+  TIOEvents wanted = (mpTransport != nullptr) ? mpTransport->WaitEvents(result.mWantEvents) : result.mWantEvents;
+
+  //Level triggered, and only re-registered when the client changes what it wants
+  if (wanted != mRegistered)
+  {
+    epoll_event event = {};
+    event.data.fd = mFD;
+    event.events = ((wanted & IOEvent::Readable) ? (UINT32)EPOLLIN : 0) |
+                   ((wanted & IOEvent::Writable) ? (UINT32)EPOLLOUT : 0);
+
+    if (epoll_ctl(mEpollFD, EPOLL_CTL_MOD, mFD, &event) != 0)
+    {
+      return IOEvent::None;
+    }
+
+    mRegistered = wanted;
+  }
+
+  int timeoutMs = -1;
+  if (result.mDeadline.has_value())
+  {
+    auto remaining = result.mDeadline.value() - std::chrono::steady_clock::now();
+
+    //Round up, waking early would only mean coming straight back here
+    auto remainingMs = std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+    timeoutMs = (int)std::clamp<long long>(remainingMs, 0, 60 * 1000);
+  }
+
+  epoll_event event = {};
+  int numEvents = 0;
+  do
+  {
+    numEvents = epoll_wait(mEpollFD, &event, 1, timeoutMs);
+  } while (numEvents < 0 && errno == EINTR);
+
+  if (numEvents <= 0)
+  {
+    return IOEvent::None;
+  }
+
+  //Errors and hangups are reported as readable, so the next read finds out what happened
+  TIOEvents events = IOEvent::None;
+  if (event.events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+  {
+    events |= IOEvent::Readable;
+  }
+
+  if (event.events & EPOLLOUT)
+  {
+    events |= IOEvent::Writable;
+  }
+
+  return events;
+}
+
+#endif //__linux__
@@ -0,0 +1,637 @@
+#ifdef __linux__
+
+#include "ssh.h"
+#include <linux/io_uring.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+using namespace SSH;
+
+namespace
+{
+  /*
+    Raw io_uring, so there is no dependency on liburing.
+
+    The receive side keeps a single read in flight, which is only ever aimed at or beyond the
+    client's write position in its receive buffer. The client never moves its write position
+    forwards without data from us, and only ever moves it backwards when compacting, which copies
+    unread data into the space below it. So data the kernel writes while nobody is looking never
+    lands on top of anything the client still needs, and it is moved down to wherever the client
+    asks for it next (usually exactly where it already is).
+  */
+  class IOUringTransport : public ITransport
+  {
+  private:
+    static constexpr __u64 sReadTag = 1ull << 62;
+    static constexpr __u64 sWriteTag = 1ull << 61;
+    static constexpr __u64 sCancelTag = 1ull << 60;
+    static constexpr __u64 sWakeTag = 1ull << 59;
+    static constexpr __u64 sWritePollTag = 1ull << 58;
+    static constexpr __u64 sReadPollTag = 1ull << 57;
+
+    int mSocket;
+    int mRingFD = -1;
+
+    //Submission ring
+    void* mpSQRing = MAP_FAILED;
+    size_t mSQRingLen = 0;
+    unsigned* mpSQHead = nullptr;
+    unsigned* mpSQTail = nullptr;
+    unsigned* mpSQMask = nullptr;
+    unsigned* mpSQArray = nullptr;
+    unsigned mSQEntries = 0;
+    io_uring_sqe* mpSQEs = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t mSQEsLen = 0;
+    unsigned mSQTail = 0; //Our copy of the tail, published when submitting
+
+    //Completion ring, shares the submission ring's mapping when the kernel allows
+    void* mpCQRing = MAP_FAILED;
+    size_t mCQRingLen = 0;
+    unsigned* mpCQHead = nullptr;
+    unsigned* mpCQTail = nullptr;
+    unsigned* mpCQMask = nullptr;
+    io_uring_cqe* mpCQEs = nullptr;
+
+    //Recv and SendVec can be called from different threads when the receive pipeline is running
+    std::mutex mMutex;
+
+    Byte* mpRecvBuf = nullptr;
+    UINT32 mRecvBufLen = 0;
+    bool mbRegistered = false; //mpRecvBuf is fixed buffer 0
+
+    bool mbReadInFlight = false;
+    bool mbReadDone = false;
+    bool mbWakePending = false; //A NOP is queued to make the ring readable, for completions reaped on someone else's behalf
+    int mReadResult = 0;
+    Byte* mpReadTarget = nullptr;
+
+    //Bytes a read had finished with when it was cancelled, handed over ahead of anything read since
+    std::vector<Byte> mCancelled;
+    size_t mCancelledOffset = 0;
+
+    //Results of the write chain currently being submitted
+    std::vector<int> mWriteResults;
+    int mWritesOutstanding = 0;
+    bool mbWritePollArmed = false;
+    bool mbWriteReady = false; //The write poll has fired since SendVec was last called
+    bool mbReadPollArmed = false; //Stands in for the read while the client reads from outside the receive buffer
+    bool mbReadReady = false;     //The read poll has fired since Recv was last called
+
+    int Enter(unsigned toSubmit, unsigned minComplete, unsigned flags)
+    {
+      int result = 0;
+      do
+      {
+        result = (int)syscall(__NR_io_uring_enter, mRingFD, toSubmit, minComplete, flags, nullptr, 0);
+      } while (result < 0 && errno == EINTR);
+
+      return result;
+    }
+
+    //Returns nullptr if the submission ring is full
+    io_uring_sqe* NextSQE()
+    {
+      unsigned head = __atomic_load_n(mpSQHead, __ATOMIC_ACQUIRE);
+      if (mSQTail - head >= mSQEntries)
+      {
+        return nullptr;
+      }
+
+      unsigned index = mSQTail & *mpSQMask;
+      io_uring_sqe* pSQE = &mpSQEs[index];
+      std::memset(pSQE, 0, sizeof(*pSQE));
+      mpSQArray[index] = index;
+      mSQTail++;
+      return pSQE;
+    }
+
+    //Publishes everything from NextSQE and hands it to the kernel, waiting for minComplete completions
+    bool Submit(unsigned toSubmit, unsigned minComplete)
+    {
+      __atomic_store_n(mpSQTail, mSQTail, __ATOMIC_RELEASE);
+
+      unsigned flags = (minComplete > 0) ? IORING_ENTER_GETEVENTS : 0;
+      while (toSubmit > 0)
+      {
+        int submitted = Enter(toSubmit, minComplete, flags);
+        if (submitted < 0)
+        {
+          return false;
+        }
+
+        toSubmit -= std::min<unsigned>(toSubmit, submitted);
+        minComplete = 0;
+      }
+
+      return true;
+    }
+
+    void Reap()
+    {
+      unsigned head = *mpCQHead;
+      unsigned tail = __atomic_load_n(mpCQTail, __ATOMIC_ACQUIRE);
+
+      for (; head != tail; ++head)
+      {
+        const io_uring_cqe& cqe = mpCQEs[head & *mpCQMask];
+        if (cqe.user_data == sReadTag)
+        {
+          mbReadInFlight = false;
+          mbReadDone = true;
+          mReadResult = cqe.res;
+        }
+        else if (cqe.user_data == sWakeTag)
+        {
+          mbWakePending = false;
+        }
+        else if (cqe.user_data == sWritePollTag)
+        {
+          mbWritePollArmed = false;
+          mbWriteReady = true;
+        }
+        else if (cqe.user_data == sReadPollTag)
+        {
+          mbReadPollArmed = false;
+          mbReadReady = true;
+        }
+        else if ((cqe.user_data & sWriteTag) != 0)
+        {
+          size_t index = (size_t)(cqe.user_data & ~sWriteTag);
+          if (index < mWriteResults.size())
+          {
+            mWriteResults[index] = cqe.res;
+            mWritesOutstanding--;
+          }
+        }
+      }
+
+      __atomic_store_n(mpCQHead, head, __ATOMIC_RELEASE);
+    }
+
+    bool ArmRead(Byte* pBuf, const int bufLen)
+    {
+      io_uring_sqe* pSQE = NextSQE();
+      if (pSQE == nullptr)
+      {
+        return false;
+      }
+
+      pSQE->opcode = mbRegistered ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      pSQE->fd = mSocket;
+      pSQE->addr = (__u64)(uintptr_t)pBuf;
+      pSQE->len = (__u32)bufLen;
+      pSQE->off = (__u64)-1; //Sockets have no file position
+      pSQE->buf_index = 0;
+      pSQE->user_data = sReadTag;
+
+      mpReadTarget = pBuf;
+      mbReadInFlight = true;
+      if (!Submit(1, 0))
+      {
+        mbReadInFlight = false;
+        return false;
+      }
+
+      return true;
+    }
+
+    //Asks for a completion once the socket is ready, so whoever is waiting on the ring hears about it
+    void ArmPoll(UINT32 pollEvents, __u64 tag, bool& bArmed)
+    {
+      if (bArmed)
+      {
+        return;
+      }
+
+      io_uring_sqe* pSQE = NextSQE();
+      if (pSQE == nullptr)
+      {
+        return;
+      }
+
+      pSQE->opcode = IORING_OP_POLL_ADD;
+      pSQE->fd = mSocket;
+      pSQE->poll32_events = pollEvents;
+      pSQE->user_data = tag;
+      bArmed = Submit(1, 0);
+    }
+
+    /*
+      Recv and SendVec reap every completion, including ones whoever calls the other is waiting on (the
+      crypto stage reads while the I/O thread writes). When that happens the ring is left readable with a NOP.
+    */
+    void WakeOthers(bool bOthersWaiting)
+    {
+      if (!bOthersWaiting || mbWakePending)
+      {
+        return;
+      }
+
+      io_uring_sqe* pSQE = NextSQE();
+      if (pSQE != nullptr)
+      {
+        pSQE->opcode = IORING_OP_NOP;
+        pSQE->user_data = sWakeTag;
+        mbWakePending = Submit(1, 0);
+      }
+    }
+
+    //Cancels any read in flight and waits until the kernel has let go of the receive buffer
+    void CancelRead()
+    {
+      if (mbReadInFlight)
+      {
+        io_uring_sqe* pSQE = NextSQE();
+        if (pSQE != nullptr)
+        {
+          pSQE->opcode = IORING_OP_ASYNC_CANCEL;
+          pSQE->fd = -1;
+          pSQE->addr = sReadTag;
+          pSQE->user_data = sCancelTag;
+          Submit(1, 0);
+        }
+
+        //The read completes one way or another, even if the cancel couldn't be queued
+        while (mbReadInFlight)
+        {
+          if (Enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+          {
+            break;
+          }
+
+          Reap();
+        }
+      }
+
+      //The read may have finished before it could be cancelled, and what it read still belongs to the caller
+      if (mbReadDone && mReadResult > 0)
+      {
+        mCancelled.erase(mCancelled.begin(), mCancelled.begin() + mCancelledOffset);
+        mCancelledOffset = 0;
+        mCancelled.insert(mCancelled.end(), mpReadTarget, mpReadTarget + mReadResult);
+      }
+
+      mbReadDone = false;
+    }
+
+    //Hands over the result of a finished read, moving it down to where the client now wants it
+    TResult TakeRead(Byte* pBuf, const int bufLen)
+    {
+      mbReadDone = false;
+
+      if (mReadResult == -EAGAIN || mReadResult == -EINTR || mReadResult == -ECANCELED)
+      {
+        return {};
+      }
+      else if (mReadResult <= 0)
+      {
+        //Error, or the remote closed the connection
+        return -1;
+      }
+
+      int numBytes = std::min(mReadResult, bufLen);
+      if (mpReadTarget != pBuf)
+      {
+        std::memmove(pBuf, mpReadTarget, numBytes);
+      }
+
+      if (numBytes < mReadResult)
+      {
+        //Keep the rest for the next call
+        mpReadTarget += numBytes;
+        mReadResult -= numBytes;
+        mbReadDone = true;
+      }
+
+      return numBytes;
+    }
+
+    bool InRecvBuffer(const Byte* pBuf, const int bufLen) const
+    {
+      return (mpRecvBuf != nullptr && pBuf >= mpRecvBuf && pBuf + bufLen <= mpRecvBuf + mRecvBufLen);
+    }
+
+  public:
+    explicit IOUringTransport(int socketFD)
+      : mSocket(socketFD)
+    {}
+
+    ~IOUringTransport()
+    {
+      if (mRingFD >= 0)
+      {
+        AttachRecvBuffer(nullptr, 0);
+      }
+
+      if (mpSQEs != MAP_FAILED)
+      {
+        munmap(mpSQEs, mSQEsLen);
+      }
+
+      if (mpCQRing != MAP_FAILED && mpCQRing != mpSQRing)
+      {
+        munmap(mpCQRing, mCQRingLen);
+      }
+
+      if (mpSQRing != MAP_FAILED)
+      {
+        munmap(mpSQRing, mSQRingLen);
+      }
+
+      if (mRingFD >= 0)
+      {
+        close(mRingFD);
+      }
+    }
+
+    bool Init(const UINT32 queueDepth)
+    {
+      io_uring_params params;
+      std::memset(&params, 0, sizeof(params));
+
+      mRingFD = (int)syscall(__NR_io_uring_setup, std::max<UINT32>(queueDepth, 2), &params);
+      if (mRingFD < 0)
+      {
+        return false;
+      }
+
+      mSQEntries = params.sq_entries;
+      mSQRingLen = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+      mCQRingLen = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+
+      bool bSingleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+      if (bSingleMap)
+      {
+        mSQRingLen = mCQRingLen = std::max(mSQRingLen, mCQRingLen);
+      }
+
+      mpSQRing = mmap(nullptr, mSQRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFD, IORING_OFF_SQ_RING);
+      if (mpSQRing == MAP_FAILED)
+      {
+        return false;
+      }
+
+      mpCQRing = bSingleMap ? mpSQRing : mmap(nullptr, mCQRingLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFD, IORING_OFF_CQ_RING);
+      if (mpCQRing == MAP_FAILED)
+      {
+        return false;
+      }
+
+      mSQEsLen = params.sq_entries * sizeof(io_uring_sqe);
+      mpSQEs = static_cast<io_uring_sqe*>(mmap(nullptr, mSQEsLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, mRingFD, IORING_OFF_SQES));
+      if (mpSQEs == MAP_FAILED)
+      {
+        return false;
+      }
+
+      Byte* pSQRing = static_cast<Byte*>(mpSQRing);
+      mpSQHead = reinterpret_cast<unsigned*>(pSQRing + params.sq_off.head);
+      mpSQTail = reinterpret_cast<unsigned*>(pSQRing + params.sq_off.tail);
+      mpSQMask = reinterpret_cast<unsigned*>(pSQRing + params.sq_off.ring_mask);
+      mpSQArray = reinterpret_cast<unsigned*>(pSQRing + params.sq_off.array);
+      mSQTail = *mpSQTail;
+
+      Byte* pCQRing = static_cast<Byte*>(mpCQRing);
+      mpCQHead = reinterpret_cast<unsigned*>(pCQRing + params.cq_off.head);
+      mpCQTail = reinterpret_cast<unsigned*>(pCQRing + params.cq_off.tail);
+      mpCQMask = reinterpret_cast<unsigned*>(pCQRing + params.cq_off.ring_mask);
+      mpCQEs = reinterpret_cast<io_uring_cqe*>(pCQRing + params.cq_off.cqes);
+
+      return true;
+    }
+
+    int WaitFD() const override { return mRingFD; }
+
+    //Reads and room to write both arrive as completions, which make the ring readable
+    TIOEvents WaitEvents(TIOEvents events) const override
+    {
+      return (events != IOEvent::None) ? IOEvent::Readable : IOEvent::None;
+    }
+
+    void AttachRecvBuffer(Byte* pBuf, const UINT32 bufLen) override
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      CancelRead();
+
+      if (mbRegistered)
+      {
+        syscall(__NR_io_uring_register, mRingFD, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        mbRegistered = false;
+      }
+
+      mpRecvBuf = pBuf;
+      mRecvBufLen = bufLen;
+
+      if (pBuf != nullptr)
+      {
+        //Pinning can fail against RLIMIT_MEMLOCK on older kernels, plain reads still work
+        iovec vec = { pBuf, bufLen };
+        mbRegistered = (syscall(__NR_io_uring_register, mRingFD, IORING_REGISTER_BUFFERS, &vec, 1) == 0);
+      }
+    }
+
+    TResult Recv(Byte* pBuf, const int bufLen) override
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      Reap();
+      mbReadReady = false;
+      WakeOthers(mbWriteReady);
+
+      if (mCancelledOffset < mCancelled.size())
+      {
+        int numBytes = (int)std::min<size_t>(bufLen, mCancelled.size() - mCancelledOffset);
+        std::memcpy(pBuf, mCancelled.data() + mCancelledOffset, numBytes);
+        mCancelledOffset += numBytes;
+
+        if (mCancelledOffset == mCancelled.size())
+        {
+          mCancelled.clear();
+          mCancelledOffset = 0;
+        }
+
+        return numBytes;
+      }
+
+      if (!InRecvBuffer(pBuf, bufLen))
+      {
+        //Not somewhere we can leave a read pending, so just read whatever is there now
+        ssize_t numBytes = recv(mSocket, pBuf, bufLen, MSG_DONTWAIT);
+        if (numBytes < 0)
+        {
+          if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+          {
+            //No read is pending to complete when data arrives, so have the ring say so instead
+            ArmPoll(POLLIN, sReadPollTag, mbReadPollArmed);
+            return {};
+          }
+
+          return -1;
+        }
+
+        return (numBytes > 0) ? TResult((int)numBytes) : TResult(-1);
+      }
+
+      if (!mbReadInFlight && !mbReadDone)
+      {
+        if (!ArmRead(pBuf, bufLen))
+        {
+          return -1;
+        }
+
+        //Data which is already waiting completes the read during submission
+        Reap();
+      }
+
+      WakeOthers(mbWriteReady);
+
+      if (mbReadDone)
+      {
+        return TakeRead(pBuf, bufLen);
+      }
+
+      return {};
+    }
+
+    TResult Send(const Byte* pBuf, const int bufLen) override
+    {
+      IOVec vec = { pBuf, bufLen };
+      return SendVec(&vec, 1);
+    }
+
+    TResult SendVec(const IOVec* pVecs, const int numVecs) override
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+
+      //Leave room for the read and its cancel, anything beyond goes out on the next call
+      int numWrites = std::min<int>(numVecs, (int)mSQEntries - 2);
+      if (numWrites <= 0)
+      {
+        return {};
+      }
+
+      mWriteResults.assign(numWrites, 0);
+      mWritesOutstanding = 0;
+      mbWriteReady = false;
+
+      for (int i = 0; i < numWrites; ++i)
+      {
+        io_uring_sqe* pSQE = NextSQE();
+        if (pSQE == nullptr)
+        {
+          numWrites = i;
+          break;
+        }
+
+        //Linked so they hit the socket in order, and a short write cancels the rest of the chain
+        pSQE->opcode = IORING_OP_WRITE;
+        pSQE->fd = mSocket;
+        pSQE->addr = (__u64)(uintptr_t)pVecs[i].mpBuf;
+        pSQE->len = (__u32)pVecs[i].mBufLen;
+        pSQE->off = (__u64)-1;
+        pSQE->rw_flags = RWF_NOWAIT;
+        pSQE->flags = (i + 1 < numWrites) ? IOSQE_IO_LINK : 0;
+        pSQE->user_data = sWriteTag | (__u64)i;
+        mWritesOutstanding++;
+      }
+
+      if (numWrites == 0)
+      {
+        return {};
+      }
+
+      //The packets are recycled as soon as we return, so wait for the whole chain
+      if (!Submit(numWrites, numWrites))
+      {
+        return -1;
+      }
+
+      Reap();
+      while (mWritesOutstanding > 0)
+      {
+        if (Enter(0, 1, IORING_ENTER_GETEVENTS) < 0)
+        {
+          return -1;
+        }
+
+        Reap();
+      }
+
+      WakeOthers(mbReadDone || mbReadReady);
+
+      int numOffered = 0;
+      for (int i = 0; i < numWrites; ++i)
+      {
+        numOffered += pVecs[i].mBufLen;
+      }
+
+      TResult totalSent;
+      int i = 0;
+      for (; i < numWrites; ++i)
+      {
+        int result = mWriteResults[i];
+        if (result < 0)
+        {
+          if (result == -EAGAIN || result == -ECANCELED || result == -EINTR)
+          {
+            break;
+          }
+
+          //Only report the failure if nothing has made it out yet
+          return totalSent.has_value() ? totalSent : TResult(-1);
+        }
+
+        totalSent = totalSent.value_or(0) + result;
+        if (result < pVecs[i].mBufLen)
+        {
+          ++i;
+          break;
+        }
+      }
+
+      //Anything written after a gap has corrupted the stream, which can't be recovered from
+      for (; i < numWrites; ++i)
+      {
+        if (mWriteResults[i] > 0)
+        {
+          return -1;
+        }
+      }
+
+      if (totalSent.value_or(0) < numOffered)
+      {
+        ArmPoll(POLLOUT, sWritePollTag, mbWritePollArmed);
+      }
+
+      return totalSent;
+    }
+  };
+}
+
+TTransport Transport::CreateIOUring(int socketFD, const UINT32 queueDepth, int* pOutWaitFD)
+{
+  auto pTransport = std::make_shared<IOUringTransport>(socketFD);
+  if (!pTransport->Init(queueDepth))
+  {
+    return nullptr;
+  }
+
+  if (pOutWaitFD != nullptr)
+  {
+    *pOutWaitFD = pTransport->WaitFD();
+  }
+
+  return pTransport;
+}
+
+#endif //__linux__
@@ -0,0 +1,165 @@
+#ifdef __linux__
+
+#include "ssh.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <cerrno>
+
+using namespace SSH;
+
+namespace
+{
+  bool ApplyOptions(int socketFD, const SocketOptions& options)
+  {
+    int noDelay = options.mNoDelay ? 1 : 0;
+    if (setsockopt(socketFD, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay)) != 0 && errno != EOPNOTSUPP)
+    {
+      return false;
+    }
+
+    //Setting either buffer size turns off the kernel's autotuning for it, so only touch them when asked
+    if (options.mSendBufferSize > 0 &&
+        setsockopt(socketFD, SOL_SOCKET, SO_SNDBUF, &options.mSendBufferSize, sizeof(options.mSendBufferSize)) != 0)
+    {
+      return false;
+    }
+
+    if (options.mRecvBufferSize > 0 &&
+        setsockopt(socketFD, SOL_SOCKET, SO_RCVBUF, &options.mRecvBufferSize, sizeof(options.mRecvBufferSize)) != 0)
+    {
+      return false;
+    }
+
+    return true;
+  }
+
+  bool WouldBlock()
+  {
+    return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+  }
+
+  class SocketTransport : public ITransport
+  {
+  private:
+    int mSocket;
+
+  public:
+    explicit SocketTransport(int socketFD)
+      : mSocket(socketFD)
+    {}
+
+    TResult Send(const Byte* pBuf, const int bufLen) override
+    {
+      ssize_t sentBytes = send(mSocket, pBuf, bufLen, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (sentBytes < 0)
+      {
+        return WouldBlock() ? TResult() : TResult(-1);
+      }
+
+      return (int)sentBytes;
+    }
+
+    TResult Recv(Byte* pBuf, const int bufLen) override
+    {
+      ssize_t recievedBytes = recv(mSocket, pBuf, bufLen, MSG_DONTWAIT);
+      if (recievedBytes < 0)
+      {
+        return WouldBlock() ? TResult() : TResult(-1);
+      }
+
+      //The remote has closed the connection
+      if (recievedBytes == 0)
+      {
+        return -1;
+      }
+
+      return (int)recievedBytes;
+    }
+
+    TResult SendVec(const IOVec* pVecs, const int numVecs) override
+    {
+      //IOVec is laid out as an iovec, but the field types differ so copy rather than cast
+      static constexpr int sMaxVecs = 64;
+      iovec vecs[sMaxVecs];
+      int count = (numVecs < sMaxVecs) ? numVecs : sMaxVecs;
+      for (int i = 0; i < count; ++i)
+      {
+        vecs[i].iov_base = const_cast<Byte*>(pVecs[i].mpBuf);
+        vecs[i].iov_len = (size_t)pVecs[i].mBufLen;
+      }
+
+      msghdr msg = {};
+      msg.msg_iov = vecs;
+      msg.msg_iovlen = count;
+
+      ssize_t sentBytes = sendmsg(mSocket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+      if (sentBytes < 0)
+      {
+        return WouldBlock() ? TResult() : TResult(-1);
+      }
+
+      return (int)sentBytes;
+    }
+
+    int WaitFD() const override { return mSocket; }
+  };
+}
+
+int Transport::ConnectTCP(const char* pszHost, const char* pszPort, const SocketOptions& options)
+{
+  addrinfo hints = {};
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_protocol = IPPROTO_TCP;
+
+  addrinfo* pAddrs = nullptr;
+  if (getaddrinfo(pszHost, pszPort, &hints, &pAddrs) != 0)
+  {
+    return -1;
+  }
+
+  int socketFD = -1;
+  for (addrinfo* pAddr = pAddrs; pAddr != nullptr; pAddr = pAddr->ai_next)
+  {
+    socketFD = socket(pAddr->ai_family, pAddr->ai_socktype | SOCK_CLOEXEC, pAddr->ai_protocol);
+    if (socketFD < 0)
+    {
+      continue;
+    }
+
+    //Buffer sizes have to be set before connecting for the window scale to take them into account
+    if (ApplyOptions(socketFD, options) && connect(socketFD, pAddr->ai_addr, pAddr->ai_addrlen) == 0)
+    {
+      break;
+    }
+
+    close(socketFD);
+    socketFD = -1;
+  }
+
+  freeaddrinfo(pAddrs);
+  return socketFD;
+}
+
+TTransport Transport::CreateSocket(int socketFD, const SocketOptions& options)
+{
+  int flags = fcntl(socketFD, F_GETFL, 0);
+  if (flags < 0 || fcntl(socketFD, F_SETFL, flags | O_NONBLOCK) != 0)
+  {
+    return nullptr;
+  }
+
+  if (!ApplyOptions(socketFD, options))
+  {
+    return nullptr;
+  }
+
+  return std::make_shared<SocketTransport>(socketFD);
+}
+
+#endif //__linux__
@@ -0,0 +1,86 @@
+#include "window-tuner.h"
+
+#include <algorithm>
+
+using namespace SSH;
+
+WindowTuner::WindowTuner(UINT32 window, UINT32 maxWindow)
+  : mWindow(window)
+  , mMaxWindow(std::max(window, maxWindow))
+{}
+
+void WindowTuner::SampleRTT(TClock::duration sample)
+{
+  //Smoothed the same way as TCP's SRTT, so one delayed packet doesn't swing the window
+  if (mSmoothedRTT == TClock::duration::zero())
+  {
+    mSmoothedRTT = sample;
+  }
+  else
+  {
+    mSmoothedRTT = (mSmoothedRTT * 7 + sample) / 8;
+  }
+}
+
+void WindowTuner::OnAdjustSent(TClock::time_point now, UINT32 outstandingBytes)
+{
+  if (mWindow >= mMaxWindow || mProbeSentAt.has_value())
+  {
+    return;
+  }
+
+  mProbeSentAt = now;
+  mProbeSkipBytes = outstandingBytes;
+}
+
+UINT32 WindowTuner::OnData(TClock::time_point now, UINT32 numBytes)
+{
+  if (mWindow >= mMaxWindow)
+  {
+    return 0;
+  }
+
+  if (mProbeSentAt.has_value())
+  {
+    //Data covered by the credit the remote already had says nothing about the adjust
+    if (mProbeSkipBytes >= numBytes)
+    {
+      mProbeSkipBytes -= numBytes;
+    }
+    else
+    {
+      SampleRTT(now - mProbeSentAt.value());
+      mProbeSentAt.reset();
+    }
+  }
+
+  if (!mIntervalStart.has_value())
+  {
+    mIntervalStart = now;
+    mIntervalBytes = 0;
+  }
+
+  mIntervalBytes += numBytes;
+
+  TClock::duration elapsed = now - mIntervalStart.value();
+  if (mSmoothedRTT == TClock::duration::zero() || elapsed < mSmoothedRTT)
+  {
+    return 0;
+  }
+
+  //A round trip's worth of data, scaled back to exactly one round trip
+  double bdp = (double)mIntervalBytes * ((double)mSmoothedRTT.count() / (double)elapsed.count());
+  mIntervalStart = now;
+  mIntervalBytes = 0;
+
+  if (bdp * 2.0 < (double)mWindow)
+  {
+    //The link (or the remote) is the limit, not the window
+    return 0;
+  }
+
+  double target = std::min({ bdp * 2.0, (double)mWindow * 2.0, (double)mMaxWindow });
+  UINT32 growth = (UINT32)target - mWindow;
+  mWindow += growth;
+  return growth;
+}
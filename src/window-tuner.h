@@ -0,0 +1,63 @@
+#ifndef __WINDOW_TUNER_H__
+#define __WINDOW_TUNER_H__
+
+#include "ssh.h"
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace SSH
+{
+  /*
+    Sizes a channel's receive window to the connection's bandwidth-delay product, the way TCP
+    autotunes its receive buffer. No window is ever big enough for every link, and one that is
+    big enough for a long fat pipe ties up memory for nothing on a LAN.
+
+    The round trip time is sampled from each window adjust to the first data only its credit could
+    have allowed, and the delivery rate is measured over every round trip. Whenever a round trip
+    delivers more than half the window (so the window, not the link, is what limits the remote)
+    the window grows towards twice the bandwidth-delay product, at most doubling each round trip,
+    and never beyond the ceiling. It never shrinks, as a window can't be taken back from the remote.
+
+    Not thread safe, the channel calls it with its receive lock held.
+  */
+  class WindowTuner
+  {
+  public:
+    using TClock = std::chrono::steady_clock;
+
+  private:
+    UINT32 mWindow;
+    UINT32 mMaxWindow;
+
+    TClock::duration mSmoothedRTT = TClock::duration::zero(); //Zero until the first sample
+
+    //The adjust being timed, and how much credit the remote already had when it was sent
+    std::optional<TClock::time_point> mProbeSentAt;
+    uint64_t mProbeSkipBytes = 0;
+
+    //Data delivered since the current measurement interval began
+    std::optional<TClock::time_point> mIntervalStart;
+    uint64_t mIntervalBytes = 0;
+
+    void SampleRTT(TClock::duration sample);
+
+  public:
+    //Starts at window, and grows no further than maxWindow (autotuning is off when that is no bigger)
+    WindowTuner(UINT32 window, UINT32 maxWindow);
+
+    /*
+      Called as a window adjust is sent, with how much credit the remote still had beforehand.
+      Only one adjust is timed at once.
+    */
+    void OnAdjustSent(TClock::time_point now, UINT32 outstandingBytes);
+
+    //Called for every packet of data received, returns how many bytes the window should grow by
+    UINT32 OnData(TClock::time_point now, UINT32 numBytes);
+
+    UINT32 Window() const { return mWindow; }
+    TClock::duration SmoothedRTT() const { return mSmoothedRTT; }
+  };
+}
+
+#endif //~__WINDOW_TUNER_H__
@@ -0,0 +1,241 @@
+#include <catch2/catch.hpp>
+#include "ssh-async.h"
+#include "fake-server.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace SSH;
+
+namespace
+{
+  //A manually driven AsyncClient, talking to a fake server which answers within Send and Recv
+  struct ManualAsyncClient
+  {
+    std::shared_ptr<FakeServer> mpServer;
+    std::unique_ptr<AsyncClient> mpClient;
+    AsyncChannel mChannel;
+
+    explicit ManualAsyncClient(UINT32 serverWindowSize = 2 * 1024 * 1024, UINT32 channelWindowSize = 2 * 1024 * 1024)
+      : mpServer(std::make_shared<FakeServer>(serverWindowSize))
+    {
+      ClientOptions opts;
+      opts.mLogFunc = [](const char*) {};
+      opts.mLogLevel = LogLevel::Error;
+      opts.mTransport = mpServer;
+      opts.mRunMode = RunMode::Manual;
+      opts.mOffloadKEX = false;
+      opts.mChannelWindowSize = channelWindowSize;
+      opts.mChannelMaxWindowSize = channelWindowSize;
+
+      mpClient = std::make_unique<AsyncClient>(opts, TCtx());
+    }
+
+    //Processes until done returns true, giving up after a bounded number of passes
+    template <typename TDone>
+    bool ProcessUntil(TDone done)
+    {
+      for (int i = 0; i < 100 && !done(); ++i)
+      {
+        mpClient->GetClient().Process(IOEvent::Readable | IOEvent::Writable);
+      }
+
+      return done();
+    }
+
+    //Runs until the channel is open, each step resumed from within Process
+    bool Open()
+    {
+      bool bDone = false;
+      [](ManualAsyncClient& client, bool& bDone) -> Task
+      {
+        if (co_await client.mpClient->Connect())
+        {
+          client.mChannel = co_await client.mpClient->OpenChannel(ChannelTypes::Session);
+        }
+
+        bDone = true;
+      }(*this, bDone);
+
+      return ProcessUntil([&]() { return bDone; }) && mChannel.IsOpen();
+    }
+
+    bool SendToClient(const std::string& data)
+    {
+      return mpServer->SendData(0, (const Byte*)data.data(), (UINT32)data.length());
+    }
+
+    std::string Received() const
+    {
+      const TByteString& received = mpServer->GetChannel(0).mReceived;
+      return std::string(received.begin(), received.end());
+    }
+  };
+
+  struct ReadResult
+  {
+    bool mbDone = false;
+    size_t mNumBytes = 0;
+    std::string mData;
+  };
+
+  Task Read(AsyncChannel& channel, size_t bufLen, ReadResult& result)
+  {
+    std::vector<Byte> buf(bufLen);
+    result.mNumBytes = co_await channel.Read(buf);
+    result.mData.assign(buf.begin(), buf.begin() + result.mNumBytes);
+    result.mbDone = true;
+  }
+
+  struct WriteResult
+  {
+    bool mbDone = false;
+    TResult mWritten;
+  };
+
+  //Takes its own copy of data, which has to outlive the write
+  Task Write(AsyncChannel& channel, std::string data, WriteResult& result)
+  {
+    result.mWritten = co_await channel.Write(std::span<const Byte>((const Byte*)data.data(), data.length()));
+    result.mbDone = true;
+  }
+}
+
+TEST_CASE("AsyncClient connects and opens channels from within Process", "[Async]")
+{
+  ManualAsyncClient client;
+  REQUIRE( client.Open() );
+  REQUIRE( client.mpClient->GetState() == State::Connected );
+  REQUIRE( client.mpServer->LoggedIn() );
+  REQUIRE( client.mpServer->NumChannels() == 1 );
+  REQUIRE( !client.mpServer->Failed() );
+}
+
+TEST_CASE("AsyncChannel reads data as it arrives", "[Async]")
+{
+  ManualAsyncClient client;
+  REQUIRE( client.Open() );
+
+  SECTION("A waiting reader is handed the data directly")
+  {
+    ReadResult result;
+    Read(client.mChannel, 64, result);
+    REQUIRE( !result.mbDone );
+
+    REQUIRE( client.SendToClient("direct") );
+    REQUIRE( client.ProcessUntil([&]() { return result.mbDone; }) );
+    REQUIRE( result.mData == "direct" );
+  }
+
+  SECTION("Data nobody is waiting for is kept until it is read")
+  {
+    REQUIRE( client.SendToClient("held back") );
+    client.mpClient->GetClient().Process(IOEvent::Readable);
+
+    //Already there, so neither read has to wait
+    ReadResult first;
+    Read(client.mChannel, 4, first);
+    REQUIRE( first.mbDone );
+    REQUIRE( first.mData == "held" );
+
+    ReadResult second;
+    Read(client.mChannel, 64, second);
+    REQUIRE( second.mbDone );
+    REQUIRE( second.mData == " back" );
+  }
+
+  SECTION("The remote closing wakes a waiting reader")
+  {
+    ReadResult result;
+    Read(client.mChannel, 64, result);
+
+    client.mpServer->CloseChannel(0);
+    REQUIRE( client.ProcessUntil([&]() { return result.mbDone; }) );
+    REQUIRE( result.mNumBytes == 0 );
+    REQUIRE( !client.mChannel.IsOpen() );
+  }
+
+  REQUIRE( !client.mpServer->Failed() );
+}
+
+TEST_CASE("AsyncChannel only hands back window once the inbox has been read", "[Async]")
+{
+  //No autotuning, so the window only reopens as data is consumed
+  ManualAsyncClient client(2 * 1024 * 1024, 1024);
+  REQUIRE( client.Open() );
+
+  std::string data(1024, 'x');
+  REQUIRE( client.SendToClient(data) );
+  client.mpClient->GetClient().Process(IOEvent::Readable);
+
+  //Held in the inbox, so the window stays shut however often the client runs
+  REQUIRE( client.mpServer->GetChannel(0).mSendWindow == 0 );
+  client.mpClient->GetClient().Process(IOEvent::Readable | IOEvent::Writable);
+  REQUIRE( client.mpServer->GetChannel(0).mSendWindow == 0 );
+
+  //Reading consumes it, which gives the remote its window back
+  size_t numRead = 0;
+  while (numRead < data.length())
+  {
+    ReadResult result;
+    Read(client.mChannel, 256, result);
+    REQUIRE( result.mbDone );
+    REQUIRE( result.mNumBytes == 256 );
+    numRead += result.mNumBytes;
+  }
+
+  REQUIRE( client.ProcessUntil([&]() { return client.mpServer->GetChannel(0).mSendWindow == 1024; }) );
+  REQUIRE( client.SendToClient(data) );
+  REQUIRE( !client.mpServer->Failed() );
+}
+
+TEST_CASE("AsyncChannel writes wait for the remote's window", "[Async]")
+{
+  //The server only lets the client send a little at a time
+  ManualAsyncClient client(16);
+  REQUIRE( client.Open() );
+
+  SECTION("Small writes complete straight away")
+  {
+    WriteResult result;
+    Write(client.mChannel, "hello", result);
+    REQUIRE( result.mbDone );
+    REQUIRE( result.mWritten == 5 );
+
+    REQUIRE( client.ProcessUntil([&]() { return client.Received() == "hello"; }) );
+  }
+
+  SECTION("Larger writes resume as the window opens")
+  {
+    std::string data = "0123456789abcdefghijklmnopqrstuvwxyzABCD";
+    WriteResult result;
+    Write(client.mChannel, data, result);
+    REQUIRE( !result.mbDone );
+
+    REQUIRE( client.ProcessUntil([&]() { return client.Received().length() == 16; }) );
+    REQUIRE( !result.mbDone );
+
+    client.mpServer->AdjustWindow(0, 16);
+    REQUIRE( client.ProcessUntil([&]() { return client.Received().length() == 32; }) );
+    REQUIRE( !result.mbDone );
+
+    client.mpServer->AdjustWindow(0, 16);
+    REQUIRE( client.ProcessUntil([&]() { return result.mbDone; }) );
+    REQUIRE( result.mWritten == (int)data.length() );
+    REQUIRE( client.ProcessUntil([&]() { return client.Received() == data; }) );
+  }
+
+  SECTION("The remote closing ends a waiting write early")
+  {
+    WriteResult result;
+    Write(client.mChannel, std::string(40, 'x'), result);
+    REQUIRE( !result.mbDone );
+
+    client.mpServer->CloseChannel(0);
+    REQUIRE( client.ProcessUntil([&]() { return result.mbDone; }) );
+    REQUIRE( result.mWritten == 16 );
+  }
+
+  REQUIRE( !client.mpServer->Failed() );
+}
@@ -0,0 +1,108 @@
+#include <catch2/catch.hpp>
+#include "channel-table.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace SSH;
+
+namespace
+{
+  TChannelID Insert(ChannelTable& table)
+  {
+    return table.Insert([](TChannelID id)
+    {
+      return Channel::Create(ChannelTypes::Session, id, [](ChannelEvent, const Byte*, const int) { return TResult(); });
+    });
+  }
+
+  size_t Count(const ChannelTable& table)
+  {
+    size_t numChannels = 0;
+    table.ForEach([&](const TChannel&) { ++numChannels; });
+    return numChannels;
+  }
+}
+
+TEST_CASE("ChannelTable looks channels up by ID", "[ChannelTable]")
+{
+  ChannelTable table;
+
+  SECTION("Channels are found by the ID they were created with")
+  {
+    TChannelID a = Insert(table);
+    TChannelID b = Insert(table);
+    REQUIRE( a != 0 );
+    REQUIRE( b != 0 );
+    REQUIRE( a != b );
+
+    REQUIRE( table.Find(a) != nullptr );
+    REQUIRE( table.Find(a)->ID() == a );
+    REQUIRE( table.Get(b)->ID() == b );
+    REQUIRE( table.Find(0) == nullptr );
+    REQUIRE( table.Find(a + b) == nullptr );
+    REQUIRE( Count(table) == 2 );
+  }
+
+  SECTION("A reused slot gets a new ID, so the old one finds nothing")
+  {
+    TChannelID oldID = Insert(table);
+    REQUIRE( table.Remove(oldID) );
+    REQUIRE_FALSE( table.Remove(oldID) );
+
+    TChannelID newID = Insert(table);
+    REQUIRE( newID != oldID );
+    REQUIRE( table.Find(oldID) == nullptr );
+    REQUIRE( table.Get(oldID) == nullptr );
+    REQUIRE( table.Find(newID)->ID() == newID );
+  }
+
+  SECTION("Nothing is added when the channel can't be created")
+  {
+    REQUIRE( table.Insert([](TChannelID) { return nullptr; }) == 0 );
+    REQUIRE( Count(table) == 0 );
+    REQUIRE( table.Capacity() == 0 );
+  }
+
+  SECTION("Closed channels give their memory back")
+  {
+    std::vector<TChannelID> ids;
+    for (int i = 0; i < 1000; ++i)
+    {
+      ids.push_back(Insert(table));
+    }
+
+    REQUIRE( Count(table) == 1000 );
+    size_t peakCapacity = table.Capacity();
+    REQUIRE( peakCapacity >= 1000 );
+
+    //Churning through short lived channels reuses what is there
+    for (int i = 0; i < 5000; ++i)
+    {
+      TChannelID id = Insert(table);
+      REQUIRE( table.Remove(id) );
+    }
+    REQUIRE( table.Capacity() == peakCapacity );
+
+    //Freed in an order which leaves holes, so pages are only given back once they are empty
+    for (size_t i = 0; i < ids.size(); i += 2)
+    {
+      REQUIRE( table.Remove(ids[i]) );
+    }
+    REQUIRE( table.Capacity() == peakCapacity );
+
+    for (size_t i = 1; i < ids.size(); i += 2)
+    {
+      REQUIRE( table.Remove(ids[i]) );
+      REQUIRE( table.Find(ids[i]) == nullptr );
+    }
+
+    REQUIRE( Count(table) == 0 );
+    REQUIRE( table.Capacity() == 0 );
+
+    //And the table carries on from there, without handing old IDs straight back out
+    TChannelID id = Insert(table);
+    REQUIRE( std::find(ids.begin(), ids.end(), id) == ids.end() );
+    REQUIRE( table.Find(id)->ID() == id );
+  }
+}
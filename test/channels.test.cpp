@@ -0,0 +1,505 @@
+#include <catch2/catch.hpp>
+#include "channels.h"
+#include "channel-scheduler.h"
+#include "messages.h"
+
+#include <vector>
+
+using namespace SSH;
+
+namespace
+{
+  //recipient channel, sender channel, initial window size, maximum packet size
+  using OpenConfirmation = Schema::Message<SSH_MSG::CHANNEL_OPEN_CONFIRMATION, Schema::U32, Schema::U32, Schema::U32, Schema::U32>;
+
+  /*
+    Serialises a write packet and hands it to the channel as the connection would,
+    with the message ID and recipient channel already read off.
+  */
+  bool Deliver(IChannel& channel, PacketStore& store, TPacket pPacket)
+  {
+    //Owned by the view, as batched data can outlive the call
+    auto pWire = std::make_shared<TByteString>();
+    pPacket->PrepareWrite(0);
+    pWire->assign(pPacket->Begin(), pPacket->Begin() + pPacket->Remaining());
+
+    TPacket pRead = store.CreateView(pWire->data(), (UINT32)pWire->size(), 0, pWire);
+    REQUIRE( pRead->PrepareRead() );
+
+    Byte msgId = 0;
+    UINT32 recipient = 0;
+    pRead->Read(msgId);
+    pRead->Read(recipient);
+    return channel.HandleData(msgId, pRead);
+  }
+
+  //Bytes added by a CHANNEL_WINDOW_ADJUST, or 0 if the channel had none to send
+  UINT32 TakeAdjust(IChannel& channel, PacketStore& store)
+  {
+    TPacket pPacket = channel.TakeWindowAdjust(store);
+    if (pPacket == nullptr)
+    {
+      return 0;
+    }
+
+    TByteString wire;
+    pPacket->PrepareWrite(0);
+    wire.assign(pPacket->Begin(), pPacket->Begin() + pPacket->Remaining());
+
+    TPacket pRead = store.CreateView(wire.data(), (UINT32)wire.size(), 0);
+    REQUIRE( pRead->PrepareRead() );
+
+    UINT32 recipient = 0;
+    UINT32 numBytes = 0;
+    REQUIRE( Messages::ChannelWindowAdjust::Parse(*pRead, recipient, numBytes) );
+    REQUIRE( recipient == 7 );
+    return numBytes;
+  }
+
+  //Payload lengths of every CHANNEL_DATA packet the channel has ready
+  std::vector<UINT32> TakeDataLengths(IChannel& channel)
+  {
+    std::vector<UINT32> lengths;
+    while (TPacket pPacket = channel.TakeReadyPacket())
+    {
+      //msg id, recipient channel, data length
+      lengths.push_back(pPacket->PayloadLen() - (1 + 4 + 4));
+    }
+
+    return lengths;
+  }
+}
+
+TEST_CASE("Channels respect the remote window and packet size", "[Channels]")
+{
+  PacketStore store;
+  std::vector<ChannelEvent> events;
+  TResult dataResult; //What the callback reports consuming of each Data event
+
+  TChannel channel = Channel::Create(ChannelTypes::Session, 1, [&](ChannelEvent event, const Byte*, const int) -> TResult
+  {
+    events.push_back(event);
+    return (event == ChannelEvent::Data) ? dataResult : TResult();
+  });
+
+  std::vector<Byte> data(10000, 'x');
+
+  SECTION("Nothing is taken before the remote has opened its window")
+  {
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == 0 );
+    REQUIRE( TakeDataLengths(*channel).empty() );
+  }
+
+  SECTION("Writes are cut short at the window and split at the max packet size")
+  {
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 5000, 2000)) );
+    REQUIRE( events == std::vector<ChannelEvent>{ ChannelEvent::Opened } );
+
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == 5000 );
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 2000, 2000, 1000 } );
+
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == 0 );
+
+    //Only a writer which was held back hears about the window opening
+    REQUIRE( Deliver(*channel, store, Messages::ChannelWindowAdjust::Create(store, 1, 3000)) );
+    REQUIRE( events == std::vector<ChannelEvent>{ ChannelEvent::Opened, ChannelEvent::Writable } );
+
+    REQUIRE( channel->Write(data.data(), 1000, store) == 1000 );
+    REQUIRE( Deliver(*channel, store, Messages::ChannelWindowAdjust::Create(store, 1, 3000)) );
+    REQUIRE( events.size() == 2 );
+
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == 5000 );
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 1000, 2000, 2000, 1000 } );
+  }
+
+  SECTION("Large writes are taken a send buffer at a time")
+  {
+    channel->SetSendBuffer(5000);
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 1024 * 1024, 2000)) );
+
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == 5000 );
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == 0 );
+
+    //The writer hears about it once half of the buffer has gone out
+    REQUIRE( channel->TakeReadyPacket() != nullptr );
+    REQUIRE( events == std::vector<ChannelEvent>{ ChannelEvent::Opened } );
+    REQUIRE( channel->TakeReadyPacket() != nullptr );
+    REQUIRE( events == std::vector<ChannelEvent>{ ChannelEvent::Opened, ChannelEvent::Writable } );
+
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == 4000 );
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 1000, 2000, 2000 } );
+    REQUIRE( events.size() == 3 );
+
+    //More window doesn't help while the buffer is full
+    REQUIRE( channel->Write(data.data(), 5000, store) == 5000 );
+    REQUIRE( channel->Write(data.data(), 1, store) == 0 );
+    REQUIRE( Deliver(*channel, store, Messages::ChannelWindowAdjust::Create(store, 1, 3000)) );
+    REQUIRE( events.size() == 3 );
+  }
+
+  SECTION("Merged writes count against the window as they are taken")
+  {
+    channel->SetCoalescing(4000, std::chrono::hours(1));
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 3000, 32768)) );
+
+    REQUIRE( channel->Write(data.data(), 2500, store) == 2500 );
+    REQUIRE( channel->Write(data.data(), 1000, store) == 500 );
+    REQUIRE( TakeDataLengths(*channel).empty() );
+
+    channel->FlushExpired(TClock::now() + std::chrono::hours(2), store);
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 3000 } );
+  }
+
+  SECTION("Window is handed back once half of it has been consumed")
+  {
+    channel->SetRecvWindow(4000, 0, 1500);
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 0, 0)) );
+
+    REQUIRE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ data.data(), 1000 })) );
+    REQUIRE( TakeAdjust(*channel, store) == 0 );
+
+    REQUIRE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ data.data(), 1000 })) );
+    REQUIRE( TakeAdjust(*channel, store) == 2000 );
+    REQUIRE( TakeAdjust(*channel, store) == 0 );
+  }
+
+  SECTION("Held data keeps the window closed until it is consumed")
+  {
+    channel->SetRecvWindow(4000, 0, 1500);
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 0, 0)) );
+
+    dataResult = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      REQUIRE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ data.data(), 1000 })) );
+    }
+    REQUIRE( TakeAdjust(*channel, store) == 0 );
+
+    //The window is spent, so anything more from the remote is a protocol error
+    REQUIRE_FALSE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ data.data(), 1 })) );
+
+    REQUIRE_FALSE( channel->Consume(5000) );
+    REQUIRE( channel->Consume(1500) );
+    REQUIRE( TakeAdjust(*channel, store) == 0 );
+    REQUIRE( channel->Consume(500) );
+    REQUIRE( TakeAdjust(*channel, store) == 2000 );
+
+    REQUIRE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ data.data(), 1000 })) );
+  }
+
+  SECTION("Packets larger than advertised are rejected")
+  {
+    channel->SetRecvWindow(4000, 0, 1500);
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 0, 0)) );
+
+    REQUIRE_FALSE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ data.data(), 1501 })) );
+  }
+}
+
+TEST_CASE("Small writes are merged into as few packets as possible", "[Channels]")
+{
+  PacketStore store;
+  std::vector<Byte> data(10000, 'x');
+
+  TChannel channel = Channel::Create(ChannelTypes::Session, 1, [](ChannelEvent, const Byte*, const int)
+  {
+    return TResult();
+  });
+
+  channel->SetCoalescing(3000, std::chrono::hours(1));
+  REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 1024 * 1024, 2000)) );
+
+  SECTION("Writes are held until there is enough to send")
+  {
+    REQUIRE( channel->Write(data.data(), 1000, store) == 1000 );
+    REQUIRE( channel->Write(data.data(), 500, store) == 500 );
+    REQUIRE( TakeDataLengths(*channel).empty() );
+    REQUIRE( channel->FlushDeadline().has_value() );
+
+    REQUIRE( channel->Write(data.data(), 1500, store) == 1500 );
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 2000, 1000 } );
+    REQUIRE_FALSE( channel->FlushDeadline().has_value() );
+  }
+
+  SECTION("Merged data is sent in packets of the remote's maximum size")
+  {
+    channel->SetCoalescing(10000, std::chrono::hours(1));
+
+    REQUIRE( channel->Write(data.data(), 700, store) == 700 );
+    REQUIRE( channel->Write(data.data(), 700, store) == 700 );
+    REQUIRE( TakeDataLengths(*channel).empty() );
+
+    REQUIRE( channel->Write(data.data(), 700, store) == 700 );
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 2000 } );
+  }
+
+  SECTION("Merged data goes once it has waited long enough")
+  {
+    REQUIRE( channel->Write(data.data(), 500, store) == 500 );
+
+    auto deadline = channel->FlushDeadline();
+    REQUIRE( deadline.has_value() );
+
+    channel->FlushExpired(*deadline - std::chrono::milliseconds(1), store);
+    REQUIRE( TakeDataLengths(*channel).empty() );
+
+    channel->FlushExpired(*deadline, store);
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 500 } );
+    REQUIRE_FALSE( channel->FlushDeadline().has_value() );
+  }
+
+  SECTION("Writes big enough on their own are not held")
+  {
+    REQUIRE( channel->Write(data.data(), 3000, store) == 3000 );
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 2000, 1000 } );
+  }
+
+  SECTION("A corked channel holds everything until it is uncorked")
+  {
+    channel->Cork();
+
+    REQUIRE( channel->Write(data.data(), 1000, store) == 1000 );
+    REQUIRE( channel->Write(data.data(), 2500, store) == 2500 );
+
+    //Whole packets still go, but the threshold and the delay are ignored
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 2000 } );
+    REQUIRE_FALSE( channel->FlushDeadline().has_value() );
+    channel->FlushExpired(TClock::now() + std::chrono::hours(2), store);
+    REQUIRE( TakeDataLengths(*channel).empty() );
+
+    channel->Uncork(store);
+    REQUIRE( TakeDataLengths(*channel) == std::vector<UINT32>{ 1500 } );
+
+    //Back to merging as usual
+    REQUIRE( channel->Write(data.data(), 100, store) == 100 );
+    REQUIRE( TakeDataLengths(*channel).empty() );
+  }
+
+  SECTION("Uncorking with nothing held sends nothing")
+  {
+    channel->Cork();
+    channel->Uncork(store);
+    REQUIRE( TakeDataLengths(*channel).empty() );
+  }
+}
+
+TEST_CASE("The scheduler shares the connection fairly between channels", "[Channels]")
+{
+  PacketStore store;
+  ChannelScheduler scheduler;
+  std::vector<Byte> data(40000, 'x');
+
+  //The remote numbers its end of each channel 100 + id, so packets can be told apart on the wire
+  auto createChannel = [&](TChannelID id)
+  {
+    TChannel channel = Channel::Create(ChannelTypes::Session, id, [](ChannelEvent, const Byte*, const int) { return TResult(); });
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, id, 100 + id, 1024 * 1024, 4000)) );
+    return channel;
+  };
+
+  //Local IDs of the channels the scheduler picks packets from, in order, until it runs dry
+  auto takeOrder = [&]()
+  {
+    std::vector<UINT32> order;
+    while (TPacket pPacket = scheduler.Next())
+    {
+      TByteString wire;
+      pPacket->PrepareWrite(0);
+      wire.assign(pPacket->Begin(), pPacket->Begin() + pPacket->Remaining());
+
+      TPacket pRead = store.CreateView(wire.data(), (UINT32)wire.size(), 0);
+      REQUIRE( pRead->PrepareRead() );
+
+      Byte msgId = 0;
+      UINT32 recipient = 0;
+      pRead->Read(msgId);
+      pRead->Read(recipient);
+      order.push_back(recipient - 100);
+    }
+
+    return order;
+  };
+
+  TChannel a = createChannel(1);
+  TChannel b = createChannel(2);
+
+  SECTION("Bulk channels take turns in proportion to their weight")
+  {
+    b->SetPriority(ChannelPriority::Bulk, 2);
+
+    //Ten 4000 byte packets each, against a quantum of 16 KiB (4 packets) per unit of weight
+    REQUIRE( a->Write(data.data(), (int)data.size(), store) == data.size() );
+    REQUIRE( b->Write(data.data(), (int)data.size(), store) == data.size() );
+    scheduler.Wake(a);
+    scheduler.Wake(b);
+    scheduler.Wake(a); //Already scheduled, so this is ignored
+
+    std::vector<UINT32> expected;
+    expected.insert(expected.end(), 4, 1);
+    expected.insert(expected.end(), 8, 2);
+    expected.insert(expected.end(), 4, 1);
+    expected.insert(expected.end(), 2, 2);
+    expected.insert(expected.end(), 2, 1);
+    REQUIRE( takeOrder() == expected );
+    REQUIRE_FALSE( scheduler.Pending() );
+  }
+
+  SECTION("Interactive channels go ahead of bulk ones")
+  {
+    b->SetPriority(ChannelPriority::Interactive, 1);
+
+    REQUIRE( a->Write(data.data(), 8000, store) == 8000 );
+    scheduler.Wake(a);
+    REQUIRE( b->Write(data.data(), 100, store) == 100 );
+    scheduler.Wake(b);
+
+    REQUIRE( takeOrder() == std::vector<UINT32>{ 2, 1, 1 } );
+  }
+
+  SECTION("A channel which runs dry leaves the rotation until it is woken again")
+  {
+    REQUIRE( a->Write(data.data(), 4000, store) == 4000 );
+    scheduler.Wake(a);
+    REQUIRE( takeOrder() == std::vector<UINT32>{ 1 } );
+    REQUIRE_FALSE( scheduler.Pending() );
+
+    //Unwoken data is left with the channel
+    REQUIRE( a->Write(data.data(), 4000, store) == 4000 );
+    REQUIRE( scheduler.Next() == nullptr );
+
+    scheduler.Wake(a);
+    REQUIRE( scheduler.Pending() );
+    REQUIRE( takeOrder() == std::vector<UINT32>{ 1 } );
+  }
+}
+
+TEST_CASE("Channels close behind their data", "[Channels]")
+{
+  PacketStore store;
+  std::vector<ChannelEvent> events;
+  std::vector<Byte> data(3000, 'x');
+
+  TChannel channel = Channel::Create(ChannelTypes::Session, 1, [&](ChannelEvent event, const Byte*, const int)
+  {
+    events.push_back(event);
+    return TResult();
+  });
+
+  //Message IDs of every packet the channel has ready
+  auto takeMessages = [&]()
+  {
+    std::vector<Byte> msgIds;
+    while (TPacket pPacket = channel->TakeReadyPacket())
+    {
+      msgIds.push_back(pPacket->Payload()[0]);
+    }
+
+    return msgIds;
+  };
+
+  SECTION("A close asked for while opening waits for the confirmation")
+  {
+    REQUIRE_FALSE( channel->Close(store) );
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 10000, 2000)) );
+
+    REQUIRE( channel->ResumeClose(store) );
+    REQUIRE_FALSE( channel->ResumeClose(store) );
+    REQUIRE( channel->State() == ChannelState::Closing );
+    REQUIRE( takeMessages() == std::vector<Byte>{ SSH_MSG::CHANNEL_CLOSE } );
+  }
+
+  SECTION("Written data goes out first, and nothing more can be written")
+  {
+    channel->SetCoalescing(10000, std::chrono::hours(1));
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 10000, 2000)) );
+    REQUIRE_FALSE( channel->ResumeClose(store) );
+
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == data.size() );
+    REQUIRE( channel->Close(store) );
+    REQUIRE( channel->Write(data.data(), (int)data.size(), store) == 0 );
+
+    REQUIRE( takeMessages() == std::vector<Byte>{ SSH_MSG::CHANNEL_DATA, SSH_MSG::CHANNEL_DATA, SSH_MSG::CHANNEL_CLOSE } );
+  }
+
+  SECTION("The remote's close is answered")
+  {
+    REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 10000, 2000)) );
+    REQUIRE( Deliver(*channel, store, Messages::ChannelClose::Create(store, 1)) );
+    REQUIRE( events == std::vector<ChannelEvent>{ ChannelEvent::Opened, ChannelEvent::Closed } );
+    REQUIRE( channel->State() == ChannelState::Closed );
+
+    REQUIRE( channel->ResumeClose(store) );
+    REQUIRE( channel->State() == ChannelState::Closed );
+    REQUIRE( takeMessages() == std::vector<Byte>{ SSH_MSG::CHANNEL_CLOSE } );
+  }
+}
+
+TEST_CASE("Data callbacks take everything received in one batch", "[Channels]")
+{
+  PacketStore store;
+  std::vector<ChannelData::Span> spans;
+  ChannelData::TRetained pRetained;
+  int numCalls = 0;
+  TResult dataResult;
+
+  TChannel channel = Channel::Create(ChannelTypes::Session, 1, [](ChannelEvent event, const Byte*, const int) -> TResult
+  {
+    //Data only ever goes to the data callback
+    REQUIRE( event != ChannelEvent::Data );
+    return {};
+  },
+  [&](TChannelID id, const ChannelData& data) -> TResult
+  {
+    REQUIRE( id == 1 );
+    numCalls++;
+    spans = data.Spans();
+    pRetained = data.Retain();
+    return dataResult;
+  });
+
+  channel->SetRecvWindow(6000, 0, 2000);
+  REQUIRE( Deliver(*channel, store, OpenConfirmation::Create(store, 1, 7, 0, 0)) );
+
+  std::string text = "Batched without a copy";
+  const Byte* pText = (const Byte*)text.data();
+  REQUIRE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ pText, 7 })) );
+  REQUIRE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ pText + 7, 8 })) );
+  REQUIRE( Deliver(*channel, store, Messages::ChannelData::Create(store, 1, ByteView{ pText + 15, 7 })) );
+  REQUIRE( channel->NumBatched() == 3 );
+  REQUIRE( numCalls == 0 );
+
+  SECTION("The whole batch arrives in one call, and is consumed unless the callback says otherwise")
+  {
+    channel->DeliverBatch();
+    REQUIRE( numCalls == 1 );
+    REQUIRE( spans.size() == 3 );
+    REQUIRE( channel->NumBatched() == 0 );
+
+    //Nothing more to deliver, so no more calls
+    channel->DeliverBatch();
+    REQUIRE( numCalls == 1 );
+
+    REQUIRE_FALSE( channel->Consume(1) );
+  }
+
+  SECTION("Retained data stays valid after the call, without being copied")
+  {
+    dataResult = 0;
+    channel->DeliverBatch();
+    REQUIRE( numCalls == 1 );
+
+    std::string joined;
+    for (const ChannelData::Span& span : spans)
+    {
+      //Straight out of the packets
+      REQUIRE( span.mpData != pText );
+      joined.append((const char*)span.mpData, span.mLen);
+    }
+    REQUIRE( joined == text );
+
+    //Held data keeps the window closed until it is handed back
+    REQUIRE( TakeAdjust(*channel, store) == 0 );
+    pRetained.reset();
+    REQUIRE( channel->Consume((UINT32)text.size()) );
+  }
+}
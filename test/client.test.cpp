@@ -0,0 +1,203 @@
+#include <catch2/catch.hpp>
+#include "ssh.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace SSH;
+
+namespace
+{
+  //Both ends of a connected socket pair, closed on the way out
+  struct SocketPair
+  {
+    int mFDs[2] = { -1, -1 };
+
+    SocketPair() { socketpair(AF_UNIX, SOCK_STREAM, 0, mFDs); }
+    ~SocketPair()
+    {
+      close(mFDs[0]);
+      close(mFDs[1]);
+    }
+  };
+
+  //Polls until done returns true, giving up after a few seconds
+  template <typename TDone>
+  bool WaitFor(TDone done)
+  {
+    auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done())
+    {
+      if (std::chrono::steady_clock::now() > giveUp)
+      {
+        return false;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return true;
+  }
+
+  //Passes everything through to a socket transport, counting how often the client reads
+  class CountingTransport : public ITransport
+  {
+  private:
+    TTransport mpInner;
+
+  public:
+    std::atomic<int> mNumRecvs = 0;
+
+    explicit CountingTransport(int fd)
+      : mpInner(Transport::CreateSocket(fd))
+    {}
+
+    TResult Send(const Byte* pBuf, const int bufLen) override { return mpInner->Send(pBuf, bufLen); }
+    TResult SendVec(const IOVec* pVecs, const int numVecs) override { return mpInner->SendVec(pVecs, numVecs); }
+
+    TResult Recv(Byte* pBuf, const int bufLen) override
+    {
+      ++mNumRecvs;
+      return mpInner->Recv(pBuf, bufLen);
+    }
+
+    int WaitFD() const override { return mpInner->WaitFD(); }
+  };
+
+  //A client on its own I/O thread, talking to nobody on the other end of sockets
+  ClientOptions ThreadedOptions(const TTransport& pTransport)
+  {
+    ClientOptions opts;
+    opts.mLogFunc = [](const char*) {};
+    opts.mLogLevel = LogLevel::Error;
+    opts.mTransport = pTransport;
+    return opts;
+  }
+
+  //Reads whatever the client has sent so far, returning false if nothing turns up
+  bool DrainPeer(int fd)
+  {
+    char buffer[1024];
+    return WaitFor([&]() { return recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT) > 0; });
+  }
+}
+
+TEST_CASE("A threaded client sleeps until it is woken or the transport is ready", "[Client]")
+{
+  SocketPair sockets;
+  auto pTransport = std::make_shared<CountingTransport>(sockets.mFDs[0]);
+
+  ClientOptions opts = ThreadedOptions(pTransport);
+  TCtx ctx;
+  Client client(opts, ctx);
+  client.Connect();
+
+  //Once its version has gone out the client is waiting on the remote's
+  REQUIRE( DrainPeer(sockets.mFDs[1]) );
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+
+  //Asleep, so it isn't polling the transport
+  int numRecvs = pTransport->mNumRecvs;
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  REQUIRE( pTransport->mNumRecvs == numRecvs );
+
+  SECTION("Data arriving wakes it to read")
+  {
+    //Only part of a version line, so it goes straight back to sleep
+    REQUIRE( send(sockets.mFDs[1], "SSH-2.0", 7, 0) == 7 );
+    REQUIRE( WaitFor([&]() { return pTransport->mNumRecvs > numRecvs; }) );
+    REQUIRE( client.GetState() != State::Disconnected );
+  }
+
+  SECTION("Join returns once another thread disconnects it")
+  {
+    //Disconnect wakes the sleeping thread, which finishes without anything from the remote
+    client.Disconnect();
+    client.Join();
+
+    REQUIRE( client.GetState() == State::Disconnected );
+  }
+}
+
+TEST_CASE("A threaded client may be stopped from its own callback", "[Client]")
+{
+  SocketPair sockets;
+  TTransport pTransport = Transport::CreateSocket(sockets.mFDs[0]);
+
+  Client* pClient = nullptr;
+  std::atomic<bool> bStopped = false;
+  std::atomic<std::thread::id> callbackThread;
+
+  //The first thing logged from the I/O thread stops it, without disconnecting
+  ClientOptions opts = ThreadedOptions(pTransport);
+  opts.mLogLevel = LogLevel::Debug;
+  opts.mLogFunc = [&](const char*)
+  {
+    if (pClient != nullptr && std::this_thread::get_id() != callbackThread.load() && !bStopped.exchange(true))
+    {
+      callbackThread = std::this_thread::get_id();
+      pClient->Stop();
+    }
+  };
+
+  TCtx ctx;
+  callbackThread = std::this_thread::get_id();
+  Client client(opts, ctx);
+  pClient = &client;
+  client.Connect();
+
+  //The remote's version is picked up on the I/O thread, which logs as it goes
+  REQUIRE( send(sockets.mFDs[1], "SSH-2.0-Test\r\n", 14, 0) == 14 );
+
+  //The I/O thread can't wait for itself, so Stop returns and the thread finishes on its own
+  REQUIRE( WaitFor([&]() { return bStopped.load(); }) );
+  client.Join();
+
+  REQUIRE( callbackThread.load() != std::this_thread::get_id() );
+  REQUIRE( client.GetState() != State::Disconnected );
+}
+
+TEST_CASE("A threaded client may be destroyed from its own callback", "[Client]")
+{
+  SocketPair sockets;
+  TTransport pTransport = Transport::CreateSocket(sockets.mFDs[0]);
+  REQUIRE( pTransport != nullptr );
+
+  //Only the client keeps the transport, so it goes once the client has been freed
+  std::weak_ptr<ITransport> pWeakTransport = pTransport;
+
+  std::atomic<bool> bDestroyed = false;
+  std::atomic<std::thread::id> callbackThread;
+
+  ClientOptions opts;
+  opts.mLogFunc = [](const char*) {};
+  opts.mLogLevel = LogLevel::Error;
+  opts.mTransport = std::move(pTransport);
+  opts.mOnDisconnect = [&](Client* pClient)
+  {
+    callbackThread = std::this_thread::get_id();
+    delete pClient;
+    bDestroyed = true;
+  };
+
+  TCtx ctx;
+  Client* pClient = new Client(opts, ctx);
+  opts.mTransport.reset();
+
+  pClient->Connect();
+
+  //The remote going away disconnects the client on its I/O thread
+  shutdown(sockets.mFDs[1], SHUT_RDWR);
+
+  REQUIRE( WaitFor([&]() { return bDestroyed.load(); }) );
+  REQUIRE( callbackThread.load() != std::this_thread::get_id() );
+
+  //The I/O thread finishes its pass with the client's state intact, then frees it
+  REQUIRE( WaitFor([&]() { return pWeakTransport.expired(); }) );
+}
+#endif
@@ -0,0 +1,84 @@
+#include <catch2/catch.hpp>
+#include "crypto-pool.h"
+
+#include <atomic>
+#include <thread>
+
+using namespace SSH;
+
+TEST_CASE("CryptoPool runs submitted tasks", "[CryptoPool]")
+{
+  CryptoPool pool(4);
+  REQUIRE( pool.NumThreads() == 4 );
+
+  SECTION("Every task runs exactly once")
+  {
+    const int numTasks = 10000;
+    std::atomic<int> numRun = 0;
+
+    for (int i = 0; i < numTasks; ++i)
+    {
+      pool.Submit([&numRun]() { numRun++; });
+    }
+
+    while (numRun < numTasks)
+    {
+      std::this_thread::yield();
+    }
+
+    REQUIRE( numRun == numTasks );
+  }
+
+  SECTION("Tasks submitted by a task are picked up by idle workers")
+  {
+    const int numChildren = 64;
+    std::atomic<int> numRun = 0;
+
+    pool.Submit([&pool, &numRun]()
+    {
+      for (int i = 0; i < numChildren; ++i)
+      {
+        pool.Submit([&numRun]()
+        {
+          std::this_thread::sleep_for(std::chrono::microseconds(100));
+          numRun++;
+        });
+      }
+    });
+
+    while (numRun < numChildren)
+    {
+      std::this_thread::yield();
+    }
+
+    REQUIRE( numRun == numChildren );
+  }
+}
+
+TEST_CASE("CompletionQueue hands results back to one thread", "[CryptoPool]")
+{
+  CryptoPool pool(2);
+  auto pCompletions = std::make_shared<CompletionQueue>();
+  std::atomic<int> numPosted = 0;
+  int numCompleted = 0;
+
+  REQUIRE_FALSE( pCompletions->RunAll() );
+
+  for (int i = 0; i < 8; ++i)
+  {
+    pool.Submit([pCompletions, &numPosted, &numCompleted]()
+    {
+      pCompletions->Post([&numCompleted]() { numCompleted++; });
+      numPosted++;
+    });
+  }
+
+  while (numPosted < 8)
+  {
+    std::this_thread::yield();
+  }
+
+  REQUIRE( pCompletions->RunAll() );
+  REQUIRE( numCompleted == 8 );
+  REQUIRE_FALSE( pCompletions->RunAll() );
+}
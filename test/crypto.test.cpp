@@ -0,0 +1,57 @@
+#include <catch2/catch.hpp>
+#include "crypto/crypto.h"
+
+using namespace SSH;
+
+TEST_CASE("Split ciphers continue the same keystream", "[Crypto]")
+{
+  Key enc;
+  Key iv;
+  enc.SetLen(16);
+  iv.SetLen(16);
+  for (UINT32 i = 0; i < 16; ++i)
+  {
+    enc.Data()[i] = (Byte)(i * 3 + 1);
+    iv.Data()[i] = (Byte)(0xF0 + i); //Close to wrapping, so the counter has to carry
+  }
+
+  TCryptoHandler pInOrder = Crypto::Create(CryptoHandlers::AES128_CTR);
+  TCryptoHandler pSplit = Crypto::Create(CryptoHandlers::AES128_CTR);
+  REQUIRE( pInOrder->SetKey(enc, iv) );
+  REQUIRE( pSplit->SetKey(enc, iv) );
+
+  std::vector<Byte> first(64 * 16, 0x11);
+  std::vector<Byte> second(300 * 16, 0x22);
+  std::vector<Byte> third(16, 0x33);
+  std::vector<Byte> firstSplit = first;
+  std::vector<Byte> secondSplit = second;
+  std::vector<Byte> thirdSplit = third;
+
+  REQUIRE( pInOrder->Encrypt(first.data(), (int)first.size()) );
+  REQUIRE( pInOrder->Encrypt(second.data(), (int)second.size()) );
+  REQUIRE( pInOrder->Encrypt(third.data(), (int)third.size()) );
+
+  TCryptoHandler pFirst = pSplit->Split((UINT32)firstSplit.size());
+  TCryptoHandler pSecond = pSplit->Split((UINT32)secondSplit.size());
+  REQUIRE( pFirst != nullptr );
+  REQUIRE( pSecond != nullptr );
+
+  //Finishing out of order, and the parent carrying on past both, gives the same result
+  REQUIRE( pSplit->Encrypt(thirdSplit.data(), (int)thirdSplit.size()) );
+  REQUIRE( pSecond->Encrypt(secondSplit.data(), (int)secondSplit.size()) );
+  REQUIRE( pFirst->Encrypt(firstSplit.data(), (int)firstSplit.size()) );
+
+  REQUIRE( firstSplit == first );
+  REQUIRE( secondSplit == second );
+  REQUIRE( thirdSplit == third );
+
+  SECTION("Only whole blocks can be split off")
+  {
+    REQUIRE( pSplit->Split(17) == nullptr );
+  }
+
+  SECTION("Unencrypted streams can't be split")
+  {
+    REQUIRE( Crypto::Create(CryptoHandlers::None)->Split(16) == nullptr );
+  }
+}
@@ -0,0 +1,643 @@
+#include "fake-server.h"
+#include "messages.h"
+#include "random.h"
+#include "endian.h"
+#include "mac.h"
+#include "kex/dh_groups.h"
+
+#include <algorithm>
+#include <cstring>
+
+//The same settings the library's key exchange is built with
+#define WOLFCRYPT_ONLY
+#include <IDE/WIN10/user_settings.h>
+#include <wolfssl/wolfcrypt/dh.h>
+#include <wolfssl/wolfcrypt/rsa.h>
+#include <wolfssl/wolfcrypt/hash.h>
+#include <wolfssl/wolfcrypt/aes.h>
+#include <wolfssl/wolfcrypt/signature.h>
+
+using namespace SSH;
+
+namespace
+{
+  const char* sServerIdent = "SSH-2.0-FakeServer";
+
+  //First channel ID the server hands out, so the client's and the server's IDs never line up by accident
+  constexpr UINT32 sFirstServerID = 100;
+
+  //RSA 2048 host key (PKCS#1 DER), only ever used to sign test handshakes
+  const Byte sHostKey[] = {
+    0x30, 0x82, 0x04, 0xA2, 0x02, 0x01, 0x00, 0x02, 0x82, 0x01, 0x01, 0x00, 0xC3, 0xB8, 0x08, 0x90,
+    0xA7, 0xCC, 0x4E, 0x0C, 0x17, 0x47, 0x05, 0x82, 0x0C, 0x3C, 0x09, 0xB5, 0x9A, 0x3A, 0x72, 0x6A,
+    0x1A, 0x36, 0xC0, 0x9D, 0xBA, 0x35, 0xA9, 0x6B, 0xC8, 0xBC, 0x14, 0x7C, 0xF6, 0x66, 0x47, 0x7A,
+    0x17, 0xFE, 0xD0, 0xD8, 0x07, 0x7B, 0x47, 0x2D, 0x88, 0xD5, 0x08, 0x3A, 0xE7, 0xFC, 0xF3, 0x88,
+    0x4E, 0xF8, 0xE0, 0xDF, 0x07, 0x53, 0x11, 0xC4, 0x87, 0x3E, 0xB7, 0x3A, 0x8C, 0xCF, 0x08, 0x39,
+    0x98, 0xF7, 0x46, 0x47, 0x44, 0xAF, 0xD3, 0x04, 0x1A, 0x35, 0x77, 0x8E, 0xA3, 0x69, 0x65, 0xD2,
+    0x64, 0xBD, 0xA9, 0x27, 0x6D, 0x11, 0xB8, 0xED, 0x66, 0x0A, 0x21, 0x14, 0x16, 0xB6, 0x86, 0x4F,
+    0x3A, 0x24, 0x31, 0xDB, 0x0B, 0x70, 0x03, 0x01, 0x8F, 0xAF, 0xA6, 0xC3, 0xDF, 0x39, 0x04, 0x8F,
+    0xE2, 0xAD, 0x90, 0xD2, 0x2D, 0x5B, 0x23, 0xBA, 0xB8, 0x18, 0x65, 0xE9, 0x29, 0x66, 0x67, 0xBF,
+    0xF9, 0x70, 0x22, 0x9E, 0xAB, 0x1C, 0xA4, 0x52, 0x5E, 0xA9, 0xC5, 0x9D, 0x3F, 0x59, 0x0B, 0xF4,
+    0xE3, 0x1C, 0xFE, 0xC4, 0xD4, 0x5A, 0x76, 0xC9, 0xAC, 0xF0, 0x9C, 0x38, 0x39, 0x36, 0xEF, 0x6F,
+    0xDD, 0x4C, 0x90, 0x2D, 0x08, 0x81, 0xCB, 0x5A, 0xD3, 0xEB, 0x5A, 0xC4, 0x36, 0xB1, 0x29, 0x15,
+    0x3E, 0xAC, 0x7E, 0xDA, 0xEC, 0x8A, 0xB9, 0xCA, 0x99, 0x88, 0xC9, 0x62, 0x28, 0x22, 0xAB, 0x98,
+    0x8C, 0xF3, 0x26, 0x21, 0x2E, 0x35, 0x8B, 0x5A, 0x28, 0xC5, 0xE0, 0xB2, 0xAF, 0xC5, 0x2C, 0x63,
+    0xD4, 0x85, 0x5F, 0x7A, 0x01, 0x53, 0x97, 0xE4, 0xBB, 0xC9, 0xB0, 0x4B, 0xF2, 0x8E, 0xBF, 0x29,
+    0x95, 0x6D, 0x29, 0x93, 0x7C, 0x5C, 0x17, 0x98, 0xC4, 0xF5, 0x6C, 0x6D, 0x10, 0xA9, 0xC6, 0x0E,
+    0xD9, 0x69, 0x9A, 0x97, 0x97, 0xA6, 0xF0, 0x25, 0x25, 0x67, 0x9D, 0x49, 0x02, 0x03, 0x01, 0x00,
+    0x01, 0x02, 0x82, 0x01, 0x00, 0x0E, 0x07, 0xE2, 0x33, 0x4E, 0x98, 0x36, 0xAB, 0x26, 0xBB, 0x0C,
+    0x71, 0xC9, 0x83, 0x3F, 0x55, 0xF1, 0xC7, 0xC9, 0x5E, 0x82, 0x61, 0x14, 0xF7, 0x69, 0xBB, 0x41,
+    0x99, 0x4C, 0xC3, 0x70, 0xFB, 0x91, 0x65, 0x7D, 0x2F, 0xCB, 0x4B, 0x14, 0xF9, 0x3B, 0xB6, 0x12,
+    0x80, 0xF8, 0xEB, 0x7E, 0xC2, 0xCC, 0x51, 0x45, 0xBB, 0x2A, 0xA0, 0x2C, 0x6C, 0xC8, 0xB7, 0x63,
+    0x91, 0x71, 0x79, 0xA5, 0x44, 0x91, 0x06, 0x21, 0x8A, 0x91, 0x84, 0xFE, 0x98, 0x8A, 0xDB, 0xC8,
+    0xF6, 0xA5, 0x13, 0x5A, 0xAE, 0x12, 0xD8, 0x72, 0x38, 0x7E, 0x48, 0xDB, 0x78, 0xCC, 0x58, 0xA6,
+    0x27, 0x7C, 0xB6, 0x72, 0xAF, 0x20, 0x3E, 0xB7, 0x0B, 0xB4, 0x79, 0x16, 0x4A, 0xE3, 0xFB, 0xC4,
+    0x77, 0x66, 0xEF, 0xDA, 0x76, 0x75, 0xC8, 0xFE, 0x62, 0xFB, 0x46, 0xE2, 0x98, 0x32, 0xB0, 0xB3,
+    0x33, 0xC6, 0x51, 0x57, 0x72, 0xDA, 0xAA, 0x25, 0x2E, 0x91, 0x4A, 0x95, 0x23, 0x28, 0xB2, 0x95,
+    0x98, 0x4A, 0x4E, 0x55, 0x6E, 0x80, 0x8D, 0x5F, 0x1A, 0x92, 0x82, 0x9D, 0xA8, 0xF1, 0x4D, 0x0A,
+    0x72, 0xFA, 0x9C, 0x03, 0x98, 0xDC, 0x0E, 0xCF, 0x39, 0x07, 0x4E, 0xFC, 0x55, 0x89, 0xB5, 0x78,
+    0x18, 0x72, 0x99, 0xAE, 0x94, 0xD4, 0x09, 0xDB, 0x7D, 0xD4, 0x83, 0xB9, 0xFE, 0xB5, 0x05, 0x15,
+    0x68, 0xA1, 0xE1, 0x32, 0x7B, 0xEA, 0x0E, 0xE0, 0xDD, 0x9B, 0xAA, 0x8E, 0xE3, 0x33, 0x35, 0x51,
+    0xAB, 0x46, 0xA0, 0x3B, 0xB7, 0x5B, 0x2C, 0xFA, 0x1C, 0x07, 0x37, 0x5F, 0x7A, 0x40, 0x13, 0x4D,
+    0xCF, 0x10, 0x2A, 0xD7, 0x5B, 0xFC, 0x82, 0x1F, 0x8F, 0x61, 0x01, 0xC2, 0x82, 0x2E, 0x2E, 0x6F,
+    0xBA, 0x64, 0xB5, 0xC6, 0xFA, 0x16, 0xBF, 0xCE, 0xE9, 0x59, 0x41, 0xEA, 0x61, 0xCD, 0xFF, 0x69,
+    0x3F, 0xC8, 0x40, 0xC7, 0x21, 0x02, 0x81, 0x81, 0x00, 0xF6, 0xBD, 0x5B, 0xDF, 0xA9, 0x7E, 0xAF,
+    0x2C, 0x17, 0xD6, 0x0A, 0x16, 0x86, 0x4D, 0x5D, 0xF0, 0xBE, 0xAA, 0x96, 0x74, 0xBD, 0xC6, 0xA3,
+    0x04, 0x89, 0x95, 0xA3, 0x63, 0xF1, 0x98, 0xBE, 0xDC, 0x4B, 0xCC, 0x42, 0xDE, 0x02, 0x4B, 0xA2,
+    0xD7, 0xD6, 0x28, 0xA9, 0x58, 0x8C, 0x4C, 0xF3, 0x96, 0x24, 0x31, 0xE9, 0x6E, 0x50, 0x55, 0x8D,
+    0xA1, 0xBE, 0xA6, 0xE5, 0x4F, 0xE8, 0x62, 0x71, 0x28, 0x32, 0xC4, 0x5F, 0x03, 0xA4, 0x52, 0xE8,
+    0xAF, 0xBF, 0x45, 0x3F, 0xF7, 0xD8, 0x6B, 0xB7, 0x9B, 0x71, 0xFB, 0x84, 0xBF, 0x84, 0xE3, 0xCB,
+    0x4F, 0xCD, 0x8E, 0x6D, 0x11, 0xBF, 0xE1, 0xA8, 0x12, 0x51, 0x4C, 0xF3, 0xC2, 0xB9, 0x27, 0xAA,
+    0xA0, 0x23, 0xEF, 0x4C, 0x0F, 0xBA, 0x53, 0x7B, 0x20, 0x28, 0x0D, 0x34, 0x13, 0x9A, 0xAF, 0xB2,
+    0x94, 0x27, 0xA8, 0x24, 0x41, 0xAE, 0xD4, 0x37, 0xB1, 0x02, 0x81, 0x81, 0x00, 0xCB, 0x10, 0x79,
+    0x43, 0x7F, 0x06, 0xCC, 0xF8, 0xF0, 0x62, 0x16, 0xEC, 0x72, 0x87, 0x70, 0x16, 0x6D, 0xCE, 0xE2,
+    0x7A, 0xFA, 0x13, 0xB2, 0x3C, 0x10, 0x85, 0x8D, 0x17, 0xBA, 0x7F, 0xC0, 0xA6, 0x8D, 0xEE, 0x23,
+    0xA6, 0x38, 0x03, 0xB6, 0x3A, 0xEA, 0xD4, 0xF0, 0xEB, 0x5E, 0xCF, 0x64, 0x4E, 0x1E, 0x56, 0x92,
+    0x49, 0x7F, 0x2A, 0xA8, 0x05, 0x97, 0x72, 0x01, 0xF7, 0x1D, 0x35, 0xA2, 0xD4, 0x1A, 0x91, 0x66,
+    0x57, 0x7F, 0xA1, 0xA3, 0xE1, 0x7B, 0xC5, 0x06, 0x15, 0x51, 0xC1, 0x38, 0x62, 0x2E, 0xB0, 0x9D,
+    0x93, 0x28, 0x1E, 0x6D, 0xA6, 0x02, 0xB3, 0x50, 0xA5, 0x75, 0xD4, 0x4E, 0x4E, 0x7A, 0x9A, 0xEB,
+    0x90, 0x3D, 0x9E, 0xFA, 0x85, 0x13, 0xED, 0x3E, 0x22, 0x36, 0x33, 0x4B, 0x33, 0x2D, 0x84, 0x8B,
+    0xB4, 0xEB, 0x27, 0x64, 0xA1, 0x45, 0x04, 0xFB, 0x25, 0x8B, 0x39, 0x3D, 0x19, 0x02, 0x81, 0x80,
+    0x1D, 0x12, 0x8E, 0xC2, 0xB9, 0xCB, 0xED, 0x83, 0xFA, 0x83, 0x03, 0xC9, 0x47, 0xA5, 0xD2, 0x0D,
+    0xCD, 0xC9, 0x77, 0xD4, 0xE5, 0x8F, 0x84, 0x21, 0xC2, 0xBC, 0x58, 0xF6, 0x2B, 0xBF, 0x5D, 0xAD,
+    0xC3, 0x58, 0x9C, 0x00, 0x60, 0xB0, 0xDC, 0xCD, 0x25, 0xB4, 0xC0, 0xCF, 0x68, 0x28, 0xA1, 0x02,
+    0xED, 0xDC, 0xDB, 0xAE, 0x5D, 0xD4, 0xD6, 0xCD, 0x5A, 0x13, 0x7C, 0x2D, 0x80, 0x2A, 0x29, 0x3F,
+    0x1D, 0x4C, 0x3A, 0x0D, 0xC9, 0xCC, 0xE3, 0x11, 0xE2, 0x2D, 0x9C, 0xAD, 0xED, 0x58, 0x33, 0xD8,
+    0x23, 0x04, 0x09, 0xCE, 0x2F, 0x30, 0x50, 0x02, 0x65, 0x2C, 0x04, 0xF9, 0xF4, 0x6B, 0xF8, 0x4B,
+    0xC0, 0x3C, 0x9A, 0xF4, 0x34, 0xB0, 0xD1, 0xCF, 0xF0, 0xAB, 0xFF, 0x80, 0x52, 0xEA, 0x07, 0x35,
+    0xF0, 0xC2, 0x2D, 0x82, 0xA9, 0xD5, 0x4D, 0xEB, 0x5B, 0x08, 0xDA, 0xCC, 0xCA, 0x76, 0xC2, 0xE1,
+    0x02, 0x81, 0x80, 0x4E, 0x36, 0x28, 0x1E, 0xA1, 0x1C, 0x63, 0x72, 0x36, 0x53, 0xF1, 0x74, 0x5C,
+    0xA0, 0x61, 0xC1, 0xA1, 0xC5, 0x9F, 0x61, 0xB2, 0x54, 0x47, 0xBF, 0xEE, 0xB5, 0x21, 0xA4, 0xD4,
+    0x06, 0x44, 0x93, 0x61, 0xF3, 0x28, 0xF3, 0xEA, 0x7B, 0x33, 0x82, 0xF9, 0xD3, 0xCE, 0x7F, 0x39,
+    0x63, 0x33, 0xC5, 0x0A, 0xD6, 0x59, 0x3D, 0xC9, 0xA7, 0x0A, 0x54, 0x2D, 0x02, 0x92, 0x53, 0x35,
+    0x82, 0xE5, 0x16, 0x40, 0xAD, 0x63, 0xF7, 0xAB, 0x86, 0xFC, 0x71, 0xEA, 0x93, 0xF6, 0x45, 0xDB,
+    0xD9, 0x49, 0xF8, 0x36, 0xF7, 0x7B, 0x99, 0xA4, 0x48, 0x23, 0xFF, 0x5E, 0xE6, 0xE5, 0xD6, 0xF4,
+    0xCD, 0x32, 0xE3, 0xF3, 0x41, 0x1C, 0x1D, 0xD0, 0x3E, 0x1D, 0x4B, 0x88, 0x63, 0x46, 0x1D, 0x33,
+    0x37, 0x0A, 0x6D, 0xC9, 0xC8, 0x55, 0x6E, 0xF7, 0x6B, 0x92, 0xCC, 0xB2, 0xA2, 0xBA, 0x80, 0xB9,
+    0x60, 0xF0, 0x71, 0x02, 0x81, 0x80, 0x2D, 0xDB, 0xAE, 0x1E, 0xFD, 0x45, 0x82, 0x04, 0x29, 0xDF,
+    0x8B, 0x5C, 0x7A, 0xBA, 0x6B, 0x33, 0x5A, 0x36, 0xD7, 0x43, 0x62, 0xF6, 0xCD, 0x9C, 0x8B, 0x02,
+    0x79, 0xAA, 0xDF, 0x7A, 0xF8, 0x62, 0x9B, 0xB5, 0x0C, 0x5E, 0x19, 0x25, 0x58, 0x18, 0xA1, 0x37,
+    0xC7, 0xCE, 0xF2, 0xCD, 0x64, 0x1D, 0x37, 0x92, 0x74, 0xD2, 0xA8, 0xA1, 0xC9, 0x37, 0xCC, 0x25,
+    0x38, 0xC6, 0xF7, 0x91, 0xBB, 0x51, 0x35, 0x3B, 0x7B, 0x83, 0x05, 0x53, 0xB6, 0x9B, 0x6E, 0x6B,
+    0x4C, 0xF3, 0x8B, 0x36, 0x9D, 0x4F, 0x9A, 0x74, 0x6A, 0xD1, 0x95, 0x3C, 0x07, 0x97, 0x91, 0x2B,
+    0x89, 0xB8, 0xDA, 0x25, 0x4D, 0x91, 0xB1, 0xC8, 0x13, 0x1D, 0xB0, 0x0E, 0x40, 0xD3, 0xC9, 0x7E,
+    0x56, 0x5F, 0xBD, 0xD8, 0x4E, 0x05, 0x74, 0xBD, 0x71, 0xB2, 0x32, 0x50, 0x27, 0x3A, 0xC8, 0xCC,
+    0x34, 0xAD, 0x43, 0x31, 0x4F, 0xB7
+  };
+
+  void AppendString(TByteString& out, const Byte* pBuf, UINT32 bufLen)
+  {
+    Byte len[sizeof(UINT32)];
+    StoreBE32(len, bufLen);
+    out.insert(out.end(), len, len + sizeof(len));
+    out.insert(out.end(), pBuf, pBuf + bufLen);
+  }
+
+  void AppendString(TByteString& out, const std::string& str)
+  {
+    AppendString(out, (const Byte*)str.data(), (UINT32)str.length());
+  }
+
+  //Hashes a length prefixed buffer, the way the exchange hash is built up
+  bool HashString(wc_HashAlg& hash, const Byte* pBuf, UINT32 bufLen)
+  {
+    Byte len[sizeof(UINT32)];
+    StoreBE32(len, bufLen);
+    return (wc_HashUpdate(&hash, WC_HASH_TYPE_SHA, len, sizeof(len)) == 0 &&
+            wc_HashUpdate(&hash, WC_HASH_TYPE_SHA, pBuf, bufLen) == 0);
+  }
+
+  NameList Names(const char* pName)
+  {
+    NameList names;
+    names.Add(pName);
+    return names;
+  }
+}
+
+FakeServer::FakeServer(UINT32 windowSize, UINT32 maxPacketSize)
+  : mWindowSize(windowSize)
+  , mMaxPacketSize(maxPacketSize)
+{
+  std::string ident = std::string(sServerIdent) + "\r\n";
+  mOut.insert(mOut.end(), ident.begin(), ident.end());
+
+  //The client's lists aren't negotiated, but these are what it uses
+  Byte cookie[cKexCookieLength] = {};
+  TPacket pKEXInit = Messages::KEXInit::Create(mStore, cookie,
+                                               Names("diffie-hellman-group14-sha1"), Names("ssh-rsa"),
+                                               Names("aes128-ctr"), Names("aes128-ctr"),
+                                               Names("hmac-sha2-256"), Names("hmac-sha2-256"),
+                                               Names("none"), Names("none"),
+                                               NameList(), NameList(),
+                                               false, 0);
+
+  mServerKEXInit.assign(pKEXInit->Payload(), pKEXInit->Payload() + pKEXInit->PayloadLen());
+  Emit(pKEXInit);
+}
+
+TResult FakeServer::Send(const Byte* pBuf, const int bufLen)
+{
+  if (mbFailed)
+  {
+    return -1;
+  }
+
+  if (mSendRoom == 0)
+  {
+    return {};
+  }
+
+  int numBytes = (int)std::min<size_t>(bufLen, mSendRoom);
+  if (mSendRoom != SIZE_MAX)
+  {
+    mSendRoom -= numBytes;
+  }
+
+  Feed(pBuf, numBytes);
+  return numBytes;
+}
+
+TResult FakeServer::Recv(Byte* pBuf, const int bufLen)
+{
+  if (mOut.empty())
+  {
+    return {};
+  }
+
+  int numBytes = (int)std::min<size_t>(bufLen, mOut.size());
+  std::copy(mOut.begin(), mOut.begin() + numBytes, pBuf);
+  mOut.erase(mOut.begin(), mOut.begin() + numBytes);
+  return numBytes;
+}
+
+void FakeServer::Feed(const Byte* pBuf, const int bufLen)
+{
+  mIn.insert(mIn.end(), pBuf, pBuf + bufLen);
+
+  if (!mbGotIdent)
+  {
+    auto lf = std::find(mIn.begin(), mIn.end(), (Byte)'\n');
+    if (lf == mIn.end())
+    {
+      return;
+    }
+
+    auto identEnd = (lf != mIn.begin() && *(lf - 1) == '\r') ? (lf - 1) : lf;
+    mClientIdent.assign(mIn.begin(), identEnd);
+    mIn.erase(mIn.begin(), lf + 1);
+    mbGotIdent = true;
+  }
+
+  while (!mbFailed)
+  {
+    if (mPendingLen == 0)
+    {
+      int packetLen = mStore.DecryptHeader(mIn.data(), (int)mIn.size());
+      if (packetLen < 0)
+      {
+        mbFailed = true;
+        return;
+      }
+
+      if (packetLen == 0)
+      {
+        return;
+      }
+
+      mPendingLen = packetLen;
+    }
+
+    if (mIn.size() < mPendingLen)
+    {
+      return;
+    }
+
+    TPacket pPacket = mStore.CreateView(mIn.data(), mPendingLen, mInSeq++);
+    if (!pPacket->PrepareRead())
+    {
+      mbFailed = true;
+      return;
+    }
+
+    Handle(*pPacket);
+    pPacket.reset();
+
+    mIn.erase(mIn.begin(), mIn.begin() + mPendingLen);
+    mPendingLen = 0;
+  }
+}
+
+void FakeServer::Emit(const TPacket& pPacket)
+{
+  pPacket->PrepareWrite(mOutSeq++);
+  mOut.insert(mOut.end(), pPacket->Begin(), pPacket->Begin() + pPacket->Remaining());
+}
+
+void FakeServer::Handle(Packet& packet)
+{
+  Byte msgId = SSH_MSG::NONE;
+  packet.Peek(msgId);
+
+  switch (msgId)
+  {
+    case SSH_MSG::KEXINIT:
+    {
+      mClientKEXInit.assign(packet.Payload(), packet.Payload() + packet.PayloadLen());
+      break;
+    }
+    case SSH_MSG::KEXDH_INIT:
+    {
+      mbFailed = !ReplyDH(packet);
+      break;
+    }
+    case SSH_MSG::NEWKEYS:
+    {
+      TMACHandler pMAC = MAC::Create(MACHandlers::HMAC_SHA2_256);
+      TCryptoHandler pCrypto = Crypto::Create(CryptoHandlers::AES128_CTR);
+      if (!pMAC->SetKey(mIncomingMAC) || !pCrypto->SetKey(mIncomingEnc, mIncomingIV))
+      {
+        mbFailed = true;
+        break;
+      }
+
+      mStore.SetIncomingMACHandler(pMAC);
+      mStore.SetDecryptionHandler(pCrypto);
+      break;
+    }
+    case SSH_MSG::SERVICE_REQUEST:
+    {
+      Emit(Messages::ServiceAccept::Create(mStore, "ssh-userauth"));
+      break;
+    }
+    case SSH_MSG::USERAUTH_REQUEST:
+    {
+      TPacket pSuccess = mStore.Create(sizeof(Byte), PacketType::Write);
+      pSuccess->Write(SSH_MSG::USERAUTH_SUCCESS);
+      Emit(pSuccess);
+      mbLoggedIn = true;
+      break;
+    }
+    case SSH_MSG::GLOBAL_REQUEST:
+    {
+      std::string_view name;
+      bool bWantReply = false;
+      if (Messages::GlobalRequest::Parse(packet, name, bWantReply) && bWantReply)
+      {
+        TPacket pFailure = mStore.Create(sizeof(Byte), PacketType::Write);
+        pFailure->Write(SSH_MSG::REQUEST_FAILURE);
+        Emit(pFailure);
+      }
+      break;
+    }
+    case SSH_MSG::CHANNEL_OPEN:
+    {
+      std::string_view type;
+      Channel channel;
+      if (!Messages::ChannelOpen::Parse(packet, type, channel.mClientID, channel.mSendWindow, channel.mMaxPacketSize))
+      {
+        mbFailed = true;
+        break;
+      }
+
+      channel.mRecvWindow = mWindowSize;
+      UINT32 serverID = sFirstServerID + (UINT32)mChannels.size();
+      mChannels.push_back(channel);
+
+      TPacket pConfirm = mStore.Create(sizeof(Byte) + (4 * sizeof(UINT32)), PacketType::Write);
+      pConfirm->Write(SSH_MSG::CHANNEL_OPEN_CONFIRMATION);
+      pConfirm->Write(channel.mClientID);
+      pConfirm->Write(serverID);
+      pConfirm->Write(mWindowSize);
+      pConfirm->Write(mMaxPacketSize);
+      Emit(pConfirm);
+      break;
+    }
+    case SSH_MSG::CHANNEL_DATA:
+    {
+      UINT32 serverID = 0;
+      ByteView data;
+      Channel* pChannel = nullptr;
+      if (!Messages::ChannelData::Parse(packet, serverID, data) || (pChannel = FindChannel(serverID)) == nullptr)
+      {
+        mbFailed = true;
+        break;
+      }
+
+      //Sending beyond the window or the maximum packet size is a protocol error
+      if (data.mLen > pChannel->mRecvWindow || data.mLen > mMaxPacketSize)
+      {
+        mbFailed = true;
+        break;
+      }
+
+      pChannel->mRecvWindow -= data.mLen;
+      pChannel->mReceived.insert(pChannel->mReceived.end(), data.mpData, data.mpData + data.mLen);
+      pChannel->mNumDataPackets++;
+      break;
+    }
+    case SSH_MSG::CHANNEL_WINDOW_ADJUST:
+    {
+      UINT32 serverID = 0;
+      UINT32 numBytes = 0;
+      Channel* pChannel = nullptr;
+      if (!Messages::ChannelWindowAdjust::Parse(packet, serverID, numBytes) || (pChannel = FindChannel(serverID)) == nullptr)
+      {
+        mbFailed = true;
+        break;
+      }
+
+      pChannel->mSendWindow += numBytes;
+      break;
+    }
+    case SSH_MSG::CHANNEL_CLOSE:
+    {
+      UINT32 serverID = 0;
+      Channel* pChannel = nullptr;
+      if (!Messages::ChannelClose::Parse(packet, serverID) || (pChannel = FindChannel(serverID)) == nullptr)
+      {
+        mbFailed = true;
+        break;
+      }
+
+      if (!pChannel->mbClosed)
+      {
+        pChannel->mbClosed = true;
+        Emit(Messages::ChannelClose::Create(mStore, pChannel->mClientID));
+      }
+      break;
+    }
+    default:
+    {
+      break;
+    }
+  }
+}
+
+bool FakeServer::ReplyDH(Packet& packet)
+{
+  MPInt e;
+  if (!Messages::KEXDHInit::Parse(packet, e))
+  {
+    return false;
+  }
+
+  WC_RNG* pRNG = Random::ThreadRNG();
+  if (pRNG == nullptr)
+  {
+    return false;
+  }
+
+  //Our half of the exchange, and the shared secret
+  MPInt y;
+  MPInt f;
+  {
+    DhKey key;
+    if (wc_InitDhKey(&key) != 0)
+    {
+      return false;
+    }
+
+    UINT32 yLen = 0;
+    UINT32 fLen = 0;
+    UINT32 kLen = 0;
+    bool bAgreed = (wc_DhSetKey(&key, sDHGroup14.data.data(), sDHGroup14.data.size(), &sDHGroup14.generator, sizeof(Byte)) == 0 &&
+                    wc_DhGenerateKeyPair(&key, pRNG, y.Data(), &yLen, f.Data(), &fLen) == 0);
+    if (bAgreed)
+    {
+      y.SetLen(yLen);
+      f.SetLen(fLen);
+      y.Pad();
+      f.Pad();
+
+      bAgreed = (wc_DhAgree(&key, mK.Data(), &kLen, y.Data(), y.Len(), e.Data(), e.Len()) == 0);
+    }
+
+    wc_FreeDhKey(&key);
+    if (!bAgreed)
+    {
+      return false;
+    }
+
+    mK.SetLen(kLen);
+    mK.Pad();
+  }
+
+  RsaKey hostKey;
+  if (wc_InitRsaKey(&hostKey, nullptr) != 0)
+  {
+    return false;
+  }
+
+  bool bSigned = false;
+  TByteString keyCerts;
+  TByteString signature;
+  do
+  {
+    UINT32 index = 0;
+    if (wc_RsaPrivateKeyDecode(sHostKey, &index, &hostKey, sizeof(sHostKey)) != 0)
+    {
+      break;
+    }
+
+    //Host key blob: "ssh-rsa", e, n
+    MPInt rsaE;
+    MPInt rsaN;
+    UINT32 rsaELen = sMAX_KEX_KEY_SIZE;
+    UINT32 rsaNLen = sMAX_KEX_KEY_SIZE;
+    if (wc_RsaFlattenPublicKey(&hostKey, rsaE.Data(), &rsaELen, rsaN.Data(), &rsaNLen) != 0)
+    {
+      break;
+    }
+
+    rsaE.SetLen(rsaELen);
+    rsaN.SetLen(rsaNLen);
+    rsaE.Pad();
+    rsaN.Pad();
+
+    AppendString(keyCerts, "ssh-rsa");
+    AppendString(keyCerts, rsaE.Data(), rsaE.Len());
+    AppendString(keyCerts, rsaN.Data(), rsaN.Len());
+
+    //H = hash(V_C || V_S || I_C || I_S || K_S || e || f || K)
+    wc_HashAlg hash;
+    if (wc_HashInit(&hash, WC_HASH_TYPE_SHA) != 0)
+    {
+      break;
+    }
+
+    std::string serverIdent = sServerIdent;
+    bool bHashed = (HashString(hash, (const Byte*)mClientIdent.data(), (UINT32)mClientIdent.length()) &&
+                    HashString(hash, (const Byte*)serverIdent.data(), (UINT32)serverIdent.length()) &&
+                    HashString(hash, mClientKEXInit.data(), (UINT32)mClientKEXInit.size()) &&
+                    HashString(hash, mServerKEXInit.data(), (UINT32)mServerKEXInit.size()) &&
+                    HashString(hash, keyCerts.data(), (UINT32)keyCerts.size()) &&
+                    HashString(hash, e.Data(), e.Len()) &&
+                    HashString(hash, f.Data(), f.Len()) &&
+                    HashString(hash, mK.Data(), mK.Len()));
+
+    mH.SetLen(wc_HashGetDigestSize(WC_HASH_TYPE_SHA));
+    bHashed = bHashed && (wc_HashFinal(&hash, WC_HASH_TYPE_SHA, mH.Data()) == 0);
+    wc_HashFree(&hash, WC_HASH_TYPE_SHA);
+    if (!bHashed)
+    {
+      break;
+    }
+
+    int maxSigLen = wc_SignatureGetSize(WC_SIGNATURE_TYPE_RSA_W_ENC, &hostKey, sizeof(hostKey));
+    if (maxSigLen <= 0)
+    {
+      break;
+    }
+
+    TByteString sig(maxSigLen);
+    UINT32 sigLen = (UINT32)maxSigLen;
+    if (wc_SignatureGenerate(WC_HASH_TYPE_SHA, WC_SIGNATURE_TYPE_RSA_W_ENC, mH.Data(), mH.Len(),
+                             sig.data(), &sigLen, &hostKey, sizeof(hostKey), pRNG) != 0)
+    {
+      break;
+    }
+
+    AppendString(signature, "ssh-rsa");
+    AppendString(signature, sig.data(), sigLen);
+    bSigned = true;
+  } while (false);
+
+  wc_FreeRsaKey(&hostKey);
+  if (!bSigned)
+  {
+    return false;
+  }
+
+  Emit(Messages::KEXDHReply::Create(mStore,
+                                    ByteView{ keyCerts.data(), (UINT32)keyCerts.size() },
+                                    ByteView{ f.Data(), f.Len() },
+                                    ByteView{ signature.data(), (UINT32)signature.size() }));
+
+  Emit(Messages::NewKeys::Create(mStore));
+
+  //Client to server keys are A, C and E, server to client are B, D and F (RFC 4253 section 7.2)
+  UINT32 macLen = MAC::Len(MACHandlers::HMAC_SHA2_256);
+  Key outgoingIV;
+  Key outgoingEnc;
+  Key outgoingMAC;
+  if (!DeriveKey(mIncomingIV, AES_BLOCK_SIZE, 'A') || !DeriveKey(outgoingIV, AES_BLOCK_SIZE, 'B') ||
+      !DeriveKey(mIncomingEnc, AES_BLOCK_SIZE, 'C') || !DeriveKey(outgoingEnc, AES_BLOCK_SIZE, 'D') ||
+      !DeriveKey(mIncomingMAC, macLen, 'E') || !DeriveKey(outgoingMAC, macLen, 'F'))
+  {
+    return false;
+  }
+
+  TMACHandler pMAC = MAC::Create(MACHandlers::HMAC_SHA2_256);
+  TCryptoHandler pCrypto = Crypto::Create(CryptoHandlers::AES128_CTR);
+  if (!pMAC->SetKey(outgoingMAC) || !pCrypto->SetKey(outgoingEnc, outgoingIV))
+  {
+    return false;
+  }
+
+  mStore.SetOutgoingMACHandler(pMAC);
+  mStore.SetEncryptionHandler(pCrypto);
+  return true;
+}
+
+bool FakeServer::DeriveKey(Key& outKey, UINT32 keyLen, Byte keyID)
+{
+  //K1 = hash(K || H || X || session_id), then Kn = hash(K || H || K1 || ... || Kn-1) until there is enough
+  const UINT32 digestLen = wc_HashGetDigestSize(WC_HASH_TYPE_SHA);
+  TByteString keyData;
+  while (keyData.size() < keyLen)
+  {
+    wc_HashAlg hash;
+    if (wc_HashInit(&hash, WC_HASH_TYPE_SHA) != 0)
+    {
+      return false;
+    }
+
+    bool bHashed = (HashString(hash, mK.Data(), mK.Len()) &&
+                    wc_HashUpdate(&hash, WC_HASH_TYPE_SHA, mH.Data(), mH.Len()) == 0);
+    if (keyData.empty())
+    {
+      //The first key exchange's H is the session ID
+      bHashed = bHashed && (wc_HashUpdate(&hash, WC_HASH_TYPE_SHA, &keyID, sizeof(keyID)) == 0 &&
+                            wc_HashUpdate(&hash, WC_HASH_TYPE_SHA, mH.Data(), mH.Len()) == 0);
+    }
+    else
+    {
+      bHashed = bHashed && (wc_HashUpdate(&hash, WC_HASH_TYPE_SHA, keyData.data(), (UINT32)keyData.size()) == 0);
+    }
+
+    Byte digest[WC_MAX_DIGEST_SIZE];
+    bHashed = bHashed && (wc_HashFinal(&hash, WC_HASH_TYPE_SHA, digest) == 0);
+    wc_HashFree(&hash, WC_HASH_TYPE_SHA);
+    if (!bHashed)
+    {
+      return false;
+    }
+
+    keyData.insert(keyData.end(), digest, digest + digestLen);
+  }
+
+  outKey.SetLen(keyLen);
+  std::memcpy(outKey.Data(), keyData.data(), keyLen);
+  return true;
+}
+
+FakeServer::Channel* FakeServer::FindChannel(UINT32 serverID)
+{
+  if (serverID < sFirstServerID || serverID - sFirstServerID >= mChannels.size())
+  {
+    return nullptr;
+  }
+
+  return &mChannels[serverID - sFirstServerID];
+}
+
+bool FakeServer::SendData(size_t index, const Byte* pBuf, UINT32 bufLen)
+{
+  Channel& channel = mChannels[index];
+  if (bufLen > channel.mSendWindow || bufLen > channel.mMaxPacketSize)
+  {
+    return false;
+  }
+
+  channel.mSendWindow -= bufLen;
+  Emit(Messages::ChannelData::Create(mStore, channel.mClientID, ByteView{ pBuf, bufLen }));
+  return true;
+}
+
+void FakeServer::AdjustWindow(size_t index, UINT32 numBytes)
+{
+  Channel& channel = mChannels[index];
+  channel.mRecvWindow += numBytes;
+  Emit(Messages::ChannelWindowAdjust::Create(mStore, channel.mClientID, numBytes));
+}
+
+void FakeServer::CloseChannel(size_t index)
+{
+  Channel& channel = mChannels[index];
+  if (!channel.mbClosed)
+  {
+    channel.mbClosed = true;
+    Emit(Messages::ChannelClose::Create(mStore, channel.mClientID));
+  }
+}
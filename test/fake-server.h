@@ -0,0 +1,99 @@
+#ifndef __FAKE_SERVER_H__
+#define __FAKE_SERVER_H__
+
+#include "ssh.h"
+#include "packets.h"
+#include "mpint.h"
+#include "crypto/crypto.h"
+#include <deque>
+#include <string>
+#include <vector>
+
+namespace SSH
+{
+  /*
+    An SSH server for tests, which stands in for a client's transport. It does the real key exchange
+    (group 14, signed with a fixed RSA host key) so the client's checks pass, accepts any login and
+    confirms every channel. Everything happens within Send and Recv, so a client using RunMode::Manual
+    is driven entirely by calls to Process on the test's own thread.
+  */
+  class FakeServer : public ITransport
+  {
+  public:
+    //A channel as the server sees it, in the order the client opened them
+    struct Channel
+    {
+      UINT32 mClientID = 0;
+      UINT32 mSendWindow = 0; //How much more the server may send the client
+      UINT32 mRecvWindow = 0; //How much more the client may send the server
+      UINT32 mMaxPacketSize = 0; //Largest CHANNEL_DATA the client accepts
+      TByteString mReceived;
+      UINT32 mNumDataPackets = 0;
+      bool mbClosed = false;
+    };
+
+  private:
+    PacketStore mStore;
+    std::vector<Byte> mIn;
+    std::deque<Byte> mOut;
+    UINT32 mInSeq = 0;
+    UINT32 mOutSeq = 0;
+    UINT32 mPendingLen = 0; //Full size of the packet at the front of mIn, once its header is decrypted
+
+    std::string mClientIdent;
+    bool mbGotIdent = false;
+    TByteString mClientKEXInit;
+    TByteString mServerKEXInit;
+
+    MPInt mK;
+    Key mH;
+    Key mIncomingIV;
+    Key mIncomingEnc;
+    Key mIncomingMAC;
+
+    UINT32 mWindowSize;
+    UINT32 mMaxPacketSize;
+    size_t mSendRoom = SIZE_MAX;
+
+    std::vector<Channel> mChannels;
+    bool mbLoggedIn = false;
+    bool mbFailed = false;
+
+    void Feed(const Byte* pBuf, const int bufLen);
+    void Handle(Packet& packet);
+    void Emit(const TPacket& pPacket);
+
+    //Answers the client's KEXDH_INIT, then switches to the new keys for everything the server sends
+    bool ReplyDH(Packet& packet);
+    bool DeriveKey(Key& outKey, UINT32 keyLen, Byte keyID);
+
+    Channel* FindChannel(UINT32 serverID);
+
+  public:
+    //Every channel opened is given windowSize, and packets up to maxPacketSize
+    explicit FakeServer(UINT32 windowSize = 2 * 1024 * 1024, UINT32 maxPacketSize = 32 * 1024);
+
+    TResult Send(const Byte* pBuf, const int bufLen) override;
+    TResult Recv(Byte* pBuf, const int bufLen) override;
+
+    //Limits how many more bytes Send accepts, as if the socket's buffer had filled up (SIZE_MAX for no limit)
+    void SetSendRoom(size_t numBytes) { mSendRoom = numBytes; }
+
+    //Set once the client has misbehaved, after which every Send fails
+    bool Failed() const { return mbFailed; }
+    bool LoggedIn() const { return mbLoggedIn; }
+
+    //Bytes the server has sent which the client has yet to Recv
+    size_t NumPending() const { return mOut.size(); }
+
+    size_t NumChannels() const { return mChannels.size(); }
+    Channel& GetChannel(size_t index) { return mChannels[index]; }
+
+    //Sends the client data on a channel, returns false if it doesn't fit the client's window
+    bool SendData(size_t index, const Byte* pBuf, UINT32 bufLen);
+    void AdjustWindow(size_t index, UINT32 numBytes);
+    void CloseChannel(size_t index);
+  };
+}
+
+#endif //~__FAKE_SERVER_H__
@@ -0,0 +1,173 @@
+#include <catch2/catch.hpp>
+#include "io-waiter.h"
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+using namespace SSH;
+
+namespace
+{
+  //Whether tag was reported, with any of events if given
+  bool Reported(const std::vector<IOWaiter::Ready>& ready, void* pTag, TIOEvents events = IOEvent::None)
+  {
+    for (const IOWaiter::Ready& entry : ready)
+    {
+      if (entry.mpTag == pTag && (events == IOEvent::None || (entry.mEvents & events) != 0))
+      {
+        return true;
+      }
+    }
+
+    return false;
+  }
+}
+
+TEST_CASE("IOWaiter sleeps until its deadline when there is nothing to do", "[IOWaiter]")
+{
+  IOWaiter waiter;
+  std::vector<IOWaiter::Ready> ready;
+
+  auto start = IOWaiter::TClock::now();
+  waiter.Wait(start + std::chrono::milliseconds(30), ready);
+
+  REQUIRE( ready.empty() );
+  REQUIRE( IOWaiter::TClock::now() - start >= std::chrono::milliseconds(30) );
+
+  //Sub-millisecond deadlines are still honoured
+  start = IOWaiter::TClock::now();
+  waiter.Wait(start + std::chrono::microseconds(200), ready);
+
+  REQUIRE( ready.empty() );
+  REQUIRE( IOWaiter::TClock::now() - start >= std::chrono::microseconds(200) );
+}
+
+TEST_CASE("IOWaiter wakes with the tags it was woken for", "[IOWaiter]")
+{
+  IOWaiter waiter;
+  std::vector<IOWaiter::Ready> ready;
+  int tag = 0;
+
+  SECTION("A wake before waiting means the wait doesn't block")
+  {
+    waiter.Wake(&tag);
+
+    auto start = IOWaiter::TClock::now();
+    waiter.Wait(std::nullopt, ready);
+
+    REQUIRE( ready.size() == 1 );
+    REQUIRE( ready[0].mpTag == &tag );
+    REQUIRE( ready[0].mEvents == IOEvent::None );
+    REQUIRE( IOWaiter::TClock::now() - start < std::chrono::seconds(1) );
+
+    //The wake has been used up, so the next wait sleeps again
+    ready.clear();
+    waiter.Wait(IOWaiter::TClock::now() + std::chrono::milliseconds(10), ready);
+    REQUIRE( ready.empty() );
+  }
+
+  SECTION("Another thread wakes a wait without a deadline")
+  {
+    std::thread waker([&]()
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      waiter.Wake(&tag);
+    });
+
+    waiter.Wait(std::nullopt, ready);
+    waker.join();
+
+    REQUIRE( Reported(ready, &tag) );
+  }
+
+  SECTION("Wakes from the waiting thread are still reported")
+  {
+    std::thread waitingThread([&]()
+    {
+      waiter.Wait(IOWaiter::TClock::now(), ready);
+      waiter.Wake(&tag);
+
+      ready.clear();
+      waiter.Wait(std::nullopt, ready);
+    });
+
+    waitingThread.join();
+    REQUIRE( Reported(ready, &tag) );
+  }
+}
+
+#ifdef __linux__
+TEST_CASE("IOWaiter reports watched descriptors as they become ready", "[IOWaiter]")
+{
+  int fds[2] = { -1, -1 };
+  REQUIRE( socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0 );
+
+  IOWaiter waiter;
+  std::vector<IOWaiter::Ready> ready;
+  int tag = 0;
+
+  REQUIRE( waiter.Watch(fds[0], &tag, IOEvent::Readable) );
+
+  SECTION("Nothing to read sleeps until the deadline")
+  {
+    waiter.Wait(IOWaiter::TClock::now() + std::chrono::milliseconds(10), ready);
+    REQUIRE( ready.empty() );
+  }
+
+  SECTION("Data arriving wakes the wait")
+  {
+    ssize_t written = 0;
+    std::thread writer([&]()
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      written = write(fds[1], "x", 1);
+    });
+
+    waiter.Wait(std::nullopt, ready);
+    writer.join();
+
+    REQUIRE( written == 1 );
+    REQUIRE( Reported(ready, &tag, IOEvent::Readable) );
+  }
+
+  SECTION("Watching for nothing keeps the descriptor quiet")
+  {
+    REQUIRE( write(fds[1], "x", 1) == 1 );
+    REQUIRE( waiter.Watch(fds[0], &tag, IOEvent::None) );
+
+    waiter.Wait(IOWaiter::TClock::now() + std::chrono::milliseconds(10), ready);
+    REQUIRE( ready.empty() );
+
+    //Level triggered, so what is already waiting is reported once watched for again
+    REQUIRE( waiter.Watch(fds[0], &tag, IOEvent::Readable) );
+    waiter.Wait(IOWaiter::TClock::now() + std::chrono::milliseconds(10), ready);
+    REQUIRE( Reported(ready, &tag, IOEvent::Readable) );
+  }
+
+  SECTION("Room to write is reported when watched for")
+  {
+    REQUIRE( waiter.Watch(fds[0], &tag, IOEvent::Writable) );
+
+    waiter.Wait(std::nullopt, ready);
+    REQUIRE( Reported(ready, &tag, IOEvent::Writable) );
+  }
+
+  SECTION("Unwatched descriptors aren't reported")
+  {
+    REQUIRE( write(fds[1], "x", 1) == 1 );
+    waiter.Unwatch(fds[0]);
+
+    waiter.Wait(IOWaiter::TClock::now() + std::chrono::milliseconds(10), ready);
+    REQUIRE( ready.empty() );
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+}
+#endif
@@ -0,0 +1,90 @@
+#include <catch2/catch.hpp>
+#include "messages.h"
+
+using namespace SSH;
+
+namespace
+{
+  //Serialises a write packet and wraps the result as an incoming packet
+  TPacket RoundTrip(PacketStore& store, TPacket pPacket, TByteString& outWire)
+  {
+    pPacket->PrepareWrite(0);
+    outWire.assign(pPacket->Begin(), pPacket->Begin() + pPacket->Remaining());
+
+    TPacket pRead = store.CreateView(outWire.data(), (UINT32)outWire.size(), 0);
+    REQUIRE( pRead->PrepareRead() );
+    return pRead;
+  }
+}
+
+TEST_CASE("Message schemas serialise and parse fields", "[Messages]")
+{
+  PacketStore store;
+  TByteString wire;
+
+  SECTION("Fixed sizes are known at compile time")
+  {
+    STATIC_REQUIRE( Messages::NewKeys::sFixedLen == 1 );
+    STATIC_REQUIRE( Messages::ChannelData::sFixedLen == 1 + 4 + 4 );
+    REQUIRE( Messages::ServiceRequest::Len("ssh-userauth") == 1 + 4 + 12 );
+  }
+
+  SECTION("Packets are sized exactly for the message")
+  {
+    TPacket pPacket = Messages::ChannelOpen::Create(store, "session", 1, 2, 3);
+    REQUIRE( pPacket->PayloadLen() == (int)Messages::ChannelOpen::Len("session", 1, 2, 3) );
+
+    Byte expectedOut[] = {
+      SSH_MSG::CHANNEL_OPEN,
+      0x00, 0x00, 0x00, 0x07,
+      's', 'e', 's', 's', 'i', 'o', 'n',
+      0x00, 0x00, 0x00, 0x01,
+      0x00, 0x00, 0x00, 0x02,
+      0x00, 0x00, 0x00, 0x03
+    };
+
+    REQUIRE( memcmp(expectedOut, pPacket->Payload(), sizeof(expectedOut)) == 0 );
+  }
+
+  SECTION("Written messages parse back")
+  {
+    Byte data[] = { 0xDE, 0xAD, 0xBE, 0xEF };
+    TPacket pRead = RoundTrip(store, Messages::ChannelData::Create(store, 42, ByteView{ data, sizeof(data) }), wire);
+
+    UINT32 channel = 0;
+    ByteView readData;
+    REQUIRE( Messages::ChannelData::Parse(*pRead, channel, readData) );
+    REQUIRE( channel == 42 );
+    REQUIRE( readData.mLen == sizeof(data) );
+    REQUIRE( memcmp(readData.mpData, data, sizeof(data)) == 0 );
+
+    //Parsed fields refer into the packet rather than copying out of it
+    REQUIRE( readData.mpData > pRead->Payload() );
+    REQUIRE( readData.mpData < pRead->Payload() + pRead->PayloadLen() );
+  }
+
+  SECTION("Mismatched message IDs are rejected")
+  {
+    TPacket pRead = RoundTrip(store, Messages::ServiceRequest::Create(store, "ssh-userauth"), wire);
+
+    std::string_view service;
+    REQUIRE_FALSE( Messages::ServiceAccept::Parse(*pRead, service) );
+    REQUIRE( Messages::ServiceRequest::Parse(*pRead, service) );
+    REQUIRE( service == "ssh-userauth" );
+  }
+
+  SECTION("Truncated payloads are rejected")
+  {
+    //A string claiming more bytes than the payload holds
+    TPacket pPacket = store.Create(1 + 4 + 2, PacketType::Write);
+    pPacket->Write(SSH_MSG::SERVICE_ACCEPT);
+    pPacket->Write(32);
+    pPacket->Write((Byte)'s');
+    pPacket->Write((Byte)'s');
+
+    TPacket pRead = RoundTrip(store, pPacket, wire);
+
+    std::string_view service;
+    REQUIRE_FALSE( Messages::ServiceAccept::Parse(*pRead, service) );
+  }
+}
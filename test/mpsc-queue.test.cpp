@@ -0,0 +1,97 @@
+#include <catch2/catch.hpp>
+#include "mpsc-queue.h"
+
+#include <thread>
+#include <vector>
+
+using namespace SSH;
+
+TEST_CASE("MPSCQueue hands values from many threads to one", "[MPSCQueue]")
+{
+  SECTION("Capacity is rounded up to a power of two")
+  {
+    MPSCQueue<int> queue(5);
+    REQUIRE( queue.Capacity() == 8 );
+  }
+
+  SECTION("Values come out in the order they went in")
+  {
+    MPSCQueue<int> queue(4);
+    REQUIRE( queue.Empty() );
+
+    for (int i = 0; i < 4; ++i)
+    {
+      REQUIRE( queue.TryPush(i) );
+    }
+
+    int value = -1;
+    for (int i = 0; i < 4; ++i)
+    {
+      REQUIRE( queue.TryPop(value) );
+      REQUIRE( value == i );
+    }
+
+    REQUIRE( queue.Empty() );
+    REQUIRE_FALSE( queue.TryPop(value) );
+  }
+
+  SECTION("A full queue rejects pushes until a value is popped")
+  {
+    MPSCQueue<int> queue(2);
+    REQUIRE( queue.TryPush(1) );
+    REQUIRE( queue.TryPush(2) );
+    REQUIRE_FALSE( queue.TryPush(3) );
+
+    int value = 0;
+    REQUIRE( queue.TryPop(value) );
+    REQUIRE( queue.TryPush(3) );
+  }
+
+  SECTION("Each producer's values stay in order")
+  {
+    const int numProducers = 4;
+    const int numValues = 20000;
+    MPSCQueue<int> queue(64);
+
+    std::vector<std::thread> producers;
+    for (int producer = 0; producer < numProducers; ++producer)
+    {
+      producers.emplace_back([&queue, producer]()
+      {
+        for (int i = 0; i < numValues; ++i)
+        {
+          while (!queue.TryPush(producer * numValues + i))
+          {
+            std::this_thread::yield();
+          }
+        }
+      });
+    }
+
+    std::vector<int> nextValue(numProducers, 0);
+    bool bInOrder = true;
+    int numPopped = 0;
+    while (numPopped < numProducers * numValues)
+    {
+      int value = 0;
+      if (!queue.TryPop(value))
+      {
+        std::this_thread::yield();
+        continue;
+      }
+
+      int producer = value / numValues;
+      bInOrder &= (value % numValues == nextValue[producer]);
+      nextValue[producer]++;
+      numPopped++;
+    }
+
+    for (auto& thread : producers)
+    {
+      thread.join();
+    }
+
+    REQUIRE( bInOrder );
+    REQUIRE( queue.Empty() );
+  }
+}
@@ -0,0 +1,103 @@
+#include <catch2/catch.hpp>
+#include "packets.h"
+
+using namespace SSH;
+
+TEST_CASE("PacketStore recycles packets through its pool", "[PacketPool]")
+{
+  PacketStore store(std::make_shared<PacketPool>(4));
+
+  SECTION("Buffers are cache line aligned")
+  {
+    TPacket pPacket = store.Create(100, PacketType::Write);
+    REQUIRE( ((uintptr_t)pPacket->Begin() % PacketPool::sBufferAlignment) == 0 );
+  }
+
+  SECTION("Released packets are reused for the same size class")
+  {
+    const Byte* pFirstBuf = nullptr;
+    {
+      TPacket pPacket = store.Create(100, PacketType::Write);
+      pFirstBuf = pPacket->Begin();
+    }
+
+    REQUIRE( store.PoolStats().mMisses == 1 );
+    REQUIRE( store.PoolStats().mReleases == 1 );
+
+    TPacket pPacket = store.Create(90, PacketType::Write);
+    REQUIRE( pPacket->Begin() == pFirstBuf );
+    REQUIRE( store.PoolStats().mHits == 1 );
+
+    //A recycled packet must look exactly like a fresh one
+    REQUIRE( pPacket->PayloadLen() == 90 );
+    REQUIRE( pPacket->Ready() == false );
+  }
+
+  SECTION("Different size classes do not share buffers")
+  {
+    {
+      TPacket pSmall = store.Create(16, PacketType::Write);
+    }
+
+    TPacket pLarge = store.Create(4000, PacketType::Write);
+    REQUIRE( store.PoolStats().mHits == 0 );
+    REQUIRE( store.PoolStats().mMisses == 2 );
+  }
+
+  SECTION("Free lists are capped")
+  {
+    {
+      std::vector<TPacket> packets;
+      for (int i = 0; i < 6; ++i)
+      {
+        packets.push_back(store.Create(32, PacketType::Write));
+      }
+    }
+
+    REQUIRE( store.PoolStats().mReleases == 4 );
+    REQUIRE( store.PoolStats().mDiscards == 2 );
+  }
+
+  SECTION("Packets may outlive their store")
+  {
+    TPacket pPacket;
+    {
+      PacketStore tmpStore;
+      pPacket = tmpStore.Create(32, PacketType::Write);
+    }
+
+    REQUIRE( pPacket->PayloadLen() == 32 );
+  }
+
+  SECTION("The pool lives until the last of its packets is back")
+  {
+    std::weak_ptr<PacketPool> pWeakPool;
+    TPacket pPacket;
+    {
+      auto pPool = std::make_shared<PacketPool>(4);
+      pWeakPool = pPool;
+
+      PacketStore tmpStore(pPool);
+      pPacket = tmpStore.Create(32, PacketType::Write);
+      TPacket pView = tmpStore.Create(16, PacketType::Write);
+    }
+
+    REQUIRE_FALSE( pWeakPool.expired() );
+    REQUIRE( pWeakPool.lock()->Stats().mReleases == 1 );
+
+    pPacket.reset();
+    REQUIRE( pWeakPool.expired() );
+  }
+
+  SECTION("Copies share nothing with the packet they came from")
+  {
+    TPacket pPacket = store.Create(32, PacketType::Write);
+    TPacket pCopy = store.Copy(pPacket);
+    REQUIRE( pCopy != pPacket );
+    REQUIRE( pCopy->Begin() != pPacket->Begin() );
+
+    pPacket.reset();
+    REQUIRE( store.PoolStats().mReleases == 1 );
+    REQUIRE( pCopy->PayloadLen() == 32 );
+  }
+}
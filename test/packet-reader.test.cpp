@@ -0,0 +1,68 @@
+#include <catch2/catch.hpp>
+#include "packet-reader.h"
+
+using namespace SSH;
+
+TEST_CASE("PacketReader reads fields in place", "[PacketReader]")
+{
+  SECTION("Integers are read big endian from any alignment")
+  {
+    Byte buf[] = { 0xFF, 0x12, 0x34, 0x56, 0x78 };
+    PacketReader reader(buf + 1, sizeof(buf) - 1);
+
+    UINT32 value = 0;
+    REQUIRE( reader.Read(value) );
+    REQUIRE( value == 0x12345678 );
+    REQUIRE( reader.Remaining() == 0 );
+  }
+
+  SECTION("Strings are views into the buffer")
+  {
+    Byte buf[] = {
+      0x00, 0x00, 0x00, 0x04,
+      'z', 'l', 'i', 'b',
+      0x01
+    };
+    PacketReader reader(buf, sizeof(buf));
+
+    std::string_view str;
+    bool flag = false;
+    REQUIRE( reader.Read(str) );
+    REQUIRE( reader.Read(flag) );
+
+    REQUIRE( str == "zlib" );
+    REQUIRE( (const Byte*)str.data() == buf + sizeof(UINT32) );
+    REQUIRE( flag );
+    REQUIRE( reader.Consumed() == sizeof(buf) );
+  }
+
+  SECTION("Truncation is reported instead of over reading")
+  {
+    //Length field claims more data than is present
+    Byte buf[] = {
+      0x00, 0x00, 0x00, 0x10,
+      'a', 'b',
+    };
+    PacketReader reader(buf, sizeof(buf));
+
+    ByteView view;
+    REQUIRE_FALSE( reader.Read(view) );
+    REQUIRE( reader.Truncated() );
+    REQUIRE( view.mpData == nullptr );
+
+    //Once truncated every following read fails, even if it would fit
+    Byte b = 0;
+    REQUIRE_FALSE( reader.Read(b) );
+    REQUIRE( reader.Consumed() == 0 );
+  }
+
+  SECTION("Short integers are truncated")
+  {
+    Byte buf[] = { 0x00, 0x01 };
+    PacketReader reader(buf, sizeof(buf));
+
+    UINT32 value = 0;
+    REQUIRE_FALSE( reader.Read(value) );
+    REQUIRE( reader.Truncated() );
+  }
+}
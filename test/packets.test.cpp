@@ -0,0 +1,81 @@
+#include <catch2/catch.hpp>
+#include "packets.h"
+#include "endian.h"
+
+#include <cstring>
+
+using namespace SSH;
+
+TEST_CASE("PacketStore enforces the maximum packet length", "[Packets]")
+{
+  PacketStore store;
+
+  //packet_length, padding_length, then enough of the payload to make up a first block
+  Byte header[16] = {};
+  header[sizeof(UINT32)] = 4;
+
+  SECTION("Defaults to the RFC minimum")
+  {
+    REQUIRE( store.MaxPacketLen() == 35000 );
+  }
+
+  SECTION("Packets within the limit are sized")
+  {
+    StoreBE32(header, 1000);
+    REQUIRE( store.DecryptHeader(header, sizeof(header)) == 1000 + sizeof(UINT32) );
+  }
+
+  SECTION("Oversized packets are rejected before any more of them is needed")
+  {
+    StoreBE32(header, 35000);
+    REQUIRE( store.DecryptHeader(header, sizeof(header)) == -1 );
+
+    StoreBE32(header, 0xFFFFFFFF);
+    REQUIRE( store.DecryptHeader(header, sizeof(header)) == -1 );
+  }
+
+  SECTION("The limit can be configured")
+  {
+    store.SetMaxPacketLen(512);
+
+    StoreBE32(header, 508);
+    REQUIRE( store.DecryptHeader(header, sizeof(header)) == 512 );
+
+    StoreBE32(header, 509);
+    REQUIRE( store.DecryptHeader(header, sizeof(header)) == -1 );
+  }
+}
+
+TEST_CASE("Incoming packets are read in place", "[Packets]")
+{
+  PacketStore store;
+
+  //packet_length, padding_length, a 4 byte payload and 7 bytes of padding
+  Byte wire[16] = {};
+  StoreBE32(wire, 12);
+  wire[sizeof(UINT32)] = 7;
+  std::memcpy(wire + sizeof(UINT32) + sizeof(Byte), "abcd", 4);
+
+  SECTION("Nothing is sized until the whole header has arrived")
+  {
+    REQUIRE( store.DecryptHeader(wire, -1) == 0 );
+    REQUIRE( store.DecryptHeader(wire, 0) == 0 );
+    REQUIRE( store.DecryptHeader(wire, 4) == 0 );
+    REQUIRE( store.DecryptHeader(wire, 5) == 16 );
+  }
+
+  SECTION("The payload is left where it was received")
+  {
+    REQUIRE( store.DecryptHeader(wire, sizeof(wire)) == sizeof(wire) );
+
+    TPacket pPacket = store.CreateView(wire, sizeof(wire), 3);
+    REQUIRE( pPacket->PrepareRead() );
+    REQUIRE( pPacket->GetSequenceNumber() == 3 );
+    REQUIRE( pPacket->Payload() == wire + sizeof(UINT32) + sizeof(Byte) );
+    REQUIRE( pPacket->PayloadLen() == 4 );
+    REQUIRE( std::memcmp(pPacket->Payload(), "abcd", 4) == 0 );
+
+    //Prepared once only
+    REQUIRE_FALSE( pPacket->PrepareRead() );
+  }
+}
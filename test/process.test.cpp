@@ -0,0 +1,175 @@
+#include <catch2/catch.hpp>
+#include "ssh.h"
+#include "fake-server.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+using namespace SSH;
+
+namespace
+{
+  //A manually driven client, logged in to a fake server which answers within Send and Recv
+  struct ManualClient
+  {
+    std::shared_ptr<FakeServer> mpServer;
+    TCtx mCtx;
+    std::unique_ptr<Client> mpClient;
+    TChannelID mChannelID = 0;
+    bool mbOpened = false;
+
+    explicit ManualClient(UINT32 coalesceBytes = 0, UINT32 coalesceDelayMs = 2)
+      : mpServer(std::make_shared<FakeServer>())
+    {
+      ClientOptions opts;
+      opts.mLogFunc = [](const char*) {};
+      opts.mLogLevel = LogLevel::Error;
+      opts.mTransport = mpServer;
+      opts.mRunMode = RunMode::Manual;
+      opts.mOffloadKEX = false;
+      opts.mCoalesceBytes = coalesceBytes;
+      opts.mCoalesceDelayMs = coalesceDelayMs;
+
+      mpClient = std::make_unique<Client>(opts, mCtx);
+    }
+
+    //Processes until done returns true, giving up after a bounded number of passes
+    template <typename TDone>
+    bool ProcessUntil(TDone done)
+    {
+      for (int i = 0; i < 100 && !done(); ++i)
+      {
+        mpClient->Process(IOEvent::Readable | IOEvent::Writable);
+      }
+
+      return done();
+    }
+
+    bool Login()
+    {
+      mpClient->Connect();
+      return ProcessUntil([&]() { return mpClient->GetState() == State::Connected; });
+    }
+
+    bool Open()
+    {
+      mChannelID = mpClient->OpenChannel(ChannelTypes::Session, [&](ChannelEvent event, const Byte*, const int) -> TResult
+      {
+        if (event == ChannelEvent::Opened)
+        {
+          mbOpened = true;
+        }
+
+        return {};
+      });
+
+      return mChannelID != 0 && ProcessUntil([&]() { return mbOpened; });
+    }
+
+    TResult Send(const std::string& data)
+    {
+      return mpClient->Send(mChannelID, (const Byte*)data.data(), (int)data.length());
+    }
+  };
+}
+
+TEST_CASE("Process waits on the handshake's deadline until logged in", "[Process]")
+{
+  ManualClient client;
+  client.mpClient->Connect();
+
+  auto start = std::chrono::steady_clock::now();
+  ProcessResult result = client.mpClient->Process(IOEvent::None);
+
+  //Whatever stage it has got to, the handshake gives up after mHandshakeTimeoutMs (30 seconds by default)
+  REQUIRE( (result.mWantEvents & IOEvent::Readable) != 0 );
+  REQUIRE( result.mDeadline.has_value() );
+  REQUIRE( result.mDeadline.value() > start );
+  REQUIRE( result.mDeadline.value() <= std::chrono::steady_clock::now() + std::chrono::seconds(30) );
+
+  REQUIRE( client.ProcessUntil([&]() { return client.mpClient->GetState() == State::Connected; }) );
+  REQUIRE( client.mpServer->LoggedIn() );
+  REQUIRE( !client.mpServer->Failed() );
+}
+
+TEST_CASE("Process only waits to read while idle", "[Process]")
+{
+  ManualClient client;
+  REQUIRE( client.Login() );
+  REQUIRE( client.Open() );
+
+  //Nothing to send and no timers running, so there is no deadline either
+  ProcessResult result = client.mpClient->Process(IOEvent::Readable);
+  REQUIRE( result.mWantEvents == IOEvent::Readable );
+  REQUIRE( !result.mDeadline.has_value() );
+}
+
+TEST_CASE("Process waits to write while the transport is backlogged", "[Process]")
+{
+  ManualClient client;
+  REQUIRE( client.Login() );
+  REQUIRE( client.Open() );
+
+  client.mpServer->SetSendRoom(0);
+  REQUIRE( client.Send("backlogged") == 10 );
+
+  ProcessResult result = client.mpClient->Process(IOEvent::Readable | IOEvent::Writable);
+  REQUIRE( (result.mWantEvents & IOEvent::Writable) != 0 );
+  REQUIRE( (result.mWantEvents & IOEvent::Readable) != 0 );
+  REQUIRE( client.mpServer->GetChannel(0).mReceived.empty() );
+
+  SECTION("Room appearing lets it finish")
+  {
+    client.mpServer->SetSendRoom(SIZE_MAX);
+
+    result = client.mpClient->Process(IOEvent::Writable);
+    REQUIRE( result.mWantEvents == IOEvent::Readable );
+    REQUIRE( std::string(client.mpServer->GetChannel(0).mReceived.begin(), client.mpServer->GetChannel(0).mReceived.end()) == "backlogged" );
+  }
+
+  SECTION("A partial write keeps it waiting for the rest")
+  {
+    client.mpServer->SetSendRoom(8);
+
+    result = client.mpClient->Process(IOEvent::Writable);
+    REQUIRE( (result.mWantEvents & IOEvent::Writable) != 0 );
+
+    client.mpServer->SetSendRoom(SIZE_MAX);
+    result = client.mpClient->Process(IOEvent::Writable);
+    REQUIRE( result.mWantEvents == IOEvent::Readable );
+    REQUIRE( client.mpServer->GetChannel(0).mReceived.size() == 10 );
+  }
+
+  REQUIRE( !client.mpServer->Failed() );
+}
+
+TEST_CASE("Process waits on merged data's flush deadline", "[Process]")
+{
+  ManualClient client(1024, 50);
+  REQUIRE( client.Login() );
+  REQUIRE( client.Open() );
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE( client.Send("small") == 5 );
+  REQUIRE( client.Send("writes") == 6 );
+
+  //Too small to go yet, so there is nothing to write but it has to be called back in time to flush
+  ProcessResult result = client.mpClient->Process(IOEvent::Writable);
+  REQUIRE( result.mWantEvents == IOEvent::Readable );
+  REQUIRE( result.mDeadline.has_value() );
+  REQUIRE( result.mDeadline.value() >= start + std::chrono::milliseconds(50) );
+  REQUIRE( result.mDeadline.value() <= std::chrono::steady_clock::now() + std::chrono::milliseconds(50) );
+  REQUIRE( client.mpServer->GetChannel(0).mReceived.empty() );
+
+  //Once due both writes go out together
+  std::this_thread::sleep_until(result.mDeadline.value());
+  result = client.mpClient->Process(IOEvent::None);
+  result = client.mpClient->Process(IOEvent::Writable);
+
+  REQUIRE( !result.mDeadline.has_value() );
+  REQUIRE( client.mpServer->GetChannel(0).mNumDataPackets == 1 );
+  REQUIRE( client.mpServer->GetChannel(0).mReceived.size() == 11 );
+  REQUIRE( !client.mpServer->Failed() );
+}
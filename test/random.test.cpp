@@ -0,0 +1,45 @@
+#include <catch2/catch.hpp>
+#include "random.h"
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+using namespace SSH;
+
+TEST_CASE("Random service hands out fresh bytes", "[Random]")
+{
+  SECTION("Small requests are filled")
+  {
+    Byte first[16] = {};
+    Byte second[16] = {};
+
+    REQUIRE( Random::Fill(first, sizeof(first)) );
+    REQUIRE( Random::Fill(second, sizeof(second)) );
+
+    //Consecutive requests never share bytes from the batch
+    REQUIRE( memcmp(first, second, sizeof(first)) != 0 );
+  }
+
+  SECTION("Requests larger than a batch are filled completely")
+  {
+    std::vector<Byte> buf(64 * 1024, 0);
+    REQUIRE( Random::Fill(buf.data(), buf.size()) );
+
+    //The tail must have been written, not just the first batch
+    REQUIRE( std::any_of(buf.end() - 1024, buf.end(), [](Byte b) { return b != 0; }) );
+  }
+
+  SECTION("Each thread has its own DRBG")
+  {
+    WC_RNG* pMainRNG = Random::ThreadRNG();
+    WC_RNG* pOtherRNG = nullptr;
+
+    std::thread other([&]() { pOtherRNG = Random::ThreadRNG(); });
+    other.join();
+
+    REQUIRE( pMainRNG != nullptr );
+    REQUIRE( pOtherRNG != nullptr );
+    REQUIRE( pMainRNG != pOtherRNG );
+  }
+}
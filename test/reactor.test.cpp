@@ -0,0 +1,244 @@
+#include <catch2/catch.hpp>
+#include "ssh.h"
+
+#ifdef __linux__
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace SSH;
+
+namespace
+{
+  //Both ends of a connected socket pair, closed on the way out
+  struct SocketPair
+  {
+    int mFDs[2] = { -1, -1 };
+
+    SocketPair() { socketpair(AF_UNIX, SOCK_STREAM, 0, mFDs); }
+    ~SocketPair()
+    {
+      close(mFDs[0]);
+      close(mFDs[1]);
+    }
+  };
+
+  //Polls until done returns true, giving up after a few seconds
+  template <typename TDone>
+  bool WaitFor(TDone done)
+  {
+    auto giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!done())
+    {
+      if (std::chrono::steady_clock::now() > giveUp)
+      {
+        return false;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return true;
+  }
+
+  //Passes everything through to a socket transport, counting how often the client reads
+  class CountingTransport : public ITransport
+  {
+  private:
+    TTransport mpInner;
+
+  public:
+    std::atomic<int> mNumRecvs = 0;
+
+    explicit CountingTransport(int fd)
+      : mpInner(Transport::CreateSocket(fd))
+    {}
+
+    TResult Send(const Byte* pBuf, const int bufLen) override { return mpInner->Send(pBuf, bufLen); }
+    TResult SendVec(const IOVec* pVecs, const int numVecs) override { return mpInner->SendVec(pVecs, numVecs); }
+
+    TResult Recv(Byte* pBuf, const int bufLen) override
+    {
+      ++mNumRecvs;
+      return mpInner->Recv(pBuf, bufLen);
+    }
+
+    int WaitFD() const override { return mpInner->WaitFD(); }
+  };
+
+  //A manually driven client, talking to nobody on the other end of a socket pair
+  struct TestClient
+  {
+    SocketPair mSockets;
+    std::shared_ptr<CountingTransport> mpTransport;
+    TCtx mCtx;
+    std::unique_ptr<Client> mpClient;
+
+    explicit TestClient(UINT32 handshakeTimeoutMs = 30 * 1000)
+      : mpTransport(std::make_shared<CountingTransport>(mSockets.mFDs[0]))
+    {
+      ClientOptions opts;
+      opts.mLogFunc = [](const char*) {};
+      opts.mLogLevel = LogLevel::Error;
+      opts.mTransport = mpTransport;
+      opts.mRunMode = RunMode::Manual;
+      opts.mHandshakeTimeoutMs = handshakeTimeoutMs;
+
+      mpClient = std::make_unique<Client>(opts, mCtx);
+      mpClient->Connect();
+    }
+
+    //Waits for the reactor's first step, after which the client has nothing to do until the remote answers
+    bool WaitSettled()
+    {
+      if (!WaitFor([&]() { return mpTransport->mNumRecvs > 0; }))
+      {
+        return false;
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      return true;
+    }
+  };
+
+  ReactorOptions SingleThreaded()
+  {
+    ReactorOptions opts;
+    opts.mNumThreads = 1;
+    opts.mPinThreads = false;
+    return opts;
+  }
+}
+
+TEST_CASE("ClientReactor only takes clients it can drive", "[Reactor]")
+{
+  TestClient client;
+  ClientReactor reactor(SingleThreaded());
+
+  REQUIRE( reactor.Add(client.mpClient.get()) );
+  REQUIRE( !reactor.Add(client.mpClient.get()) );
+  REQUIRE( reactor.NumClients() == 1 );
+
+  SocketPair sockets;
+  ClientOptions opts;
+  opts.mLogFunc = [](const char*) {};
+  opts.mLogLevel = LogLevel::Error;
+  opts.mTransport = Transport::CreateSocket(sockets.mFDs[0]);
+  TCtx ctx;
+  Client threaded(opts, ctx);
+  REQUIRE( !reactor.Add(&threaded) );
+
+  REQUIRE( reactor.Remove(client.mpClient.get()) );
+  REQUIRE( !reactor.Remove(client.mpClient.get()) );
+  REQUIRE( reactor.NumClients() == 0 );
+}
+
+TEST_CASE("ClientReactor only steps clients which are ready, woken or due", "[Reactor]")
+{
+  TestClient first;
+  TestClient second;
+  ClientReactor reactor(SingleThreaded());
+
+  REQUIRE( reactor.Add(first.mpClient.get()) );
+  REQUIRE( reactor.Add(second.mpClient.get()) );
+  REQUIRE( first.WaitSettled() );
+  REQUIRE( second.WaitSettled() );
+
+  //Both are waiting on a remote which never answers, so neither is touched
+  int firstRecvs = first.mpTransport->mNumRecvs;
+  int secondRecvs = second.mpTransport->mNumRecvs;
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  REQUIRE( first.mpTransport->mNumRecvs == firstRecvs );
+  REQUIRE( second.mpTransport->mNumRecvs == secondRecvs );
+
+  SECTION("Ready")
+  {
+    //Only part of a version line, so the client goes straight back to waiting
+    REQUIRE( send(first.mSockets.mFDs[1], "SSH-2.0", 7, 0) == 7 );
+    REQUIRE( WaitFor([&]() { return first.mpTransport->mNumRecvs > firstRecvs; }) );
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE( second.mpTransport->mNumRecvs == secondRecvs );
+  }
+
+  SECTION("Woken")
+  {
+    //Disconnecting from another thread wakes the worker, which then lets the client go
+    first.mpClient->Disconnect();
+    REQUIRE( WaitFor([&]() { return reactor.NumClients() == 1; }) );
+    REQUIRE( !reactor.Remove(first.mpClient.get()) );
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    REQUIRE( second.mpTransport->mNumRecvs == secondRecvs );
+  }
+
+  reactor.Remove(first.mpClient.get());
+  reactor.Remove(second.mpClient.get());
+}
+
+TEST_CASE("ClientReactor steps clients once their deadline is due", "[Reactor]")
+{
+  TestClient client(50);
+  ClientReactor reactor(SingleThreaded());
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE( reactor.Add(client.mpClient.get()) );
+
+  //Nothing ever arrives, so only the handshake deadline can disconnect it, after which it is dropped
+  REQUIRE( WaitFor([&]() { return reactor.NumClients() == 0; }) );
+  REQUIRE( std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(50) );
+  REQUIRE( client.mpClient->GetState() == State::Disconnected );
+}
+
+TEST_CASE("ClientReactor leaves removed clients alone", "[Reactor]")
+{
+  TestClient client;
+  ClientReactor reactor(SingleThreaded());
+
+  REQUIRE( reactor.Add(client.mpClient.get()) );
+  REQUIRE( client.WaitSettled() );
+  REQUIRE( reactor.Remove(client.mpClient.get()) );
+  REQUIRE( reactor.NumClients() == 0 );
+
+  //Neither readiness nor a wake reaches a removed client
+  int numRecvs = client.mpTransport->mNumRecvs;
+  REQUIRE( send(client.mSockets.mFDs[1], "SSH-2.0", 7, 0) == 7 );
+  client.mpClient->Disconnect();
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  REQUIRE( client.mpTransport->mNumRecvs == numRecvs );
+}
+
+TEST_CASE("ClientReactor takes clients from racing threads once", "[Reactor]")
+{
+  TestClient client;
+  ClientReactor reactor(SingleThreaded());
+
+  std::atomic<int> numAdded = 0;
+  std::vector<std::thread> threads;
+  for (int i = 0; i < 4; ++i)
+  {
+    threads.emplace_back([&]()
+    {
+      if (reactor.Add(client.mpClient.get()))
+      {
+        ++numAdded;
+      }
+    });
+  }
+
+  for (std::thread& thread : threads)
+  {
+    thread.join();
+  }
+
+  REQUIRE( numAdded == 1 );
+  REQUIRE( reactor.NumClients() == 1 );
+  REQUIRE( reactor.Remove(client.mpClient.get()) );
+}
+#endif
@@ -0,0 +1,124 @@
+#include <catch2/catch.hpp>
+#include "recv-buffer.h"
+
+#include <cstring>
+#include <string>
+
+using namespace SSH;
+
+namespace
+{
+  void Append(RecvBuffer& buffer, const std::string& data)
+  {
+    REQUIRE( buffer.WriteSpace() >= data.size() );
+    std::memcpy(buffer.WritePtr(), data.data(), data.size());
+    buffer.Commit((UINT32)data.size());
+  }
+}
+
+TEST_CASE("RecvBuffer keeps every packet contiguous", "[RecvBuffer]")
+{
+  RecvBuffer buffer(16);
+
+  SECTION("Commits and consumes never run past the data")
+  {
+    Append(buffer, "0123");
+    buffer.Commit(100);
+    REQUIRE( buffer.WriteSpace() == 0 );
+
+    buffer.Consume(100);
+    REQUIRE( buffer.Readable() == 0 );
+  }
+
+  SECTION("An empty buffer starts again from the front")
+  {
+    Append(buffer, "0123456789");
+    buffer.Consume(10);
+    buffer.Prepare(0);
+
+    REQUIRE( buffer.ReadPtr() == buffer.Data() );
+    REQUIRE( buffer.WriteSpace() == 16 );
+  }
+
+  SECTION("A partial packet at the end of the buffer is moved to the front once it can't be finished there")
+  {
+    Append(buffer, "0123456789");
+    buffer.Consume(8);
+
+    //8 more bytes fit where the packet is, so nothing moves
+    buffer.Prepare(8);
+    REQUIRE( buffer.ReadPtr() == buffer.Data() + 8 );
+
+    //12 don't, so the 2 bytes of it we have are moved down
+    buffer.Prepare(12);
+    REQUIRE( buffer.ReadPtr() == buffer.Data() );
+    REQUIRE( buffer.Readable() == 2 );
+    REQUIRE( buffer.WriteSpace() == 14 );
+
+    //And the rest of it lands straight after them
+    Append(buffer, "abcdefghij");
+    REQUIRE( buffer.Readable() == 12 );
+    REQUIRE( std::memcmp(buffer.ReadPtr(), "89abcdefghij", 12) == 0 );
+  }
+
+  SECTION("A full buffer is compacted to make room for more")
+  {
+    Append(buffer, "0123456789abcdef");
+    buffer.Consume(4);
+    REQUIRE( buffer.WriteSpace() == 0 );
+
+    buffer.Prepare(0);
+    REQUIRE( buffer.Readable() == 12 );
+    REQUIRE( buffer.WriteSpace() == 4 );
+    REQUIRE( std::memcmp(buffer.ReadPtr(), "456789abcdef", 12) == 0 );
+  }
+}
+
+TEST_CASE("RecvBuffer keeps read data for whoever holds it", "[RecvBuffer]")
+{
+  RecvBuffer buffer(16);
+  Append(buffer, "0123456789ab");
+
+  const Byte* pRead = buffer.ReadPtr();
+  buffer.Consume(10);
+
+  SECTION("Unheld data is compacted over in place")
+  {
+    Byte* pBefore = buffer.Data();
+    REQUIRE( buffer.Prepare(8) == nullptr );
+
+    REQUIRE( buffer.Data() == pBefore );
+    REQUIRE( buffer.Readable() == 2 );
+    REQUIRE( std::memcmp(buffer.ReadPtr(), "ab", 2) == 0 );
+  }
+
+  SECTION("Held data is left alone, and the buffer carries on in a new block")
+  {
+    std::shared_ptr<const void> pOwner = buffer.Owner();
+    std::shared_ptr<const void> pOldBlock = buffer.Prepare(8);
+
+    REQUIRE( pOldBlock == pOwner );
+    REQUIRE( buffer.Data() != pRead );
+    REQUIRE( buffer.Readable() == 2 );
+    REQUIRE( std::memcmp(buffer.ReadPtr(), "ab", 2) == 0 );
+    REQUIRE( std::memcmp(pRead, "0123456789", 10) == 0 );
+
+    //Once released the new block is reused in place like any other
+    pOwner.reset();
+    pOldBlock.reset();
+    Byte* pBlock = buffer.Data();
+    buffer.Consume(2);
+    buffer.Prepare(8);
+    REQUIRE( buffer.Data() == pBlock );
+  }
+
+  SECTION("Starting again from the front also leaves held data alone")
+  {
+    std::shared_ptr<const void> pOwner = buffer.Owner();
+    buffer.Consume(2);
+    buffer.Prepare(8);
+    Append(buffer, "xyz");
+
+    REQUIRE( std::memcmp(pRead, "0123456789ab", 12) == 0 );
+  }
+}
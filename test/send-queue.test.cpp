@@ -0,0 +1,147 @@
+#include <catch2/catch.hpp>
+#include "send-queue.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace SSH;
+
+namespace
+{
+  //Takes at most mMaxWrite bytes per write, keeping everything it took
+  class ShortWriteTransport : public ITransport
+  {
+  public:
+    int mMaxWrite = 0;
+    int mNumWrites = 0;
+    TByteString mWire;
+
+    TResult Send(const Byte* pBuf, const int bufLen) override
+    {
+      IOVec vec = { pBuf, bufLen };
+      return SendVec(&vec, 1);
+    }
+
+    TResult Recv(Byte* pBuf, const int bufLen) override
+    {
+      return {};
+    }
+
+    TResult SendVec(const IOVec* pVecs, const int numVecs) override
+    {
+      mNumWrites++;
+
+      int numBytes = 0;
+      for (int i = 0; i < numVecs && numBytes < mMaxWrite; ++i)
+      {
+        int vecBytes = std::min(pVecs[i].mBufLen, mMaxWrite - numBytes);
+        mWire.insert(mWire.end(), pVecs[i].mpBuf, pVecs[i].mpBuf + vecBytes);
+        numBytes += vecBytes;
+      }
+
+      return numBytes;
+    }
+  };
+
+  //Payloads of the unencrypted packets in wire, which must hold nothing but whole packets
+  std::vector<TByteString> ParsePayloads(const TByteString& wire)
+  {
+    std::vector<TByteString> payloads;
+
+    size_t offset = 0;
+    while (offset + 5 <= wire.size())
+    {
+      UINT32 packetLen = (wire[offset] << 24) | (wire[offset + 1] << 16) | (wire[offset + 2] << 8) | wire[offset + 3];
+      Byte paddingLen = wire[offset + 4];
+      REQUIRE( offset + 4 + packetLen <= wire.size() );
+
+      const Byte* pPayload = wire.data() + offset + 5;
+      payloads.emplace_back(pPayload, pPayload + (packetLen - paddingLen - 1));
+      offset += 4 + packetLen;
+    }
+
+    REQUIRE( offset == wire.size() );
+    return payloads;
+  }
+}
+
+TEST_CASE("A short gather write resumes where it stopped", "[SendQueue]")
+{
+  PacketStore store;
+  SendQueue queue;
+  ShortWriteTransport transport;
+
+  std::vector<TByteString> payloads;
+  for (UINT32 i = 0; i < 5; ++i)
+  {
+    TByteString payload(20 + i * 7, (Byte)('a' + i));
+    TPacket pPacket = store.Create((UINT32)payload.size(), PacketType::Write);
+    pPacket->Write(payload.data(), (int)payload.size(), Packet::WriteMethod::WithoutLength);
+    pPacket->PrepareWrite(i);
+
+    queue.Push(pPacket);
+    payloads.push_back(payload);
+  }
+
+  const size_t totalBytes = queue.NumBytes();
+  SendQueue::WriteStats stats;
+
+  SECTION("A write ending part way through a packet leaves the rest of it at the front")
+  {
+    //Past the end of the first packet, but short of the end of the second
+    UINT32 firstLen = queue.Front()->Remaining();
+    transport.mMaxWrite = (int)firstLen + 10;
+
+    REQUIRE( queue.Write(transport, stats) == SendQueue::WriteResult::Partial );
+    REQUIRE( stats.mNumBytes == (int)firstLen + 10 );
+    REQUIRE( stats.mNumOffered == (int)totalBytes );
+    REQUIRE( stats.mNumPackets == 5 );
+
+    REQUIRE( queue.Size() == 4 );
+    REQUIRE( queue.Front()->Remaining() == (UINT32)queue.Front()->PacketLen() + 4 - 10 );
+    REQUIRE( queue.NumBytes() == totalBytes - firstLen - 10 );
+
+    //The next write carries on from the middle of that packet
+    transport.mMaxWrite = (int)totalBytes;
+
+    REQUIRE( queue.Write(transport, stats) == SendQueue::WriteResult::Complete );
+    REQUIRE( stats.mNumBytes == (int)(totalBytes - firstLen - 10) );
+    REQUIRE( queue.Empty() );
+    REQUIRE( queue.Write(transport, stats) == SendQueue::WriteResult::Empty );
+
+    REQUIRE( transport.mWire.size() == totalBytes );
+    REQUIRE( ParsePayloads(transport.mWire) == payloads );
+  }
+
+  SECTION("Packets arrive whole and in order however the writes are split")
+  {
+    int maxWrite = GENERATE(1, 3, 7, 64);
+    transport.mMaxWrite = maxWrite;
+
+    while (!queue.Empty())
+    {
+      size_t numBefore = transport.mWire.size();
+      SendQueue::WriteResult result = queue.Write(transport, stats);
+
+      REQUIRE( transport.mWire.size() - numBefore == std::min<size_t>(maxWrite, totalBytes - numBefore) );
+      REQUIRE( result == (queue.Empty() ? SendQueue::WriteResult::Complete : SendQueue::WriteResult::Partial) );
+      REQUIRE( transport.mNumWrites <= (int)totalBytes );
+    }
+
+    REQUIRE( ParsePayloads(transport.mWire) == payloads );
+  }
+
+  SECTION("Nothing is written past a packet still being encrypted")
+  {
+    queue.Front()->SetInFlight(true);
+    transport.mMaxWrite = (int)totalBytes;
+
+    REQUIRE( queue.Write(transport, stats) == SendQueue::WriteResult::Waiting );
+    REQUIRE( transport.mNumWrites == 0 );
+
+    queue.Front()->SetInFlight(false);
+
+    REQUIRE( queue.Write(transport, stats) == SendQueue::WriteResult::Complete );
+    REQUIRE( ParsePayloads(transport.mWire) == payloads );
+  }
+}
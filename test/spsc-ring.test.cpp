@@ -0,0 +1,71 @@
+#include <catch2/catch.hpp>
+#include "spsc-ring.h"
+
+#include <thread>
+
+using namespace SSH;
+
+TEST_CASE("SPSCRing passes values between two threads", "[SPSCRing]")
+{
+  SECTION("A full ring rejects pushes until a value is popped")
+  {
+    SPSCRing<int> ring(3);
+    REQUIRE( ring.Capacity() == 4 );
+    REQUIRE( ring.Empty() );
+
+    for (int i = 0; i < 4; ++i)
+    {
+      REQUIRE( ring.TryPush(i) );
+    }
+    REQUIRE_FALSE( ring.TryPush(4) );
+
+    int value = -1;
+    REQUIRE( ring.TryPop(value) );
+    REQUIRE( value == 0 );
+    REQUIRE( ring.TryPush(4) );
+
+    for (int i = 1; i <= 4; ++i)
+    {
+      REQUIRE( ring.TryPop(value) );
+      REQUIRE( value == i );
+    }
+
+    REQUIRE( ring.Empty() );
+    REQUIRE_FALSE( ring.TryPop(value) );
+  }
+
+  SECTION("Values arrive in order across threads")
+  {
+    const int numValues = 100000;
+    SPSCRing<int> ring(16);
+
+    std::thread producer([&ring]()
+    {
+      for (int i = 0; i < numValues; ++i)
+      {
+        while (!ring.TryPush(i))
+        {
+          std::this_thread::yield();
+        }
+      }
+    });
+
+    bool bInOrder = true;
+    int expected = 0;
+    while (expected < numValues)
+    {
+      int value = 0;
+      if (!ring.TryPop(value))
+      {
+        std::this_thread::yield();
+        continue;
+      }
+
+      bInOrder &= (value == expected);
+      expected++;
+    }
+
+    producer.join();
+    REQUIRE( bInOrder );
+  }
+}
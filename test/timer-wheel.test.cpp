@@ -0,0 +1,125 @@
+#include <catch2/catch.hpp>
+#include "timer-wheel.h"
+
+#include <vector>
+
+using namespace SSH;
+using namespace std::chrono;
+
+TEST_CASE("TimerWheel fires timers on time", "[TimerWheel]")
+{
+  const TimerWheel::TClock::time_point start;
+  TimerWheel wheel(milliseconds(10), start);
+
+  SECTION("Timers fire once their delay has passed, never early")
+  {
+    //Spread across every level of the wheel
+    const std::vector<milliseconds> delays = { milliseconds(5), milliseconds(10), milliseconds(630),
+                                               milliseconds(650), seconds(41), seconds(3000), hours(20) };
+    std::vector<Timer> timers(delays.size());
+    std::vector<TimerWheel::TClock::time_point> firedAt(delays.size());
+
+    for (size_t i = 0; i < delays.size(); ++i)
+    {
+      wheel.Arm(timers[i], delays[i], [&, i]()
+      {
+        firedAt[i] = wheel.Now();
+      });
+    }
+    REQUIRE( wheel.NumTimers() == delays.size() );
+
+    //Uneven steps, so ticks are sometimes skipped over in a single Advance
+    auto now = start;
+    while (wheel.NumTimers() > 0 && now < start + hours(21))
+    {
+      now += milliseconds(7);
+      wheel.Advance(now);
+
+      auto next = wheel.NextDeadline();
+      if (next.has_value() && next.value() > now + seconds(1))
+      {
+        //Nothing due for a while, so jump most of the way there
+        now = next.value() - milliseconds(7);
+      }
+    }
+
+    REQUIRE( wheel.NumTimers() == 0 );
+    for (size_t i = 0; i < delays.size(); ++i)
+    {
+      CAPTURE( i );
+      REQUIRE( firedAt[i] >= start + delays[i] );
+      REQUIRE( firedAt[i] <= start + delays[i] + milliseconds(30) );
+      REQUIRE_FALSE( timers[i].Armed() );
+    }
+  }
+
+  SECTION("Cancelled and destroyed timers don't fire")
+  {
+    int numFired = 0;
+    Timer kept;
+    Timer cancelled;
+    wheel.Arm(kept, milliseconds(100), [&]() { numFired++; });
+    wheel.Arm(cancelled, milliseconds(100), [&]() { numFired += 10; });
+
+    {
+      Timer destroyed;
+      wheel.Arm(destroyed, milliseconds(100), [&]() { numFired += 100; });
+      REQUIRE( wheel.NumTimers() == 3 );
+    }
+
+    cancelled.Cancel();
+    REQUIRE( wheel.NumTimers() == 1 );
+
+    wheel.Advance(start + seconds(1));
+    REQUIRE( numFired == 1 );
+  }
+
+  SECTION("Re-arming moves a timer rather than adding another")
+  {
+    int numFired = 0;
+    Timer timer;
+    wheel.Arm(timer, milliseconds(100), [&]() { numFired++; });
+    wheel.Arm(timer, seconds(5), [&]() { numFired++; });
+    REQUIRE( wheel.NumTimers() == 1 );
+
+    wheel.Advance(start + seconds(1));
+    REQUIRE( numFired == 0 );
+
+    wheel.Advance(start + seconds(6));
+    REQUIRE( numFired == 1 );
+  }
+
+  SECTION("A timer can re-arm itself from its own callback")
+  {
+    int numFired = 0;
+    Timer timer;
+    std::function<void()> repeat = [&]()
+    {
+      if (++numFired < 5)
+      {
+        wheel.Arm(timer, milliseconds(0), repeat);
+      }
+    };
+    wheel.Arm(timer, milliseconds(0), repeat);
+
+    //Each firing is at least a tick after the last
+    wheel.Advance(start + milliseconds(25));
+    REQUIRE( numFired == 2 );
+
+    wheel.Advance(start + seconds(1));
+    REQUIRE( numFired == 5 );
+    REQUIRE_FALSE( timer.Armed() );
+  }
+
+  SECTION("The next deadline is never later than the next timer")
+  {
+    REQUIRE_FALSE( wheel.NextDeadline().has_value() );
+
+    Timer timer;
+    wheel.Arm(timer, milliseconds(200), []() {});
+    REQUIRE( wheel.NextDeadline().value() == start + milliseconds(200) );
+
+    wheel.Arm(timer, seconds(10), []() {});
+    REQUIRE( wheel.NextDeadline().value() <= start + seconds(10) );
+  }
+}
@@ -0,0 +1,257 @@
+#include <catch2/catch.hpp>
+#include "ssh.h"
+#include "recv-buffer.h"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+using namespace SSH;
+
+namespace
+{
+  //Both ends of a connected socket pair, closed on the way out
+  struct SocketPair
+  {
+    int mFDs[2] = { -1, -1 };
+
+    SocketPair() { socketpair(AF_UNIX, SOCK_STREAM, 0, mFDs); }
+    ~SocketPair()
+    {
+      close(mFDs[0]);
+      close(mFDs[1]);
+    }
+  };
+
+  //Waits for the ring to signal a completion, so the read armed by the last Recv has finished
+  bool WaitReadable(int fd)
+  {
+    pollfd pollFD = { fd, POLLIN, 0 };
+    return (poll(&pollFD, 1, 1000) == 1);
+  }
+
+  //Receives into buffer until numBytes have arrived or the transport goes quiet
+  UINT32 RecvAll(ITransport& transport, RecvBuffer& buffer, int waitFD, UINT32 numBytes)
+  {
+    UINT32 received = 0;
+    for (int i = 0; i < 20 && received < numBytes; ++i)
+    {
+      TResult result = transport.Recv(buffer.WritePtr(), buffer.WriteSpace());
+      if (result.has_value())
+      {
+        REQUIRE( result.value() > 0 );
+        buffer.Commit(result.value());
+        received += result.value();
+      }
+      else
+      {
+        WaitReadable(waitFD);
+      }
+    }
+
+    return received;
+  }
+}
+
+TEST_CASE("IOUring hands over a finished read when the receive buffer moves", "[Transport]")
+{
+  SocketPair sockets;
+  int waitFD = -1;
+  TTransport pTransport = Transport::CreateIOUring(sockets.mFDs[0], 8, &waitFD);
+  if (pTransport == nullptr)
+  {
+    WARN("io_uring is unavailable, skipping");
+    return;
+  }
+
+  std::vector<Byte> oldBuf(256);
+  std::vector<Byte> newBuf(256);
+  pTransport->AttachRecvBuffer(oldBuf.data(), (UINT32)oldBuf.size());
+
+  //Nothing to read yet, so this leaves a read armed on the old buffer
+  TResult result = pTransport->Recv(oldBuf.data(), (int)oldBuf.size());
+  REQUIRE( !result.has_value() );
+
+  const Byte sent[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 };
+  REQUIRE( send(sockets.mFDs[1], sent, sizeof(sent), 0) == (ssize_t)sizeof(sent) );
+  REQUIRE( WaitReadable(waitFD) );
+
+  //The read has completed into the old buffer, and moving has to cancel it without losing what it read
+  pTransport->AttachRecvBuffer(newBuf.data(), (UINT32)newBuf.size());
+  oldBuf.assign(oldBuf.size(), 0xFF);
+
+  SECTION("In one go")
+  {
+    result = pTransport->Recv(newBuf.data(), (int)newBuf.size());
+    REQUIRE( result.value_or(0) == (int)sizeof(sent) );
+    REQUIRE( std::equal(sent, sent + sizeof(sent), newBuf.begin()) );
+  }
+
+  SECTION("A piece at a time, ahead of anything read since")
+  {
+    result = pTransport->Recv(newBuf.data(), 4);
+    REQUIRE( result.value_or(0) == 4 );
+    REQUIRE( std::equal(sent, sent + 4, newBuf.begin()) );
+
+    const Byte more[] = { 11, 12 };
+    REQUIRE( send(sockets.mFDs[1], more, sizeof(more), 0) == (ssize_t)sizeof(more) );
+
+    result = pTransport->Recv(newBuf.data() + 4, (int)newBuf.size() - 4);
+    REQUIRE( result.value_or(0) == 6 );
+    REQUIRE( std::equal(sent + 4, sent + sizeof(sent), newBuf.begin() + 4) );
+
+    //Only now does anything new arrive
+    int numBytes = 0;
+    for (int i = 0; i < 100 && numBytes < (int)sizeof(more); ++i)
+    {
+      result = pTransport->Recv(newBuf.data() + 10 + numBytes, (int)newBuf.size() - 10 - numBytes);
+      if (result.has_value())
+      {
+        REQUIRE( result.value() > 0 );
+        numBytes += result.value();
+      }
+      else
+      {
+        WaitReadable(waitFD);
+      }
+    }
+
+    REQUIRE( numBytes == (int)sizeof(more) );
+    REQUIRE( std::equal(more, more + sizeof(more), newBuf.begin() + 10) );
+  }
+
+  pTransport->AttachRecvBuffer(nullptr, 0);
+}
+
+TEST_CASE("IOUring keeps the stream intact when a retained block is left behind", "[Transport]")
+{
+  SocketPair sockets;
+  int waitFD = -1;
+  TTransport pTransport = Transport::CreateIOUring(sockets.mFDs[0], 8, &waitFD);
+  if (pTransport == nullptr)
+  {
+    WARN("io_uring is unavailable, skipping");
+    return;
+  }
+
+  RecvBuffer buffer(64);
+  pTransport->AttachRecvBuffer(buffer.Data(), buffer.Capacity());
+
+  std::vector<Byte> stream(100);
+  for (size_t i = 0; i < stream.size(); ++i)
+  {
+    stream[i] = (Byte)i;
+  }
+
+  //A batch handed out from the first 40 bytes is retained, as ChannelData::Retain does
+  REQUIRE( send(sockets.mFDs[1], stream.data(), 40, 0) == 40 );
+  REQUIRE( RecvAll(*pTransport, buffer, waitFD, 40) == 40 );
+  REQUIRE( std::equal(stream.begin(), stream.begin() + 40, buffer.ReadPtr()) );
+
+  std::shared_ptr<const void> pRetained = buffer.Owner();
+  const Byte* pBatch = buffer.ReadPtr();
+  buffer.Consume(40);
+
+  //Leave a read armed on what's left of the retained block
+  REQUIRE( !pTransport->Recv(buffer.WritePtr(), buffer.WriteSpace()).has_value() );
+
+  size_t numSent = 40;
+  SECTION("The armed read completed before the move")
+  {
+    REQUIRE( send(sockets.mFDs[1], stream.data() + numSent, 10, 0) == 10 );
+    REQUIRE( WaitReadable(waitFD) );
+    numSent += 10;
+  }
+
+  SECTION("The armed read is still waiting when the buffer moves")
+  {
+  }
+
+  //Moving on to a new block has to take the transport with it before the old one may go
+  std::shared_ptr<const void> pOldBlock = buffer.Prepare(32);
+  REQUIRE( pOldBlock == pRetained );
+  pTransport->AttachRecvBuffer(buffer.Data(), buffer.Capacity());
+  pOldBlock.reset();
+
+  //The retained batch is untouched, and once it is released nothing is left aimed at the old block
+  REQUIRE( std::equal(stream.begin(), stream.begin() + 40, pBatch) );
+  pRetained.reset();
+
+  ssize_t numLeft = (ssize_t)(stream.size() - numSent);
+  REQUIRE( send(sockets.mFDs[1], stream.data() + numSent, numLeft, 0) == numLeft );
+
+  REQUIRE( RecvAll(*pTransport, buffer, waitFD, (UINT32)stream.size() - 40) == stream.size() - 40 );
+  REQUIRE( std::equal(stream.begin() + 40, stream.end(), buffer.ReadPtr()) );
+
+  pTransport->AttachRecvBuffer(nullptr, 0);
+}
+
+TEST_CASE("EpollWaiter sleeps on an io_uring transport until it has something to do", "[Transport]")
+{
+  using TClock = std::chrono::steady_clock;
+
+  SocketPair sockets;
+  TTransport pTransport = Transport::CreateIOUring(sockets.mFDs[0], 8);
+  if (pTransport == nullptr)
+  {
+    WARN("io_uring is unavailable, skipping");
+    return;
+  }
+
+  std::vector<Byte> buf(256);
+  pTransport->AttachRecvBuffer(buf.data(), (UINT32)buf.size());
+  REQUIRE( !pTransport->Recv(buf.data(), (int)buf.size()).has_value() );
+
+  EpollWaiter waiter(pTransport);
+  ProcessResult result;
+  result.mWantEvents = IOEvent::Readable | IOEvent::Writable;
+
+  SECTION("Wanting to write doesn't keep it awake")
+  {
+    //The ring itself is always writable, so it must only be waited on for its completions
+    result.mDeadline = TClock::now() + std::chrono::milliseconds(50);
+    REQUIRE( waiter.Wait(result) == IOEvent::None );
+    REQUIRE( TClock::now() >= result.mDeadline.value() );
+  }
+
+  SECTION("Data arriving wakes it")
+  {
+    const Byte sent[] = { 1, 2, 3 };
+    REQUIRE( send(sockets.mFDs[1], sent, sizeof(sent), 0) == (ssize_t)sizeof(sent) );
+
+    result.mDeadline = TClock::now() + std::chrono::seconds(5);
+    REQUIRE( waiter.Wait(result) == IOEvent::Readable );
+    REQUIRE( TClock::now() < result.mDeadline.value() );
+    REQUIRE( pTransport->Recv(buf.data(), (int)buf.size()).value_or(0) == (int)sizeof(sent) );
+  }
+
+  SECTION("Room to write again wakes it")
+  {
+    //Fill the socket until a write is cut short, which has the ring watch for room
+    std::vector<Byte> chunk(64 * 1024, 'x');
+    IOVec vec = { chunk.data(), (int)chunk.size() };
+    for (int i = 0; i < 1000 && pTransport->SendVec(&vec, 1).value_or(0) == vec.mBufLen; ++i)
+    {
+    }
+
+    result.mDeadline = TClock::now() + std::chrono::milliseconds(50);
+    REQUIRE( waiter.Wait(result) == IOEvent::None );
+
+    //Draining the other end makes room
+    while (recv(sockets.mFDs[1], chunk.data(), chunk.size(), MSG_DONTWAIT) > 0)
+    {
+    }
+
+    result.mDeadline = TClock::now() + std::chrono::seconds(5);
+    REQUIRE( waiter.Wait(result) == IOEvent::Readable );
+    REQUIRE( TClock::now() < result.mDeadline.value() );
+  }
+
+  pTransport->AttachRecvBuffer(nullptr, 0);
+}
+#endif
@@ -0,0 +1,88 @@
+#include <catch2/catch.hpp>
+#include "window-tuner.h"
+
+using namespace SSH;
+using namespace std::chrono;
+
+namespace
+{
+  /*
+    A remote which always has data to send, over a link with the given round trip and rate.
+    Each round trip it sends whatever the link or the window allows, whichever is less, and the
+    receiver consumes it all and hands the window straight back. Returns the tuner's final window.
+  */
+  UINT32 Simulate(WindowTuner& tuner, milliseconds rtt, UINT32 bytesPerRTT, int numRoundTrips)
+  {
+    WindowTuner::TClock::time_point now;
+    const UINT32 packetLen = 32 * 1024;
+
+    for (int trip = 0; trip < numRoundTrips; ++trip)
+    {
+      UINT32 window = tuner.Window();
+      UINT32 toSend = std::min(window, bytesPerRTT);
+
+      //The adjust for the last round trip's data goes out with none of the window left
+      tuner.OnAdjustSent(now, 0);
+      now += rtt;
+
+      UINT32 growth = 0;
+      for (UINT32 sent = 0; sent < toSend; sent += packetLen)
+      {
+        growth += tuner.OnData(now, std::min(packetLen, toSend - sent));
+        now += microseconds(10);
+      }
+
+      REQUIRE( tuner.Window() == window + growth );
+    }
+
+    return tuner.Window();
+  }
+}
+
+TEST_CASE("WindowTuner sizes the window to the bandwidth-delay product", "[WindowTuner]")
+{
+  const UINT32 MiB = 1024 * 1024;
+
+  SECTION("A window limited transfer grows until the link is the limit")
+  {
+    //100ms at 50 MB/s needs 5 MB in flight
+    WindowTuner tuner(MiB, 64 * MiB);
+    UINT32 window = Simulate(tuner, milliseconds(100), 5 * 1000 * 1000, 20);
+
+    REQUIRE( window >= 5 * 1000 * 1000 );
+    REQUIRE( window <= 2 * 5 * 1000 * 1000 + 64 * 1024 );
+    REQUIRE( tuner.SmoothedRTT() >= milliseconds(100) );
+    REQUIRE( tuner.SmoothedRTT() < milliseconds(101) );
+  }
+
+  SECTION("The window never grows beyond the ceiling")
+  {
+    WindowTuner tuner(MiB, 4 * MiB);
+    REQUIRE( Simulate(tuner, milliseconds(200), 100 * MiB, 20) == 4 * MiB );
+  }
+
+  SECTION("A link slower than the window leaves it alone")
+  {
+    WindowTuner tuner(2 * MiB, 64 * MiB);
+    REQUIRE( Simulate(tuner, milliseconds(1), 100 * 1024, 50) == 2 * MiB );
+  }
+
+  SECTION("Autotuning is off when the ceiling is no bigger than the window")
+  {
+    WindowTuner tuner(MiB, 0);
+    REQUIRE( Simulate(tuner, milliseconds(100), 100 * MiB, 10) == MiB );
+  }
+
+  SECTION("Data sent on earlier credit isn't mistaken for the reply to an adjust")
+  {
+    WindowTuner tuner(MiB, 64 * MiB);
+    WindowTuner::TClock::time_point now;
+
+    tuner.OnAdjustSent(now, 100 * 1000);
+    tuner.OnData(now + milliseconds(1), 100 * 1000);
+    REQUIRE( tuner.SmoothedRTT() == WindowTuner::TClock::duration::zero() );
+
+    tuner.OnData(now + milliseconds(50), 1000);
+    REQUIRE( tuner.SmoothedRTT() == milliseconds(50) );
+  }
+}